@@ -5,7 +5,8 @@
  * to communicate with Viessmann heating systems.
  * 
  * Usage: ./vbusdecoder_linux [options]
- *   -p <port>      Serial port (default: /dev/ttyUSB0)
+ *   -p <port>      Serial port, or tcp://host:port or rfc2217://host:port
+ *                  of a serial server (default: /dev/ttyUSB0)
  *   -b <baud>      Baud rate (default: 9600)
  *   -t <protocol>  Protocol type: vbus, kw, p300, km (default: vbus)
  *   -h             Show this help
@@ -13,6 +14,7 @@
  * Examples:
  *   ./vbusdecoder_linux -p /dev/ttyUSB0 -b 9600 -t vbus
  *   ./vbusdecoder_linux -p /dev/ttyUSB1 -b 4800 -t kw
+ *   ./vbusdecoder_linux -p rfc2217://192.168.1.20:2217 -b 4800 -t kw
  */
 
 #include <stdio.h>
@@ -22,11 +24,13 @@
 #include <signal.h>
 #include <unistd.h>
 #include "LinuxSerial.h"
+#include "LinuxTcpSerial.h"
 #include "vbusdecoder.h"
 
 // Global variables for signal handling
 volatile bool running = true;
 LinuxSerial vbusSerial;
+LinuxTcpSerial netSerial;
 
 void signalHandler(int signum) {
     printf("\nShutting down...\n");
@@ -36,7 +40,8 @@ void signalHandler(int signum) {
 void printHelp(const char* progname) {
     printf("Viessmann Multi-Protocol Library - Linux Example\n");
     printf("\nUsage: %s [options]\n", progname);
-    printf("  -p <port>      Serial port (default: /dev/ttyUSB0)\n");
+    printf("  -p <port>      Serial port, or tcp://host:port or rfc2217://host:port of a\n");
+    printf("                 serial server (default: /dev/ttyUSB0)\n");
     printf("  -b <baud>      Baud rate (default: 9600)\n");
     printf("  -t <protocol>  Protocol type: vbus, kw, p300, km (default: vbus)\n");
     printf("  -c <config>    Serial config: 8N1, 8E2 (default: 8N1)\n");
@@ -44,6 +49,7 @@ void printHelp(const char* progname) {
     printf("\nExamples:\n");
     printf("  %s -p /dev/ttyUSB0 -b 9600 -t vbus\n", progname);
     printf("  %s -p /dev/ttyUSB1 -b 4800 -t kw -c 8E2\n", progname);
+    printf("  %s -p rfc2217://192.168.1.20:2217 -b 4800 -t kw -c 8E2\n", progname);
     printf("\nProtocol Guide:\n");
     printf("  vbus  - RESOL VBUS Protocol (Vitosolic 200, DeltaSol) - 9600 baud, 8N1\n");
     printf("  kw    - KW-Bus (VS1) for Vitotronic 100/200/300 - 4800 baud, 8E2\n");
@@ -105,20 +111,29 @@ int main(int argc, char* argv[]) {
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
     
-    // Open serial port
-    printf("Opening serial port %s at %lu baud...\n", port, baud);
-    if (!vbusSerial.begin(port, baud, config)) {
-        fprintf(stderr, "Failed to open serial port %s\n", port);
-        fprintf(stderr, "Make sure:\n");
-        fprintf(stderr, "  1. The device is connected\n");
-        fprintf(stderr, "  2. You have permission to access the port (add user to 'dialout' group)\n");
-        fprintf(stderr, "  3. The port path is correct\n");
-        return 1;
+    // Serial servers are connected in the background and reconnected
+    // whenever the connection drops
+    Stream* stream = &vbusSerial;
+    if (LinuxTcpSerial::isUrl(port)) {
+        printf("Connecting to %s...\n", port);
+        if (!netSerial.begin(port, baud, config)) return 1;
+        stream = &netSerial;
+    } else {
+        // Open serial port
+        printf("Opening serial port %s at %lu baud...\n", port, baud);
+        if (!vbusSerial.begin(port, baud, config)) {
+            fprintf(stderr, "Failed to open serial port %s\n", port);
+            fprintf(stderr, "Make sure:\n");
+            fprintf(stderr, "  1. The device is connected\n");
+            fprintf(stderr, "  2. You have permission to access the port (add user to 'dialout' group)\n");
+            fprintf(stderr, "  3. The port path is correct\n");
+            return 1;
+        }
+        printf("Serial port opened successfully.\n");
     }
-    printf("Serial port opened successfully.\n");
     
     // Initialize decoder
-    VBUSDecoder vbus(&vbusSerial);
+    VBUSDecoder vbus(stream);
     vbus.begin(protocol);
     
     // Display active protocol
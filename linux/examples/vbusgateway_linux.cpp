@@ -0,0 +1,249 @@
+/*
+ * Viessmann Multi-Protocol Library - Linux Gateway Example
+ *
+ * Decodes many serial ports in a single thread. LinuxIoMux keeps a read
+ * posted on every port (io_uring, or epoll on older kernels) and each
+ * completion runs the decoder of that port.
+ *
+ * Usage: ./vbusgateway_linux [options] -p <port> [[options] -p <port> ...]
+ *   -b <baud>      Baud rate for the following ports (default: 9600)
+ *   -t <protocol>  Protocol for the following ports: vbus, kw, p300, km (default: vbus)
+ *   -c <config>    Serial config for the following ports: 8N1, 8E2 (default: 8N1)
+ *   -L             Low-latency mode for the following ports
+ *   -p <port>      Serial port, may be given up to 64 times
+ *   -B <backend>   I/O backend: auto, io_uring, epoll (default: auto)
+ *   -r <file>      Record the raw bytes of all ports, see vbusreplay_linux
+ *   -s <MiB>       Size at which the capture file is rotated (default: 64)
+ *   -h             Show this help
+ *
+ * Example:
+ *   ./vbusgateway_linux -p /dev/ttyUSB0 -p /dev/ttyUSB1 -b 4800 -t kw -c 8E2 -p /dev/ttyUSB2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <unistd.h>
+#include <vector>
+#include "LinuxSerial.h"
+#include "LinuxIoMux.h"
+#include "LinuxCapture.h"
+#include "vbusdecoder.h"
+
+#define GATEWAY_WAIT_MS 100         // Decoders also run this often without data
+#define GATEWAY_REPORT_MS 5000
+
+struct GatewayPort {
+    const char* path;
+    unsigned long baud;
+    ProtocolType protocol;
+    uint8_t config;
+    bool lowLatency;
+    LinuxSerial serial;
+    LinuxIoLink* link;
+    LinuxCaptureStream* tee;    // Between link and decoder while recording
+    VBUSDecoder* decoder;
+};
+
+volatile bool running = true;
+
+void signalHandler(int signum) {
+    (void)signum;
+    running = false;
+}
+
+void printHelp(const char* progname) {
+    printf("Viessmann Multi-Protocol Library - Linux Gateway Example\n");
+    printf("\nUsage: %s [options] -p <port> [[options] -p <port> ...]\n", progname);
+    printf("  -b <baud>      Baud rate for the following ports (default: 9600)\n");
+    printf("  -t <protocol>  Protocol for the following ports: vbus, kw, p300, km (default: vbus)\n");
+    printf("  -c <config>    Serial config for the following ports: 8N1, 8E2 (default: 8N1)\n");
+    printf("  -L             Low-latency mode for the following ports (ASYNC_LOW_LATENCY,\n");
+    printf("                 1 ms latency timer of USB adapters)\n");
+    printf("  -p <port>      Serial port, may be given up to %d times\n", IOMUX_MAX_LINKS);
+    printf("  -B <backend>   I/O backend: auto, io_uring, epoll (default: auto)\n");
+    printf("  -r <file>      Record the raw bytes of all ports, see vbusreplay_linux\n");
+    printf("  -s <MiB>       Size at which the capture file is rotated (default: %d)\n",
+           CAPTURE_FILE_SIZE >> 20);
+    printf("  -h             Show this help\n");
+}
+
+ProtocolType parseProtocol(const char* str) {
+    if (strcasecmp(str, "kw") == 0) return PROTOCOL_KW;
+    if (strcasecmp(str, "p300") == 0) return PROTOCOL_P300;
+    if (strcasecmp(str, "km") == 0) return PROTOCOL_KM;
+    return PROTOCOL_VBUS;
+}
+
+IoMuxBackend parseBackend(const char* str) {
+    if (strcasecmp(str, "io_uring") == 0) return IOMUX_IO_URING;
+    if (strcasecmp(str, "epoll") == 0) return IOMUX_EPOLL;
+    return IOMUX_AUTO;
+}
+
+// Runs the decoder until it stops consuming; some states take one byte per
+// loop(), and finishing a frame takes up to two passes without reading
+void onData(LinuxIoLink* link, void* context) {
+    GatewayPort* port = (GatewayPort*)context;
+    port->serial.recordArrival(link->available(), link->getArrivalTime());
+    int idle = 0;
+    while (link->available() > 0 && idle < 3) {
+        int before = link->available();
+        port->decoder->loop();
+        idle = link->available() < before ? 0 : idle + 1;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<GatewayPort*> ports;
+    unsigned long baud = 9600;
+    ProtocolType protocol = PROTOCOL_VBUS;
+    uint8_t config = SERIAL_8N1;
+    bool lowLatency = false;
+    IoMuxBackend backend = IOMUX_AUTO;
+    const char* capturePath = nullptr;
+    uint64_t captureSize = CAPTURE_FILE_SIZE;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:t:c:Lp:B:r:s:h")) != -1) {
+        switch (opt) {
+            case 'b':
+                baud = atol(optarg);
+                break;
+            case 't':
+                protocol = parseProtocol(optarg);
+                break;
+            case 'c':
+                config = strcasecmp(optarg, "8E2") == 0 ? SERIAL_8E2 : SERIAL_8N1;
+                break;
+            case 'L':
+                lowLatency = true;
+                break;
+            case 'p': {
+                GatewayPort* port = new GatewayPort();
+                port->path = optarg;
+                port->baud = baud;
+                port->protocol = protocol;
+                port->config = config;
+                port->lowLatency = lowLatency;
+                port->link = nullptr;
+                port->tee = nullptr;
+                port->decoder = nullptr;
+                ports.push_back(port);
+                break;
+            }
+            case 'B':
+                backend = parseBackend(optarg);
+                break;
+            case 'r':
+                capturePath = optarg;
+                break;
+            case 's':
+                captureSize = (uint64_t)strtoul(optarg, nullptr, 10) << 20;
+                break;
+            case 'h':
+                printHelp(argv[0]);
+                return 0;
+            default:
+                printHelp(argv[0]);
+                return 1;
+        }
+    }
+    if (ports.empty() || ports.size() > IOMUX_MAX_LINKS) {
+        printHelp(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    LinuxIoMux mux;
+    if (!mux.begin(backend)) {
+        fprintf(stderr, "I/O backend not available\n");
+        return 1;
+    }
+    printf("I/O backend: %s\n", mux.getBackendName());
+
+    LinuxCapture capture;
+    if (capturePath) {
+        if (!capture.begin(capturePath, captureSize)) return 1;
+        printf("Recording to %s\n", capturePath);
+    }
+
+    for (GatewayPort* port : ports) {
+        if (!port->serial.begin(port->path, port->baud, port->config)) continue;
+        if (port->lowLatency && !port->serial.setLowLatency(true)) {
+            printf("%s: low-latency mode not supported\n", port->path);
+        }
+        port->link = mux.add(port->serial.getFd());
+        if (!port->link) {
+            port->serial.end();
+            continue;
+        }
+        int captureId = capture.isOpen() ?
+            capture.addPort(port->path, port->protocol, port->baud, port->config) : -1;
+        if (captureId >= 0) {
+            port->tee = new LinuxCaptureStream(port->link, &capture, captureId);
+            port->decoder = new VBUSDecoder(port->tee);
+            port->tee->setDecoder(port->decoder);
+        } else {
+            port->decoder = new VBUSDecoder(port->link);
+        }
+        port->decoder->begin(port->protocol);
+        port->link->setHandler(&onData, port);
+        printf("Opened %s at %lu baud\n", port->path, port->baud);
+    }
+
+    unsigned long lastReport = millis();
+    while (running) {
+        mux.wait(GATEWAY_WAIT_MS);
+        for (GatewayPort* port : ports) {
+            if (!port->link) continue;
+            if (port->link->hasFailed()) {
+                printf("%s: port closed\n", port->path);
+                if (port->tee) port->tee->flushCapture();
+                mux.remove(port->link);
+                port->link = nullptr;
+                continue;
+            }
+            port->decoder->loop();      // Timeouts and requests of the polling protocols
+        }
+
+        if (millis() - lastReport < GATEWAY_REPORT_MS) continue;
+        lastReport = millis();
+        for (GatewayPort* port : ports) {
+            if (!port->decoder) continue;
+            printf("%s: %s, %s, %lu bytes, %lu frames", port->path,
+                   port->decoder->getVbusStat() ? "Ok" : "Error",
+                   port->decoder->isReady() ? "ready" : "waiting",
+                   port->link ? port->link->getByteCount() : 0UL,
+                   (unsigned long)port->decoder->getFrameCount());
+            SerialTiming timing = port->serial.getTiming();
+            if (timing.reads > 0) {
+                printf(", %.1f bytes/read, jitter %lu us", (double)timing.bytes / timing.reads, timing.jitter);
+            }
+            for (uint8_t i = 0; port->decoder->isReady() && i < port->decoder->getTempNum(); i++) {
+                printf("%s%.1f°C", i == 0 ? ", " : " ", port->decoder->getTemp(i));
+            }
+            printf("\n");
+        }
+        printf("System calls so far: %lu\n", mux.getSyscallCount());
+        if (capture.getLostCount() > 0) {
+            printf("Capture: %lu bytes not recorded, capture buffers were full\n", capture.getLostCount());
+        }
+        printf("\n");
+    }
+
+    for (GatewayPort* port : ports) {
+        if (port->link) mux.remove(port->link);
+        delete port->decoder;
+        delete port->tee;
+        port->serial.end();
+        delete port;
+    }
+    mux.end();
+    capture.end();
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Viessmann Multi-Protocol Library - Linux Capture Replay
+ *
+ * Runs capture files written by LinuxCapture (vbusgateway_linux -r, or the
+ * web server's -r) through a decoder per recorded port. The clock is
+ * virtual and follows the recorded timestamps, so a capture replays as fast
+ * as it can be read and timeouts behave as they did on the bus. Frames
+ * decoded on replay are checked against the frame markers of the capture.
+ *
+ * Usage: ./vbusreplay_linux [options] <file> [<file> ...]
+ *   -v             Print every decoded frame
+ *   -h             Show this help
+ *
+ * Rotated files are given oldest first:
+ *   ./vbusreplay_linux capture.vbcap.3 capture.vbcap.2 capture.vbcap.1 capture.vbcap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include "Arduino.h"
+#include "LinuxCapture.h"
+#include "vbusdecoder.h"
+
+// Stream over the recorded bytes of one port; requests the decoder sends
+// are dropped, the answers are in the capture
+class ReplayStream : public Stream {
+public:
+    ReplayStream() : start(0) {}
+
+    void feed(const uint8_t* data, size_t length) {
+        if (start == buffer.size()) {
+            buffer.clear();
+            start = 0;
+        }
+        buffer.insert(buffer.end(), data, data + length);
+    }
+
+    int available() override { return buffer.size() - start; }
+    int read() override { return start < buffer.size() ? buffer[start++] : -1; }
+    size_t write(uint8_t data) override { (void)data; return 1; }
+    size_t write(const uint8_t *data, size_t size) override { (void)data; return size; }
+    void flush() override {}
+
+private:
+    std::vector<uint8_t> buffer;
+    size_t start;
+};
+
+struct ReplayPort {
+    char name[64];
+    ProtocolType protocol;
+    unsigned long baud;
+    uint8_t config;
+    ReplayStream stream;
+    VBUSDecoder* decoder;
+    unsigned long bytes;
+    unsigned long markers;      // CAPTURE_FRAME records
+    unsigned long mismatches;   // Intervals between markers with a different number of frames on replay
+    uint32_t lastRecorded;      // Frame count of the last marker
+    uint32_t lastReplayed;      // Replayed frame count at the last marker
+    unsigned long recorded;     // Frames since the first marker, plus the ones replayed before it
+    uint32_t lastFrames;
+};
+
+static const char* protocolName(ProtocolType protocol) {
+    switch (protocol) {
+        case PROTOCOL_VBUS: return "VBUS";
+        case PROTOCOL_KW: return "KW";
+        case PROTOCOL_P300: return "P300";
+        case PROTOCOL_KM: return "KM";
+        default: return "?";
+    }
+}
+
+void printHelp(const char* progname) {
+    printf("Viessmann Multi-Protocol Library - Linux Capture Replay\n");
+    printf("\nUsage: %s [options] <file> [<file> ...]\n", progname);
+    printf("  -v             Print every decoded frame\n");
+    printf("  -h             Show this help\n");
+    printf("\nRotated files of one capture are given oldest first.\n");
+}
+
+// Same as the gateway: run until the decoder stops consuming
+static void runDecoder(ReplayPort* port) {
+    int idle = 0;
+    while (port->stream.available() > 0 && idle < 3) {
+        int before = port->stream.available();
+        port->decoder->loop();
+        idle = port->stream.available() < before ? 0 : idle + 1;
+    }
+}
+
+static void printFrames(ReplayPort* port, uint64_t time, uint64_t start) {
+    uint32_t frames = port->decoder->getFrameCount();
+    if (frames == port->lastFrames) return;
+    port->lastFrames = frames;
+    printf("%10.3f %s: frame %u", (time - start) / 1e6, port->name, frames);
+    for (uint8_t i = 0; port->decoder->isReady() && i < port->decoder->getTempNum(); i++) {
+        printf("%s%.1f°C", i == 0 ? ", " : " ", port->decoder->getTemp(i));
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "vh")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+            case 'h':
+                printHelp(argv[0]);
+                return 0;
+            default:
+                printHelp(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        printHelp(argv[0]);
+        return 1;
+    }
+
+    ReplayPort* ports[CAPTURE_MAX_PORTS] = {};
+    unsigned long lost = 0;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    unsigned long started = millis();
+    VBUSClock::setVirtual();
+
+    for (int i = optind; i < argc; i++) {
+        LinuxCaptureReader reader;
+        if (!reader.open(argv[i])) return 1;
+        if (i == optind) {
+            first = reader.getStartTime();
+            time_t wall = reader.getWallTime() / 1000000;
+            printf("Capture started %s", ctime(&wall));
+        }
+
+        CaptureRecord record;
+        while (reader.next(record)) {
+            // Records of different ports may be slightly out of order; the
+            // decoders' timeouts need a clock that never goes back
+            unsigned long time = record.time / 1000;
+            if ((long)(time - VBUSClock::now()) > 0) VBUSClock::set(time);
+            last = record.time;
+            ReplayPort* port = record.port < CAPTURE_MAX_PORTS ? ports[record.port] : nullptr;
+
+            switch (record.type) {
+                case CAPTURE_PORT:
+                    if (port || record.length < 6) break;   // Repeated at the start of every file
+                    port = new ReplayPort();
+                    snprintf(port->name, sizeof(port->name), "%.*s", record.length - 6, (const char*)record.payload + 6);
+                    port->protocol = (ProtocolType)record.payload[0];
+                    port->baud = record.payload[1] | (record.payload[2] << 8) |
+                                 (record.payload[3] << 16) | ((unsigned long)record.payload[4] << 24);
+                    port->config = record.payload[5];
+                    port->decoder = new VBUSDecoder(&port->stream);
+                    port->decoder->begin(port->protocol);
+                    ports[record.port] = port;
+                    printf("Port %u: %s, %s, %lu baud\n", record.port, port->name,
+                           protocolName(port->protocol), port->baud);
+                    break;
+                case CAPTURE_DATA:
+                    if (!port) break;
+                    port->stream.feed(record.payload, record.length);
+                    port->bytes += record.length;
+                    runDecoder(port);
+                    if (verbose) printFrames(port, record.time, first);
+                    break;
+                case CAPTURE_FRAME: {
+                    if (!port || record.length < 4) break;
+                    uint32_t recorded = record.payload[0] | (record.payload[1] << 8) |
+                                        (record.payload[2] << 16) | ((uint32_t)record.payload[3] << 24);
+                    uint32_t replayed = port->decoder->getFrameCount();
+                    if (port->markers++ == 0) {
+                        port->recorded = replayed;
+                    } else {
+                        port->recorded += recorded - port->lastRecorded;
+                        if (recorded - port->lastRecorded != replayed - port->lastReplayed) port->mismatches++;
+                    }
+                    port->lastRecorded = recorded;
+                    port->lastReplayed = replayed;
+                    break;
+                }
+                case CAPTURE_LOST:
+                    if (record.length >= 4) {
+                        lost += record.payload[0] | (record.payload[1] << 8) |
+                                (record.payload[2] << 16) | ((unsigned long)record.payload[3] << 24);
+                    }
+                    break;
+            }
+
+            // Timeouts and requests of the polling protocols
+            for (ReplayPort* other : ports) {
+                if (other) other->decoder->loop();
+            }
+        }
+    }
+
+    printf("\n%.1f s of bus traffic replayed in %.3f s\n", (last - first) / 1e6, (millis() - started) / 1000.0);
+    if (lost) printf("%lu bytes were not recorded (capture buffers full)\n", lost);
+    for (int i = 0; i < CAPTURE_MAX_PORTS; i++) {
+        ReplayPort* port = ports[i];
+        if (!port) continue;
+        printf("%s: %lu bytes, %lu frames recorded, %lu replayed, %lu mismatches\n", port->name,
+               port->bytes, port->recorded, (unsigned long)port->decoder->getFrameCount(), port->mismatches);
+        delete port->decoder;
+        delete port;
+    }
+    return 0;
+}
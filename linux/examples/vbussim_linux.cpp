@@ -0,0 +1,726 @@
+/*
+ * Viessmann Multi-Protocol Library - Linux Bus Simulator
+ *
+ * Generates VBUS, KW, P300 and KM-Bus traffic on a pseudo-terminal or a
+ * TCP port, so decoders, the logger and the web server can be exercised
+ * without a heating system. KW (VS1) and P300 (VS2) read and write
+ * requests are answered from a simulated datapoint memory, like a
+ * Vitotronic would. Unthrottled, frames are written as fast as the reader
+ * takes them, hours of bus traffic in minutes.
+ *
+ * Usage: ./vbussim_linux [options]
+ *   -d <device>    vbus[:address], kw, p300 or km; may be repeated (default: vbus:7e11)
+ *   -r <rate>      Frames per second and device, 0 = unthrottled (default: 1)
+ *   -n <share>     Share of frames followed by 1-16 random bytes (default: 0)
+ *   -e <share>     Share of frames with one bit flipped (default: 0)
+ *   -N <count>     Stop after this many frames (default: unlimited)
+ *   -l <path>      Symlink to the pseudo-terminal
+ *   -L <port>      Serve a TCP client on this port instead of a pseudo-terminal
+ *   -S <seed>      Seed for the noise and corruption (default: 1)
+ *   -h             Show this help
+ *
+ * Examples:
+ *   ./vbussim_linux -l /tmp/ttyVBUS -d vbus:7e11 -d vbus:1060
+ *   ./vbussim_linux -L 4000 -d kw -r 0 -n 0.01 -e 0.01 -N 1000000
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <vector>
+#include "Arduino.h"
+#include "vbusdecoder.h"
+
+#define SIM_MAX_DEVICES 16
+#define SIM_OUTPUT_SIZE 16384       // Pending bytes, answers always fit
+#define SIM_OUTPUT_LOW 4096         // Unthrottled, frames are added while less is pending
+#define SIM_FRAME_SIZE 128
+#define SIM_REQUEST_SIZE 64
+#define SIM_REPORT_MS 10000
+
+// Datapoints of the simulated Vitotronic, 2-byte values little-endian in 0.1 °C
+#define SIM_DP_DEVICE_ID 0x00F8
+#define SIM_DP_OUTDOOR 0x0800
+#define SIM_DP_BOILER 0x0802
+#define SIM_DP_HOT_WATER 0x0804
+#define SIM_DP_FLOW 0x0806
+#define SIM_DP_MODE 0x2323
+
+struct SimDevice {
+    ProtocolType protocol;
+    uint16_t address;           // VBUS source address
+    unsigned long nextFrame;    // micros()
+};
+
+struct SimStats {
+    unsigned long frames;
+    unsigned long corrupted;
+    unsigned long skipped;      // Throttled frames nobody read
+    unsigned long noiseBytes;
+    unsigned long requests;     // Answered or applied
+    unsigned long rejected;     // Bad checksum or unknown function
+    double busSeconds;          // Time the bytes sent take on the real bus
+};
+
+volatile bool running = true;
+std::vector<SimDevice> devices;
+SimStats stats;
+uint8_t memory[65536];
+uint8_t outBuffer[SIM_OUTPUT_SIZE];
+size_t outLength = 0;
+uint8_t request[SIM_REQUEST_SIZE];
+size_t requestLength = 0;
+uint8_t kmMode = KMBUS_MODE_DAY;
+uint32_t randomState = 1;
+unsigned long valueStep = 0;
+
+void signalHandler(int signum) {
+    (void)signum;
+    running = false;
+}
+
+void printHelp(const char* progname) {
+    printf("Viessmann Multi-Protocol Library - Linux Bus Simulator\n");
+    printf("\nUsage: %s [options]\n", progname);
+    printf("  -d <device>    vbus[:address], kw, p300 or km; may be repeated (default: vbus:7e11)\n");
+    printf("  -r <rate>      Frames per second and device, 0 = unthrottled (default: 1)\n");
+    printf("  -n <share>     Share of frames followed by 1-16 random bytes (default: 0)\n");
+    printf("  -e <share>     Share of frames with one bit flipped (default: 0)\n");
+    printf("  -N <count>     Stop after this many frames (default: unlimited)\n");
+    printf("  -l <path>      Symlink to the pseudo-terminal\n");
+    printf("  -L <port>      Serve a TCP client on this port instead of a pseudo-terminal\n");
+    printf("  -S <seed>      Seed for the noise and corruption (default: 1)\n");
+    printf("  -h             Show this help\n");
+    printf("\nExamples:\n");
+    printf("  %s -l /tmp/ttyVBUS -d vbus:7e11 -d vbus:1060\n", progname);
+    printf("  %s -L 4000 -d kw -r 0 -n 0.01 -e 0.01 -N 1000000\n", progname);
+}
+
+bool parseDevice(const char* str, SimDevice& device) {
+    device.address = 0;
+    device.nextFrame = 0;
+    if (strncasecmp(str, "vbus", 4) == 0 && (str[4] == '\0' || str[4] == ':')) {
+        device.protocol = PROTOCOL_VBUS;
+        device.address = str[4] == ':' ? (uint16_t)strtoul(str + 5, NULL, 16) : 0x7E11;
+    } else if (strcasecmp(str, "kw") == 0) {
+        device.protocol = PROTOCOL_KW;
+    } else if (strcasecmp(str, "p300") == 0) {
+        device.protocol = PROTOCOL_P300;
+    } else if (strcasecmp(str, "km") == 0) {
+        device.protocol = PROTOCOL_KM;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool hasProtocol(ProtocolType protocol) {
+    for (const SimDevice& device : devices) {
+        if (device.protocol == protocol) return true;
+    }
+    return false;
+}
+
+// xorshift32, reproducible runs for a given seed
+uint32_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+bool chance(double share) {
+    return share > 0 && (nextRandom() & 0xFFFFFF) < share * 0x1000000;
+}
+
+// ============================================================================
+// Simulated values
+// ============================================================================
+
+// Temperatures in 0.1 °C drifting slowly in a sawtooth per channel
+int16_t simTemperature(uint8_t channel) {
+    static const int16_t base[] = { 50, 550, 480, 420 };
+    return base[channel & 3] + (int16_t)((valueStep / (channel + 1)) % 100);
+}
+
+void putLittleEndian(uint16_t address, int16_t value) {
+    memory[address] = value & 0xFF;
+    memory[(uint16_t)(address + 1)] = (value >> 8) & 0xFF;
+}
+
+void updateMemory() {
+    valueStep++;
+    putLittleEndian(SIM_DP_OUTDOOR, simTemperature(0));
+    putLittleEndian(SIM_DP_BOILER, simTemperature(1));
+    putLittleEndian(SIM_DP_HOT_WATER, simTemperature(2));
+    putLittleEndian(SIM_DP_FLOW, simTemperature(3));
+}
+
+// ============================================================================
+// Frames, in the framing VBUSDecoder expects
+// ============================================================================
+
+uint8_t vbusCRC(const uint8_t* data, uint8_t length) {
+    uint8_t crc = 0x7F;
+    for (uint8_t i = 0; i < length; i++) crc = (crc - data[i]) & 0x7F;
+    return crc;
+}
+
+// Data blocks the device decoders read, 4 bytes each
+uint8_t vbusBlocks(uint16_t address) {
+    switch (address) {
+        case 0x1060: return 16;     // Vitosolic 200
+        case 0x7E11:                // DeltaSol BX Plus
+        case 0x7E21: return 7;      // DeltaSol BX
+        case 0x7E31: return 6;      // DeltaSol MX
+        default: return 2;
+    }
+}
+
+size_t buildVbusFrame(const SimDevice& device, uint8_t* frame) {
+    uint8_t blocks = vbusBlocks(device.address);
+    uint8_t payload[16 * 4];
+    memset(payload, 0, sizeof(payload));
+    for (uint8_t i = 0; i < 4; i++) {
+        int16_t temp = simTemperature(i);
+        payload[i * 2] = temp & 0xFF;
+        payload[i * 2 + 1] = (temp >> 8) & 0xFF;
+    }
+    payload[8] = valueStep % 101;       // Pump speed in %
+    payload[9] = (valueStep / 7) % 101;
+
+    size_t length = 0;
+    frame[length++] = 0xAA;
+    frame[length++] = 0x10;             // Destination 0x0010, display/DL
+    frame[length++] = 0x00;
+    frame[length++] = device.address & 0xFF;
+    frame[length++] = device.address >> 8;
+    frame[length++] = 0x10;             // Protocol 1.0
+    frame[length++] = 0x00;             // Command 0x0100
+    frame[length++] = 0x01;
+    frame[length++] = blocks;
+    frame[length] = vbusCRC(frame + 1, 8);
+    length++;
+
+    for (uint8_t i = 0; i < blocks; i++) {
+        uint8_t* block = frame + length;
+        uint8_t septet = 0;
+        for (uint8_t j = 0; j < 4; j++) {
+            uint8_t value = payload[i * 4 + j];
+            if (value & 0x80) septet |= 1 << j;
+            block[j] = value & 0x7F;
+        }
+        block[4] = septet;
+        block[5] = vbusCRC(block, 5);
+        length += 6;
+    }
+    return length;
+}
+
+// 0x05 (VS1 sync), then 0x01 <len> <addr> <temps big-endian> <xor>
+size_t buildKwFrame(uint8_t* frame) {
+    size_t length = 0;
+    frame[length++] = 0x05;
+    frame[length++] = 0x01;
+    frame[length++] = 9;
+    frame[length++] = SIM_DP_OUTDOOR >> 8;
+    for (uint8_t i = 0; i < 4; i++) {
+        int16_t temp = simTemperature(i);
+        frame[length++] = (temp >> 8) & 0xFF;
+        frame[length++] = temp & 0xFF;
+    }
+    uint8_t checksum = 0;
+    for (size_t i = 1; i < length; i++) checksum ^= frame[i];
+    frame[length++] = checksum;
+    return length;
+}
+
+// 0x05 <len> <type> <addr> <temps big-endian> <sum>
+size_t buildP300Frame(uint8_t* frame) {
+    size_t length = 0;
+    frame[length++] = 0x05;
+    frame[length++] = 11;
+    frame[length++] = 0x01;             // Response
+    frame[length++] = SIM_DP_OUTDOOR >> 8;
+    frame[length++] = SIM_DP_OUTDOOR & 0xFF;
+    for (uint8_t i = 0; i < 4; i++) {
+        int16_t temp = simTemperature(i);
+        frame[length++] = (temp >> 8) & 0xFF;
+        frame[length++] = temp & 0xFF;
+    }
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < length; i++) checksum += frame[i];
+    frame[length++] = checksum;
+    return length;
+}
+
+// CRC-16/KERMIT, the reflected CCITT CRC of VBUSDecoder::_kmCalcCRC16
+uint16_t kmCRC(const uint8_t* data, size_t length) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+// Master status record, 0x68 L L 0x68 <record> <crc16> 0x16; values
+// XORed with 0xAA and temperatures in 0.5 °C
+size_t buildKmFrame(uint8_t* frame) {
+    uint8_t record[15] = {
+        KMBUS_CMD_WRR_DAT, 0x00, 0x00, KMBUS_ADDR_MASTER_STATUS,
+        (uint8_t)((valueStep & 1) ? KMBUS_STATUS_BURNER : 0), 0x00,
+        (uint8_t)(simTemperature(1) / 5), (uint8_t)(simTemperature(2) / 5), 120, 0x00,
+        (uint8_t)(simTemperature(0) / 5),
+        (uint8_t)(KMBUS_STATUS_MAIN_PUMP | ((valueStep & 2) ? KMBUS_STATUS_LOOP_PUMP : 0)),
+        (uint8_t)(simTemperature(3) / 5), 0x00, kmMode
+    };
+    size_t length = 0;
+    frame[length++] = 0x68;
+    frame[length++] = sizeof(record);
+    frame[length++] = sizeof(record);
+    frame[length++] = 0x68;
+    for (size_t i = 0; i < sizeof(record); i++) {
+        // The control, slot, class and record bytes are sent as they are
+        frame[length++] = i < 4 ? record[i] : record[i] ^ KMBUS_XOR_MASK;
+    }
+    uint16_t crc = kmCRC(frame + 4, sizeof(record));
+    frame[length++] = crc & 0xFF;
+    frame[length++] = crc >> 8;
+    frame[length++] = 0x16;
+    return length;
+}
+
+// ============================================================================
+// Output
+// ============================================================================
+
+bool queue(const uint8_t* data, size_t length) {
+    if (outLength + length > SIM_OUTPUT_SIZE) return false;
+    memcpy(outBuffer + outLength, data, length);
+    outLength += length;
+    return true;
+}
+
+void queueByte(uint8_t data) {
+    queue(&data, 1);
+}
+
+// VBUS runs at 9600 baud 8N1, KW and P300 at 4800 baud 8E2, KM at 4800 8N1
+double busSeconds(ProtocolType protocol, size_t bytes) {
+    switch (protocol) {
+        case PROTOCOL_VBUS: return bytes * 10 / 9600.0;
+        case PROTOCOL_KM: return bytes * 10 / 4800.0;
+        default: return bytes * 12 / 4800.0;
+    }
+}
+
+// Builds the next frame of a device with the configured noise and
+// corruption; false if the output had no room for it
+bool sendFrame(const SimDevice& device, double noise, double errors) {
+    uint8_t frame[SIM_FRAME_SIZE + 16];
+    size_t length = 0;
+    updateMemory();
+    switch (device.protocol) {
+        case PROTOCOL_VBUS: length = buildVbusFrame(device, frame); break;
+        case PROTOCOL_KW: length = buildKwFrame(frame); break;
+        case PROTOCOL_P300: length = buildP300Frame(frame); break;
+        case PROTOCOL_KM: length = buildKmFrame(frame); break;
+    }
+
+    bool corrupt = chance(errors);
+    if (corrupt) frame[nextRandom() % length] ^= 1 << (nextRandom() % 8);
+    size_t noiseBytes = chance(noise) ? 1 + nextRandom() % 16 : 0;
+    for (size_t i = 0; i < noiseBytes; i++) frame[length++] = nextRandom() & 0xFF;
+
+    if (!queue(frame, length)) {
+        stats.skipped++;
+        return false;
+    }
+    stats.frames++;
+    stats.corrupted += corrupt;
+    stats.noiseBytes += noiseBytes;
+    stats.busSeconds += busSeconds(device.protocol, length);
+    return true;
+}
+
+// ============================================================================
+// Requests
+// ============================================================================
+
+uint8_t p300Checksum(const uint8_t* telegram, size_t length) {
+    uint8_t checksum = 0;
+    for (size_t i = 1; i < length; i++) checksum += telegram[i];
+    return checksum;
+}
+
+// VS2 telegram: 0x41 <len> <type> <function> <addr> <count> [data] <sum>
+void handleP300Telegram(const uint8_t* data, size_t length) {
+    if (length < 8 || p300Checksum(data, length - 1) != data[length - 1] || data[2] != 0x00) {
+        queueByte(0x15);    // NAK
+        stats.rejected++;
+        return;
+    }
+    uint16_t address = (data[4] << 8) | data[5];
+    uint8_t count = data[6];
+
+    uint8_t reply[SIM_REQUEST_SIZE + 8];
+    size_t replyLength = 0;
+    reply[replyLength++] = 0x41;
+    reply[replyLength++] = 0;
+    reply[replyLength++] = 0x01;        // Response
+    reply[replyLength++] = data[3];
+    reply[replyLength++] = data[4];
+    reply[replyLength++] = data[5];
+    reply[replyLength++] = count;
+    if (data[3] == 0x01 && length == 8 && count <= SIM_REQUEST_SIZE) {
+        for (uint8_t i = 0; i < count; i++) reply[replyLength++] = memory[(uint16_t)(address + i)];
+    } else if (data[3] == 0x02 && length == 8u + count) {
+        for (uint8_t i = 0; i < count; i++) memory[(uint16_t)(address + i)] = data[7 + i];
+    } else {
+        queueByte(0x15);
+        stats.rejected++;
+        return;
+    }
+    reply[1] = replyLength - 2;
+    reply[replyLength] = p300Checksum(reply, replyLength);
+    replyLength++;
+    queueByte(0x06);    // ACK
+    queue(reply, replyLength);
+    stats.requests++;
+}
+
+// KM-Bus command as sent by VBUSDecoder::_kmSendCommand; mode changes show
+// up in the next status record
+void handleKmCommand(const uint8_t* data, size_t length) {
+    if (length < 9 || data[4] != KMBUS_CMD_WRR_DAT || data[5] != KMBUS_ADDR_MASTER_CMD) {
+        stats.rejected++;
+        return;
+    }
+    switch (data[6]) {
+        case KMBUS_WRR_MODE_OFF: kmMode = KMBUS_MODE_OFF; break;
+        case KMBUS_WRR_MODE_HEAT_WATER: kmMode = KMBUS_MODE_DAY; break;
+        case KMBUS_WRR_ECO_ON: kmMode = KMBUS_MODE_ECO; break;
+        case KMBUS_WRR_PARTY_ON: kmMode = KMBUS_MODE_PARTY; break;
+        default: break;
+    }
+    stats.requests++;
+}
+
+// Handles the request at the start of data; returns the bytes consumed,
+// 0 while it is incomplete
+size_t handleRequest(const uint8_t* data, size_t length) {
+    switch (data[0]) {
+        case 0x04:      // VS2 end of transmission, back to VS1 sync
+            if (hasProtocol(PROTOCOL_P300)) queueByte(0x05);
+            return 1;
+        case 0x16:      // VS2 start
+            if (length < 3) return 0;
+            if (data[1] != 0x00 || data[2] != 0x00 || !hasProtocol(PROTOCOL_P300)) return 1;
+            queueByte(0x06);
+            return 3;
+        case 0x41: {
+            if (length < 2) return 0;
+            size_t total = data[1] + 3;
+            if (total > SIM_REQUEST_SIZE || !hasProtocol(PROTOCOL_P300)) return 1;
+            if (length < total) return 0;
+            handleP300Telegram(data, total);
+            return total;
+        }
+        case 0x01: {    // VS1 0x01 0xF7 <addr> <count> read, 0x01 0xF4 <addr> <count> <data> write
+            if (!hasProtocol(PROTOCOL_KW)) return 1;
+            if (length < 5) return 0;
+            uint16_t address = (data[2] << 8) | data[3];
+            uint8_t count = data[4];
+            if (data[1] == 0xF7) {
+                for (uint8_t i = 0; i < count; i++) queueByte(memory[(uint16_t)(address + i)]);
+            } else if (data[1] == 0xF4 && 5u + count <= SIM_REQUEST_SIZE) {
+                if (length < 5u + count) return 0;
+                for (uint8_t i = 0; i < count; i++) memory[(uint16_t)(address + i)] = data[5 + i];
+                queueByte(0x00);
+                stats.requests++;
+                return 5 + count;
+            } else {
+                return 1;
+            }
+            stats.requests++;
+            return 5;
+        }
+        case 0x68: {
+            if (!hasProtocol(PROTOCOL_KM)) return 1;
+            if (length < 4) return 0;
+            if (data[3] != 0x68) return 1;
+            for (size_t i = 7; i < length && i < SIM_REQUEST_SIZE; i++) {
+                if (data[i] == 0x16) {
+                    handleKmCommand(data, i + 1);
+                    return i + 1;
+                }
+            }
+            return length < SIM_REQUEST_SIZE ? 0 : 1;
+        }
+        default:
+            stats.rejected++;
+            return 1;
+    }
+}
+
+// False once the client closed the connection
+bool readRequests(int fd) {
+    ssize_t n = read(fd, request + requestLength, sizeof(request) - requestLength);
+    if (n == 0) return false;
+    if (n < 0) return errno == EAGAIN || errno == EINTR;
+    requestLength += n;
+
+    while (requestLength > 0) {
+        size_t used = handleRequest(request, requestLength);
+        if (used == 0) {
+            if (requestLength < sizeof(request)) break;
+            used = 1;
+        }
+        requestLength -= used;
+        memmove(request, request + used, requestLength);
+    }
+    return true;
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+// Pseudo-terminal master; the slave stays open here as well, raw so
+// nothing is echoed, and clients may come and go
+int openPty(const char* link, int& slave) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+    const char* name = ptsname(master);
+    slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+    printf("Pseudo-terminal: %s\n", name);
+    if (link) {
+        unlink(link);
+        if (symlink(name, link) != 0) {
+            perror("symlink");
+        } else {
+            printf("Linked as: %s\n", link);
+        }
+    }
+    return master;
+}
+
+int openListener(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+        perror("listen");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    printf("Listening on TCP port %u\n", port);
+    return fd;
+}
+
+void printStats(unsigned long started) {
+    double elapsed = (millis() - started) / 1000.0;
+    printf("%lu frames (%lu corrupted, %lu skipped), %lu noise bytes, %lu requests (%lu rejected), "
+           "%.0f s of bus time in %.1f s (%.0fx)\n",
+           stats.frames, stats.corrupted, stats.skipped, stats.noiseBytes, stats.requests, stats.rejected,
+           stats.busSeconds, elapsed, elapsed > 0 ? stats.busSeconds / elapsed : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    double rate = 1;
+    double noise = 0;
+    double errors = 0;
+    unsigned long limit = 0;
+    const char* link = nullptr;
+    uint16_t tcpPort = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:r:n:e:N:l:L:S:h")) != -1) {
+        switch (opt) {
+            case 'd': {
+                SimDevice device;
+                if (!parseDevice(optarg, device) || devices.size() >= SIM_MAX_DEVICES) {
+                    printHelp(argv[0]);
+                    return 1;
+                }
+                devices.push_back(device);
+                break;
+            }
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'n':
+                noise = atof(optarg);
+                break;
+            case 'e':
+                errors = atof(optarg);
+                break;
+            case 'N':
+                limit = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                link = optarg;
+                break;
+            case 'L':
+                tcpPort = (uint16_t)atoi(optarg);
+                break;
+            case 'S':
+                randomState = strtoul(optarg, NULL, 10);
+                if (randomState == 0) randomState = 1;
+                break;
+            case 'h':
+                printHelp(argv[0]);
+                return 0;
+            default:
+                printHelp(argv[0]);
+                return 1;
+        }
+    }
+    if (devices.empty()) {
+        SimDevice device;
+        parseDevice("vbus", device);
+        devices.push_back(device);
+    }
+
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    memory[SIM_DP_DEVICE_ID] = 0x20;
+    memory[SIM_DP_DEVICE_ID + 1] = 0x53;
+    memory[SIM_DP_MODE] = 0x02;         // Heating and hot water
+    updateMemory();
+
+    int slave = -1;
+    int listener = -1;
+    int out = -1;
+    if (tcpPort) {
+        listener = openListener(tcpPort);
+        if (listener < 0) return 1;
+    } else {
+        out = openPty(link, slave);
+        if (out < 0) return 1;
+    }
+    printf("Simulating %zu device(s), %s\n", devices.size(), rate > 0 ? "throttled" : "unthrottled");
+    fflush(stdout);
+
+    unsigned long interval = rate > 0 ? (unsigned long)(1000000 / rate) : 0;
+    unsigned long started = millis();
+    unsigned long lastReport = started;
+    size_t next = 0;    // Round robin when unthrottled
+
+    while (running) {
+        // Generate what is due; nothing while no TCP client is connected
+        unsigned long now = micros();
+        bool done = limit > 0 && stats.frames >= limit;
+        if (out >= 0 && !done && interval == 0) {
+            while (outLength < SIM_OUTPUT_LOW && !(limit > 0 && stats.frames >= limit)) {
+                sendFrame(devices[next], noise, errors);
+                next = (next + 1) % devices.size();
+            }
+        } else if (out >= 0 && !done) {
+            for (SimDevice& device : devices) {
+                if ((long)(now - device.nextFrame) < 0) continue;
+                sendFrame(device, noise, errors);
+                // Falling behind by more than a second restarts the schedule
+                device.nextFrame += interval;
+                if ((long)(now - device.nextFrame) > 1000000L) device.nextFrame = now + interval;
+            }
+        }
+        if (done && outLength == 0) break;
+
+        int timeout = 100;
+        if (interval > 0 && out >= 0 && !done) {
+            for (const SimDevice& device : devices) {
+                long wait = (long)(device.nextFrame - now) / 1000;
+                if (wait < timeout) timeout = wait > 0 ? (int)wait : 0;
+            }
+        }
+
+        struct pollfd fds[2];
+        nfds_t count = 0;
+        if (out >= 0) {
+            fds[count].fd = out;
+            fds[count].events = POLLIN | (outLength > 0 ? POLLOUT : 0);
+            count++;
+        }
+        if (listener >= 0) {
+            fds[count].fd = listener;
+            fds[count].events = POLLIN;
+            count++;
+        }
+        if (poll(fds, count, timeout) < 0 && errno != EINTR) break;
+
+        bool open = out < 0 || !(fds[0].revents & (POLLHUP | POLLERR));
+        if (out >= 0 && (fds[0].revents & POLLOUT)) {
+            ssize_t n = write(out, outBuffer, outLength);
+            if (n > 0) {
+                outLength -= n;
+                memmove(outBuffer, outBuffer + n, outLength);
+            } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                open = false;
+            }
+        }
+        if (out >= 0 && (fds[0].revents & POLLIN)) open &= readRequests(out);
+        bool hangup = !open && listener >= 0;
+
+        // One TCP client at a time; the next one starts with a clean buffer
+        if (listener >= 0 && (fds[count - 1].revents & POLLIN)) {
+            int client = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client >= 0 && out >= 0) {
+                close(client);
+            } else if (client >= 0) {
+                out = client;
+                for (SimDevice& device : devices) device.nextFrame = micros();
+                printf("Client connected\n");
+                fflush(stdout);
+            }
+        }
+        if (hangup) {
+            close(out);
+            out = -1;
+            outLength = 0;
+            requestLength = 0;
+            printf("Client disconnected\n");
+            fflush(stdout);
+        }
+
+        if (millis() - lastReport >= SIM_REPORT_MS) {
+            lastReport = millis();
+            printStats(started);
+        }
+    }
+
+    printStats(started);
+    if (out >= 0) close(out);
+    if (slave >= 0) close(slave);
+    if (listener >= 0) close(listener);
+    if (link) unlink(link);
+    return 0;
+}
@@ -13,6 +13,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <math.h>
+#include <string>
 
 // Arduino-style type definitions
 typedef bool boolean;
@@ -42,6 +44,37 @@ unsigned long micros();
 void delay(unsigned long ms);
 void delayMicroseconds(unsigned int us);
 
+// Arduino min()/max(); templates instead of macros so <algorithm> still works
+template<typename T> inline T min(T a, T b) { return b < a ? b : a; }
+template<typename T> inline T max(T a, T b) { return a < b ? b : a; }
+
+// Subset of the Arduino String class used by the library's export functions
+class String {
+public:
+    String(const char* str = "") : value(str ? str : "") {}
+    String(const std::string& str) : value(str) {}
+    String(int number);
+    String(unsigned int number);
+    String(long number);
+    String(unsigned long number);
+    String(double number, unsigned char decimals = 2);
+
+    const char* c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.size(); }
+
+    String& operator+=(const String& other) { value += other.value; return *this; }
+    String& operator+=(const char* str) { value += str; return *this; }
+    String& operator+=(char c) { value += c; return *this; }
+    friend String operator+(const String& a, const String& b) { return String(a.value + b.value); }
+    friend String operator+(const char* a, const String& b) { return String(a + b.value); }
+    friend String operator+(const String& a, const char* b) { return String(a.value + b); }
+    bool operator==(const String& other) const { return value == other.value; }
+    bool operator!=(const String& other) const { return value != other.value; }
+
+private:
+    std::string value;
+};
+
 // F() macro for compatibility (no-op on Linux)
 #define F(string_literal) (string_literal)
 
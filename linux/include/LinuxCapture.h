@@ -0,0 +1,181 @@
+/*
+ * Linux bus capture
+ * Records the raw bytes read from any Stream into capture files for offline
+ * replay, written by a background thread so decoding is never held up by
+ * the disk
+ */
+
+#pragma once
+#ifndef LINUX_CAPTURE_H
+#define LINUX_CAPTURE_H
+
+#include "Arduino.h"
+#include "vbusdecoder.h"
+#include <pthread.h>
+
+#define CAPTURE_BUFFER_SIZE 65536       // Bytes per buffer; one is filled while the other is written
+#define CAPTURE_FLUSH_MS 1000           // A partly filled buffer is written after this long
+#define CAPTURE_SYNC_MS 10000           // fdatasync() at most this often
+#define CAPTURE_FILE_SIZE 67108864      // Default size at which the file is rotated (64 MiB)
+#define CAPTURE_FILE_COUNT 8            // Default rotated files kept: <path>.1 (newest) .. <path>.8
+#define CAPTURE_MAX_PORTS 16
+#define CAPTURE_CHUNK_SIZE 256          // Bytes per data record
+#define CAPTURE_CHUNK_US 1000           // Bytes read further apart start a new data record
+
+// File format, all values little-endian:
+//   Header   "VBCP", uint16 version, uint16 header size, uint64 CLOCK_MONOTONIC
+//            µs and uint64 CLOCK_REALTIME µs when the file was opened
+//   Records  uint8 type, uint8 port, uint16 payload length, int32 µs since
+//            the previous record (the header for the first), payload
+// Every file starts with the port records of all ports, so each one can be
+// replayed on its own
+#define CAPTURE_MAGIC "VBCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 24
+#define CAPTURE_RECORD_SIZE 8
+
+enum CaptureRecordType {
+    CAPTURE_PORT = 1,   // uint8 protocol, uint32 baud, uint8 config, name
+    CAPTURE_DATA = 2,   // Bytes as read, the time is the one of the first
+    CAPTURE_FRAME = 3,  // uint32 frame count; the port's bytes up to here completed a valid frame
+    CAPTURE_TIME = 4,   // uint64 CLOCK_MONOTONIC µs, at the start of each buffer
+    CAPTURE_LOST = 5    // uint32 bytes not recorded because both buffers were full
+};
+
+// Writes capture files. Records are appended to the active buffer under a
+// short lock; the writer thread swaps buffers when one is full or
+// CAPTURE_FLUSH_MS passed, so a slow disk only costs bytes of the capture
+// (reported as CAPTURE_LOST), never time of the caller
+class LinuxCapture {
+public:
+    LinuxCapture();
+    ~LinuxCapture();
+
+    // Rotates to <path>.1 .. <path>.<files> when the file reaches maxSize
+    bool begin(const char* path, uint64_t maxSize = CAPTURE_FILE_SIZE,
+               uint8_t files = CAPTURE_FILE_COUNT);
+    void end();     // Writes the remaining records and syncs the file
+    bool isOpen() const { return running; }
+
+    // Returns the port ID for the records, the same again for a port with
+    // the same name and settings; -1 when all are in use
+    int addPort(const char* name, ProtocolType protocol, unsigned long baud, uint8_t config);
+
+    void data(uint8_t port, const uint8_t* bytes, size_t length, uint64_t time);
+    void frame(uint8_t port, uint32_t frameCount, uint64_t time);
+
+    unsigned long getLostCount() const { return lostTotal; }
+
+    // CLOCK_MONOTONIC in µs, the time base of all records
+    static uint64_t now();
+
+private:
+    struct Port {
+        uint8_t protocol;
+        uint32_t baud;
+        uint8_t config;
+        char name[64];
+    };
+
+    char path[256];
+    uint64_t maxSize;
+    uint8_t files;
+    int fd;
+    uint64_t fileSize;
+
+    Port ports[CAPTURE_MAX_PORTS];
+    uint8_t portCount;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool running;
+    bool stopping;
+
+    // Guarded by mutex
+    uint8_t buffers[2][CAPTURE_BUFFER_SIZE];
+    size_t lengths[2];
+    int active;                 // Buffer records are appended to
+    bool writing;               // The other buffer is full and being written
+    uint64_t lastTime;          // Time of the last record in the active buffer
+    uint64_t activeSince;       // When the active buffer got its first record
+    unsigned long lost;         // Not reported in a CAPTURE_LOST record yet
+    unsigned long lostTotal;
+
+    bool append(uint8_t type, uint8_t port, const uint8_t* payload, size_t length, uint64_t time);
+    void startBuffer(uint64_t time);
+    bool swap();
+    bool openFile();
+    void rotate();
+    void writeAll(const uint8_t* bytes, size_t length);
+    void writeLoop();
+    static void* writeThread(void* arg);
+};
+
+// Stream passing another Stream through and recording what is read from
+// it. With a decoder set, a CAPTURE_FRAME record follows every frame the
+// decoder completed; the decoder checks available() at the start of each
+// loop(), which is where new frames are noticed
+class LinuxCaptureStream : public Stream {
+public:
+    LinuxCaptureStream(Stream* source, LinuxCapture* capture, uint8_t port);
+    ~LinuxCaptureStream();
+
+    void setDecoder(VBUSDecoder* decoder);
+
+    // Stream interface implementation
+    int available() override;
+    int read() override;
+    size_t write(uint8_t data) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    void flush() override;
+
+    // Records the bytes read so far, e.g. before the port is closed
+    void flushCapture();
+
+private:
+    Stream* source;
+    LinuxCapture* capture;
+    uint8_t port;
+    VBUSDecoder* decoder;
+    uint32_t frameCount;
+
+    uint8_t chunk[CAPTURE_CHUNK_SIZE];
+    size_t chunkLength;
+    uint64_t chunkTime;
+
+    void checkFrames();
+};
+
+// Reads the records of a capture file
+struct CaptureRecord {
+    uint8_t type;           // CaptureRecordType
+    uint8_t port;
+    uint16_t length;
+    uint64_t time;          // CLOCK_MONOTONIC µs
+    const uint8_t* payload; // Valid until the next call of next()
+};
+
+class LinuxCaptureReader {
+public:
+    LinuxCaptureReader();
+    ~LinuxCaptureReader();
+
+    bool open(const char* path);
+    void close();
+
+    // False at the end of the file or on a truncated record
+    bool next(CaptureRecord& record);
+
+    uint64_t getStartTime() const { return startTime; }     // CLOCK_MONOTONIC µs
+    uint64_t getWallTime() const { return wallTime; }       // CLOCK_REALTIME µs at the start
+
+private:
+    FILE* file;
+    uint64_t startTime;
+    uint64_t wallTime;
+    uint64_t time;
+    uint8_t payload[65536];
+};
+
+#endif // LINUX_CAPTURE_H
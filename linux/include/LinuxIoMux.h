@@ -0,0 +1,133 @@
+/*
+ * Linux I/O multiplexer
+ * Serves many serial ports or sockets from a single thread. Reads are kept
+ * posted on io_uring with registered buffers where the kernel supports it,
+ * otherwise they are driven by epoll
+ */
+
+#pragma once
+#ifndef LINUX_IO_MUX_H
+#define LINUX_IO_MUX_H
+
+#include "Arduino.h"
+
+#define IOMUX_MAX_LINKS 64              // Registered buffer slots
+#define IOMUX_BUFFER_SIZE 1024          // Bytes per read; all slots stay below the 64 KiB memlock default
+#define IOMUX_QUEUE_DEPTH 256           // io_uring submission entries, two per posted read
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+enum IoMuxBackend {
+    IOMUX_AUTO = 0,         // io_uring if available, else epoll
+    IOMUX_IO_URING,
+    IOMUX_EPOLL
+};
+
+class LinuxIoLink;
+typedef void (*IoLinkHandler)(LinuxIoLink* link, void* context);
+
+// One serial port or socket. Reads return the bytes of the last completed
+// read straight from its buffer; the next read is posted once all of them
+// were consumed. write() and flush() go to the descriptor directly
+class LinuxIoLink : public Stream {
+public:
+    LinuxIoLink();
+
+    // Stream interface implementation
+    int available() override;
+    int read() override;
+    size_t write(uint8_t data) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    void flush() override;
+
+    // Called from LinuxIoMux::wait() when data arrived or the link failed,
+    // typically runs the decoder reading this link
+    void setHandler(IoLinkHandler handler, void* context);
+
+    int getFd() const { return fd; }
+    bool hasFailed() const { return failed; }          // Hangup or read error
+    unsigned long getArrivalTime() const { return arrival; }   // micros() of the last read
+    unsigned long getByteCount() const { return bytes; }
+
+private:
+    friend class LinuxIoMux;
+
+    enum State : uint8_t { FREE, ACTIVE, REMOVING };
+
+    int fd;
+    uint16_t slot;
+    State state;
+    bool pending;           // Read posted or armed
+    bool failed;
+    uint8_t* buffer;        // Registered buffer of this slot
+    uint16_t start;
+    uint16_t length;
+    unsigned long arrival;
+    unsigned long bytes;
+    IoLinkHandler handler;
+    void* context;
+};
+
+class LinuxIoMux {
+public:
+    LinuxIoMux();
+    ~LinuxIoMux();
+
+    // IOMUX_AUTO falls back to epoll when io_uring is missing, disabled or
+    // older than 5.11. Returns false if the requested backend is unavailable
+    bool begin(IoMuxBackend backend = IOMUX_AUTO);
+    void end();
+    IoMuxBackend getBackend() const { return backend; }
+    const char* getBackendName() const;
+
+    // The descriptor stays owned by the caller; remove() the link before
+    // closing it. Returns nullptr when all slots are in use
+    LinuxIoLink* add(int fd);
+    void remove(LinuxIoLink* link);
+
+    // Posts reads for all links that consumed their data, waits up to
+    // timeoutMs for completions and calls the handlers of the links that
+    // got data. With io_uring, posting and waiting is a single system call.
+    // Returns the number of links handled
+    int wait(int timeoutMs);
+
+    unsigned long getSyscallCount() const { return syscalls; }
+
+private:
+    IoMuxBackend backend;
+    LinuxIoLink links[IOMUX_MAX_LINKS];
+    uint8_t* buffers;
+    unsigned long syscalls;
+
+    // io_uring
+    int ringFd;
+    void* ring;
+    size_t ringSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    // epoll
+    int epollFd;
+
+    bool beginUring();
+    void endUring();
+    bool beginEpoll();
+    struct io_uring_sqe* getSqe();
+    void postUring(LinuxIoLink* link);
+    int waitUring(int timeoutMs);
+    int waitEpoll(int timeoutMs);
+    void complete(LinuxIoLink* link, int result);
+};
+
+#endif // LINUX_IO_MUX_H
@@ -0,0 +1,93 @@
+/*
+ * Linux MQTT client
+ * Minimal MQTT 3.1.1 client over non-blocking POSIX sockets, providing the
+ * PubSubClient-style interface used by VBUSMqttClient
+ */
+
+#pragma once
+#ifndef LINUX_MQTT_CLIENT_H
+#define LINUX_MQTT_CLIENT_H
+
+#include "Arduino.h"
+
+#define MQTT_LINUX_MAX_PACKET_SIZE 1024     // Default incoming packet limit (setBufferSize)
+#define MQTT_LINUX_OUTPUT_SIZE 32768        // Bytes waiting for the socket to become writable
+#define MQTT_LINUX_KEEPALIVE 15             // Seconds
+#define MQTT_LINUX_CONNECT_TIMEOUT 10000    // ms for TCP connect and CONNACK
+
+// Connection states
+enum MqttLinuxState {
+    MQTT_LINUX_DISCONNECTED = 0,
+    MQTT_LINUX_CONNECTING,      // TCP connect in progress, CONNECT queued
+    MQTT_LINUX_WAIT_CONNACK,    // CONNECT sent, waiting for the broker
+    MQTT_LINUX_CONNECTED
+};
+
+class LinuxMqttClient {
+public:
+    LinuxMqttClient();
+    ~LinuxMqttClient();
+
+    // Configuration
+    void setServer(const char* host, uint16_t port);
+    void setKeepAlive(uint16_t seconds);
+    bool setBufferSize(uint16_t size);
+    void setCallback(void (*callback)(char*, uint8_t*, unsigned int));
+
+    // Connection management. connect() only starts the connection; packets
+    // published before the broker answered are queued behind CONNECT
+    // (allowed by MQTT 3.1.1) and go out once the socket is writable.
+    // connected() is true, as with PubSubClient, only once CONNACK arrived
+    bool connect(const char* id);
+    bool connect(const char* id, const char* user, const char* pass);
+    void disconnect();
+    bool connected();
+    bool loop();
+    MqttLinuxState state() const { return connState; }
+
+    // Publishing (QoS 0 only)
+    bool publish(const char* topic, const char* payload, bool retained = false);
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained = false);
+    bool subscribe(const char* topic);
+
+    // Event loop integration: wait for POLLIN on getSocket(), and for
+    // POLLOUT while wantsWrite() is true, then call loop()
+    int getSocket() const { return fd; }
+    bool wantsWrite() const;
+
+private:
+    int fd;
+    MqttLinuxState connState;
+    char host[128];
+    uint16_t port;
+    uint16_t keepAlive;
+    uint16_t nextPacketId;
+    void (*callback)(char*, uint8_t*, unsigned int);
+
+    // Outgoing bytes the socket has not accepted yet
+    uint8_t* outBuffer;
+    size_t outLength;
+
+    // Incoming packet assembly
+    uint8_t* inBuffer;
+    uint16_t inSize;
+    size_t inLength;
+    size_t skipLength;          // Remainder of a packet larger than inSize
+
+    unsigned long connectStarted;
+    unsigned long lastOutbound;
+    unsigned long lastInbound;
+    bool pingOutstanding;
+
+    bool openSocket();
+    void closeSocket();
+    bool checkConnect();
+    bool flushOutput();
+    bool readInput();
+    void handlePacket(const uint8_t* packet, size_t length, size_t headerLength);
+    bool beginPacket(uint8_t header, size_t remaining);
+    void append(const void* data, size_t length);
+    void appendString(const char* str);
+};
+
+#endif // LINUX_MQTT_CLIENT_H
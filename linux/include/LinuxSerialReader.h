@@ -0,0 +1,77 @@
+/*
+ * Linux serial reader thread
+ * Reads a LinuxSerial port on a thread of its own into a lock-free ring, so
+ * a stalled main loop costs memory instead of bytes lost in the tty buffer
+ */
+
+#pragma once
+#ifndef LINUX_SERIAL_READER_H
+#define LINUX_SERIAL_READER_H
+
+#include "Arduino.h"
+#include "LinuxSerial.h"
+#include <pthread.h>
+#include <atomic>
+
+#define SERIAL_READER_RING_SIZE 16384    // Bytes, power of two; 17 s at 9600 baud
+#define SERIAL_READER_CHUNK_SIZE 1024    // Bytes per read() call
+#define SERIAL_READER_POLL_MS 100        // How quickly stop() is noticed
+
+// Stream over the ring. The reader thread is the only producer, the thread
+// calling available()/read() the only consumer. write() and flush() go
+// straight to the port.
+class LinuxSerialReader : public Stream {
+public:
+    // The port stays owned by the caller and must outlive the reader
+    LinuxSerialReader(LinuxSerial* serial);
+    ~LinuxSerialReader();
+
+    bool start();
+    void stop();
+
+    // Stream interface implementation
+    int available() override;
+    int read() override;
+    size_t write(uint8_t data) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    void flush() override;
+
+    // Becomes readable when bytes arrived or the port failed. Call
+    // acknowledge() before consuming, so no wakeup is lost
+    int getEventFd() const { return eventFd; }
+    void acknowledge();
+
+    // Port hung up or returned an error (adapter removed); the thread has ended
+    bool hasFailed() const { return failed.load(std::memory_order_acquire); }
+
+    // micros() when the chunk containing the byte last returned by read()
+    // came in
+    unsigned long getArrivalTime() const { return lastArrival; }
+
+    // Bytes read from the port but dropped because the ring was full, and
+    // the highest ring fill level seen
+    unsigned long getOverflowCount() const { return overflow.load(std::memory_order_relaxed); }
+    size_t getHighWater() const { return highWater.load(std::memory_order_relaxed); }
+
+private:
+    LinuxSerial* serial;
+    pthread_t thread;
+    bool running;
+    std::atomic<bool> stopping;
+    std::atomic<bool> failed;
+    int eventFd;
+
+    uint8_t ring[SERIAL_READER_RING_SIZE];
+    unsigned long arrival[SERIAL_READER_RING_SIZE];
+    std::atomic<size_t> head;      // Written by the reader thread only
+    std::atomic<size_t> tail;      // Written by the consumer only
+    unsigned long lastArrival;
+    std::atomic<unsigned long> overflow;
+    std::atomic<size_t> highWater;
+
+    void readLoop();
+    void signal();
+    static void* readThread(void* arg);
+};
+
+#endif // LINUX_SERIAL_READER_H
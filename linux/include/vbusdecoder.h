@@ -21,7 +21,7 @@ enum ProtocolType: uint8_t {
 // Bus participant information structure
 struct BusParticipant {
   uint16_t address;           // Device address
-  uint32_t lastSeen;          // Last time packet was received (millis)
+  uint32_t lastSeen;          // Last time packet was received (VBUSClock)
   uint8_t tempChannels;       // Number of temperature channels
   uint8_t pumpChannels;       // Number of pump channels
   uint8_t relayChannels;      // Number of relay channels
@@ -113,6 +113,29 @@ enum KMBusMode: uint8_t {
 // KM-Bus maximum number of heating circuits
 #define KMBUS_MAX_CIRCUITS 3
 
+// Time source in milliseconds, see VBUSClock
+typedef unsigned long (*VBUSClockSource)();
+
+// Time base of the decoder, data logger, scheduler and MQTT client, used
+// in place of millis(). A replay switches it to virtual time and sets it
+// to each recorded frame's timestamp before feeding the frame, so
+// timeouts, log intervals and rules follow the recording instead of the
+// wall clock and days of traffic are processed in seconds
+class VBUSClock {
+  public:
+    static unsigned long now();
+    static void setSource(VBUSClockSource source);  // nullptr restores millis()
+    static void setVirtual(unsigned long start = 0);
+    static void set(unsigned long ms);              // Virtual time only
+    static void advance(unsigned long ms);          // Virtual time only
+    static bool isVirtual();
+
+  private:
+    static VBUSClockSource _source;
+    static bool _virtual;
+    static unsigned long _virtualTime;
+};
+
 class VBUSDecoder {
   
   public:
@@ -135,6 +158,8 @@ class VBUSDecoder {
     uint16_t const getHeatQuantity() const;
     uint8_t const getSystemVariant() const;
     ProtocolType const getProtocol() const;
+    uint32_t getFrameCount() const;         // Incremented for every decoded frame
+    uint32_t getFrameTime() const;          // VBUSClock time of the last decoded frame
     
     // Bus participant discovery and management
     void enableAutoDiscovery(bool enable = true);
@@ -198,6 +223,8 @@ class VBUSDecoder {
     uint32_t _operatingHours[8];
     uint16_t _heatQuantity;
     uint8_t _systemVariant;
+    uint32_t _frameCount;
+    uint32_t _frameTime;
     
     // Bus participant discovery
     static const uint8_t MAX_PARTICIPANTS = 16;
@@ -271,4 +298,4 @@ class VBUSDecoder {
     void _kmDefaultDecoder();
 };
 
-#endif
+#endif
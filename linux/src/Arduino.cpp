@@ -3,37 +3,36 @@
  */
 
 #include "Arduino.h"
+#include <time.h>
 
-static struct timeval start_time;
+// CLOCK_MONOTONIC: immune to NTP steps and manual changes of the wall clock
+static struct timespec start_time;
 static bool time_initialized = false;
 
 static void init_time() {
     if (!time_initialized) {
-        gettimeofday(&start_time, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
         time_initialized = true;
     }
 }
 
-unsigned long millis() {
+static long long elapsed_us() {
     init_time();
-    struct timeval current_time;
-    gettimeofday(&current_time, NULL);
-    
-    unsigned long ms = (current_time.tv_sec - start_time.tv_sec) * 1000UL;
-    ms += (current_time.tv_usec - start_time.tv_usec) / 1000UL;
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC, &current_time);
     
-    return ms;
+    // Signed nanoseconds: tv_nsec may be smaller than at start
+    long long us = (long long)(current_time.tv_sec - start_time.tv_sec) * 1000000LL;
+    us += (current_time.tv_nsec - start_time.tv_nsec) / 1000;
+    return us;
+}
+
+unsigned long millis() {
+    return (unsigned long)(elapsed_us() / 1000);
 }
 
 unsigned long micros() {
-    init_time();
-    struct timeval current_time;
-    gettimeofday(&current_time, NULL);
-    
-    unsigned long us = (current_time.tv_sec - start_time.tv_sec) * 1000000UL;
-    us += (current_time.tv_usec - start_time.tv_usec);
-    
-    return us;
+    return (unsigned long)elapsed_us();
 }
 
 void delay(unsigned long ms) {
@@ -43,3 +42,17 @@ void delay(unsigned long ms) {
 void delayMicroseconds(unsigned int us) {
     usleep(us);
 }
+
+String::String(int number) : value(std::to_string(number)) {}
+
+String::String(unsigned int number) : value(std::to_string(number)) {}
+
+String::String(long number) : value(std::to_string(number)) {}
+
+String::String(unsigned long number) : value(std::to_string(number)) {}
+
+String::String(double number, unsigned char decimals) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, number);
+    value = buffer;
+}
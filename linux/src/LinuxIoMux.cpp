@@ -0,0 +1,431 @@
+/*
+ * Linux I/O multiplexer implementation
+ */
+
+#include "LinuxIoMux.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <endian.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// Without io_uring headers and syscall numbers only epoll is built
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_EXT_ARG)
+#define IOMUX_HAVE_URING 1
+#else
+#define IOMUX_HAVE_URING 0
+#endif
+
+// user_data of io_uring requests: slot << 2 | tag
+#define IOMUX_TAG_POLL 0
+#define IOMUX_TAG_READ 1
+#define IOMUX_TAG_CANCEL 2
+
+// LinuxIoLink
+
+LinuxIoLink::LinuxIoLink()
+    : fd(-1), slot(0), state(FREE), pending(false), failed(false), buffer(nullptr),
+      start(0), length(0), arrival(0), bytes(0), handler(nullptr), context(nullptr) {
+}
+
+int LinuxIoLink::available() {
+    return length - start;
+}
+
+int LinuxIoLink::read() {
+    if (start >= length) return -1;
+    return buffer[start++];
+}
+
+size_t LinuxIoLink::write(uint8_t data) {
+    return write(&data, 1);
+}
+
+size_t LinuxIoLink::write(const uint8_t *buffer, size_t size) {
+    if (fd < 0 || failed) return 0;
+    ssize_t n = ::write(fd, buffer, size);
+    return (n > 0) ? n : 0;
+}
+
+void LinuxIoLink::flush() {
+    if (fd >= 0 && isatty(fd)) tcdrain(fd);
+}
+
+void LinuxIoLink::setHandler(IoLinkHandler handler, void* context) {
+    this->handler = handler;
+    this->context = context;
+}
+
+// LinuxIoMux
+
+LinuxIoMux::LinuxIoMux()
+    : backend(IOMUX_AUTO), buffers(nullptr), syscalls(0), ringFd(-1), ring(MAP_FAILED), ringSize(0),
+      sqes((struct io_uring_sqe*)MAP_FAILED), sqesSize(0), sqHead(nullptr), sqTail(nullptr),
+      sqArray(nullptr), sqMask(0), sqEntries(0), sqLocalTail(0), cqHead(nullptr), cqTail(nullptr),
+      cqMask(0), cqes(nullptr), epollFd(-1) {
+}
+
+LinuxIoMux::~LinuxIoMux() {
+    end();
+}
+
+bool LinuxIoMux::begin(IoMuxBackend requested) {
+    end();
+    buffers = (uint8_t*)aligned_alloc(4096, IOMUX_MAX_LINKS * IOMUX_BUFFER_SIZE);
+    if (!buffers) return false;
+    for (uint16_t i = 0; i < IOMUX_MAX_LINKS; i++) {
+        links[i] = LinuxIoLink();
+        links[i].slot = i;
+        links[i].buffer = buffers + i * IOMUX_BUFFER_SIZE;
+    }
+
+    if (requested != IOMUX_EPOLL && beginUring()) {
+        backend = IOMUX_IO_URING;
+        return true;
+    }
+    if (requested != IOMUX_IO_URING && beginEpoll()) {
+        backend = IOMUX_EPOLL;
+        return true;
+    }
+    end();
+    return false;
+}
+
+void LinuxIoMux::end() {
+    endUring();
+    if (epollFd >= 0) close(epollFd);
+    epollFd = -1;
+    free(buffers);
+    buffers = nullptr;
+    for (uint16_t i = 0; i < IOMUX_MAX_LINKS; i++) {
+        links[i] = LinuxIoLink();
+    }
+    backend = IOMUX_AUTO;
+}
+
+const char* LinuxIoMux::getBackendName() const {
+    switch (backend) {
+        case IOMUX_IO_URING: return "io_uring";
+        case IOMUX_EPOLL: return "epoll";
+        default: return "none";
+    }
+}
+
+LinuxIoLink* LinuxIoMux::add(int fd) {
+    if (fd < 0 || backend == IOMUX_AUTO) return nullptr;
+    for (uint16_t i = 0; i < IOMUX_MAX_LINKS; i++) {
+        LinuxIoLink* link = &links[i];
+        if (link->state != LinuxIoLink::FREE) continue;
+
+        if (backend == IOMUX_EPOLL) {
+            struct epoll_event event;
+            event.events = 0;       // Armed by wait()
+            event.data.u32 = i;
+            syscalls++;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) return nullptr;
+        }
+        link->fd = fd;
+        link->state = LinuxIoLink::ACTIVE;
+        link->pending = false;
+        link->failed = false;
+        link->start = 0;
+        link->length = 0;
+        link->arrival = 0;
+        link->bytes = 0;
+        link->handler = nullptr;
+        link->context = nullptr;
+        return link;
+    }
+    return nullptr;
+}
+
+void LinuxIoMux::remove(LinuxIoLink* link) {
+    if (!link || link->state != LinuxIoLink::ACTIVE) return;
+    link->handler = nullptr;
+    link->start = link->length = 0;
+
+    if (backend == IOMUX_EPOLL) {
+        syscalls++;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, link->fd, nullptr);
+    } else if (link->pending) {
+#if IOMUX_HAVE_URING
+        // The slot's buffer stays in use until the read completes
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = ((uint64_t)link->slot << 2) | IOMUX_TAG_POLL;
+            sqe->user_data = ((uint64_t)link->slot << 2) | IOMUX_TAG_CANCEL;
+        }
+        link->fd = -1;
+        link->state = LinuxIoLink::REMOVING;
+        return;
+#endif
+    }
+    link->fd = -1;
+    link->state = LinuxIoLink::FREE;
+    link->pending = false;
+}
+
+int LinuxIoMux::wait(int timeoutMs) {
+    if (backend == IOMUX_IO_URING) return waitUring(timeoutMs);
+    if (backend == IOMUX_EPOLL) return waitEpoll(timeoutMs);
+    return 0;
+}
+
+// Private helper methods
+
+// Bytes of a finished read are handed to the link's handler; a hangup or
+// error fails the link for good
+void LinuxIoMux::complete(LinuxIoLink* link, int result) {
+    link->pending = false;
+    if (link->state == LinuxIoLink::REMOVING) {
+        link->state = LinuxIoLink::FREE;
+        return;
+    }
+    if (result == -EAGAIN || result == -EINTR || result == -ECANCELED) return;   // Posted again
+    if (result <= 0) {
+        link->failed = true;
+    } else {
+        link->start = 0;
+        link->length = result;
+        link->bytes += result;
+        link->arrival = micros();
+    }
+    if (link->handler) link->handler(link, link->context);
+}
+
+bool LinuxIoMux::beginEpoll() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    return epollFd >= 0;
+}
+
+// Interest is only armed while a link's buffer is empty, so a handler that
+// leaves bytes unread does not make epoll spin
+int LinuxIoMux::waitEpoll(int timeoutMs) {
+    for (uint16_t i = 0; i < IOMUX_MAX_LINKS; i++) {
+        LinuxIoLink* link = &links[i];
+        bool idle = link->state == LinuxIoLink::ACTIVE && !link->failed && link->start >= link->length;
+        if (idle == link->pending) continue;
+        struct epoll_event event;
+        event.events = idle ? (uint32_t)EPOLLIN : 0;
+        event.data.u32 = i;
+        syscalls++;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, link->fd, &event);
+        link->pending = idle;
+    }
+
+    struct epoll_event events[IOMUX_MAX_LINKS];
+    syscalls++;
+    int count = epoll_wait(epollFd, events, IOMUX_MAX_LINKS, timeoutMs);
+    int handled = 0;
+    for (int i = 0; i < count; i++) {
+        LinuxIoLink* link = &links[events[i].data.u32];
+        if (link->state != LinuxIoLink::ACTIVE || !link->pending) continue;
+
+        syscalls++;
+        ssize_t n = ::read(link->fd, link->buffer, IOMUX_BUFFER_SIZE);
+        int result = n < 0 ? -errno : (int)n;
+        if (result == -EAGAIN || result == -EINTR) continue;
+        if (n <= 0) {
+            syscalls++;
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, link->fd, nullptr);
+        }
+        // Stays armed until the handler consumed the bytes
+        complete(link, result);
+        if (link->state == LinuxIoLink::ACTIVE) link->pending = n > 0;
+        handled++;
+    }
+    return handled;
+}
+
+#if IOMUX_HAVE_URING
+
+static int ioUringSetup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned submit, unsigned minComplete, unsigned flags, void* arg, size_t argSize) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, arg, argSize);
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+bool LinuxIoMux::beginUring() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = ioUringSetup(IOMUX_QUEUE_DEPTH, &params);
+    if (ringFd < 0) return false;
+
+    // EXT_ARG (5.11) lets io_uring_enter() wait with a timeout
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        endUring();
+        return false;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ringSize = sqSize > cqSize ? sqSize : cqSize;
+    ring = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      ringFd, IORING_OFF_SQES);
+    if (ring == MAP_FAILED || sqes == (struct io_uring_sqe*)MAP_FAILED) {
+        endUring();
+        return false;
+    }
+
+    uint8_t* base = (uint8_t*)ring;
+    sqHead = (unsigned*)(base + params.sq_off.head);
+    sqTail = (unsigned*)(base + params.sq_off.tail);
+    sqArray = (unsigned*)(base + params.sq_off.array);
+    sqMask = *(unsigned*)(base + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+    cqHead = (unsigned*)(base + params.cq_off.head);
+    cqTail = (unsigned*)(base + params.cq_off.tail);
+    cqMask = *(unsigned*)(base + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(base + params.cq_off.cqes);
+
+    // Every operation used must be known to the kernel
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, probeSize);
+    bool supported = probe && ioUringRegister(ringFd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    const uint8_t ops[] = { IORING_OP_POLL_ADD, IORING_OP_READ_FIXED, IORING_OP_ASYNC_CANCEL };
+    for (size_t i = 0; supported && i < sizeof(ops); i++) {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+
+    // Pinned once, reads then need no per-request page mapping
+    struct iovec iov[IOMUX_MAX_LINKS];
+    for (uint16_t i = 0; i < IOMUX_MAX_LINKS; i++) {
+        iov[i].iov_base = buffers + i * IOMUX_BUFFER_SIZE;
+        iov[i].iov_len = IOMUX_BUFFER_SIZE;
+    }
+    if (!supported || ioUringRegister(ringFd, IORING_REGISTER_BUFFERS, iov, IOMUX_MAX_LINKS) < 0) {
+        endUring();
+        return false;
+    }
+    return true;
+}
+
+// Closing the ring cancels all requests still posted
+void LinuxIoMux::endUring() {
+    if (ring != MAP_FAILED) munmap(ring, ringSize);
+    if (sqes != (struct io_uring_sqe*)MAP_FAILED) munmap(sqes, sqesSize);
+    if (ringFd >= 0) close(ringFd);
+    ring = MAP_FAILED;
+    sqes = (struct io_uring_sqe*)MAP_FAILED;
+    ringFd = -1;
+}
+
+struct io_uring_sqe* LinuxIoMux::getSqe() {
+    if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) return nullptr;
+    unsigned index = sqLocalTail & sqMask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    sqLocalTail++;
+    return sqe;
+}
+
+// Serial ports are opened non-blocking, where a plain read would complete
+// with -EAGAIN at once. A poll linked in front of the read waits for data
+void LinuxIoMux::postUring(LinuxIoLink* link) {
+    if (sqLocalTail + 2 - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > sqEntries) return;
+
+    struct io_uring_sqe* poll = getSqe();
+    poll->opcode = IORING_OP_POLL_ADD;
+    poll->fd = link->fd;
+    uint32_t events = POLLIN;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);   // Kernel reads the halves swapped
+#endif
+    poll->poll32_events = events;
+    poll->flags = IOSQE_IO_LINK;
+    poll->user_data = ((uint64_t)link->slot << 2) | IOMUX_TAG_POLL;
+
+    struct io_uring_sqe* read = getSqe();
+    read->opcode = IORING_OP_READ_FIXED;
+    read->fd = link->fd;
+    read->addr = (uint64_t)(uintptr_t)link->buffer;
+    read->len = IOMUX_BUFFER_SIZE;
+    read->off = (uint64_t)-1;      // Current position, streams have none
+    read->buf_index = link->slot;
+    read->user_data = ((uint64_t)link->slot << 2) | IOMUX_TAG_READ;
+    link->pending = true;
+}
+
+int LinuxIoMux::waitUring(int timeoutMs) {
+    for (uint16_t i = 0; i < IOMUX_MAX_LINKS; i++) {
+        LinuxIoLink* link = &links[i];
+        if (link->state == LinuxIoLink::ACTIVE && !link->pending && !link->failed && link->start >= link->length) {
+            postUring(link);
+        }
+    }
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+    unsigned toSubmit = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    bool ready = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) != *cqHead;
+    if (toSubmit > 0 || !ready) {
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        syscalls++;
+        ioUringEnter(ringFd, toSubmit, ready ? 0 : 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                     &arg, sizeof(arg));
+    }
+
+    int handled = 0;
+    unsigned head = *cqHead;
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &cqes[head & cqMask];
+        uint64_t data = cqe->user_data;
+        int result = cqe->res;
+        head++;
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+        if ((data & 3) != IOMUX_TAG_READ) continue;
+        LinuxIoLink* link = &links[(data >> 2) % IOMUX_MAX_LINKS];
+        complete(link, result);
+        if (result > 0) handled++;
+    }
+    return handled;
+}
+
+#else
+
+bool LinuxIoMux::beginUring() {
+    return false;
+}
+
+void LinuxIoMux::endUring() {
+}
+
+struct io_uring_sqe* LinuxIoMux::getSqe() {
+    return nullptr;
+}
+
+void LinuxIoMux::postUring(LinuxIoLink*) {
+}
+
+int LinuxIoMux::waitUring(int) {
+    return 0;
+}
+
+#endif
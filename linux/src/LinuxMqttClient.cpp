@@ -0,0 +1,424 @@
+/*
+ * Linux MQTT client implementation
+ */
+
+#include "LinuxMqttClient.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// MQTT 3.1.1 control packet types (upper nibble of the fixed header)
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_SUBSCRIBE   0x82   // Reserved flags 0010
+#define MQTT_PINGREQ     0xC0
+#define MQTT_PINGRESP    0xD0
+#define MQTT_DISCONNECT  0xE0
+
+LinuxMqttClient::LinuxMqttClient() :
+    fd(-1),
+    connState(MQTT_LINUX_DISCONNECTED),
+    port(1883),
+    keepAlive(MQTT_LINUX_KEEPALIVE),
+    nextPacketId(1),
+    callback(nullptr),
+    outLength(0),
+    inSize(MQTT_LINUX_MAX_PACKET_SIZE),
+    inLength(0),
+    skipLength(0),
+    connectStarted(0),
+    lastOutbound(0),
+    lastInbound(0),
+    pingOutstanding(false) {
+    host[0] = '\0';
+    outBuffer = new uint8_t[MQTT_LINUX_OUTPUT_SIZE];
+    inBuffer = new uint8_t[inSize];
+}
+
+LinuxMqttClient::~LinuxMqttClient() {
+    closeSocket();
+    delete[] outBuffer;
+    delete[] inBuffer;
+}
+
+void LinuxMqttClient::setServer(const char* server, uint16_t serverPort) {
+    snprintf(host, sizeof(host), "%s", server ? server : "");
+    port = serverPort;
+}
+
+void LinuxMqttClient::setKeepAlive(uint16_t seconds) {
+    keepAlive = seconds;
+}
+
+bool LinuxMqttClient::setBufferSize(uint16_t size) {
+    if (size == 0) return false;
+    if (size == inSize) return true;
+
+    uint8_t* buffer = new uint8_t[size];
+    size_t keep = inLength < size ? inLength : 0;
+    memcpy(buffer, inBuffer, keep);
+    delete[] inBuffer;
+    inBuffer = buffer;
+    inSize = size;
+    inLength = keep;
+    return true;
+}
+
+void LinuxMqttClient::setCallback(void (*cb)(char*, uint8_t*, unsigned int)) {
+    callback = cb;
+}
+
+bool LinuxMqttClient::connect(const char* id) {
+    return connect(id, nullptr, nullptr);
+}
+
+bool LinuxMqttClient::connect(const char* id, const char* user, const char* pass) {
+    if (connState != MQTT_LINUX_DISCONNECTED) return true;
+    if (!openSocket()) return false;
+
+    // CONNECT: protocol name, level 4, flags, keep alive, then the payload
+    size_t remaining = 10 + 2 + strlen(id);
+    uint8_t flags = 0x02;  // Clean session
+    if (user) {
+        flags |= 0x80;
+        remaining += 2 + strlen(user);
+        if (pass) {
+            flags |= 0x40;
+            remaining += 2 + strlen(pass);
+        }
+    }
+
+    outLength = 0;
+    if (!beginPacket(MQTT_CONNECT, remaining)) {
+        closeSocket();
+        return false;
+    }
+    appendString("MQTT");
+    uint8_t header[4] = { 4, flags, (uint8_t)(keepAlive >> 8), (uint8_t)(keepAlive & 0xFF) };
+    append(header, sizeof(header));
+    appendString(id);
+    if (flags & 0x80) appendString(user);
+    if (flags & 0x40) appendString(pass);
+
+    // A local broker often accepts the connection immediately
+    if (connState == MQTT_LINUX_CONNECTING) checkConnect();
+    return connState != MQTT_LINUX_DISCONNECTED;
+}
+
+void LinuxMqttClient::disconnect() {
+    if (connState == MQTT_LINUX_CONNECTED || connState == MQTT_LINUX_WAIT_CONNACK) {
+        // Best effort: whatever is still queued plus DISCONNECT
+        if (beginPacket(MQTT_DISCONNECT, 0)) flushOutput();
+    }
+    closeSocket();
+}
+
+bool LinuxMqttClient::connected() {
+    return connState == MQTT_LINUX_CONNECTED;
+}
+
+bool LinuxMqttClient::wantsWrite() const {
+    return connState == MQTT_LINUX_CONNECTING || outLength > 0;
+}
+
+bool LinuxMqttClient::loop() {
+    if (connState == MQTT_LINUX_DISCONNECTED) return false;
+
+    unsigned long now = millis();
+    if (connState != MQTT_LINUX_CONNECTED && now - connectStarted > MQTT_LINUX_CONNECT_TIMEOUT) {
+        fprintf(stderr, "MQTT: connection to %s:%u timed out\n", host, port);
+        closeSocket();
+        return false;
+    }
+
+    if (connState == MQTT_LINUX_CONNECTING && !checkConnect()) {
+        return connState != MQTT_LINUX_DISCONNECTED;
+    }
+
+    if (!readInput()) return false;
+
+    if (connState == MQTT_LINUX_CONNECTED && keepAlive > 0) {
+        now = millis();  // readInput() may have moved lastInbound past the earlier value
+        unsigned long interval = keepAlive * 1000UL;
+        if (pingOutstanding && now - lastInbound > interval) {
+            fprintf(stderr, "MQTT: broker stopped responding\n");
+            closeSocket();
+            return false;
+        }
+        if (!pingOutstanding && (now - lastOutbound > interval / 2 || now - lastInbound > interval)) {
+            if (beginPacket(MQTT_PINGREQ, 0)) pingOutstanding = true;
+        }
+    }
+
+    return flushOutput();
+}
+
+bool LinuxMqttClient::publish(const char* topic, const char* payload, bool retained) {
+    return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained);
+}
+
+bool LinuxMqttClient::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    if (connState == MQTT_LINUX_DISCONNECTED) return false;
+
+    if (!beginPacket(MQTT_PUBLISH | (retained ? 0x01 : 0x00), 2 + strlen(topic) + length)) {
+        return false;  // Output buffer full, the broker is not keeping up
+    }
+    appendString(topic);
+    append(payload, length);
+
+    // Hand it to the kernel right away; the rest waits for POLLOUT
+    if (connState != MQTT_LINUX_CONNECTING) flushOutput();
+    return true;
+}
+
+bool LinuxMqttClient::subscribe(const char* topic) {
+    if (connState == MQTT_LINUX_DISCONNECTED) return false;
+
+    if (!beginPacket(MQTT_SUBSCRIBE, 2 + 2 + strlen(topic) + 1)) return false;
+    uint8_t packetId[2] = { (uint8_t)(nextPacketId >> 8), (uint8_t)(nextPacketId & 0xFF) };
+    if (++nextPacketId == 0) nextPacketId = 1;
+    append(packetId, sizeof(packetId));
+    appendString(topic);
+    uint8_t qos = 0;
+    append(&qos, 1);
+
+    if (connState != MQTT_LINUX_CONNECTING) flushOutput();
+    return true;
+}
+
+// Private methods
+
+bool LinuxMqttClient::openSocket() {
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    // Name resolution is the one blocking step; brokers are normally given
+    // as an IP address or a name served from /etc/hosts or the local resolver
+    struct addrinfo* result = nullptr;
+    int err = getaddrinfo(host, service, &hints, &result);
+    if (err != 0) {
+        fprintf(stderr, "MQTT: cannot resolve %s: %s\n", host, gai_strerror(err));
+        return false;
+    }
+
+    for (struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            connState = MQTT_LINUX_WAIT_CONNACK;
+            break;
+        }
+        if (errno == EINPROGRESS) {
+            connState = MQTT_LINUX_CONNECTING;
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        fprintf(stderr, "MQTT: cannot connect to %s:%u: %s\n", host, port, strerror(errno));
+        return false;
+    }
+
+    connectStarted = millis();
+    lastInbound = lastOutbound = connectStarted;
+    pingOutstanding = false;
+    inLength = 0;
+    skipLength = 0;
+    return true;
+}
+
+void LinuxMqttClient::closeSocket() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    connState = MQTT_LINUX_DISCONNECTED;
+    outLength = 0;
+    inLength = 0;
+    skipLength = 0;
+}
+
+// Finish a non-blocking connect; false while it is still in progress
+bool LinuxMqttClient::checkConnect() {
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    if (poll(&pfd, 1, 0) <= 0) return false;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        fprintf(stderr, "MQTT: cannot connect to %s:%u: %s\n", host, port, strerror(error ? error : errno));
+        closeSocket();
+        return false;
+    }
+
+    connState = MQTT_LINUX_WAIT_CONNACK;
+    return flushOutput();
+}
+
+bool LinuxMqttClient::flushOutput() {
+    if (outLength == 0 || connState == MQTT_LINUX_CONNECTING) return true;
+
+    ssize_t n = send(fd, outBuffer, outLength, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return true;
+        fprintf(stderr, "MQTT: write failed: %s\n", strerror(errno));
+        closeSocket();
+        return false;
+    }
+
+    outLength -= n;
+    if (outLength > 0) memmove(outBuffer, outBuffer + n, outLength);
+    lastOutbound = millis();
+    return true;
+}
+
+bool LinuxMqttClient::readInput() {
+    uint8_t chunk[512];
+
+    while (true) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n == 0) {
+            fprintf(stderr, "MQTT: broker closed the connection\n");
+            closeSocket();
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return true;
+            fprintf(stderr, "MQTT: read failed: %s\n", strerror(errno));
+            closeSocket();
+            return false;
+        }
+        lastInbound = millis();
+
+        for (ssize_t i = 0; i < n; ) {
+            if (skipLength > 0) {
+                size_t take = (size_t)(n - i) < skipLength ? (size_t)(n - i) : skipLength;
+                skipLength -= take;
+                i += take;
+                continue;
+            }
+            inBuffer[inLength++] = chunk[i++];
+
+            // Fixed header: type byte plus 1-4 bytes of remaining length
+            size_t remaining = 0;
+            size_t headerLength = 0;
+            for (size_t k = 1; k < inLength && k <= 4; k++) {
+                remaining |= (size_t)(inBuffer[k] & 0x7F) << (7 * (k - 1));
+                if ((inBuffer[k] & 0x80) == 0) {
+                    headerLength = k + 1;
+                    break;
+                }
+            }
+            if (headerLength == 0) {
+                if (inLength >= 5 || inLength >= inSize) {
+                    fprintf(stderr, "MQTT: malformed packet from broker\n");
+                    closeSocket();
+                    return false;
+                }
+                continue;
+            }
+
+            if (headerLength + remaining > inSize) {
+                // Too large for the buffer, drop it like PubSubClient does
+                skipLength = remaining - (inLength - headerLength);
+                inLength = 0;
+                continue;
+            }
+            if (inLength == headerLength + remaining) {
+                inLength = 0;
+                handlePacket(inBuffer, headerLength + remaining, headerLength);
+                if (connState == MQTT_LINUX_DISCONNECTED) return false;
+            }
+        }
+    }
+}
+
+void LinuxMqttClient::handlePacket(const uint8_t* packet, size_t length, size_t headerLength) {
+    switch (packet[0] & 0xF0) {
+        case MQTT_CONNACK:
+            if (length < headerLength + 2 || packet[headerLength + 1] != 0) {
+                fprintf(stderr, "MQTT: broker refused the connection (code %d)\n",
+                        length >= headerLength + 2 ? packet[headerLength + 1] : -1);
+                closeSocket();
+                return;
+            }
+            connState = MQTT_LINUX_CONNECTED;
+            printf("MQTT: connected to %s:%u\n", host, port);
+            break;
+
+        case MQTT_PINGRESP:
+            pingOutstanding = false;
+            break;
+
+        case MQTT_PUBLISH: {
+            if (callback == nullptr || length < headerLength + 2) break;
+            size_t topicLength = (packet[headerLength] << 8) | packet[headerLength + 1];
+            size_t offset = headerLength + 2 + topicLength;
+            if ((packet[0] & 0x06) != 0) offset += 2;  // Packet identifier for QoS > 0
+            if (offset > length) break;
+
+            // The topic is passed NUL terminated, as PubSubClient does
+            char topic[256];
+            if (topicLength >= sizeof(topic)) break;
+            memcpy(topic, packet + headerLength + 2, topicLength);
+            topic[topicLength] = '\0';
+            callback(topic, (uint8_t*)packet + offset, length - offset);
+            break;
+        }
+
+        default:
+            // SUBACK and anything else QoS 0 does not need
+            break;
+    }
+}
+
+// Reserve space for a whole packet and write its fixed header
+bool LinuxMqttClient::beginPacket(uint8_t header, size_t remaining) {
+    uint8_t fixed[5];
+    size_t fixedLength = 0;
+    fixed[fixedLength++] = header;
+    size_t value = remaining;
+    do {
+        uint8_t digit = value & 0x7F;
+        value >>= 7;
+        if (value > 0) digit |= 0x80;
+        fixed[fixedLength++] = digit;
+    } while (value > 0 && fixedLength < sizeof(fixed));
+
+    if (outLength + fixedLength + remaining > MQTT_LINUX_OUTPUT_SIZE) return false;
+    append(fixed, fixedLength);
+    return true;
+}
+
+void LinuxMqttClient::append(const void* data, size_t length) {
+    if (length == 0) return;
+    memcpy(outBuffer + outLength, data, length);
+    outLength += length;
+}
+
+void LinuxMqttClient::appendString(const char* str) {
+    size_t length = strlen(str);
+    uint8_t prefix[2] = { (uint8_t)(length >> 8), (uint8_t)(length & 0xFF) };
+    append(prefix, sizeof(prefix));
+    append(str, length);
+}
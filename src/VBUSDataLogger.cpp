@@ -4,25 +4,87 @@
 
 #include "VBUSDataLogger.h"
 
+// Binary export geometry; records are stored in export layout already
+static const uint16_t BINARY_FIXED_HEADER_SIZE = 18;
+static const uint16_t BINARY_DESCRIPTOR_SIZE = 8;
+static const uint8_t BINARY_MAX_CHANNELS = 6;
+static const uint16_t BINARY_MAX_RECORD_SIZE = 4 + VBUSLOG_MAX_TEMPS * 2 + VBUSLOG_MAX_PUMPS +
+                                               (VBUSLOG_MAX_RELAYS + 7) / 8 + 2 + 2 + 1;
+
+// Little-endian helpers for the packed records and binary export
+static void _putU16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = (value >> 8) & 0xFF;
+}
+
+static void _putU32(uint8_t* out, uint32_t value) {
+  out[0] = value & 0xFF;
+  out[1] = (value >> 8) & 0xFF;
+  out[2] = (value >> 16) & 0xFF;
+  out[3] = (value >> 24) & 0xFF;
+}
+
+static void _putFloat(uint8_t* out, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  _putU32(out, bits);
+}
+
+static uint16_t _getU16(const uint8_t* in) {
+  return (uint16_t)in[0] | ((uint16_t)in[1] << 8);
+}
+
+static uint32_t _getU32(const uint8_t* in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) |
+         ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// Temperatures are stored in 0.1 °C steps
+static int16_t _encodeTemp(float temp) {
+  if (!(temp > -99.0 && temp < 999.0)) return VBUSLOG_TEMP_INVALID;
+  return (int16_t)(temp * 10.0f + (temp < 0 ? -0.5f : 0.5f));
+}
+
 VBUSDataLogger::VBUSDataLogger(VBUSDecoder* decoder, uint16_t bufferSize) :
   _decoder(decoder),
+  _storage(nullptr),
   _bufferSize(bufferSize),
   _writeIndex(0),
   _count(0),
   _logInterval(300),  // 5 minutes default
   _lastLog(0),
-  _paused(false)
+  _paused(false),
+  _schemaFixed(false),
+  _mode(LOG_MODE_INTERVAL),
+  _pumpDeadband(5),     // 5 % pump speed
+  _maxGap(3600),        // Heartbeat at least once per hour
+  _lastFrameCount(0),
+  _clock(nullptr)
 {
-  _buffer = new DataPoint[_bufferSize];
+  // Storage is allocated once the schema is known
+  _applySchema(0, 0, 0, false);
+  for (uint8_t i = 0; i < VBUSLOG_MAX_TEMPS; i++) {
+    _tempDeadband[i] = 0.5;  // 0.5 °C
+  }
 }
 
 VBUSDataLogger::~VBUSDataLogger() {
-  delete[] _buffer;
+  delete[] _storage;
 }
 
 void VBUSDataLogger::begin() {
+  if (!_schemaFixed) {
+    uint16_t recordSize = _schema.recordSize;
+    _deriveSchema();
+    // The decoder reports other channels than at allocation time
+    if (_schema.recordSize != recordSize) {
+      delete[] _storage;
+      _storage = nullptr;
+    }
+  }
+  _ensureStorage();
   clear();
-  _lastLog = millis();
+  _lastLog = VBUSClock::now();
 }
 
 void VBUSDataLogger::setLogInterval(uint32_t intervalSeconds) {
@@ -31,18 +93,90 @@ void VBUSDataLogger::setLogInterval(uint32_t intervalSeconds) {
 
 void VBUSDataLogger::setMaxDataPoints(uint16_t maxPoints) {
   if (maxPoints != _bufferSize) {
-    delete[] _buffer;
+    delete[] _storage;
+    _storage = nullptr;
     _bufferSize = maxPoints;
-    _buffer = new DataPoint[_bufferSize];
+    _ensureStorage();
     clear();
   }
 }
 
+// Fix the record layout instead of deriving it from the decoder.
+// Changing the layout discards all recorded points.
+void VBUSDataLogger::setSchema(uint8_t tempCount, uint8_t pumpCount, uint8_t relayCount, bool kmBus) {
+  _schemaFixed = true;
+  delete[] _storage;
+  _storage = nullptr;
+  _applySchema(tempCount, pumpCount, relayCount, kmBus);
+  _ensureStorage();
+  clear();
+}
+
+LogSchema VBUSDataLogger::getSchema() {
+  return _schema;
+}
+
+uint32_t VBUSDataLogger::getLogInterval() {
+  return _logInterval;
+}
+
+void VBUSDataLogger::setClock(LogClock clock) {
+  _clock = clock;
+}
+
+void VBUSDataLogger::setDecoder(VBUSDecoder* decoder) {
+  _decoder = decoder;
+  _lastFrameCount = 0;
+  
+  // Nothing recorded yet: the schema follows the new decoder
+  if (_storage == nullptr && !_schemaFixed) {
+    _deriveSchema();
+    _ensureStorage();
+  }
+}
+
+void VBUSDataLogger::setLogMode(LogMode mode) {
+  _mode = mode;
+  _lastFrameCount = _decoder ? _decoder->getFrameCount() : 0;
+}
+
+LogMode VBUSDataLogger::getLogMode() {
+  return _mode;
+}
+
+void VBUSDataLogger::setTemperatureDeadband(float deadband) {
+  for (uint8_t i = 0; i < VBUSLOG_MAX_TEMPS; i++) {
+    _tempDeadband[i] = deadband;
+  }
+}
+
+void VBUSDataLogger::setTemperatureDeadband(uint8_t channel, float deadband) {
+  if (channel < VBUSLOG_MAX_TEMPS) {
+    _tempDeadband[channel] = deadband;
+  }
+}
+
+void VBUSDataLogger::setPumpDeadband(uint8_t deadband) {
+  _pumpDeadband = deadband;
+}
+
+void VBUSDataLogger::setMaxGap(uint32_t seconds) {
+  _maxGap = seconds;
+}
+
 void VBUSDataLogger::loop() {
   if (_paused) return;
-  if (!_decoder->isReady()) return;
+  if (_decoder == nullptr || !_decoder->isReady()) return;
+  
+  if (_mode == LOG_MODE_CHANGE) {
+    // Nothing to compare until the decoder has produced a new frame
+    if (_decoder->getFrameCount() != _lastFrameCount) {
+      onFrame();
+    }
+    return;
+  }
   
-  uint32_t now = millis();
+  uint32_t now = VBUSClock::now();
   if (now - _lastLog >= (_logInterval * 1000)) {
     logNow();
     _lastLog = now;
@@ -50,49 +184,41 @@ void VBUSDataLogger::loop() {
 }
 
 void VBUSDataLogger::logNow() {
-  if (!_decoder->isReady()) return;
-  
-  DataPoint point;
-  point.timestamp = millis() / 1000;  // Convert to seconds
+  if (_decoder == nullptr || !_decoder->isReady()) return;
+  if (!_ensureStorage()) return;
   
-  // Log temperatures
-  uint8_t tempCount = min((uint8_t)8, _decoder->getTempNum());
-  for (uint8_t i = 0; i < tempCount; i++) {
-    point.temperatures[i] = _decoder->getTemp(i);
-  }
-  for (uint8_t i = tempCount; i < 8; i++) {
-    point.temperatures[i] = -999.0;  // Invalid marker
-  }
+  uint8_t record[BINARY_MAX_RECORD_SIZE];
+  _sampleRecord(record);
+  _addRecord(record);
+}
+
+// Record the current frame if it moved any channel beyond its deadband,
+// toggled a relay, or the heartbeat gap has elapsed
+void VBUSDataLogger::onFrame() {
+  if (_decoder == nullptr) return;
+  _lastFrameCount = _decoder->getFrameCount();
+  if (_paused) return;
+  if (_mode != LOG_MODE_CHANGE) return;
+  if (!_decoder->isReady()) return;
+  if (!_ensureStorage()) return;
   
-  // Log pump power
-  uint8_t pumpCount = min((uint8_t)4, _decoder->getPumpNum());
-  for (uint8_t i = 0; i < pumpCount; i++) {
-    point.pumps[i] = _decoder->getPump(i);
-  }
-  for (uint8_t i = pumpCount; i < 4; i++) {
-    point.pumps[i] = 0;
-  }
+  uint8_t record[BINARY_MAX_RECORD_SIZE];
+  _sampleRecord(record);
   
-  // Log relay states
-  uint8_t relayCount = min((uint8_t)4, _decoder->getRelayNum());
-  for (uint8_t i = 0; i < relayCount; i++) {
-    point.relays[i] = _decoder->getRelay(i);
+  if (_count == 0 ||
+      _getU32(record) - _timestampAt(_count - 1) >= _maxGap ||
+      _hasSignificantChange(record, _recordAt(_count - 1))) {
+    _addRecord(record);
+    _lastLog = VBUSClock::now();
   }
-  for (uint8_t i = relayCount; i < 4; i++) {
-    point.relays[i] = false;
-  }
-  
-  // Log error mask and heat quantity
-  point.errorMask = _decoder->getErrorMask();
-  point.heatQuantity = _decoder->getHeatQuantity();
-  
-  _addDataPoint(point);
 }
 
 void VBUSDataLogger::clear() {
   _writeIndex = 0;
   _count = 0;
-  memset(_buffer, 0, sizeof(DataPoint) * _bufferSize);
+  if (_storage != nullptr) {
+    memset(_storage, 0, (size_t)_schema.recordSize * _bufferSize);
+  }
 }
 
 void VBUSDataLogger::pause() {
@@ -101,7 +227,7 @@ void VBUSDataLogger::pause() {
 
 void VBUSDataLogger::resume() {
   _paused = false;
-  _lastLog = millis();
+  _lastLog = VBUSClock::now();
 }
 
 bool VBUSDataLogger::isPaused() {
@@ -114,22 +240,57 @@ uint16_t VBUSDataLogger::getDataPointCount() {
 
 DataPoint* VBUSDataLogger::getDataPoint(uint16_t index) {
   if (index >= _count) return nullptr;
-  return &_buffer[_getCircularIndex(index)];
+  _unpackRecord(_recordAt(index), _scratch);
+  return &_scratch;
 }
 
 DataPoint* VBUSDataLogger::getLatestDataPoint() {
   if (_count == 0) return nullptr;
-  uint16_t index = (_writeIndex + _bufferSize - 1) % _bufferSize;
-  return &_buffer[index];
+  return getDataPoint(_count - 1);
 }
 
 DataPoint* VBUSDataLogger::getOldestDataPoint() {
   if (_count == 0) return nullptr;
-  if (_count < _bufferSize) {
-    return &_buffer[0];
-  } else {
-    return &_buffer[_writeIndex];
+  return getDataPoint(0);
+}
+
+uint16_t VBUSDataLogger::getSeries(LogChannelKind kind, uint8_t channel, uint32_t startTime, uint32_t endTime,
+                                   uint32_t step, LogBucket* buckets, uint16_t maxBuckets) {
+  if (buckets == nullptr || maxBuckets == 0 || step == 0 || _storage == nullptr) return 0;
+  
+  uint16_t written = 0;
+  LogBucket* bucket = nullptr;
+  float sum = 0;
+  
+  // Records are in time order: find the first one, then a single pass
+  for (uint16_t i = _lowerBound(startTime); i < _count; i++) {
+    const uint8_t* record = _recordAt(i);
+    uint32_t timestamp = _getU32(record);
+    if (timestamp > endTime) break;
+    
+    uint32_t bucketStart = timestamp - timestamp % step;
+    if (bucket == nullptr || bucket->timestamp != bucketStart) {
+      if (bucket != nullptr && bucket->samples > 0) bucket->avg = sum / bucket->samples;
+      if (written == maxBuckets) return written;
+      bucket = &buckets[written++];
+      bucket->timestamp = bucketStart;
+      bucket->samples = 0;
+      bucket->min = NAN;
+      bucket->max = NAN;
+      bucket->avg = NAN;
+      sum = 0;
+    }
+    
+    float value;
+    if (!_channelValue(record, kind, channel, value)) continue;
+    if (bucket->samples == 0 || value < bucket->min) bucket->min = value;
+    if (bucket->samples == 0 || value > bucket->max) bucket->max = value;
+    bucket->samples++;
+    sum += value;
   }
+  if (bucket != nullptr && bucket->samples > 0) bucket->avg = sum / bucket->samples;
+  
+  return written;
 }
 
 DataStats VBUSDataLogger::getStatistics(uint32_t startTime, uint32_t endTime) {
@@ -137,50 +298,55 @@ DataStats VBUSDataLogger::getStatistics(uint32_t startTime, uint32_t endTime) {
   memset(&stats, 0, sizeof(DataStats));
   
   // Initialize min/max
-  for (uint8_t i = 0; i < 8; i++) {
+  for (uint8_t i = 0; i < _schema.tempCount; i++) {
     stats.tempMin[i] = 999.0;
     stats.tempMax[i] = -999.0;
   }
   
   uint16_t validCount = 0;
-  float tempSum[8] = {0};
+  float tempSum[VBUSLOG_MAX_TEMPS] = {0};
   
+  // Work on the packed records directly, no unpacking needed
   for (uint16_t i = 0; i < _count; i++) {
-    DataPoint* point = getDataPoint(i);
-    if (point->timestamp >= startTime && point->timestamp <= endTime) {
+    const uint8_t* record = _recordAt(i);
+    uint32_t timestamp = _getU32(record);
+    if (timestamp >= startTime && timestamp <= endTime) {
       validCount++;
       
       // Temperature statistics
-      for (uint8_t t = 0; t < 8; t++) {
-        if (point->temperatures[t] > -99.0 && point->temperatures[t] < 999.0) {
-          if (point->temperatures[t] < stats.tempMin[t]) {
-            stats.tempMin[t] = point->temperatures[t];
+      for (uint8_t t = 0; t < _schema.tempCount; t++) {
+        int16_t raw = (int16_t)_getU16(record + 4 + t * 2);
+        if (raw != VBUSLOG_TEMP_INVALID) {
+          float temp = raw / 10.0f;
+          if (temp < stats.tempMin[t]) {
+            stats.tempMin[t] = temp;
           }
-          if (point->temperatures[t] > stats.tempMax[t]) {
-            stats.tempMax[t] = point->temperatures[t];
+          if (temp > stats.tempMax[t]) {
+            stats.tempMax[t] = temp;
           }
-          tempSum[t] += point->temperatures[t];
+          tempSum[t] += temp;
         }
       }
       
-      // Runtime statistics (approximate based on interval)
-      for (uint8_t p = 0; p < 4; p++) {
-        stats.pumpRuntime[p] += (point->pumps[p] * _logInterval) / 100;
+      // Runtime statistics (approximate based on time covered by the point)
+      uint32_t duration = _pointDuration(i);
+      for (uint8_t p = 0; p < _schema.pumpCount; p++) {
+        stats.pumpRuntime[p] += (record[_pumpOffset + p] * duration) / 100;
       }
-      for (uint8_t r = 0; r < 4; r++) {
-        if (point->relays[r]) {
-          stats.relayRuntime[r] += _logInterval;
+      for (uint8_t r = 0; r < _schema.relayCount; r++) {
+        if (record[_relayOffset + r / 8] & (1 << (r % 8))) {
+          stats.relayRuntime[r] += duration;
         }
       }
       
       // Heat accumulation
-      stats.totalHeat += point->heatQuantity;
+      stats.totalHeat += _getU16(record + _errorOffset + 2);
     }
   }
   
   // Calculate averages
   if (validCount > 0) {
-    for (uint8_t t = 0; t < 8; t++) {
+    for (uint8_t t = 0; t < _schema.tempCount; t++) {
       stats.tempAvg[t] = tempSum[t] / validCount;
     }
   }
@@ -189,7 +355,7 @@ DataStats VBUSDataLogger::getStatistics(uint32_t startTime, uint32_t endTime) {
 }
 
 DataStats VBUSDataLogger::getStatisticsLastHours(uint8_t hours) {
-  uint32_t now = millis() / 1000;
+  uint32_t now = _now();
   uint32_t startTime = now - (hours * 3600);
   return getStatistics(startTime, now);
 }
@@ -198,33 +364,51 @@ DataStats VBUSDataLogger::getStatisticsAll() {
   return getStatistics(0, 0xFFFFFFFF);
 }
 
+// Only channels in the schema are exported; unavailable sensors are left empty
 String VBUSDataLogger::exportCSV(uint32_t startTime, uint32_t endTime) {
-  String csv = "Timestamp,Temp0,Temp1,Temp2,Temp3,Temp4,Temp5,Temp6,Temp7,";
-  csv += "Pump0,Pump1,Pump2,Pump3,Relay0,Relay1,Relay2,Relay3,ErrorMask,HeatQuantity\n";
+  String csv = "Timestamp,";
+  for (uint8_t t = 0; t < _schema.tempCount; t++) {
+    csv += "Temp" + String(t) + ",";
+  }
+  for (uint8_t p = 0; p < _schema.pumpCount; p++) {
+    csv += "Pump" + String(p) + ",";
+  }
+  for (uint8_t r = 0; r < _schema.relayCount; r++) {
+    csv += "Relay" + String(r) + ",";
+  }
+  if (_schema.kmBus) {
+    csv += "KMMode,";
+  }
+  csv += "ErrorMask,HeatQuantity\n";
   
   for (uint16_t i = 0; i < _count; i++) {
+    if (_timestampAt(i) < startTime || _timestampAt(i) > endTime) continue;
     DataPoint* point = getDataPoint(i);
-    if (point->timestamp >= startTime && point->timestamp <= endTime) {
-      csv += String(point->timestamp) + ",";
-      
-      // Temperatures
-      for (uint8_t t = 0; t < 8; t++) {
-        csv += String(point->temperatures[t], 2) + ",";
-      }
-      
-      // Pumps
-      for (uint8_t p = 0; p < 4; p++) {
-        csv += String(point->pumps[p]) + ",";
+    csv += String(point->timestamp) + ",";
+    
+    // Temperatures
+    for (uint8_t t = 0; t < _schema.tempCount; t++) {
+      if (!isnan(point->temperatures[t])) {
+        csv += String(point->temperatures[t], 1);
       }
-      
-      // Relays
-      for (uint8_t r = 0; r < 4; r++) {
-        csv += String(point->relays[r]) + ",";
-      }
-      
-      csv += String(point->errorMask) + ",";
-      csv += String(point->heatQuantity) + "\n";
+      csv += ",";
     }
+    
+    // Pumps
+    for (uint8_t p = 0; p < _schema.pumpCount; p++) {
+      csv += String(point->pumps[p]) + ",";
+    }
+    
+    // Relays
+    for (uint8_t r = 0; r < _schema.relayCount; r++) {
+      csv += String(point->relays[r]) + ",";
+    }
+    
+    if (_schema.kmBus) {
+      csv += String(point->kmMode) + ",";
+    }
+    csv += String(point->errorMask) + ",";
+    csv += String(point->heatQuantity) + "\n";
   }
   
   return csv;
@@ -235,46 +419,251 @@ String VBUSDataLogger::exportJSON(uint32_t startTime, uint32_t endTime) {
   bool first = true;
   
   for (uint16_t i = 0; i < _count; i++) {
+    if (_timestampAt(i) < startTime || _timestampAt(i) > endTime) continue;
     DataPoint* point = getDataPoint(i);
-    if (point->timestamp >= startTime && point->timestamp <= endTime) {
-      if (!first) json += ",";
-      first = false;
-      
-      json += "{\"timestamp\":" + String(point->timestamp) + ",";
-      json += "\"temperatures\":[";
-      for (uint8_t t = 0; t < 8; t++) {
-        if (t > 0) json += ",";
-        json += String(point->temperatures[t], 2);
-      }
-      json += "],\"pumps\":[";
-      for (uint8_t p = 0; p < 4; p++) {
-        if (p > 0) json += ",";
-        json += String(point->pumps[p]);
-      }
-      json += "],\"relays\":[";
-      for (uint8_t r = 0; r < 4; r++) {
-        if (r > 0) json += ",";
-        json += point->relays[r] ? "true" : "false";
+    if (!first) json += ",";
+    first = false;
+    
+    json += "{\"timestamp\":" + String(point->timestamp) + ",";
+    json += "\"temperatures\":[";
+    for (uint8_t t = 0; t < _schema.tempCount; t++) {
+      if (t > 0) json += ",";
+      if (isnan(point->temperatures[t])) {
+        json += "null";
+      } else {
+        json += String(point->temperatures[t], 1);
       }
-      json += "],\"errorMask\":" + String(point->errorMask) + ",";
-      json += "\"heatQuantity\":" + String(point->heatQuantity) + "}";
     }
+    json += "],\"pumps\":[";
+    for (uint8_t p = 0; p < _schema.pumpCount; p++) {
+      if (p > 0) json += ",";
+      json += String(point->pumps[p]);
+    }
+    json += "],\"relays\":[";
+    for (uint8_t r = 0; r < _schema.relayCount; r++) {
+      if (r > 0) json += ",";
+      json += point->relays[r] ? "true" : "false";
+    }
+    json += "],";
+    if (_schema.kmBus) {
+      json += "\"kmMode\":" + String(point->kmMode) + ",";
+    }
+    json += "\"errorMask\":" + String(point->errorMask) + ",";
+    json += "\"heatQuantity\":" + String(point->heatQuantity) + "}";
   }
   
   json += "]}";
   return json;
 }
 
+// The header is encoded into one stack array sized for the widest schema and
+// written at once. Stored records already use the export layout, so they
+// are copied verbatim
+size_t VBUSDataLogger::exportBinary(uint32_t startTime, uint32_t endTime, Stream* out) {
+  if (out == nullptr) return 0;
+
+  size_t written = 0;
+  uint16_t count = _countInRange(startTime, endTime);
+  uint8_t header[BINARY_FIXED_HEADER_SIZE + BINARY_MAX_CHANNELS * BINARY_DESCRIPTOR_SIZE];
+  uint16_t headerLen = _encodeBinaryHeader(header, count);
+  written += out->write(header, headerLen);
+
+  for (uint16_t i = 0; i < _count; i++) {
+    uint32_t timestamp = _timestampAt(i);
+    if (timestamp >= startTime && timestamp <= endTime) {
+      written += out->write(_recordAt(i), _schema.recordSize);
+    }
+  }
+
+  return written;
+}
+
+size_t VBUSDataLogger::exportBinary(uint32_t startTime, uint32_t endTime, uint8_t* buffer, size_t bufferSize) {
+  if (buffer == nullptr) return 0;
+
+  uint16_t count = _countInRange(startTime, endTime);
+  size_t required = _binaryHeaderSize() + (size_t)count * _schema.recordSize;
+  if (bufferSize < required) return 0;
+
+  size_t offset = _encodeBinaryHeader(buffer, count);
+  for (uint16_t i = 0; i < _count; i++) {
+    uint32_t timestamp = _timestampAt(i);
+    if (timestamp >= startTime && timestamp <= endTime) {
+      memcpy(buffer + offset, _recordAt(i), _schema.recordSize);
+      offset += _schema.recordSize;
+    }
+  }
+
+  return offset;
+}
+
+size_t VBUSDataLogger::getBinaryExportSize(uint32_t startTime, uint32_t endTime) {
+  return _binaryHeaderSize() + (size_t)_countInRange(startTime, endTime) * _schema.recordSize;
+}
+
 // Private helper methods
 
-void VBUSDataLogger::_addDataPoint(const DataPoint& point) {
-  _buffer[_writeIndex] = point;
+// Widest channel counts reported by the decoder and any known participant
+void VBUSDataLogger::_deriveSchema() {
+  if (_decoder == nullptr) return;
+  
+  uint8_t temps = _decoder->getTempNum();
+  uint8_t pumps = _decoder->getPumpNum();
+  uint8_t relays = _decoder->getRelayNum();
+  
+  for (uint8_t i = 0; i < _decoder->getParticipantCount(); i++) {
+    const BusParticipant* participant = _decoder->getParticipant(i);
+    if (participant == nullptr) continue;
+    if (participant->tempChannels > temps) temps = participant->tempChannels;
+    if (participant->pumpChannels > pumps) pumps = participant->pumpChannels;
+    if (participant->relayChannels > relays) relays = participant->relayChannels;
+  }
+  
+  _applySchema(temps, pumps, relays, _decoder->getProtocol() == PROTOCOL_KM);
+}
+
+void VBUSDataLogger::_applySchema(uint8_t tempCount, uint8_t pumpCount, uint8_t relayCount, bool kmBus) {
+  _schema.tempCount = min(tempCount, (uint8_t)VBUSLOG_MAX_TEMPS);
+  _schema.pumpCount = min(pumpCount, (uint8_t)VBUSLOG_MAX_PUMPS);
+  _schema.relayCount = min(relayCount, (uint8_t)VBUSLOG_MAX_RELAYS);
+  _schema.kmBus = kmBus;
+  
+  // timestamp, temperatures, pumps, relay bits, error mask, heat quantity, KM mode
+  _pumpOffset = 4 + _schema.tempCount * 2;
+  _relayOffset = _pumpOffset + _schema.pumpCount;
+  _errorOffset = _relayOffset + (_schema.relayCount + 7) / 8;
+  _schema.recordSize = _errorOffset + 2 + 2 + (kmBus ? 1 : 0);
+}
+
+// Allocate record storage. If begin() ran before the decoder reported any
+// channels, the schema is derived from the first decoded frame instead.
+bool VBUSDataLogger::_ensureStorage() {
+  if (_storage != nullptr) return true;
+  
+  if (!_schemaFixed && _schema.tempCount == 0 && _schema.pumpCount == 0 && _schema.relayCount == 0) {
+    if (_decoder == nullptr || !_decoder->isReady()) return false;
+    _deriveSchema();
+    if (_schema.tempCount == 0 && _schema.pumpCount == 0 && _schema.relayCount == 0) return false;
+  }
+  
+  _storage = new uint8_t[(size_t)_schema.recordSize * _bufferSize];
+  clear();
+  return true;
+}
+
+void VBUSDataLogger::_addRecord(const uint8_t* record) {
+  memcpy(_storage + (size_t)_writeIndex * _schema.recordSize, record, _schema.recordSize);
   _writeIndex = (_writeIndex + 1) % _bufferSize;
   if (_count < _bufferSize) {
     _count++;
   }
 }
 
+// Sample the decoder straight into a packed record
+void VBUSDataLogger::_sampleRecord(uint8_t* record) {
+  _putU32(record, _now());
+  
+  // Temperatures; sensors the decoder does not report are marked unavailable
+  uint8_t tempCount = min(_schema.tempCount, _decoder->getTempNum());
+  for (uint8_t i = 0; i < _schema.tempCount; i++) {
+    int16_t raw = i < tempCount ? _encodeTemp(_decoder->getTemp(i)) : VBUSLOG_TEMP_INVALID;
+    _putU16(record + 4 + i * 2, (uint16_t)raw);
+  }
+  
+  // Pump power
+  uint8_t pumpCount = min(_schema.pumpCount, _decoder->getPumpNum());
+  for (uint8_t i = 0; i < _schema.pumpCount; i++) {
+    record[_pumpOffset + i] = i < pumpCount ? _decoder->getPump(i) : 0;
+  }
+  
+  // Relay states, packed LSB first
+  uint8_t relayCount = min(_schema.relayCount, _decoder->getRelayNum());
+  memset(record + _relayOffset, 0, _errorOffset - _relayOffset);
+  for (uint8_t i = 0; i < relayCount; i++) {
+    if (_decoder->getRelay(i)) {
+      record[_relayOffset + i / 8] |= (1 << (i % 8));
+    }
+  }
+  
+  // Error mask, heat quantity and KM-Bus mode
+  _putU16(record + _errorOffset, _decoder->getErrorMask());
+  _putU16(record + _errorOffset + 2, _decoder->getHeatQuantity());
+  if (_schema.kmBus) {
+    record[_errorOffset + 4] = _decoder->getKMBusMode();
+  }
+}
+
+void VBUSDataLogger::_unpackRecord(const uint8_t* record, DataPoint& point) {
+  memset(&point, 0, sizeof(DataPoint));
+  point.timestamp = _getU32(record);
+  
+  for (uint8_t t = 0; t < _schema.tempCount; t++) {
+    int16_t raw = (int16_t)_getU16(record + 4 + t * 2);
+    point.temperatures[t] = raw == VBUSLOG_TEMP_INVALID ? NAN : raw / 10.0f;
+  }
+  for (uint8_t p = 0; p < _schema.pumpCount; p++) {
+    point.pumps[p] = record[_pumpOffset + p];
+  }
+  for (uint8_t r = 0; r < _schema.relayCount; r++) {
+    point.relays[r] = (record[_relayOffset + r / 8] & (1 << (r % 8))) != 0;
+  }
+  
+  point.errorMask = _getU16(record + _errorOffset);
+  point.heatQuantity = _getU16(record + _errorOffset + 2);
+  if (_schema.kmBus) {
+    point.kmMode = record[_errorOffset + 4];
+  }
+}
+
+bool VBUSDataLogger::_hasSignificantChange(const uint8_t* record, const uint8_t* last) {
+  for (uint8_t i = 0; i < _schema.tempCount; i++) {
+    int16_t raw = (int16_t)_getU16(record + 4 + i * 2);
+    int16_t lastRaw = (int16_t)_getU16(last + 4 + i * 2);
+    // A sensor appearing or disappearing always counts
+    if ((raw == VBUSLOG_TEMP_INVALID) != (lastRaw == VBUSLOG_TEMP_INVALID)) return true;
+    int32_t delta = (int32_t)raw - (int32_t)lastRaw;
+    if (delta < 0) delta = -delta;
+    if (delta > 0 && delta / 10.0f >= _tempDeadband[i]) return true;
+  }
+  
+  for (uint8_t i = 0; i < _schema.pumpCount; i++) {
+    uint8_t pump = record[_pumpOffset + i];
+    uint8_t lastPump = last[_pumpOffset + i];
+    int16_t delta = (int16_t)pump - (int16_t)lastPump;
+    if (delta < 0) delta = -delta;
+    if (delta > 0 && delta >= _pumpDeadband) return true;
+    // Any on/off transition counts, even below the deadband
+    if ((pump == 0) != (lastPump == 0)) return true;
+  }
+  
+  // Relay bits, error mask and KM-Bus mode must match exactly
+  if (memcmp(record + _relayOffset, last + _relayOffset, _errorOffset - _relayOffset) != 0) return true;
+  if (_getU16(record + _errorOffset) != _getU16(last + _errorOffset)) return true;
+  return _schema.kmBus && record[_errorOffset + 4] != last[_errorOffset + 4];
+}
+
+uint8_t* VBUSDataLogger::_recordAt(uint16_t index) {
+  return _storage + (size_t)_getCircularIndex(index) * _schema.recordSize;
+}
+
+uint32_t VBUSDataLogger::_timestampAt(uint16_t index) {
+  return _getU32(_recordAt(index));
+}
+
+// Time span a data point represents, used for runtime statistics
+uint32_t VBUSDataLogger::_pointDuration(uint16_t index) {
+  if (_mode != LOG_MODE_CHANGE) return _logInterval;
+  
+  uint32_t timestamp = _timestampAt(index);
+  if (index + 1 < _count) {
+    return _timestampAt(index + 1) - timestamp;
+  }
+  
+  // Latest point holds until now, bounded by the heartbeat gap
+  uint32_t elapsed = _now() - timestamp;
+  return elapsed < _maxGap ? elapsed : _maxGap;
+}
+
 uint16_t VBUSDataLogger::_getCircularIndex(uint16_t offset) {
   if (_count < _bufferSize) {
     return offset;
@@ -291,3 +680,110 @@ void VBUSDataLogger::_calculateStats(DataStats& stats, uint16_t startIdx, uint16
   (void)startIdx;
   (void)count;
 }
+
+uint16_t VBUSDataLogger::_countInRange(uint32_t startTime, uint32_t endTime) {
+  uint16_t count = 0;
+  for (uint16_t i = 0; i < _count; i++) {
+    uint32_t timestamp = _timestampAt(i);
+    if (timestamp >= startTime && timestamp <= endTime) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// Index of the first point at or after time (binary search)
+uint16_t VBUSDataLogger::_lowerBound(uint32_t time) {
+  uint16_t low = 0;
+  uint16_t high = _count;
+  while (low < high) {
+    uint16_t mid = low + (high - low) / 2;
+    if (_timestampAt(mid) < time) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+// Value of one channel in a packed record; false if it is not recorded or
+// the sensor was unavailable
+bool VBUSDataLogger::_channelValue(const uint8_t* record, LogChannelKind kind, uint8_t channel, float& value) {
+  switch (kind) {
+    case LOG_CHANNEL_TEMPERATURE: {
+      if (channel >= _schema.tempCount) return false;
+      int16_t raw = (int16_t)_getU16(record + 4 + channel * 2);
+      if (raw == VBUSLOG_TEMP_INVALID) return false;
+      value = raw / 10.0f;
+      return true;
+    }
+    case LOG_CHANNEL_PUMP:
+      if (channel >= _schema.pumpCount) return false;
+      value = record[_pumpOffset + channel];
+      return true;
+    case LOG_CHANNEL_RELAY:
+      if (channel >= _schema.relayCount) return false;
+      value = (record[_relayOffset + channel / 8] & (1 << (channel % 8))) ? 1.0f : 0.0f;
+      return true;
+    case LOG_CHANNEL_ERROR_MASK:
+      value = _getU16(record + _errorOffset);
+      return true;
+    case LOG_CHANNEL_HEAT_QUANTITY:
+      value = _getU16(record + _errorOffset + 2);
+      return true;
+    case LOG_CHANNEL_KM_MODE:
+      if (!_schema.kmBus) return false;
+      value = record[_errorOffset + 4];
+      return true;
+  }
+  return false;
+}
+
+uint32_t VBUSDataLogger::_now() {
+  return _clock != nullptr ? _clock() : VBUSClock::now() / 1000;
+}
+
+// Error mask and heat quantity are always present, other kinds only if used
+uint8_t VBUSDataLogger::_binaryChannelCount() {
+  return (_schema.tempCount > 0) + (_schema.pumpCount > 0) + (_schema.relayCount > 0) +
+         2 + (_schema.kmBus ? 1 : 0);
+}
+
+uint16_t VBUSDataLogger::_binaryHeaderSize() {
+  return BINARY_FIXED_HEADER_SIZE + _binaryChannelCount() * BINARY_DESCRIPTOR_SIZE;
+}
+
+// Schema header: magic, version, channel descriptors and record geometry
+uint16_t VBUSDataLogger::_encodeBinaryHeader(uint8_t* out, uint32_t recordCount) {
+  const uint8_t descriptors[BINARY_MAX_CHANNELS][3] = {
+    { LOG_CHANNEL_TEMPERATURE, LOG_ENCODING_INT16, _schema.tempCount },
+    { LOG_CHANNEL_PUMP, LOG_ENCODING_UINT8, _schema.pumpCount },
+    { LOG_CHANNEL_RELAY, LOG_ENCODING_BITS, _schema.relayCount },
+    { LOG_CHANNEL_ERROR_MASK, LOG_ENCODING_UINT16, 1 },
+    { LOG_CHANNEL_HEAT_QUANTITY, LOG_ENCODING_UINT16, 1 },
+    { LOG_CHANNEL_KM_MODE, LOG_ENCODING_UINT8, (uint8_t)(_schema.kmBus ? 1 : 0) }
+  };
+  const float scales[BINARY_MAX_CHANNELS] = { 0.1f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+
+  memcpy(out, VBUSLOG_BINARY_MAGIC, 4);
+  out[4] = VBUSLOG_BINARY_VERSION;
+  out[5] = _binaryChannelCount();
+  _putU16(out + 6, _binaryHeaderSize());
+  _putU16(out + 8, _schema.recordSize);
+  _putU32(out + 10, recordCount);
+  _putU32(out + 14, _logInterval);
+
+  uint8_t* desc = out + BINARY_FIXED_HEADER_SIZE;
+  for (uint8_t i = 0; i < BINARY_MAX_CHANNELS; i++) {
+    if (descriptors[i][2] == 0) continue;  // Unused kinds take no space
+    desc[0] = descriptors[i][0];
+    desc[1] = descriptors[i][1];
+    desc[2] = descriptors[i][2];
+    desc[3] = 0;  // Reserved
+    _putFloat(desc + 4, scales[i]);
+    desc += BINARY_DESCRIPTOR_SIZE;
+  }
+
+  return _binaryHeaderSize();
+}
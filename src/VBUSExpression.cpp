@@ -0,0 +1,472 @@
+/*
+ * Viessmann Multi-Protocol Library - Condition Expression Implementation
+ */
+
+#include "VBUSExpression.h"
+
+// Named variables, matched as whole words
+struct ExpressionName {
+  const char* name;
+  ExpressionVar var;
+  bool isTime;
+};
+
+static const ExpressionName EXPRESSION_NAMES[] = {
+  { "hour", EXPR_VAR_HOUR, true },
+  { "minute", EXPR_VAR_MINUTE, true },
+  { "day", EXPR_VAR_DAY, true },
+  { "time", EXPR_VAR_TIME, true },
+  { "errors", EXPR_VAR_ERRORS, false },
+  { "heat", EXPR_VAR_HEAT, false },
+  { "km.burner", EXPR_VAR_KM_BURNER, false },
+  { "km.mainpump", EXPR_VAR_KM_MAINPUMP, false },
+  { "km.looppump", EXPR_VAR_KM_LOOPPUMP, false },
+  { "km.mode", EXPR_VAR_KM_MODE, false },
+  { "km.boiler", EXPR_VAR_KM_BOILER, false },
+  { "km.hotwater", EXPR_VAR_KM_HOTWATER, false },
+  { "km.outdoor", EXPR_VAR_KM_OUTDOOR, false },
+  { "km.setpoint", EXPR_VAR_KM_SETPOINT, false },
+  { "km.flow", EXPR_VAR_KM_FLOW, false }
+};
+
+static const uint8_t EXPRESSION_NAME_COUNT = sizeof(EXPRESSION_NAMES) / sizeof(EXPRESSION_NAMES[0]);
+
+// Channel arrays of the decoder hold 32 entries
+static const uint8_t EXPRESSION_MAX_CHANNEL = 32;
+
+static bool _isIdentChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+// NAN (unavailable sensor) counts as false
+static bool _truth(float value) {
+  return value == value && value != 0.0f;
+}
+
+VBUSExpression::VBUSExpression() :
+  _codeSize(0),
+  _constCount(0),
+  _valid(false),
+  _usesTime(false),
+  _usesBusData(false),
+  _errorPos(0),
+  _src(nullptr),
+  _pos(0),
+  _depth(0),
+  _nesting(0),
+  _failed(false)
+{
+}
+
+bool VBUSExpression::compile(const char* source) {
+  _codeSize = 0;
+  _constCount = 0;
+  _valid = false;
+  _usesTime = false;
+  _usesBusData = false;
+  _errorPos = 0;
+  _src = source;
+  _pos = 0;
+  _depth = 0;
+  _nesting = 0;
+  _failed = false;
+
+  if (source == nullptr) return false;
+
+  _parseOr();
+  _skipSpace();
+  if (!_failed && _src[_pos] != '\0') {
+    _fail();  // Trailing input
+  }
+
+  _src = nullptr;
+  _valid = !_failed && _codeSize > 0;
+  return _valid;
+}
+
+bool VBUSExpression::isValid() const {
+  return _valid;
+}
+
+uint16_t VBUSExpression::getErrorPosition() const {
+  return _errorPos;
+}
+
+uint8_t VBUSExpression::getCodeSize() const {
+  return _codeSize;
+}
+
+// Stack machine over the compiled program. The stack lives in this frame,
+// its depth was bounded at compile time.
+float VBUSExpression::evaluate(const VBUSDecoder* decoder, uint8_t hour, uint8_t minute, uint8_t dayOfWeek) const {
+  if (!_valid) return NAN;
+
+  float stack[VBUSEXPR_MAX_STACK];
+  uint8_t sp = 0;
+  uint8_t pc = 0;
+
+  while (pc < _codeSize) {
+    uint8_t op = _code[pc++];
+    switch (op) {
+      case EXPR_OP_CONST:
+        stack[sp++] = _consts[_code[pc++]];
+        break;
+
+      case EXPR_OP_TEMP: {
+        float temp = decoder->getTemp(_code[pc++]);
+        stack[sp++] = (temp < -99.0 || temp > 999.0) ? NAN : temp;
+        break;
+      }
+
+      case EXPR_OP_PUMP:
+        stack[sp++] = decoder->getPump(_code[pc++]);
+        break;
+
+      case EXPR_OP_RELAY:
+        stack[sp++] = decoder->getRelay(_code[pc++]) ? 1.0f : 0.0f;
+        break;
+
+      case EXPR_OP_VAR: {
+        float value = 0;
+        switch (_code[pc++]) {
+          case EXPR_VAR_HOUR:        value = hour; break;
+          case EXPR_VAR_MINUTE:      value = minute; break;
+          case EXPR_VAR_DAY:         value = dayOfWeek; break;
+          case EXPR_VAR_TIME:        value = hour * 60 + minute; break;
+          case EXPR_VAR_ERRORS:      value = decoder->getErrorMask(); break;
+          case EXPR_VAR_HEAT:        value = decoder->getHeatQuantity(); break;
+          case EXPR_VAR_KM_BURNER:   value = decoder->getKMBusBurnerStatus() ? 1 : 0; break;
+          case EXPR_VAR_KM_MAINPUMP: value = decoder->getKMBusMainPumpStatus() ? 1 : 0; break;
+          case EXPR_VAR_KM_LOOPPUMP: value = decoder->getKMBusLoopPumpStatus() ? 1 : 0; break;
+          case EXPR_VAR_KM_MODE:     value = decoder->getKMBusMode(); break;
+          case EXPR_VAR_KM_BOILER:   value = decoder->getKMBusBoilerTemp(); break;
+          case EXPR_VAR_KM_HOTWATER: value = decoder->getKMBusHotWaterTemp(); break;
+          case EXPR_VAR_KM_OUTDOOR:  value = decoder->getKMBusOutdoorTemp(); break;
+          case EXPR_VAR_KM_SETPOINT: value = decoder->getKMBusSetpointTemp(); break;
+          case EXPR_VAR_KM_FLOW:     value = decoder->getKMBusDepartureTemp(); break;
+        }
+        stack[sp++] = value;
+        break;
+      }
+
+      case EXPR_OP_NEG:
+        stack[sp - 1] = -stack[sp - 1];
+        break;
+
+      case EXPR_OP_NOT:
+        stack[sp - 1] = _truth(stack[sp - 1]) ? 0.0f : 1.0f;
+        break;
+
+      default: {
+        // Binary operators
+        float b = stack[--sp];
+        float a = stack[sp - 1];
+        float result = 0;
+        switch (op) {
+          case EXPR_OP_ADD: result = a + b; break;
+          case EXPR_OP_SUB: result = a - b; break;
+          case EXPR_OP_MUL: result = a * b; break;
+          case EXPR_OP_DIV: result = (b != 0.0f) ? a / b : NAN; break;
+          case EXPR_OP_AND: result = (_truth(a) && _truth(b)) ? 1.0f : 0.0f; break;
+          case EXPR_OP_OR:  result = (_truth(a) || _truth(b)) ? 1.0f : 0.0f; break;
+          case EXPR_OP_LT:  result = (a < b) ? 1.0f : 0.0f; break;
+          case EXPR_OP_LE:  result = (a <= b) ? 1.0f : 0.0f; break;
+          case EXPR_OP_GT:  result = (a > b) ? 1.0f : 0.0f; break;
+          case EXPR_OP_GE:  result = (a >= b) ? 1.0f : 0.0f; break;
+          case EXPR_OP_EQ:  result = (a == b) ? 1.0f : 0.0f; break;
+          case EXPR_OP_NE:  result = (a != b) ? 1.0f : 0.0f; break;
+        }
+        stack[sp - 1] = result;
+        break;
+      }
+    }
+  }
+
+  return stack[0];
+}
+
+bool VBUSExpression::test(const VBUSDecoder* decoder, uint8_t hour, uint8_t minute, uint8_t dayOfWeek) const {
+  return _truth(evaluate(decoder, hour, minute, dayOfWeek));
+}
+
+bool VBUSExpression::usesTime() const {
+  return _usesTime;
+}
+
+bool VBUSExpression::usesBusData() const {
+  return _usesBusData;
+}
+
+// Parser
+
+// or := and { ("||" | "or") and }
+void VBUSExpression::_parseOr() {
+  _parseAnd();
+  while (!_failed && (_matchOp("||") || _matchWord("or"))) {
+    _parseAnd();
+    _emit(EXPR_OP_OR, -1);
+  }
+}
+
+// and := not { ("&&" | "and") not }
+void VBUSExpression::_parseAnd() {
+  _parseNot();
+  while (!_failed && (_matchOp("&&") || _matchWord("and"))) {
+    _parseNot();
+    _emit(EXPR_OP_AND, -1);
+  }
+}
+
+// not := { "!" | "not" } comparison
+// Prefix operators are counted rather than recursed into, so a long run of
+// them cannot exhaust the stack; each one takes a byte of code.
+void VBUSExpression::_parseNot() {
+  uint8_t count = 0;
+  while (true) {
+    _skipSpace();
+    bool bang = _src[_pos] == '!' && _src[_pos + 1] != '=';
+    if (bang) _pos++;
+    if (!bang && !_matchWord("not")) break;
+    if (++count >= VBUSEXPR_MAX_CODE) {
+      _fail();
+      return;
+    }
+  }
+  _parseComparison();
+  while (count-- > 0 && !_failed) _emit(EXPR_OP_NOT, 0);
+}
+
+// comparison := additive [ ("<" | "<=" | ">" | ">=" | "==" | "!=") additive ]
+void VBUSExpression::_parseComparison() {
+  _parseAdditive();
+  if (_failed) return;
+
+  ExpressionOp op;
+  if (_matchOp("<=")) op = EXPR_OP_LE;
+  else if (_matchOp(">=")) op = EXPR_OP_GE;
+  else if (_matchOp("==")) op = EXPR_OP_EQ;
+  else if (_matchOp("!=")) op = EXPR_OP_NE;
+  else if (_matchOp("<")) op = EXPR_OP_LT;
+  else if (_matchOp(">")) op = EXPR_OP_GT;
+  else return;
+
+  _parseAdditive();
+  _emit(op, -1);
+}
+
+// additive := multiplicative { ("+" | "-") multiplicative }
+void VBUSExpression::_parseAdditive() {
+  _parseMultiplicative();
+  while (!_failed) {
+    if (_matchOp("+")) {
+      _parseMultiplicative();
+      _emit(EXPR_OP_ADD, -1);
+    } else if (_matchOp("-")) {
+      _parseMultiplicative();
+      _emit(EXPR_OP_SUB, -1);
+    } else {
+      break;
+    }
+  }
+}
+
+// multiplicative := unary { ("*" | "/") unary }
+void VBUSExpression::_parseMultiplicative() {
+  _parseUnary();
+  while (!_failed) {
+    if (_matchOp("*")) {
+      _parseUnary();
+      _emit(EXPR_OP_MUL, -1);
+    } else if (_matchOp("/")) {
+      _parseUnary();
+      _emit(EXPR_OP_DIV, -1);
+    } else {
+      break;
+    }
+  }
+}
+
+// unary := { "-" } primary
+void VBUSExpression::_parseUnary() {
+  uint8_t count = 0;
+  while (_matchOp("-")) {
+    if (++count >= VBUSEXPR_MAX_CODE) {
+      _fail();
+      return;
+    }
+  }
+  _parsePrimary();
+  while (count-- > 0 && !_failed) _emit(EXPR_OP_NEG, 0);
+}
+
+// primary := number | "(" or ")" | temp(n) | pump(n) | relay(n) | name
+void VBUSExpression::_parsePrimary() {
+  if (_failed) return;
+  _skipSpace();
+
+  if (_matchOp("(")) {
+    if (++_nesting > VBUSEXPR_MAX_NESTING) {
+      _fail();
+      return;
+    }
+    _parseOr();
+    _nesting--;
+    if (!_failed && !_matchOp(")")) _fail();
+    return;
+  }
+
+  char c = _src[_pos];
+  if (c >= '0' && c <= '9') {
+    float value;
+    if (!_parseNumber(value)) {
+      _fail();
+      return;
+    }
+
+    // Reuse an existing constant slot if possible
+    uint8_t index = 0;
+    while (index < _constCount && _consts[index] != value) index++;
+    if (index == _constCount) {
+      if (_constCount >= VBUSEXPR_MAX_CONSTS) {
+        _fail();
+        return;
+      }
+      _consts[_constCount++] = value;
+    }
+    _emit(EXPR_OP_CONST, index, 1);
+    return;
+  }
+
+  uint8_t index;
+  if (_matchWord("temp")) {
+    if (_parseIndex(index, EXPRESSION_MAX_CHANNEL)) _emit(EXPR_OP_TEMP, index, 1);
+    _usesBusData = true;
+    return;
+  }
+  if (_matchWord("pump")) {
+    if (_parseIndex(index, EXPRESSION_MAX_CHANNEL)) _emit(EXPR_OP_PUMP, index, 1);
+    _usesBusData = true;
+    return;
+  }
+  if (_matchWord("relay")) {
+    if (_parseIndex(index, EXPRESSION_MAX_CHANNEL)) _emit(EXPR_OP_RELAY, index, 1);
+    _usesBusData = true;
+    return;
+  }
+
+  for (uint8_t i = 0; i < EXPRESSION_NAME_COUNT; i++) {
+    if (_matchWord(EXPRESSION_NAMES[i].name)) {
+      _emit(EXPR_OP_VAR, EXPRESSION_NAMES[i].var, 1);
+      if (EXPRESSION_NAMES[i].isTime) {
+        _usesTime = true;
+      } else {
+        _usesBusData = true;
+      }
+      return;
+    }
+  }
+
+  _fail();  // Unknown token
+}
+
+// Decimal number, or HH:MM which is converted to minutes since midnight
+bool VBUSExpression::_parseNumber(float& value) {
+  uint32_t whole = 0;
+  while (_src[_pos] >= '0' && _src[_pos] <= '9') {
+    whole = whole * 10 + (_src[_pos++] - '0');
+    if (whole > 100000) return false;
+  }
+  value = whole;
+
+  if (_src[_pos] == ':') {
+    _pos++;
+    if (_src[_pos] < '0' || _src[_pos] > '5' || _src[_pos + 1] < '0' || _src[_pos + 1] > '9') return false;
+    uint8_t minutes = (_src[_pos] - '0') * 10 + (_src[_pos + 1] - '0');
+    _pos += 2;
+    if (whole > 23) return false;
+    value = whole * 60 + minutes;
+    return true;
+  }
+
+  if (_src[_pos] == '.') {
+    _pos++;
+    float scale = 0.1f;
+    if (_src[_pos] < '0' || _src[_pos] > '9') return false;
+    while (_src[_pos] >= '0' && _src[_pos] <= '9') {
+      value += (_src[_pos++] - '0') * scale;
+      scale *= 0.1f;
+    }
+  }
+  return true;
+}
+
+// "(" integer literal ")" below limit
+bool VBUSExpression::_parseIndex(uint8_t& index, uint8_t limit) {
+  if (!_matchOp("(")) {
+    _fail();
+    return false;
+  }
+  _skipSpace();
+  uint16_t value = 0;
+  uint8_t digits = 0;
+  while (_src[_pos] >= '0' && _src[_pos] <= '9' && digits < 3) {
+    value = value * 10 + (_src[_pos++] - '0');
+    digits++;
+  }
+  if (digits == 0 || value >= limit || !_matchOp(")")) {
+    _fail();
+    return false;
+  }
+  index = value;
+  return true;
+}
+
+void VBUSExpression::_skipSpace() {
+  while (_src[_pos] == ' ' || _src[_pos] == '\t') _pos++;
+}
+
+bool VBUSExpression::_matchOp(const char* op) {
+  _skipSpace();
+  uint8_t len = strlen(op);
+  if (strncmp(_src + _pos, op, len) != 0) return false;
+  _pos += len;
+  return true;
+}
+
+bool VBUSExpression::_matchWord(const char* word) {
+  _skipSpace();
+  uint8_t len = strlen(word);
+  if (strncmp(_src + _pos, word, len) != 0) return false;
+  if (_isIdentChar(_src[_pos + len])) return false;
+  _pos += len;
+  return true;
+}
+
+void VBUSExpression::_emit(ExpressionOp op, int8_t stackEffect) {
+  if (_failed) return;
+  if (_codeSize + 1 > VBUSEXPR_MAX_CODE) {
+    _fail();
+    return;
+  }
+  _code[_codeSize++] = op;
+  _depth += stackEffect;
+}
+
+void VBUSExpression::_emit(ExpressionOp op, uint8_t operand, int8_t stackEffect) {
+  if (_failed) return;
+  if (_codeSize + 2 > VBUSEXPR_MAX_CODE || _depth + stackEffect > VBUSEXPR_MAX_STACK) {
+    _fail();
+    return;
+  }
+  _code[_codeSize++] = op;
+  _code[_codeSize++] = operand;
+  _depth += stackEffect;
+}
+
+void VBUSExpression::_fail() {
+  if (!_failed) {
+    _failed = true;
+    _errorPos = _pos;
+  }
+}
@@ -0,0 +1,117 @@
+/*
+ * Viessmann Multi-Protocol Library - Condition Expressions
+ * Compiles condition expressions for the scheduler into compact bytecode
+ */
+
+#pragma once
+#ifndef VBUSExpression_h
+#define VBUSExpression_h
+
+#include <Arduino.h>
+#include "vbusdecoder.h"
+
+// Compiled program limits (fixed size, nothing is allocated during evaluation)
+#define VBUSEXPR_MAX_CODE 64       // Bytecode bytes
+#define VBUSEXPR_MAX_CONSTS 8      // Numeric constants
+#define VBUSEXPR_MAX_STACK 8       // Evaluation stack depth
+#define VBUSEXPR_MAX_NESTING 8     // Nested parentheses
+
+// Bytecode instructions
+enum ExpressionOp: uint8_t {
+  EXPR_OP_CONST = 1,     // Push constant, operand: constant index
+  EXPR_OP_TEMP,          // Push temperature, operand: sensor index
+  EXPR_OP_PUMP,          // Push pump power, operand: pump index
+  EXPR_OP_RELAY,         // Push relay state, operand: relay index
+  EXPR_OP_VAR,           // Push variable, operand: ExpressionVar
+  EXPR_OP_ADD,
+  EXPR_OP_SUB,
+  EXPR_OP_MUL,
+  EXPR_OP_DIV,
+  EXPR_OP_NEG,
+  EXPR_OP_NOT,
+  EXPR_OP_AND,
+  EXPR_OP_OR,
+  EXPR_OP_LT,
+  EXPR_OP_LE,
+  EXPR_OP_GT,
+  EXPR_OP_GE,
+  EXPR_OP_EQ,
+  EXPR_OP_NE
+};
+
+// Named values available in expressions
+enum ExpressionVar: uint8_t {
+  EXPR_VAR_HOUR = 0,         // hour        (0-23)
+  EXPR_VAR_MINUTE,           // minute      (0-59)
+  EXPR_VAR_DAY,              // day         (0=Sunday)
+  EXPR_VAR_TIME,             // time        (minutes since midnight)
+  EXPR_VAR_ERRORS,           // errors      (error mask)
+  EXPR_VAR_HEAT,             // heat        (heat quantity in Wh)
+  EXPR_VAR_KM_BURNER,        // km.burner
+  EXPR_VAR_KM_MAINPUMP,      // km.mainpump
+  EXPR_VAR_KM_LOOPPUMP,      // km.looppump
+  EXPR_VAR_KM_MODE,          // km.mode
+  EXPR_VAR_KM_BOILER,        // km.boiler
+  EXPR_VAR_KM_HOTWATER,      // km.hotwater
+  EXPR_VAR_KM_OUTDOOR,       // km.outdoor
+  EXPR_VAR_KM_SETPOINT,      // km.setpoint
+  EXPR_VAR_KM_FLOW           // km.flow
+};
+
+class VBUSExpression {
+  public:
+    VBUSExpression();
+
+    // Compilation
+    bool compile(const char* source);
+    bool isValid() const;
+    uint16_t getErrorPosition() const;   // Offset in source of the first error
+    uint8_t getCodeSize() const;
+
+    // Evaluation
+    float evaluate(const VBUSDecoder* decoder, uint8_t hour, uint8_t minute, uint8_t dayOfWeek) const;
+    bool test(const VBUSDecoder* decoder, uint8_t hour, uint8_t minute, uint8_t dayOfWeek) const;
+
+    // Inputs referenced by the expression
+    bool usesTime() const;
+    bool usesBusData() const;
+
+  private:
+    uint8_t _code[VBUSEXPR_MAX_CODE];
+    uint8_t _codeSize;
+    float _consts[VBUSEXPR_MAX_CONSTS];
+    uint8_t _constCount;
+    bool _valid;
+    bool _usesTime;
+    bool _usesBusData;
+    uint16_t _errorPos;
+
+    // Parser state, only used during compile()
+    const char* _src;
+    uint16_t _pos;
+    uint8_t _depth;
+    uint8_t _nesting;
+    bool _failed;
+
+    // Recursive descent parser, lowest to highest precedence
+    void _parseOr();
+    void _parseAnd();
+    void _parseNot();
+    void _parseComparison();
+    void _parseAdditive();
+    void _parseMultiplicative();
+    void _parseUnary();
+    void _parsePrimary();
+    bool _parseNumber(float& value);
+    bool _parseIndex(uint8_t& index, uint8_t limit);
+
+    // Helpers
+    void _skipSpace();
+    bool _matchOp(const char* op);
+    bool _matchWord(const char* word);
+    void _emit(ExpressionOp op, int8_t stackEffect);
+    void _emit(ExpressionOp op, uint8_t operand, int8_t stackEffect);
+    void _fail();
+};
+
+#endif
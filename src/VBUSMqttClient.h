@@ -12,8 +12,77 @@
 
 #if defined(ESP32) || defined(ESP8266)
   #include <PubSubClient.h>
+  typedef PubSubClient MqttTransport;
+#elif defined(__linux__)
+  // Native MQTT 3.1.1 client over non-blocking POSIX sockets (linux/)
+  #include "LinuxMqttClient.h"
+  typedef LinuxMqttClient MqttTransport;
 #endif
 
+// Publishing modes
+enum MqttPublishMode: uint8_t {
+  MQTT_PUBLISH_PER_VALUE = 0,    // One topic per value, every publish interval (default)
+  MQTT_PUBLISH_AGGREGATED = 1,   // One JSON state document per participant
+  MQTT_PUBLISH_CHANGES = 2       // Per-value topics, only values that changed, plus periodic full refresh
+};
+
+// Size of the aggregated state document buffer
+#define MQTT_STATE_PAYLOAD_SIZE 1024
+
+// Participants tracked for per-participant publish intervals
+#define MQTT_MAX_STATE_SOURCES 16
+
+// Outbound queue: messages wait here until the client accepts them
+#ifndef MQTT_QUEUE_BYTES
+#define MQTT_QUEUE_BYTES 4096          // Queue memory, topics and payloads
+#endif
+#define MQTT_QUEUE_DRAIN_PER_LOOP 8    // Messages handed to the client per loop()
+#define MQTT_DISCOVERY_PER_LOOP 8      // Discovery configs handed to the client per loop()
+
+// Offline backlog: samples taken while the broker is unreachable
+#define MQTT_BACKLOG_DEFAULT 60        // Samples (one per publish interval)
+#define MQTT_BACKLOG_BATCH 4           // Samples per replay message
+#define MQTT_BACKLOG_TEMPS 16
+#define MQTT_BACKLOG_PUMPS 8
+
+// Reconnect backoff
+#define MQTT_RECONNECT_MIN 5000        // ms
+#define MQTT_RECONNECT_MAX 60000       // ms
+
+// Topics that do not depend on the channel layout, precomputed in the arena
+enum MqttTopicId: uint8_t {
+  MQTT_TOPIC_PROTOCOL = 0,
+  MQTT_TOPIC_READY,
+  MQTT_TOPIC_ERROR_MASK,
+  MQTT_TOPIC_SYSTEM_TIME,
+  MQTT_TOPIC_HEAT,
+  MQTT_TOPIC_KM_BURNER,
+  MQTT_TOPIC_KM_MAIN_PUMP,
+  MQTT_TOPIC_KM_LOOP_PUMP,
+  MQTT_TOPIC_KM_MODE,
+  MQTT_TOPIC_KM_BOILER,
+  MQTT_TOPIC_KM_HOTWATER,
+  MQTT_TOPIC_KM_OUTDOOR,
+  MQTT_TOPIC_KM_SETPOINT,
+  MQTT_TOPIC_KM_DEPARTURE,
+  MQTT_TOPIC_BACKLOG,
+  MQTT_TOPIC_FIXED_COUNT
+};
+
+// One offline sample, replayed to <base>/backlog after reconnect
+struct MqttBacklogSample {
+  uint32_t timestamp;                  // VBUSClock::now() / 1000 when taken
+  uint16_t source;
+  uint16_t errorMask;
+  uint16_t heatQuantity;
+  uint8_t tempCount;
+  uint8_t pumpCount;
+  uint8_t relayCount;
+  int16_t temp[MQTT_BACKLOG_TEMPS];    // 0.1 °C, INT16_MIN if invalid
+  uint8_t pump[MQTT_BACKLOG_PUMPS];
+  uint32_t relays;                     // Bit per relay
+};
+
 // MQTT Configuration
 struct MqttConfig {
   const char* broker;          // MQTT broker address
@@ -29,12 +98,30 @@ struct MqttConfig {
 
 class VBUSMqttClient {
   public:
+#if defined(ESP32) || defined(ESP8266)
     VBUSMqttClient(VBUSDecoder* decoder, Client* networkClient);
+#else
+    VBUSMqttClient(VBUSDecoder* decoder);
+#endif
     ~VBUSMqttClient();
     
     // Configuration
     void begin(const MqttConfig& config);
     void setConfig(const MqttConfig& config);
+    void setDecoder(VBUSDecoder* decoder);   // nullptr pauses publishing
+    
+    // Publishing mode
+    void setPublishMode(MqttPublishMode mode);
+    MqttPublishMode getPublishMode();
+    void setTemperatureDeadband(float deadband);
+    void setPumpDeadband(uint8_t deadband);
+    void setFullRefreshInterval(uint32_t seconds);
+    
+    // Outbound queue and offline backlog
+    void setOfflineBacklog(uint16_t samples);  // 0 disables the backlog
+    uint16_t getQueuedCount();
+    uint32_t getDroppedCount();                 // Messages lost to queue overflow
+    uint16_t getBacklogCount();
     
     // Connection management
     bool connect();
@@ -49,6 +136,8 @@ class VBUSMqttClient {
     void publishRelays();
     void publishStatus();
     void publishKMBusData();
+    void publishState();         // Aggregated document for the participant of the last frame
+    void publishChanges();       // Values that moved beyond the deadband since last sent
     
     // Home Assistant integration
     void publishHomeAssistantDiscovery();
@@ -60,22 +149,109 @@ class VBUSMqttClient {
     // Callbacks
     void setCallback(void (*callback)(char*, uint8_t*, unsigned int));
     
+#if !defined(ESP32) && !defined(ESP8266)
+    // Event loop integration: poll the socket, then call loop()
+    int getSocket();
+    bool wantsWrite();
+#endif
+    
   private:
     VBUSDecoder* _decoder;
-    PubSubClient* _mqttClient;
+    MqttTransport* _mqttClient;
     MqttConfig _config;
     uint32_t _lastPublish;
     bool _discoveryPublished;
     
+    // Publishing mode state
+    MqttPublishMode _mode;
+    float _tempDeadband;
+    uint8_t _pumpDeadband;
+    uint32_t _fullRefreshInterval;
+    uint32_t _lastFullRefresh;
+    uint32_t _lastFrameCount;
+    char* _stateBuffer;
+    uint16_t _stateSource[MQTT_MAX_STATE_SOURCES];
+    uint32_t _statePublished[MQTT_MAX_STATE_SOURCES];
+    uint8_t _stateSourceCount;
+    
+    // Last values sent, for change detection
+    bool _sentValid;
+    float _sentTemp[32];
+    uint8_t _sentPump[32];
+    uint32_t _sentRelays;
+    uint16_t _sentErrorMask;
+    uint16_t _sentHeat;
+    uint16_t _sentSystemTime;
+    uint8_t _sentKMStatus;       // Burner, main pump, loop pump bits
+    uint8_t _sentKMMode;
+    float _sentKMTemp[5];        // Boiler, hot water, outdoor, setpoint, departure
+    
+    // Outbound queue: entries appended at _queueTail, sent from _queueHead
+    uint8_t* _queue;
+    uint16_t _queueHead;
+    uint16_t _queueTail;
+    uint16_t _queueCount;
+    uint32_t _queueDropped;
+    
+    // Offline backlog ring
+    MqttBacklogSample* _backlog;
+    uint16_t _backlogSize;
+    uint16_t _backlogStart;
+    uint16_t _backlogCount;
+    uint32_t _lastBacklogSample;
+    
+    // Reconnect backoff
+    uint32_t _lastReconnectAttempt;
+    uint32_t _reconnectDelay;
+    bool _sessionUp;             // The broker accepted the connection (CONNACK)
+    
+    // Precomputed topics and discovery payloads, all in one arena. Rebuilt
+    // only when the channel layout or the participant list changes
+    char* _arena;
+    size_t _arenaSize;
+    size_t _arenaUsed;
+    bool _tablesValid;
+    uint16_t _topicOffset[MQTT_TOPIC_FIXED_COUNT];
+    uint16_t* _channelOffset;    // Temperatures, then pumps, then relays
+    uint8_t _layoutTemps;
+    uint8_t _layoutPumps;
+    uint8_t _layoutRelays;
+    uint8_t _layoutParticipants;
+    uint16_t _stateTopicAddress[MQTT_MAX_STATE_SOURCES];
+    uint16_t _stateTopicOffset[MQTT_MAX_STATE_SOURCES];
+    uint8_t _stateTopicCount;
+    size_t _discoveryOffset;     // (topic, payload) string pairs
+    uint8_t _discoveryCount;
+    uint8_t _discoveryNext;      // Entries the client accepted so far
+    uint16_t _discoverySource;   // State topic used by aggregated discovery
+    
     // Helper methods
     void _reconnect();
-    void _publishSensor(const char* name, const char* deviceClass, 
-                       const char* unit, const char* valueTopic);
-    void _publishBinarySensor(const char* name, const char* deviceClass, 
-                             const char* valueTopic);
-    String _buildTopic(const char* suffix);
-    String _buildStateTopic(const char* suffix);
-    String _buildDiscoveryTopic(const char* component, const char* objectId);
+    void _startSession();
+    void _publishDiscovery();
+    void _publishDue(uint32_t now);
+    bool _enqueue(const char* topic, const uint8_t* payload, uint16_t length, bool retained, bool coalesce = true);
+    void _compactQueue();
+    void _dropOldest();
+    void _drainQueue();
+    void _sampleBacklog(uint32_t now);
+    void _replayBacklog();
+    void _invalidateTables();
+    void _updateTables();
+    void _fillTables();
+    size_t _arenaPrintf(const char* format, ...);
+    void _addSensorConfig(const char* objectId, const char* name, const char* deviceClass,
+                          const char* unit, const char* stateTopic, const char* valueTemplate);
+    void _addBinarySensorConfig(const char* objectId, const char* name, const char* deviceClass,
+                                const char* stateTopic, const char* valueTemplate);
+    const char* _topic(MqttTopicId id);
+    const char* _tempTopic(uint8_t idx);
+    const char* _pumpTopic(uint8_t idx);
+    const char* _relayTopic(uint8_t idx);
+    const char* _stateTopic(uint16_t source);
+    bool _stateDue(uint16_t source, uint32_t now);
+    void _formatStateTopic(char* topic, size_t size, uint16_t source);
+    size_t _appendFloat(char* out, size_t size, float value);
     void _publishFloat(const char* topic, float value);
     void _publishInt(const char* topic, int value);
     void _publishBool(const char* topic, bool value);
@@ -6,6 +6,38 @@
 #include "Arduino.h"
 #include "vbusdecoder.h"
 
+VBUSClockSource VBUSClock::_source = nullptr;
+bool VBUSClock::_virtual = false;
+unsigned long VBUSClock::_virtualTime = 0;
+
+unsigned long VBUSClock::now() {
+  if (_virtual) return _virtualTime;
+  return _source != nullptr ? _source() : millis();
+}
+
+void VBUSClock::setSource(VBUSClockSource source) {
+  _source = source;
+  _virtual = false;
+}
+
+// Stands still until set() or advance() move it
+void VBUSClock::setVirtual(unsigned long start) {
+  _virtualTime = start;
+  _virtual = true;
+}
+
+void VBUSClock::set(unsigned long ms) {
+  if (_virtual) _virtualTime = ms;
+}
+
+void VBUSClock::advance(unsigned long ms) {
+  if (_virtual) _virtualTime += ms;
+}
+
+bool VBUSClock::isVirtual() {
+  return _virtual;
+}
+
 VBUSDecoder::VBUSDecoder(Stream* serial):
   _stream(serial),
   _protocol(PROTOCOL_VBUS),
@@ -25,6 +57,8 @@ VBUSDecoder::VBUSDecoder(Stream* serial):
   _operatingHours{0},
   _heatQuantity(0),
   _systemVariant(0),
+  _frameCount(0),
+  _frameTime(0),
   _participantCount(0),
   _autoDiscoveryEnabled(true),
   _kmBusMode(0),
@@ -55,7 +89,7 @@ VBUSDecoder::~VBUSDecoder()
 
 void VBUSDecoder::begin(ProtocolType protocol) {
   _protocol = protocol;
-  _lastMillis = millis();
+  _lastMillis = VBUSClock::now();
   _state = SYNC;
 }
 
@@ -202,6 +236,17 @@ const ProtocolType VBUSDecoder::getProtocol() const {
   return _protocol;
 }
 
+// Number of frames decoded since construction (wraps around)
+uint32_t VBUSDecoder::getFrameCount() const {
+  return _frameCount;
+}
+
+// Taken when the frame's last byte was read; with a virtual clock this is
+// the timestamp the replay set for the frame
+uint32_t VBUSDecoder::getFrameTime() const {
+  return _frameTime;
+}
+
 // KM-Bus specific getter methods
 bool VBUSDecoder::getKMBusBurnerStatus() const {
   return _kmBusBurnerStatus;
@@ -391,7 +436,7 @@ void VBUSDecoder::_headerDecoder() {
 
 //VBUS Sync handler
 void VBUSDecoder::_vbusSyncHandler() {
-  if (millis() - _lastMillis > 20 * 1000UL) // if no packet arrived in last 20 sec go to error state
+  if (VBUSClock::now() - _lastMillis > 20 * 1000UL) // if no packet arrived in last 20 sec go to error state
     _state = ERROR;
   if (_stream->available() > 0)
     if (_stream->read() == 0xaa) { // Sync byte has been received
@@ -411,6 +456,15 @@ void VBUSDecoder::_vbusReceiveHandler() {
   uint8_t crc;
 
   while (_stream->available() > 0) {
+    // Stop at the end of the frame, the next one may already be buffered
+    if ((_rcvBufferIdx >= 9) && (_rcvBufferIdx >= _rcvBuffer[7] * 6 + 9))
+      break;
+
+    if (_rcvBufferIdx >= MAX_BUFFER_SIZE) {
+      _state = ERROR;
+      return;
+    }
+
     uint8_t rcvByte = _stream->read();
 
     // MSB is set - according to protocol description the receiving has to be stopped
@@ -423,8 +477,8 @@ void VBUSDecoder::_vbusReceiveHandler() {
     _rcvBufferIdx++;
   }
 
-  // Test if there is frame header stored in receive buffer
-  if ((_rcvBufferIdx > 10) && (_frameCnt == 0)) {
+  // Decode the header as soon as it is complete; _frameLen is 0 until then
+  if ((_rcvBufferIdx >= 9) && (_frameLen == 0)) {
     _headerDecoder();
 
     // Only protocol 1.0 will be decoded
@@ -442,13 +496,19 @@ void VBUSDecoder::_vbusReceiveHandler() {
     }
 
     _errorFlag = false;
+
+    // Header-only packet, no data frames to wait for
+    if (_frameCnt == 0) {
+      _state = SYNC;
+      return;
+    }
   }
 
 
   // Test if whole frame has been already received
   if ((_rcvBufferIdx == _frameLen - 1)) {
     for (uint8_t i=0; i < _frameCnt; i++) {
-      crc = _calcCRC(_rcvBuffer, (i * 6) + 10, 6);
+      crc = _calcCRC(_rcvBuffer, (i * 6) + 9, 6);
 
       // Go to error state if CRC fails
       if  (crc != 0) {
@@ -456,7 +516,7 @@ void VBUSDecoder::_vbusReceiveHandler() {
         return;
       }
     }
-    _lastMillis = millis();
+    _lastMillis = VBUSClock::now();
     _state = DECODE;
   }
 }
@@ -489,6 +549,8 @@ void VBUSDecoder::_vbusDecodeHandler() {
     }
 
     _readyFlag = true;
+    _frameCount++;
+    _frameTime = _lastMillis;
     _state = SYNC;
   }
 }
@@ -827,7 +889,7 @@ void VBUSDecoder::_deltaSolMXDecoder() {
 // KW-Bus Sync handler
 // KW protocol uses 0x01 as sync byte followed by length
 void VBUSDecoder::_kwSyncHandler() {
-  if (millis() - _lastMillis > 20 * 1000UL) // if no packet arrived in last 20 sec go to error state
+  if (VBUSClock::now() - _lastMillis > 20 * 1000UL) // if no packet arrived in last 20 sec go to error state
     _state = ERROR;
   if (_stream->available() > 0) {
     uint8_t syncByte = _stream->read();
@@ -866,7 +928,7 @@ void VBUSDecoder::_kwReceiveHandler() {
 
         if (checksum == _rcvBuffer[_rcvBufferIdx - 1]) {
           _errorFlag = false;
-          _lastMillis = millis();
+          _lastMillis = VBUSClock::now();
           _state = DECODE;
           return;
         } else {
@@ -887,6 +949,8 @@ void VBUSDecoder::_kwDecodeHandler() {
 
   _kwDefaultDecoder();
   _readyFlag = true;
+  _frameCount++;
+  _frameTime = _lastMillis;
   _state = SYNC;
 }
 
@@ -925,7 +989,7 @@ void VBUSDecoder::_kwDefaultDecoder() {
 // P300 Sync handler
 // P300 uses 0x05 as sync/ack byte
 void VBUSDecoder::_p300SyncHandler() {
-  if (millis() - _lastMillis > 20 * 1000UL)
+  if (VBUSClock::now() - _lastMillis > 20 * 1000UL)
     _state = ERROR;
 
   if (_stream->available() > 0) {
@@ -963,7 +1027,7 @@ void VBUSDecoder::_p300ReceiveHandler() {
 
         if (checksum == _rcvBuffer[_rcvBufferIdx - 1]) {
           _errorFlag = false;
-          _lastMillis = millis();
+          _lastMillis = VBUSClock::now();
           _state = DECODE;
           return;
         } else {
@@ -984,6 +1048,8 @@ void VBUSDecoder::_p300DecodeHandler() {
 
   _p300DefaultDecoder();
   _readyFlag = true;
+  _frameCount++;
+  _frameTime = _lastMillis;
   _state = SYNC;
 }
 
@@ -1025,7 +1091,7 @@ void VBUSDecoder::_p300DefaultDecoder() {
 // KM-Bus Sync handler
 // KM-Bus is similar to M-Bus with specific framing
 void VBUSDecoder::_kmSyncHandler() {
-  if (millis() - _lastMillis > 20 * 1000UL)
+  if (VBUSClock::now() - _lastMillis > 20 * 1000UL)
     _state = ERROR;
 
   if (_stream->available() > 0) {
@@ -1079,7 +1145,7 @@ void VBUSDecoder::_kmReceiveHandler() {
 
         if (calculatedCRC == receivedCRC) {
           _errorFlag = false;
-          _lastMillis = millis();
+          _lastMillis = VBUSClock::now();
           _state = DECODE;
           return;
         } else {
@@ -1100,6 +1166,8 @@ void VBUSDecoder::_kmDecodeHandler() {
 
   _kmDefaultDecoder();
   _readyFlag = true;
+  _frameCount++;
+  _frameTime = _lastMillis;
   _state = SYNC;
 }
 
@@ -1333,7 +1401,7 @@ bool VBUSDecoder::addParticipant(uint16_t address, const char* name,
   // Add new participant
   BusParticipant* p = &_participants[_participantCount];
   p->address = address;
-  p->lastSeen = millis();
+  p->lastSeen = VBUSClock::now();
   p->tempChannels = tempChannels;
   p->pumpChannels = pumpChannels;
   p->relayChannels = relayChannels;
@@ -1399,14 +1467,14 @@ void VBUSDecoder::_updateParticipant(uint16_t address) {
 
   if (idx >= 0) {
     // Update existing participant
-    _participants[idx].lastSeen = millis();
+    _participants[idx].lastSeen = VBUSClock::now();
     _participants[idx].active = true;
   } else {
     // Add new participant if there's room
     if (_participantCount < MAX_PARTICIPANTS) {
       BusParticipant* p = &_participants[_participantCount];
       p->address = address;
-      p->lastSeen = millis();
+      p->lastSeen = VBUSClock::now();
       p->autoDetected = true;
       p->active = true;
 
@@ -9,32 +9,83 @@
 
 #include "Arduino.h"
 #include <termios.h>
+#include <atomic>
+
+#define SERIAL_LATENCY_TIMER 1          // ms, USB adapter latency timer in low-latency mode
+#define SERIAL_BURST_GAP 50000          // µs; longer pauses end a burst and are not counted as jitter
+
+// Byte arrival timing as seen by the reader of the port. Ideally one byte
+// arrives per character time; latency timers and USB polling turn that into
+// bursts, which shows as jitter
+struct SerialTiming {
+    unsigned long reads;        // Arrivals that brought new bytes
+    unsigned long bytes;
+    unsigned long charTime;     // µs per character at the configured line settings
+    unsigned long jitter;       // Smoothed |inter-byte gap - charTime| in µs (RFC 3550 style)
+    unsigned long maxGap;       // Longest pause within a burst in µs
+};
 
 class LinuxSerial : public Stream {
 public:
     LinuxSerial();
     ~LinuxSerial();
-    
-    // Open serial port with baud rate
+
+    // Open serial port with baud rate. Rates without a Bxxx constant are
+    // set with termios2 (BOTHER)
     bool begin(const char* port, unsigned long baud, uint8_t config = SERIAL_8N1);
     void end();
-    
+
     // Stream interface implementation
     int available() override;
     int read() override;
     size_t write(uint8_t data) override;
     size_t write(const uint8_t *buffer, size_t size) override;
     void flush() override;
-    
+
+    // Bulk read of up to size bytes, returns the number copied. Waits
+    // according to setReadTimeout()
+    size_t read(uint8_t* buffer, size_t size);
+
+    // Latency tuning, after begin(). setLowLatency() sets ASYNC_LOW_LATENCY
+    // and lowers the latency timer of USB adapters that have one (FTDI:
+    // 16 ms by default); returns false if neither is supported.
+    // setReadTimeout() with vmin or vtime (1/10 s) above 0 makes the bulk
+    // read() wait for vmin bytes or a pause of vtime, so a reader thread
+    // takes whole bursts per system call. Both 0 (default) is non-blocking
+    bool setLowLatency(bool enable);
+    bool setReadTimeout(uint8_t vmin, uint8_t vtime);
+
     // Additional methods
     bool isOpen() const { return fd >= 0; }
-    
+    int getFd() const { return fd; }  // For poll()/select() based event loops
+    bool isLowLatency() const { return lowLatency; }
+
+    // Arrival timing. Readers of getFd() that bypass available()/read()
+    // (reader threads, I/O multiplexers) report their reads here
+    void recordArrival(size_t count, unsigned long time);
+    SerialTiming getTiming() const;
+
 private:
     int fd;
     struct termios oldtio;
-    
+    char name[64];              // Device name below /dev, for sysfs
+    bool lowLatency;
+    bool blocking;
+    int oldLatencyTimer;        // -1 if not changed
+
+    // Arrival timing, updated by the thread reading the port
+    size_t pending;             // Bytes seen by available() but not read yet
+    unsigned long charTime;
+    unsigned long lastArrival;
+    std::atomic<unsigned long> reads;
+    std::atomic<unsigned long> bytes;
+    std::atomic<unsigned long> jitter;
+    std::atomic<unsigned long> maxGap;
+
     bool configure(unsigned long baud, uint8_t config);
     speed_t getBaudRate(unsigned long baud);
+    bool setCustomBaudRate(unsigned long baud);
+    int latencyTimer(int value);
 };
 
 #endif // LINUX_SERIAL_H
@@ -0,0 +1,103 @@
+/*
+ * Linux TCP serial port
+ * Stream over a TCP connection to an Ethernet serial server (ser2net,
+ * socat, ...), optionally setting the remote line with RFC 2217
+ */
+
+#pragma once
+#ifndef LINUX_TCP_SERIAL_H
+#define LINUX_TCP_SERIAL_H
+
+#include "Arduino.h"
+
+#define TCP_SERIAL_BUFFER_SIZE 4096         // Received bytes not read yet
+#define TCP_SERIAL_OUTPUT_SIZE 1024         // Bytes waiting for the socket to become writable
+#define TCP_SERIAL_CONNECT_TIMEOUT 10000    // ms
+#define TCP_SERIAL_BACKOFF_MIN 1000         // ms before the first reconnect attempt
+#define TCP_SERIAL_BACKOFF_MAX 60000        // Doubled per failed attempt up to this
+#define TCP_SERIAL_KEEPALIVE 30             // Seconds idle before the connection is probed
+
+enum TcpSerialState {
+    TCP_SERIAL_DISCONNECTED = 0,    // Waiting for the next attempt
+    TCP_SERIAL_CONNECTING,
+    TCP_SERIAL_CONNECTED
+};
+
+class LinuxTcpSerial : public Stream {
+public:
+    LinuxTcpSerial();
+    ~LinuxTcpSerial();
+
+    // tcp://host:port for a raw connection, rfc2217://host:port to also
+    // send baud rate and config to the server. Only starts connecting;
+    // the connection is kept up by loop() and the Stream calls, which
+    // reconnect with exponential backoff
+    bool begin(const char* url, unsigned long baud = 9600, uint8_t config = SERIAL_8N1);
+    void end();
+    static bool isUrl(const char* port);
+
+    // Stream interface implementation. write() drops bytes while disconnected
+    int available() override;
+    int read() override;
+    size_t write(uint8_t data) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    void flush() override;
+
+    // Bulk read of up to size bytes, returns the number copied
+    size_t read(uint8_t* buffer, size_t size);
+
+    // Event loop integration: wait for POLLIN on getFd(), and for POLLOUT
+    // while wantsWrite() is true, then call loop(). getFd() is -1 between
+    // connections and changes on reconnect
+    void loop();
+    int getFd() const { return fd; }
+    bool wantsWrite() const;
+
+    TcpSerialState state() const { return connState; }
+    bool isConnected() const { return connState == TCP_SERIAL_CONNECTED; }
+    bool isNegotiated() const { return negotiated; }   // Server confirmed the baud rate (RFC 2217)
+    unsigned long getReconnectCount() const { return reconnects; }
+
+private:
+    int fd;
+    TcpSerialState connState;
+    char host[128];
+    uint16_t port;
+    bool rfc2217;
+    unsigned long baud;
+    uint8_t config;
+
+    uint8_t inBuffer[TCP_SERIAL_BUFFER_SIZE];
+    size_t inStart;
+    size_t inLength;
+    uint8_t outBuffer[TCP_SERIAL_OUTPUT_SIZE];
+    size_t outLength;
+
+    unsigned long connectStarted;
+    unsigned long failedAt;
+    unsigned long retryDelay;   // From failedAt to the next attempt
+    unsigned long backoff;      // Delay after the next failure
+    unsigned long reconnects;
+    bool received;              // Data since connecting, resets the backoff
+
+    // Telnet parser (RFC 854) for RFC 2217 mode
+    uint8_t telnetState;
+    uint8_t telnetCommand;
+    uint8_t subOption[8];
+    uint8_t subLength;
+    uint8_t optionsSent;        // WILL/DO already sent, see TELNET_SENT_*
+    bool negotiated;
+
+    bool openSocket();
+    void closeSocket(bool retry);
+    bool checkConnect();
+    bool flushOutput();
+    bool readInput();
+    void queue(const uint8_t* data, size_t length);
+    void parseTelnet(const uint8_t* data, size_t length);
+    void handleOption(uint8_t command, uint8_t option);
+    void handleSubOption();
+    void sendComPortSettings();
+};
+
+#endif // LINUX_TCP_SERIAL_H
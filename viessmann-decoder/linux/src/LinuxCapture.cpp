@@ -0,0 +1,464 @@
+/*
+ * Linux bus capture implementation
+ */
+
+#include "LinuxCapture.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static void put16(uint8_t* p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = value >> (i * 8);
+}
+
+static void put64(uint8_t* p, uint64_t value) {
+    for (int i = 0; i < 8; i++) p[i] = value >> (i * 8);
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) value = (value << 8) | p[i];
+    return value;
+}
+
+static uint64_t get64(const uint8_t* p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) value = (value << 8) | p[i];
+    return value;
+}
+
+static uint64_t clockMicros(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+uint64_t LinuxCapture::now() {
+    return clockMicros(CLOCK_MONOTONIC);
+}
+
+LinuxCapture::LinuxCapture() : maxSize(CAPTURE_FILE_SIZE), files(CAPTURE_FILE_COUNT), fd(-1),
+    fileSize(0), portCount(0), running(false), stopping(false), active(0),
+    writing(false), lastTime(0), activeSince(0), lost(0), lostTotal(0) {
+    path[0] = '\0';
+    lengths[0] = lengths[1] = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+}
+
+LinuxCapture::~LinuxCapture() {
+    end();
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+bool LinuxCapture::begin(const char* capturePath, uint64_t size, uint8_t count) {
+    if (running) return false;
+    snprintf(path, sizeof(path), "%s", capturePath);
+    maxSize = size > CAPTURE_BUFFER_SIZE ? size : CAPTURE_BUFFER_SIZE;
+    files = count;
+
+    // A capture left from an earlier run is rotated, not overwritten
+    if (access(path, F_OK) == 0) {
+        rotate();
+    } else if (!openFile()) {
+        return false;
+    }
+    if (fd < 0) return false;
+
+    stopping = false;
+    active = 0;
+    lengths[0] = lengths[1] = 0;
+    writing = false;
+    if (pthread_create(&thread, NULL, writeThread, this) != 0) {
+        fprintf(stderr, "Error starting capture thread\n");
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void LinuxCapture::end() {
+    if (!running) return;
+
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+    running = false;
+
+    if (fd >= 0) {
+        fdatasync(fd);
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+// A port reconnected with the same settings keeps its ID
+int LinuxCapture::addPort(const char* name, ProtocolType protocol, unsigned long baud, uint8_t config) {
+    pthread_mutex_lock(&mutex);
+    for (uint8_t i = 0; i < portCount; i++) {
+        if (ports[i].protocol == protocol && ports[i].baud == baud && ports[i].config == config &&
+            strncmp(ports[i].name, name, sizeof(ports[i].name) - 1) == 0) {
+            pthread_mutex_unlock(&mutex);
+            return i;
+        }
+    }
+    if (portCount >= CAPTURE_MAX_PORTS) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    int id = portCount++;
+    Port& port = ports[id];
+    port.protocol = protocol;
+    port.baud = baud;
+    port.config = config;
+    snprintf(port.name, sizeof(port.name), "%s", name);
+
+    // Ports added while recording go into the current file as well
+    uint8_t payload[6 + sizeof(port.name)];
+    payload[0] = port.protocol;
+    put32(payload + 1, port.baud);
+    payload[5] = port.config;
+    size_t nameLength = strlen(port.name);
+    memcpy(payload + 6, port.name, nameLength);
+    if (running) append(CAPTURE_PORT, id, payload, 6 + nameLength, now());
+    pthread_mutex_unlock(&mutex);
+    return id;
+}
+
+void LinuxCapture::data(uint8_t port, const uint8_t* bytes, size_t length, uint64_t time) {
+    if (!running || length == 0) return;
+    pthread_mutex_lock(&mutex);
+    if (!append(CAPTURE_DATA, port, bytes, length, time)) {
+        lost += length;
+        lostTotal += length;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void LinuxCapture::frame(uint8_t port, uint32_t frameCount, uint64_t time) {
+    if (!running) return;
+    uint8_t payload[4];
+    put32(payload, frameCount);
+    pthread_mutex_lock(&mutex);
+    append(CAPTURE_FRAME, port, payload, sizeof(payload), time);
+    pthread_mutex_unlock(&mutex);
+}
+
+// Called with the mutex held. Times are relative to the previous record;
+// records of different ports may be slightly out of order, hence signed
+bool LinuxCapture::append(uint8_t type, uint8_t port, const uint8_t* payload, size_t length, uint64_t time) {
+    size_t need = CAPTURE_RECORD_SIZE + length;
+    if (lengths[active] + need > CAPTURE_BUFFER_SIZE && !swap()) return false;
+    if (lengths[active] == 0) startBuffer(time);
+
+    int64_t delta = (int64_t)(time - lastTime);
+    if (delta > INT32_MAX || delta < INT32_MIN) {
+        if (lengths[active] + need + CAPTURE_RECORD_SIZE + 8 > CAPTURE_BUFFER_SIZE && !swap()) return false;
+        if (lengths[active] == 0) startBuffer(time);
+        else {
+            uint8_t absolute[8];
+            put64(absolute, time);
+            lastTime = time;
+            append(CAPTURE_TIME, 0, absolute, sizeof(absolute), time);
+        }
+        delta = 0;
+    }
+
+    uint8_t* p = buffers[active] + lengths[active];
+    p[0] = type;
+    p[1] = port;
+    put16(p + 2, length);
+    put32(p + 4, (uint32_t)(int32_t)delta);
+    memcpy(p + CAPTURE_RECORD_SIZE, payload, length);
+    lengths[active] += need;
+    lastTime = time;
+    return true;
+}
+
+// Every buffer starts with the absolute time, so the writer can start a
+// new file before any of them. Bytes lost since the last buffer follow
+void LinuxCapture::startBuffer(uint64_t time) {
+    uint8_t* p = buffers[active];
+    p[0] = CAPTURE_TIME;
+    p[1] = 0;
+    put16(p + 2, 8);
+    put32(p + 4, 0);
+    put64(p + CAPTURE_RECORD_SIZE, time);
+    lengths[active] = CAPTURE_RECORD_SIZE + 8;
+    lastTime = time;
+    activeSince = now();
+
+    if (lost > 0) {
+        p += lengths[active];
+        p[0] = CAPTURE_LOST;
+        p[1] = 0;
+        put16(p + 2, 4);
+        put32(p + 4, 0);
+        put32(p + CAPTURE_RECORD_SIZE, lost);
+        lengths[active] += CAPTURE_RECORD_SIZE + 4;
+        lost = 0;
+    }
+}
+
+// Hands the active buffer to the writer. Fails while the writer still has
+// the other one
+bool LinuxCapture::swap() {
+    if (writing) return false;
+    writing = true;
+    active = 1 - active;
+    lengths[active] = 0;
+    pthread_cond_signal(&cond);
+    return true;
+}
+
+void* LinuxCapture::writeThread(void* arg) {
+    ((LinuxCapture*)arg)->writeLoop();
+    return NULL;
+}
+
+void LinuxCapture::writeLoop() {
+    uint64_t lastSync = now();
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        uint64_t time = now();
+        if (!writing && lengths[active] > 0 &&
+            (stopping || time - activeSince >= (uint64_t)CAPTURE_FLUSH_MS * 1000)) {
+            swap();
+        }
+
+        if (writing) {
+            int full = 1 - active;
+            pthread_mutex_unlock(&mutex);
+            writeAll(buffers[full], lengths[full]);
+            if (fd >= 0 && now() - lastSync >= (uint64_t)CAPTURE_SYNC_MS * 1000) {
+                fdatasync(fd);
+                lastSync = now();
+            }
+            pthread_mutex_lock(&mutex);
+            lengths[full] = 0;
+            writing = false;
+            continue;
+        }
+        if (stopping) break;
+
+        // Wake up for the next flush, or when a buffer is handed over
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (CAPTURE_FLUSH_MS % 1000) * 1000000L;
+        deadline.tv_sec += CAPTURE_FLUSH_MS / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&cond, &mutex, &deadline);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void LinuxCapture::writeAll(const uint8_t* bytes, size_t length) {
+    if (fileSize + length > maxSize && fileSize > CAPTURE_HEADER_SIZE) rotate();
+    if (fd < 0 && !openFile()) return;
+
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::write(fd, bytes + done, length - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Error writing capture %s: %s\n", path, strerror(errno));
+            return;
+        }
+        done += n;
+    }
+    fileSize += length;
+}
+
+// Header and the port records, so the file can be read without its
+// predecessors
+bool LinuxCapture::openFile() {
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_LARGEFILE, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening capture %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[CAPTURE_HEADER_SIZE];
+    memcpy(header, CAPTURE_MAGIC, 4);
+    put16(header + 4, CAPTURE_VERSION);
+    put16(header + 6, CAPTURE_HEADER_SIZE);
+    put64(header + 8, now());
+    put64(header + 16, clockMicros(CLOCK_REALTIME));
+    fileSize = 0;
+    writeAll(header, sizeof(header));
+
+    pthread_mutex_lock(&mutex);
+    uint8_t count = portCount;
+    Port copy[CAPTURE_MAX_PORTS];
+    memcpy(copy, ports, sizeof(Port) * count);
+    pthread_mutex_unlock(&mutex);
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t record[CAPTURE_RECORD_SIZE + 6 + sizeof(copy[i].name)];
+        size_t nameLength = strlen(copy[i].name);
+        record[0] = CAPTURE_PORT;
+        record[1] = i;
+        put16(record + 2, 6 + nameLength);
+        put32(record + 4, 0);
+        record[CAPTURE_RECORD_SIZE] = copy[i].protocol;
+        put32(record + CAPTURE_RECORD_SIZE + 1, copy[i].baud);
+        record[CAPTURE_RECORD_SIZE + 5] = copy[i].config;
+        memcpy(record + CAPTURE_RECORD_SIZE + 6, copy[i].name, nameLength);
+        writeAll(record, CAPTURE_RECORD_SIZE + 6 + nameLength);
+    }
+    return true;
+}
+
+// <path> becomes <path>.1, the oldest file is dropped
+void LinuxCapture::rotate() {
+    if (fd >= 0) {
+        fdatasync(fd);
+        ::close(fd);
+        fd = -1;
+    }
+
+    char from[sizeof(path) + 8];
+    char to[sizeof(path) + 8];
+    if (files > 0) {
+        snprintf(from, sizeof(from), "%s.%u", path, files);
+        unlink(from);
+        for (int i = files - 1; i >= 1; i--) {
+            snprintf(from, sizeof(from), "%s.%d", path, i);
+            snprintf(to, sizeof(to), "%s.%d", path, i + 1);
+            rename(from, to);
+        }
+        snprintf(to, sizeof(to), "%s.1", path);
+        rename(path, to);
+    }
+    openFile();
+}
+
+LinuxCaptureStream::LinuxCaptureStream(Stream* source, LinuxCapture* capture, uint8_t port)
+    : source(source), capture(capture), port(port), decoder(nullptr), frameCount(0),
+      chunkLength(0), chunkTime(0) {
+}
+
+LinuxCaptureStream::~LinuxCaptureStream() {
+    flushCapture();
+}
+
+void LinuxCaptureStream::setDecoder(VBUSDecoder* frameDecoder) {
+    decoder = frameDecoder;
+    frameCount = decoder ? decoder->getFrameCount() : 0;
+}
+
+// Frames completed by the previous loop() of the decoder are noticed
+// here. A data record ends once the source is drained
+int LinuxCaptureStream::available() {
+    checkFrames();
+    int count = source->available();
+    if (count <= 0) flushCapture();
+    return count;
+}
+
+int LinuxCaptureStream::read() {
+    int data = source->read();
+    if (data < 0) return data;
+
+    uint64_t time = LinuxCapture::now();
+    if (chunkLength == CAPTURE_CHUNK_SIZE || (chunkLength > 0 && time - chunkTime > CAPTURE_CHUNK_US)) {
+        flushCapture();
+    }
+    if (chunkLength == 0) chunkTime = time;
+    chunk[chunkLength++] = data;
+    return data;
+}
+
+size_t LinuxCaptureStream::write(uint8_t data) {
+    return source->write(data);
+}
+
+size_t LinuxCaptureStream::write(const uint8_t *buffer, size_t size) {
+    return source->write(buffer, size);
+}
+
+void LinuxCaptureStream::flush() {
+    source->flush();
+}
+
+void LinuxCaptureStream::flushCapture() {
+    if (chunkLength == 0) return;
+    capture->data(port, chunk, chunkLength, chunkTime);
+    chunkLength = 0;
+}
+
+void LinuxCaptureStream::checkFrames() {
+    if (!decoder || decoder->getFrameCount() == frameCount) return;
+    flushCapture();
+    frameCount = decoder->getFrameCount();
+    capture->frame(port, frameCount, LinuxCapture::now());
+}
+
+LinuxCaptureReader::LinuxCaptureReader() : file(NULL), startTime(0), wallTime(0), time(0) {
+}
+
+LinuxCaptureReader::~LinuxCaptureReader() {
+    close();
+}
+
+bool LinuxCaptureReader::open(const char* path) {
+    close();
+    file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Error opening capture %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[CAPTURE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, CAPTURE_MAGIC, 4) != 0 || get16(header + 4) != CAPTURE_VERSION ||
+        get16(header + 6) < CAPTURE_HEADER_SIZE) {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        close();
+        return false;
+    }
+    fseek(file, get16(header + 6), SEEK_SET);
+    startTime = get64(header + 8);
+    wallTime = get64(header + 16);
+    time = startTime;
+    return true;
+}
+
+void LinuxCaptureReader::close() {
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+bool LinuxCaptureReader::next(CaptureRecord& record) {
+    uint8_t header[CAPTURE_RECORD_SIZE];
+    if (!file || fread(header, 1, sizeof(header), file) != sizeof(header)) return false;
+
+    record.type = header[0];
+    record.port = header[1];
+    record.length = get16(header + 2);
+    if (fread(payload, 1, record.length, file) != record.length) return false;
+    record.payload = payload;
+
+    time += (int32_t)get32(header + 4);
+    if (record.type == CAPTURE_TIME && record.length >= 8) time = get64(payload);
+    record.time = time;
+    return true;
+}
@@ -8,8 +8,29 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
+#include <linux/serial.h>
 
-LinuxSerial::LinuxSerial() : fd(-1) {
+// termios2 from <asm/termbits.h>, which cannot be included together with
+// <termios.h>. The layout is the one of all architectures defining TCGETS2
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+LinuxSerial::LinuxSerial() : fd(-1), lowLatency(false), blocking(false),
+    oldLatencyTimer(-1), pending(0), charTime(0), lastArrival(0),
+    reads(0), bytes(0), jitter(0), maxGap(0) {
+    name[0] = '\0';
 }
 
 LinuxSerial::~LinuxSerial() {
@@ -24,6 +45,12 @@ bool LinuxSerial::begin(const char* port, unsigned long baud, uint8_t config) {
         return false;
     }
     
+    // Device name for sysfs, also behind /dev/serial/by-id links
+    char* resolved = realpath(port, NULL);
+    const char* slash = strrchr(resolved ? resolved : port, '/');
+    snprintf(name, sizeof(name), "%s", slash ? slash + 1 : (resolved ? resolved : port));
+    free(resolved);
+
     // Save old terminal settings
     if (tcgetattr(fd, &oldtio) < 0) {
         fprintf(stderr, "Error getting terminal attributes: %s\n", strerror(errno));
@@ -44,12 +71,16 @@ bool LinuxSerial::begin(const char* port, unsigned long baud, uint8_t config) {
 
 void LinuxSerial::end() {
     if (fd >= 0) {
+        setLowLatency(false);
         tcsetattr(fd, TCSANOW, &oldtio);
         close(fd);
         fd = -1;
+        blocking = false;
+        pending = 0;
     }
 }
 
+// Bytes are counted as arrived when available() first sees them
 int LinuxSerial::available() {
     if (fd < 0) return 0;
     
@@ -57,19 +88,35 @@ int LinuxSerial::available() {
     if (ioctl(fd, FIONREAD, &bytes_available) < 0) {
         return 0;
     }
+    if ((size_t)bytes_available > pending) {
+        recordArrival(bytes_available - pending, micros());
+    }
+    pending = bytes_available;
     return bytes_available;
 }
 
 int LinuxSerial::read() {
     if (fd < 0) return -1;
+    // Stream reads never wait, also with a read timeout set
+    if (blocking && available() <= 0) return -1;
     
     uint8_t data;
     ssize_t n = ::read(fd, &data, 1);
     if (n <= 0) return -1;
+    if (pending > 0) pending--;
     
     return data;
 }
 
+size_t LinuxSerial::read(uint8_t* buffer, size_t size) {
+    if (fd < 0) return 0;
+
+    ssize_t n = ::read(fd, buffer, size);
+    if (n <= 0) return 0;
+    pending = pending > (size_t)n ? pending - n : 0;
+    return n;
+}
+
 size_t LinuxSerial::write(uint8_t data) {
     if (fd < 0) return 0;
     
@@ -90,18 +137,135 @@ void LinuxSerial::flush() {
     }
 }
 
+// A batch read that waits has to run on a blocking descriptor; VMIN and
+// VTIME are ignored with O_NONBLOCK
+bool LinuxSerial::setReadTimeout(uint8_t vmin, uint8_t vtime) {
+    if (fd < 0) return false;
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0) return false;
+    tio.c_cc[VMIN] = vmin;
+    tio.c_cc[VTIME] = vtime;
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+        fprintf(stderr, "Error setting read timeout: %s\n", strerror(errno));
+        return false;
+    }
+    blocking = vmin > 0 || vtime > 0;
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+    return true;
+}
+
+// ASYNC_LOW_LATENCY makes the tty layer push received bytes to readers
+// right away. USB adapters collect bytes until their latency timer runs
+// out; FTDI exposes that timer in sysfs, set back by setLowLatency(false)
+bool LinuxSerial::setLowLatency(bool enable) {
+    if (fd < 0) return false;
+    if (enable == lowLatency) return true;
+
+    bool applied = false;
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+        if (enable) serial.flags |= ASYNC_LOW_LATENCY;
+        else serial.flags &= ~ASYNC_LOW_LATENCY;
+        applied = ioctl(fd, TIOCSSERIAL, &serial) == 0;
+    }
+    if (enable) {
+        oldLatencyTimer = latencyTimer(SERIAL_LATENCY_TIMER);
+        applied |= oldLatencyTimer >= 0;
+    } else if (oldLatencyTimer >= 0) {
+        latencyTimer(oldLatencyTimer);
+        oldLatencyTimer = -1;
+    }
+    lowLatency = enable && applied;
+    return applied;
+}
+
+// Writes the latency timer of a USB adapter in ms, returns the previous
+// value or -1 if the adapter has none or it is not writable
+int LinuxSerial::latencyTimer(int value) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer", name);
+    FILE* file = fopen(path, "r+");
+    if (!file) return -1;
+
+    int previous = -1;
+    if (fscanf(file, "%d", &previous) == 1) {
+        rewind(file);
+        if (fprintf(file, "%d\n", value) < 0 || fflush(file) != 0) previous = -1;
+    }
+    fclose(file);
+    return previous;
+}
+
+void LinuxSerial::recordArrival(size_t count, unsigned long time) {
+    if (count == 0) return;
+
+    unsigned long gap = time - lastArrival;
+    bool burst = reads.load(std::memory_order_relaxed) > 0 && gap < SERIAL_BURST_GAP;
+    lastArrival = time;
+    reads.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(count, std::memory_order_relaxed);
+    if (!burst) return;   // First bytes after a pause, their wait is unknown
+    if (gap > maxGap.load(std::memory_order_relaxed)) {
+        maxGap.store(gap, std::memory_order_relaxed);
+    }
+
+    // The first byte came gap after the previous one, the others of this
+    // read right with it. The estimate is kept scaled by 16
+    unsigned long scaled = jitter.load(std::memory_order_relaxed);
+    unsigned long deviation = gap > charTime ? gap - charTime : charTime - gap;
+    scaled += deviation - scaled / 16;
+    for (size_t i = 1; i < count && i < 64; i++) {
+        scaled += charTime - scaled / 16;
+    }
+    jitter.store(scaled, std::memory_order_relaxed);
+}
+
+SerialTiming LinuxSerial::getTiming() const {
+    SerialTiming timing;
+    timing.reads = reads.load(std::memory_order_relaxed);
+    timing.bytes = bytes.load(std::memory_order_relaxed);
+    timing.charTime = charTime;
+    timing.jitter = jitter.load(std::memory_order_relaxed) / 16;
+    timing.maxGap = maxGap.load(std::memory_order_relaxed);
+    return timing;
+}
+
+// 0 for rates without a constant, see setCustomBaudRate()
 speed_t LinuxSerial::getBaudRate(unsigned long baud) {
     switch(baud) {
+        case 1200: return B1200;
+        case 2400: return B2400;
         case 4800: return B4800;
         case 9600: return B9600;
         case 19200: return B19200;
         case 38400: return B38400;
         case 57600: return B57600;
         case 115200: return B115200;
-        default: return B9600;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return 0;
     }
 }
 
+bool LinuxSerial::setCustomBaudRate(unsigned long baud) {
+#ifdef TCGETS2
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) == 0) {
+        tio.c_cflag = (tio.c_cflag & ~CBAUD) | BOTHER;
+        tio.c_ispeed = baud;
+        tio.c_ospeed = baud;
+        if (ioctl(fd, TCSETS2, &tio) == 0) return true;
+    }
+    fprintf(stderr, "Error setting baud rate %lu: %s\n", baud, strerror(errno));
+#else
+    fprintf(stderr, "Baud rate %lu is not supported\n", baud);
+#endif
+    return false;
+}
+
 bool LinuxSerial::configure(unsigned long baud, uint8_t config) {
     struct termios newtio;
     memset(&newtio, 0, sizeof(newtio));
@@ -146,10 +310,10 @@ bool LinuxSerial::configure(unsigned long baud, uint8_t config) {
     newtio.c_cc[VTIME] = 0;  // Non-blocking
     newtio.c_cc[VMIN] = 0;
     
-    // Set baud rate
+    // Set baud rate, non-standard rates after the other settings
     speed_t speed = getBaudRate(baud);
-    cfsetispeed(&newtio, speed);
-    cfsetospeed(&newtio, speed);
+    cfsetispeed(&newtio, speed ? speed : B38400);
+    cfsetospeed(&newtio, speed ? speed : B38400);
     
     // Flush and apply settings
     tcflush(fd, TCIFLUSH);
@@ -157,6 +321,12 @@ bool LinuxSerial::configure(unsigned long baud, uint8_t config) {
         fprintf(stderr, "Error setting terminal attributes: %s\n", strerror(errno));
         return false;
     }
+    if (!speed && !setCustomBaudRate(baud)) return false;
+    
+    // Start, data, parity and stop bits of one character
+    unsigned long bits = 10 + (parity ? 1 : 0) + (stopbits == 0x01 ? 1 : 0);
+    charTime = baud ? bits * 1000000UL / baud : 0;
+    pending = 0;
     
     return true;
 }
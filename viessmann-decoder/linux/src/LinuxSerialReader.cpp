@@ -0,0 +1,137 @@
+/*
+ * Linux serial reader thread implementation
+ */
+
+#include "LinuxSerialReader.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+LinuxSerialReader::LinuxSerialReader(LinuxSerial* serial)
+    : serial(serial), running(false), stopping(false), failed(false), eventFd(-1),
+      head(0), tail(0), lastArrival(0), overflow(0), highWater(0) {
+}
+
+LinuxSerialReader::~LinuxSerialReader() {
+    stop();
+}
+
+bool LinuxSerialReader::start() {
+    if (running) return true;
+    if (!serial || !serial->isOpen()) return false;
+
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0) {
+        fprintf(stderr, "Error creating serial reader event: %s\n", strerror(errno));
+        return false;
+    }
+    stopping = false;
+    failed = false;
+    if (pthread_create(&thread, NULL, &LinuxSerialReader::readThread, this) != 0) {
+        fprintf(stderr, "Error starting serial reader thread\n");
+        close(eventFd);
+        eventFd = -1;
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void LinuxSerialReader::stop() {
+    if (running) {
+        stopping = true;
+        pthread_join(thread, NULL);
+        running = false;
+    }
+    if (eventFd >= 0) {
+        close(eventFd);
+        eventFd = -1;
+    }
+}
+
+int LinuxSerialReader::available() {
+    return (int)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed));
+}
+
+int LinuxSerialReader::read() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return -1;
+
+    size_t index = t & (SERIAL_READER_RING_SIZE - 1);
+    uint8_t data = ring[index];
+    lastArrival = arrival[index];
+    tail.store(t + 1, std::memory_order_release);
+    return data;
+}
+
+size_t LinuxSerialReader::write(uint8_t data) {
+    return serial->write(data);
+}
+
+size_t LinuxSerialReader::write(const uint8_t *buffer, size_t size) {
+    return serial->write(buffer, size);
+}
+
+void LinuxSerialReader::flush() {
+    serial->flush();
+}
+
+void LinuxSerialReader::acknowledge() {
+    uint64_t count;
+    if (eventFd >= 0) (void)::read(eventFd, &count, sizeof(count));
+}
+
+void* LinuxSerialReader::readThread(void* arg) {
+    ((LinuxSerialReader*)arg)->readLoop();
+    return NULL;
+}
+
+void LinuxSerialReader::signal() {
+    uint64_t one = 1;
+    (void)::write(eventFd, &one, sizeof(one));
+}
+
+// The port keeps draining while the ring is full: the bytes that do not fit
+// are counted, instead of the kernel dropping them unnoticed
+void LinuxSerialReader::readLoop() {
+    uint8_t chunk[SERIAL_READER_CHUNK_SIZE];
+    int fd = serial->getFd();
+
+    while (!stopping.load(std::memory_order_relaxed)) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, SERIAL_READER_POLL_MS);
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
+
+        ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) break;   // Hangup (0) or I/O error, e.g. the adapter was unplugged
+        unsigned long now = micros();
+        serial->recordArrival(n, now);
+
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t used = h - tail.load(std::memory_order_acquire);
+        size_t count = (size_t)n;
+        if (count > SERIAL_READER_RING_SIZE - used) {
+            overflow.fetch_add(count - (SERIAL_READER_RING_SIZE - used), std::memory_order_relaxed);
+            count = SERIAL_READER_RING_SIZE - used;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t index = (h + i) & (SERIAL_READER_RING_SIZE - 1);
+            ring[index] = chunk[i];
+            arrival[index] = now;
+        }
+        head.store(h + count, std::memory_order_release);
+        if (used + count > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(used + count, std::memory_order_relaxed);
+        }
+        signal();
+    }
+
+    if (!stopping.load(std::memory_order_relaxed)) {
+        failed.store(true, std::memory_order_release);
+        signal();
+    }
+}
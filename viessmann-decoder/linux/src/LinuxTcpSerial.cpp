@@ -0,0 +1,486 @@
+/*
+ * Linux TCP serial port implementation
+ */
+
+#include "LinuxTcpSerial.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Telnet (RFC 854) commands and options
+#define TELNET_SE       240
+#define TELNET_SB       250
+#define TELNET_WILL     251
+#define TELNET_WONT     252
+#define TELNET_DO       253
+#define TELNET_DONT     254
+#define TELNET_IAC      255
+#define TELNET_BINARY   0
+#define TELNET_SGA      3
+#define TELNET_COM_PORT 44
+
+// RFC 2217 client-to-server sub-options; the server answers with +100
+#define COM_PORT_SET_BAUDRATE 1
+#define COM_PORT_SET_DATASIZE 2
+#define COM_PORT_SET_PARITY   3
+#define COM_PORT_SET_STOPSIZE 4
+#define COM_PORT_REPLY        100
+
+// Parser states
+#define TELNET_STATE_DATA    0
+#define TELNET_STATE_IAC     1
+#define TELNET_STATE_OPTION  2
+#define TELNET_STATE_SUB     3
+#define TELNET_STATE_SUB_IAC 4
+
+// optionsSent bits
+#define TELNET_SENT_WILL_COM_PORT 0x01
+#define TELNET_SENT_WILL_BINARY   0x02
+#define TELNET_SENT_DO_BINARY     0x04
+#define TELNET_SENT_WILL_SGA      0x08
+#define TELNET_SENT_DO_SGA        0x10
+
+LinuxTcpSerial::LinuxTcpSerial() :
+    fd(-1),
+    connState(TCP_SERIAL_DISCONNECTED),
+    port(0),
+    rfc2217(false),
+    baud(9600),
+    config(SERIAL_8N1),
+    inStart(0),
+    inLength(0),
+    outLength(0),
+    connectStarted(0),
+    failedAt(0),
+    retryDelay(0),
+    backoff(TCP_SERIAL_BACKOFF_MIN),
+    reconnects(0),
+    received(false),
+    telnetState(TELNET_STATE_DATA),
+    telnetCommand(0),
+    subLength(0),
+    optionsSent(0),
+    negotiated(false) {
+    host[0] = '\0';
+}
+
+LinuxTcpSerial::~LinuxTcpSerial() {
+    end();
+}
+
+bool LinuxTcpSerial::isUrl(const char* port) {
+    return port && (strncmp(port, "tcp://", 6) == 0 || strncmp(port, "rfc2217://", 10) == 0);
+}
+
+bool LinuxTcpSerial::begin(const char* url, unsigned long baudRate, uint8_t serialConfig) {
+    end();
+    if (!isUrl(url)) return false;
+    rfc2217 = strncmp(url, "rfc2217://", 10) == 0;
+    const char* address = strstr(url, "://") + 3;
+
+    // host:port, IPv6 addresses in brackets
+    const char* colon = strrchr(address, ':');
+    if (!colon || colon == address || atoi(colon + 1) <= 0 || atoi(colon + 1) > 65535) {
+        fprintf(stderr, "TCP serial: expected %s://host:port, got %s\n", rfc2217 ? "rfc2217" : "tcp", url);
+        return false;
+    }
+    const char* hostStart = address;
+    size_t hostLength = colon - address;
+    if (*address == '[' && colon[-1] == ']') {
+        hostStart++;
+        hostLength -= 2;
+    }
+    if (hostLength == 0 || hostLength >= sizeof(host)) return false;
+    memcpy(host, hostStart, hostLength);
+    host[hostLength] = '\0';
+    port = (uint16_t)atoi(colon + 1);
+    baud = baudRate;
+    config = serialConfig;
+
+    backoff = TCP_SERIAL_BACKOFF_MIN;
+    reconnects = 0;
+    if (!openSocket()) closeSocket(true);
+    return true;
+}
+
+void LinuxTcpSerial::end() {
+    closeSocket(false);
+    host[0] = '\0';
+}
+
+int LinuxTcpSerial::available() {
+    loop();
+    return inLength - inStart;
+}
+
+int LinuxTcpSerial::read() {
+    if (inStart == inLength) loop();
+    if (inStart == inLength) return -1;
+    return inBuffer[inStart++];
+}
+
+size_t LinuxTcpSerial::read(uint8_t* buffer, size_t size) {
+    if (inStart == inLength) loop();
+    size_t count = inLength - inStart;
+    if (count > size) count = size;
+    memcpy(buffer, inBuffer + inStart, count);
+    inStart += count;
+    return count;
+}
+
+size_t LinuxTcpSerial::write(uint8_t data) {
+    return write(&data, 1);
+}
+
+// With RFC 2217 a 0xFF data byte is sent as IAC IAC
+size_t LinuxTcpSerial::write(const uint8_t *buffer, size_t size) {
+    if (connState != TCP_SERIAL_CONNECTED) return 0;
+
+    size_t written = 0;
+    for (; written < size; written++) {
+        bool escape = rfc2217 && buffer[written] == TELNET_IAC;
+        if (outLength + (escape ? 2 : 1) > TCP_SERIAL_OUTPUT_SIZE) break;
+        if (escape) outBuffer[outLength++] = TELNET_IAC;
+        outBuffer[outLength++] = buffer[written];
+    }
+    flushOutput();
+    return written;
+}
+
+void LinuxTcpSerial::flush() {
+    flushOutput();
+}
+
+bool LinuxTcpSerial::wantsWrite() const {
+    return connState == TCP_SERIAL_CONNECTING || (connState == TCP_SERIAL_CONNECTED && outLength > 0);
+}
+
+void LinuxTcpSerial::loop() {
+    if (host[0] == '\0') return;
+
+    if (connState == TCP_SERIAL_DISCONNECTED) {
+        if (millis() - failedAt < retryDelay) return;
+        if (!openSocket()) {
+            closeSocket(true);
+            return;
+        }
+    }
+
+    if (connState == TCP_SERIAL_CONNECTING) {
+        if (millis() - connectStarted > TCP_SERIAL_CONNECT_TIMEOUT) {
+            fprintf(stderr, "TCP serial: connection to %s:%u timed out\n", host, port);
+            closeSocket(true);
+            return;
+        }
+        if (!checkConnect()) return;
+    }
+
+    if (readInput()) flushOutput();
+}
+
+// Private methods
+
+bool LinuxTcpSerial::openSocket() {
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    // Name resolution is the one blocking step, as for the MQTT client
+    struct addrinfo* result = nullptr;
+    int err = getaddrinfo(host, service, &hints, &result);
+    if (err != 0) {
+        fprintf(stderr, "TCP serial: cannot resolve %s: %s\n", host, gai_strerror(err));
+        return false;
+    }
+
+    for (struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+
+        // Requests of the polling protocols go out at once; a server that
+        // vanished is noticed within about a minute of silence
+        int one = 1;
+        int idle = TCP_SERIAL_KEEPALIVE;
+        int interval = 10;
+        int count = 3;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            connState = TCP_SERIAL_CONNECTING;
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        fprintf(stderr, "TCP serial: cannot connect to %s:%u: %s\n", host, port, strerror(errno));
+        return false;
+    }
+    connectStarted = millis();
+    return true;
+}
+
+// retry schedules the next attempt, doubling the delay each time until
+// data arrives again
+void LinuxTcpSerial::closeSocket(bool retry) {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (retry) {
+        if (connState == TCP_SERIAL_CONNECTED) reconnects++;
+        failedAt = millis();
+        retryDelay = backoff;
+        backoff = backoff * 2 < TCP_SERIAL_BACKOFF_MAX ? backoff * 2 : TCP_SERIAL_BACKOFF_MAX;
+    }
+    connState = TCP_SERIAL_DISCONNECTED;
+    inStart = 0;
+    inLength = 0;
+    outLength = 0;
+    received = false;
+    telnetState = TELNET_STATE_DATA;
+    subLength = 0;
+    optionsSent = 0;
+    negotiated = false;
+}
+
+// Finish a non-blocking connect; false while it is still in progress
+bool LinuxTcpSerial::checkConnect() {
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    if (poll(&pfd, 1, 0) <= 0) return false;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        fprintf(stderr, "TCP serial: cannot connect to %s:%u: %s\n", host, port, strerror(error ? error : errno));
+        closeSocket(true);
+        return false;
+    }
+
+    connState = TCP_SERIAL_CONNECTED;
+    printf("TCP serial: connected to %s:%u\n", host, port);
+    if (rfc2217) {
+        // Line settings follow once the server answered DO COM-PORT-OPTION
+        const uint8_t offer[] = {
+            TELNET_IAC, TELNET_WILL, TELNET_COM_PORT,
+            TELNET_IAC, TELNET_WILL, TELNET_BINARY,
+            TELNET_IAC, TELNET_DO, TELNET_BINARY
+        };
+        queue(offer, sizeof(offer));
+        optionsSent = TELNET_SENT_WILL_COM_PORT | TELNET_SENT_WILL_BINARY | TELNET_SENT_DO_BINARY;
+    }
+    return true;
+}
+
+bool LinuxTcpSerial::flushOutput() {
+    if (outLength == 0 || connState != TCP_SERIAL_CONNECTED) return true;
+
+    ssize_t n = send(fd, outBuffer, outLength, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return true;
+        fprintf(stderr, "TCP serial: write to %s:%u failed: %s\n", host, port, strerror(errno));
+        closeSocket(true);
+        return false;
+    }
+
+    outLength -= n;
+    if (outLength > 0) memmove(outBuffer, outBuffer + n, outLength);
+    return true;
+}
+
+// Reads until the socket is drained or the buffer is full; a full buffer
+// leaves the rest to TCP flow control
+bool LinuxTcpSerial::readInput() {
+    uint8_t chunk[1024];
+
+    while (true) {
+        if (inStart == inLength) {
+            inStart = 0;
+            inLength = 0;
+        } else if (inStart > 0 && inLength == TCP_SERIAL_BUFFER_SIZE) {
+            memmove(inBuffer, inBuffer + inStart, inLength - inStart);
+            inLength -= inStart;
+            inStart = 0;
+        }
+        size_t space = TCP_SERIAL_BUFFER_SIZE - inLength;
+        if (space == 0) return true;
+
+        // Raw data goes straight into the buffer, telnet data is parsed
+        // from a chunk (parsing never makes it longer)
+        uint8_t* target = rfc2217 ? chunk : inBuffer + inLength;
+        if (rfc2217 && space > sizeof(chunk)) space = sizeof(chunk);
+        ssize_t n = recv(fd, target, space, MSG_DONTWAIT);
+        if (n == 0) {
+            fprintf(stderr, "TCP serial: %s:%u closed the connection\n", host, port);
+            closeSocket(true);
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return true;
+            fprintf(stderr, "TCP serial: read from %s:%u failed: %s\n", host, port, strerror(errno));
+            closeSocket(true);
+            return false;
+        }
+
+        if (!received) {
+            received = true;
+            backoff = TCP_SERIAL_BACKOFF_MIN;
+        }
+        if (rfc2217) {
+            parseTelnet(chunk, n);
+        } else {
+            inLength += n;
+        }
+    }
+}
+
+void LinuxTcpSerial::queue(const uint8_t* data, size_t length) {
+    if (outLength + length > TCP_SERIAL_OUTPUT_SIZE) return;
+    memcpy(outBuffer + outLength, data, length);
+    outLength += length;
+}
+
+// Data bytes go to inBuffer, commands are answered
+void LinuxTcpSerial::parseTelnet(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = data[i];
+        switch (telnetState) {
+            case TELNET_STATE_DATA:
+                if (c == TELNET_IAC) telnetState = TELNET_STATE_IAC;
+                else inBuffer[inLength++] = c;
+                break;
+            case TELNET_STATE_IAC:
+                if (c == TELNET_IAC) {
+                    inBuffer[inLength++] = c;
+                    telnetState = TELNET_STATE_DATA;
+                } else if (c >= TELNET_WILL) {
+                    telnetCommand = c;
+                    telnetState = TELNET_STATE_OPTION;
+                } else if (c == TELNET_SB) {
+                    subLength = 0;
+                    telnetState = TELNET_STATE_SUB;
+                } else {
+                    telnetState = TELNET_STATE_DATA;    // NOP, GA and the like
+                }
+                break;
+            case TELNET_STATE_OPTION:
+                handleOption(telnetCommand, c);
+                telnetState = TELNET_STATE_DATA;
+                break;
+            case TELNET_STATE_SUB:
+                if (c == TELNET_IAC) telnetState = TELNET_STATE_SUB_IAC;
+                else if (subLength < sizeof(subOption)) subOption[subLength++] = c;
+                break;
+            case TELNET_STATE_SUB_IAC:
+                if (c == TELNET_SE) {
+                    handleSubOption();
+                    telnetState = TELNET_STATE_DATA;
+                } else {
+                    if (subLength < sizeof(subOption)) subOption[subLength++] = c;
+                    telnetState = TELNET_STATE_SUB;
+                }
+                break;
+        }
+    }
+}
+
+// Binary mode and suppress-go-ahead are accepted, COM-PORT-OPTION is what
+// the connection is for; everything else is refused
+void LinuxTcpSerial::handleOption(uint8_t command, uint8_t option) {
+    uint8_t reply[3] = { TELNET_IAC, 0, option };
+    if (command == TELNET_DO) {
+        uint8_t sent = option == TELNET_COM_PORT ? TELNET_SENT_WILL_COM_PORT :
+                       option == TELNET_BINARY ? TELNET_SENT_WILL_BINARY :
+                       option == TELNET_SGA ? TELNET_SENT_WILL_SGA : 0;
+        if (sent == 0) {
+            reply[1] = TELNET_WONT;
+            queue(reply, sizeof(reply));
+        } else if (!(optionsSent & sent)) {
+            reply[1] = TELNET_WILL;
+            queue(reply, sizeof(reply));
+            optionsSent |= sent;
+        }
+        if (option == TELNET_COM_PORT) sendComPortSettings();
+    } else if (command == TELNET_WILL) {
+        uint8_t sent = option == TELNET_BINARY ? TELNET_SENT_DO_BINARY :
+                       option == TELNET_SGA ? TELNET_SENT_DO_SGA : 0;
+        if (sent == 0) {
+            reply[1] = TELNET_DONT;
+            queue(reply, sizeof(reply));
+        } else if (!(optionsSent & sent)) {
+            reply[1] = TELNET_DO;
+            queue(reply, sizeof(reply));
+            optionsSent |= sent;
+        }
+    } else if (command == TELNET_DONT && option == TELNET_COM_PORT) {
+        fprintf(stderr, "TCP serial: %s:%u does not support RFC 2217, line settings unchanged\n", host, port);
+    }
+}
+
+void LinuxTcpSerial::handleSubOption() {
+    if (subLength >= 6 && subOption[0] == TELNET_COM_PORT &&
+        subOption[1] == COM_PORT_REPLY + COM_PORT_SET_BAUDRATE) {
+        unsigned long confirmed = ((unsigned long)subOption[2] << 24) | ((unsigned long)subOption[3] << 16) |
+                                  ((unsigned long)subOption[4] << 8) | subOption[5];
+        negotiated = confirmed == baud;
+        if (!negotiated) {
+            fprintf(stderr, "TCP serial: %s:%u set %lu baud instead of %lu\n", host, port, confirmed, baud);
+        }
+    }
+}
+
+// Same config bits as LinuxSerial: parity in bits 2-3, stop bits in 4-5
+void LinuxTcpSerial::sendComPortSettings() {
+    uint8_t parity = (config >> 2) & 0x03;
+    uint8_t stopBits = ((config >> 4) & 0x03) == 0x01 ? 2 : 1;
+    uint8_t values[4] = {
+        (uint8_t)(baud >> 24), (uint8_t)(baud >> 16), (uint8_t)(baud >> 8), (uint8_t)baud
+    };
+
+    uint8_t message[40];
+    size_t length = 0;
+    const uint8_t start[] = { TELNET_IAC, TELNET_SB, TELNET_COM_PORT };
+    const uint8_t end[] = { TELNET_IAC, TELNET_SE };
+
+    memcpy(message + length, start, 3); length += 3;
+    message[length++] = COM_PORT_SET_BAUDRATE;
+    for (uint8_t i = 0; i < 4; i++) {
+        message[length++] = values[i];
+        if (values[i] == TELNET_IAC) message[length++] = TELNET_IAC;
+    }
+    memcpy(message + length, end, 2); length += 2;
+
+    memcpy(message + length, start, 3); length += 3;
+    message[length++] = COM_PORT_SET_DATASIZE;
+    message[length++] = 8;
+    memcpy(message + length, end, 2); length += 2;
+
+    memcpy(message + length, start, 3); length += 3;
+    message[length++] = COM_PORT_SET_PARITY;
+    message[length++] = parity == 0x02 ? 3 : parity == 0x03 ? 2 : 1;    // Even 3, odd 2, none 1
+    memcpy(message + length, end, 2); length += 2;
+
+    memcpy(message + length, start, 3); length += 3;
+    message[length++] = COM_PORT_SET_STOPSIZE;
+    message[length++] = stopBits;
+    memcpy(message + length, end, 2); length += 2;
+
+    queue(message, length);
+}
@@ -35,14 +35,85 @@ if ! bashio::var.has_value "${SERIAL_CONFIG}"; then
     SERIAL_CONFIG="8N1"
 fi
 
+# MQTT: explicit broker settings win, otherwise use the Mosquitto add-on
+MQTT_ARGS=()
+if bashio::config.true 'mqtt_enabled'; then
+    if bashio::config.has_value 'mqtt_host'; then
+        MQTT_HOST=$(bashio::config 'mqtt_host')
+        MQTT_PORT=$(bashio::config 'mqtt_port' '1883')
+        MQTT_USER=$(bashio::config 'mqtt_user' '')
+        MQTT_PASSWORD=$(bashio::config 'mqtt_password' '')
+    elif bashio::services.available "mqtt"; then
+        MQTT_HOST=$(bashio::services mqtt "host")
+        MQTT_PORT=$(bashio::services mqtt "port")
+        MQTT_USER=$(bashio::services mqtt "username")
+        MQTT_PASSWORD=$(bashio::services mqtt "password")
+    fi
+
+    if bashio::var.has_value "${MQTT_HOST}"; then
+        MQTT_ARGS+=(-m "${MQTT_HOST}:${MQTT_PORT}")
+        MQTT_ARGS+=(-o "$(bashio::config 'mqtt_topic' 'viessmann')")
+        MQTT_ARGS+=(-M "$(bashio::config 'mqtt_publish_mode' 'changes')")
+        if bashio::var.has_value "${MQTT_USER}"; then
+            MQTT_ARGS+=(-u "${MQTT_USER}" -k "${MQTT_PASSWORD}")
+        fi
+        if bashio::config.false 'mqtt_discovery'; then
+            MQTT_ARGS+=(-D)
+        fi
+    else
+        bashio::log.warning "MQTT is enabled but no broker is configured or available"
+    fi
+fi
+
+# Serial reader thread and low-latency mode, off unless enabled
+SERIAL_ARGS=()
+if bashio::config.true 'serial_reader_thread'; then
+    SERIAL_ARGS+=(-R)
+fi
+if bashio::config.true 'serial_low_latency'; then
+    SERIAL_ARGS+=(-L)
+fi
+
+# Raw bus capture for offline replay
+CAPTURE_ARGS=()
+if bashio::config.has_value 'capture_file'; then
+    CAPTURE_ARGS+=(-r "$(bashio::config 'capture_file')")
+    if bashio::config.has_value 'capture_size'; then
+        CAPTURE_ARGS+=(-s "$(bashio::config 'capture_size')")
+    fi
+fi
+
+# Web server threading and connection limits, the binary's defaults otherwise
+HTTP_ARGS=()
+if bashio::config.has_value 'http_threads'; then
+    HTTP_ARGS+=(-T "$(bashio::config 'http_threads')")
+fi
+if bashio::config.has_value 'http_polling'; then
+    HTTP_ARGS+=(-P "$(bashio::config 'http_polling')")
+fi
+if bashio::config.has_value 'http_max_connections'; then
+    HTTP_ARGS+=(-C "$(bashio::config 'http_max_connections')")
+fi
+if bashio::config.has_value 'http_connections_per_ip'; then
+    HTTP_ARGS+=(-I "$(bashio::config 'http_connections_per_ip')")
+fi
+if bashio::config.has_value 'http_keepalive_timeout'; then
+    HTTP_ARGS+=(-K "$(bashio::config 'http_keepalive_timeout')")
+fi
+
 bashio::log.info "Starting Viessmann Decoder Webserver..."
 bashio::log.info "Serial Port: ${SERIAL_PORT}"
 bashio::log.info "Baud Rate: ${BAUD_RATE}"
 bashio::log.info "Protocol: ${PROTOCOL}"
 bashio::log.info "Serial Config: ${SERIAL_CONFIG}"
+if bashio::var.has_value "${MQTT_HOST}"; then
+    bashio::log.info "MQTT Broker: ${MQTT_HOST}:${MQTT_PORT}"
+fi
 
 # Check serial port availability (informational only - webserver will handle reconnection)
-if bashio::fs.file_exists "${SERIAL_PORT}"; then
+if [[ "${SERIAL_PORT}" == tcp://* || "${SERIAL_PORT}" == rfc2217://* ]]; then
+    bashio::log.info "Serial port ${SERIAL_PORT} is a network serial server"
+elif bashio::fs.file_exists "${SERIAL_PORT}"; then
     if exec 3<>"${SERIAL_PORT}" 2>/dev/null; then
         exec 3>&-
         bashio::log.info "Serial port ${SERIAL_PORT} is available"
@@ -68,4 +139,8 @@ exec viessmann_webserver \
     -b "${BAUD_RATE}" \
     -t "${PROTOCOL}" \
     -c "${SERIAL_CONFIG}" \
-    -w 8099
+    -w 8099 \
+    "${SERIAL_ARGS[@]}" \
+    "${CAPTURE_ARGS[@]}" \
+    "${MQTT_ARGS[@]}" \
+    "${HTTP_ARGS[@]}"
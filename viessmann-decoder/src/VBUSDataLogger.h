@@ -10,23 +10,80 @@
 #include <Arduino.h>
 #include "vbusdecoder.h"
 
-// Data point structure
+// Sampling modes
+enum LogMode: uint8_t {
+  LOG_MODE_INTERVAL = 0,     // Record a point every log interval (default)
+  LOG_MODE_CHANGE = 1        // Record a point when a decoded frame changes a value
+};
+
+// Widest schema the logger can record (matches the decoder channel arrays)
+#define VBUSLOG_MAX_TEMPS 32
+#define VBUSLOG_MAX_PUMPS 32
+#define VBUSLOG_MAX_RELAYS 32
+
+// Data point structure (unpacked view of a stored record)
 struct DataPoint {
-  uint32_t timestamp;      // Unix timestamp or millis()
-  float temperatures[8];   // Store up to 8 temperature sensors
-  uint8_t pumps[4];        // Store up to 4 pump power levels
-  bool relays[4];          // Store up to 4 relay states
-  uint16_t errorMask;      // Error mask
-  uint16_t heatQuantity;   // Heat quantity in Wh
+  uint32_t timestamp;                        // Unix timestamp or millis()
+  float temperatures[VBUSLOG_MAX_TEMPS];     // NAN if the sensor was unavailable
+  uint8_t pumps[VBUSLOG_MAX_PUMPS];          // Pump power levels
+  bool relays[VBUSLOG_MAX_RELAYS];           // Relay states
+  uint16_t errorMask;                        // Error mask
+  uint16_t heatQuantity;                     // Heat quantity in Wh
+  uint8_t kmMode;                            // KM-Bus operating mode (KM-Bus schemas only)
+};
+
+// Record layout, derived from the decoder in begin() or set explicitly.
+// Channels outside the schema are not stored at all.
+struct LogSchema {
+  uint8_t tempCount;       // Temperature channels per record
+  uint8_t pumpCount;       // Pump channels per record
+  uint8_t relayCount;      // Relay channels per record
+  bool kmBus;              // Record the KM-Bus operating mode
+  uint16_t recordSize;     // Packed record size in bytes
 };
 
+// Binary export format (see doc/DATA_LOGGER.md)
+#define VBUSLOG_BINARY_MAGIC "VBLG"
+#define VBUSLOG_BINARY_VERSION 1
+#define VBUSLOG_TEMP_INVALID ((int16_t)0x8000)  // Encoded marker for unavailable sensors
+
+// Channel kinds described in the binary schema header
+enum LogChannelKind: uint8_t {
+  LOG_CHANNEL_TEMPERATURE = 1,
+  LOG_CHANNEL_PUMP = 2,
+  LOG_CHANNEL_RELAY = 3,
+  LOG_CHANNEL_ERROR_MASK = 4,
+  LOG_CHANNEL_HEAT_QUANTITY = 5,
+  LOG_CHANNEL_KM_MODE = 6
+};
+
+// Value encodings used in binary records (all multi-byte values little-endian)
+enum LogChannelEncoding: uint8_t {
+  LOG_ENCODING_INT16 = 1,    // Signed 16 bit, multiply by scale
+  LOG_ENCODING_UINT8 = 2,    // Unsigned 8 bit, multiply by scale
+  LOG_ENCODING_BITS = 3,     // One bit per channel, packed LSB first
+  LOG_ENCODING_UINT16 = 4    // Unsigned 16 bit, multiply by scale
+};
+
+// One downsampled step of a channel, see getSeries()
+struct LogBucket {
+  uint32_t timestamp;      // Start of the bucket, a multiple of the step
+  uint16_t samples;        // Points with a valid value, 0 if the sensor was unavailable
+  float min;
+  float max;
+  float avg;               // For relays the fraction of points with the relay on
+};
+
+// Timestamp source in seconds; the default is VBUSClock::now() / 1000
+typedef uint32_t (*LogClock)();
+
 // Statistical data
 struct DataStats {
-  float tempMin[8];
-  float tempMax[8];
-  float tempAvg[8];
-  uint32_t pumpRuntime[4];
-  uint32_t relayRuntime[4];
+  float tempMin[VBUSLOG_MAX_TEMPS];
+  float tempMax[VBUSLOG_MAX_TEMPS];
+  float tempAvg[VBUSLOG_MAX_TEMPS];
+  uint32_t pumpRuntime[VBUSLOG_MAX_PUMPS];
+  uint32_t relayRuntime[VBUSLOG_MAX_RELAYS];
   uint32_t totalHeat;
 };
 
@@ -39,21 +96,42 @@ class VBUSDataLogger {
     void begin();
     void setLogInterval(uint32_t intervalSeconds);
     void setMaxDataPoints(uint16_t maxPoints);
+    void setSchema(uint8_t tempCount, uint8_t pumpCount, uint8_t relayCount, bool kmBus = false);
+    LogSchema getSchema();
+    uint32_t getLogInterval();
+    void setClock(LogClock clock);          // e.g. Unix time once NTP is synced
+    void setDecoder(VBUSDecoder* decoder);  // After a reconnect; keeps the recorded points
+    
+    // Change-driven sampling
+    void setLogMode(LogMode mode);
+    LogMode getLogMode();
+    void setTemperatureDeadband(float deadband);
+    void setTemperatureDeadband(uint8_t channel, float deadband);
+    void setPumpDeadband(uint8_t deadband);
+    void setMaxGap(uint32_t seconds);
     
     // Logging control
     void loop();
     void logNow();
+    void onFrame();
     void clear();
     void pause();
     void resume();
     bool isPaused();
     
-    // Data access
+    // Data access (returned pointers stay valid until the next call)
     uint16_t getDataPointCount();
     DataPoint* getDataPoint(uint16_t index);
     DataPoint* getLatestDataPoint();
     DataPoint* getOldestDataPoint();
     
+    // Downsampling: one bucket per step seconds between startTime and
+    // endTime, for one channel (channel is ignored for single-value kinds).
+    // Buckets without any point are skipped. Returns the number of buckets
+    // written; timestamps must not go backwards for the range lookup
+    uint16_t getSeries(LogChannelKind kind, uint8_t channel, uint32_t startTime, uint32_t endTime,
+                       uint32_t step, LogBucket* buckets, uint16_t maxBuckets);
+    
     // Statistics
     DataStats getStatistics(uint32_t startTime, uint32_t endTime);
     DataStats getStatisticsLastHours(uint8_t hours);
@@ -62,21 +140,56 @@ class VBUSDataLogger {
     // Export
     String exportCSV(uint32_t startTime, uint32_t endTime);
     String exportJSON(uint32_t startTime, uint32_t endTime);
+    size_t exportBinary(uint32_t startTime, uint32_t endTime, Stream* out);
+    size_t exportBinary(uint32_t startTime, uint32_t endTime, uint8_t* buffer, size_t bufferSize);
+    size_t getBinaryExportSize(uint32_t startTime, uint32_t endTime);
     
   private:
     VBUSDecoder* _decoder;
-    DataPoint* _buffer;
+    uint8_t* _storage;         // _bufferSize packed records of _schema.recordSize bytes
     uint16_t _bufferSize;
     uint16_t _writeIndex;
     uint16_t _count;
     uint32_t _logInterval;
     uint32_t _lastLog;
     bool _paused;
+    DataPoint _scratch;        // Backing store for getDataPoint()
+    
+    // Record layout
+    LogSchema _schema;
+    bool _schemaFixed;         // Set by setSchema(), not re-derived in begin()
+    uint8_t _pumpOffset;
+    uint8_t _relayOffset;
+    uint8_t _errorOffset;
+    
+    // Change-driven sampling state
+    LogMode _mode;
+    float _tempDeadband[VBUSLOG_MAX_TEMPS];
+    uint8_t _pumpDeadband;
+    uint32_t _maxGap;
+    uint32_t _lastFrameCount;
+    LogClock _clock;
     
     // Helper methods
-    void _addDataPoint(const DataPoint& point);
+    void _deriveSchema();
+    void _applySchema(uint8_t tempCount, uint8_t pumpCount, uint8_t relayCount, bool kmBus);
+    bool _ensureStorage();
+    void _addRecord(const uint8_t* record);
+    void _sampleRecord(uint8_t* record);
+    void _unpackRecord(const uint8_t* record, DataPoint& point);
+    bool _hasSignificantChange(const uint8_t* record, const uint8_t* last);
+    uint8_t* _recordAt(uint16_t index);
+    uint32_t _timestampAt(uint16_t index);
+    uint32_t _pointDuration(uint16_t index);
     uint16_t _getCircularIndex(uint16_t offset);
     void _calculateStats(DataStats& stats, uint16_t startIdx, uint16_t count);
+    uint16_t _countInRange(uint32_t startTime, uint32_t endTime);
+    uint16_t _lowerBound(uint32_t time);
+    bool _channelValue(const uint8_t* record, LogChannelKind kind, uint8_t channel, float& value);
+    uint32_t _now();
+    uint8_t _binaryChannelCount();
+    uint16_t _binaryHeaderSize();
+    uint16_t _encodeBinaryHeader(uint8_t* out, uint32_t recordCount);
 };
 
 #endif
@@ -3,29 +3,143 @@
  */
 
 #include "VBUSMqttClient.h"
+#include <stdarg.h>
 
-#if defined(ESP32) || defined(ESP8266)
+#if defined(ESP32) || defined(ESP8266) || defined(__linux__)
 
+#if defined(ESP32) || defined(ESP8266)
 VBUSMqttClient::VBUSMqttClient(VBUSDecoder* decoder, Client* networkClient) :
+#else
+VBUSMqttClient::VBUSMqttClient(VBUSDecoder* decoder) :
+#endif
   _decoder(decoder),
   _lastPublish(0),
-  _discoveryPublished(false)
+  _discoveryPublished(false),
+  _mode(MQTT_PUBLISH_PER_VALUE),
+  _tempDeadband(0.5),          // 0.5 °C
+  _pumpDeadband(5),            // 5 % pump speed
+  _fullRefreshInterval(600),   // Full refresh every 10 minutes
+  _lastFullRefresh(0),
+  _lastFrameCount(0),
+  _stateBuffer(nullptr),
+  _stateSourceCount(0),
+  _sentValid(false),
+  _queueHead(0),
+  _queueTail(0),
+  _queueCount(0),
+  _queueDropped(0),
+  _backlog(nullptr),
+  _backlogSize(MQTT_BACKLOG_DEFAULT),
+  _backlogStart(0),
+  _backlogCount(0),
+  _lastBacklogSample(0),
+  _lastReconnectAttempt(0),
+  _reconnectDelay(MQTT_RECONNECT_MIN),
+  _sessionUp(false),
+  _arena(nullptr),
+  _arenaSize(0),
+  _arenaUsed(0),
+  _tablesValid(false),
+  _channelOffset(nullptr),
+  _layoutTemps(0),
+  _layoutPumps(0),
+  _layoutRelays(0),
+  _layoutParticipants(0),
+  _stateTopicCount(0),
+  _discoveryOffset(0),
+  _discoveryCount(0),
+  _discoveryNext(0),
+  _discoverySource(0)
 {
+#if defined(ESP32) || defined(ESP8266)
   _mqttClient = new PubSubClient(*networkClient);
+  // An unreachable broker would otherwise stall loop() for 15 seconds
+  _mqttClient->setSocketTimeout(2);
+#else
+  _mqttClient = new LinuxMqttClient();
+#endif
+  _queue = new uint8_t[MQTT_QUEUE_BYTES];
 }
 
 VBUSMqttClient::~VBUSMqttClient() {
   delete _mqttClient;
+  delete[] _stateBuffer;
+  delete[] _queue;
+  delete[] _backlog;
+  delete[] _arena;
+  delete[] _channelOffset;
 }
 
 void VBUSMqttClient::begin(const MqttConfig& config) {
   _config = config;
   _mqttClient->setServer(_config.broker, _config.port);
+  _invalidateTables();
 }
 
 void VBUSMqttClient::setConfig(const MqttConfig& config) {
   _config = config;
   _mqttClient->setServer(_config.broker, _config.port);
+  _invalidateTables();
+}
+
+void VBUSMqttClient::setDecoder(VBUSDecoder* decoder) {
+  _decoder = decoder;
+  _discoveryPublished = false;  // The new device may have other channels
+  _sentValid = false;
+  _stateSourceCount = 0;
+  _lastFrameCount = decoder ? decoder->getFrameCount() : 0;
+  _invalidateTables();
+}
+
+void VBUSMqttClient::setPublishMode(MqttPublishMode mode) {
+  _mode = mode;
+  _invalidateTables();       // Discovery payloads depend on the mode
+  _sentValid = false;
+  _stateSourceCount = 0;
+  _lastFrameCount = _decoder ? _decoder->getFrameCount() : 0;
+  
+  if (_mode == MQTT_PUBLISH_AGGREGATED && _stateBuffer == nullptr) {
+    // State documents exceed the default PubSubClient packet size (2.8+ required)
+    _stateBuffer = new char[MQTT_STATE_PAYLOAD_SIZE];
+    _mqttClient->setBufferSize(MQTT_STATE_PAYLOAD_SIZE + 128);
+  }
+}
+
+MqttPublishMode VBUSMqttClient::getPublishMode() {
+  return _mode;
+}
+
+void VBUSMqttClient::setTemperatureDeadband(float deadband) {
+  _tempDeadband = deadband;
+}
+
+void VBUSMqttClient::setPumpDeadband(uint8_t deadband) {
+  _pumpDeadband = deadband;
+}
+
+void VBUSMqttClient::setFullRefreshInterval(uint32_t seconds) {
+  _fullRefreshInterval = seconds;
+}
+
+void VBUSMqttClient::setOfflineBacklog(uint16_t samples) {
+  // The ring is allocated on the first offline sample
+  delete[] _backlog;
+  _backlog = nullptr;
+  _backlogSize = samples;
+  _backlogStart = 0;
+  _backlogCount = 0;
+}
+
+uint16_t VBUSMqttClient::getQueuedCount() {
+  return _queueCount;
+}
+
+uint32_t VBUSMqttClient::getDroppedCount() {
+  return _queueDropped;
+}
+
+uint16_t VBUSMqttClient::getBacklogCount() {
+  return _backlogCount;
 }
 
 bool VBUSMqttClient::connect() {
@@ -38,10 +152,9 @@ bool VBUSMqttClient::connect() {
     connected = _mqttClient->connect(_config.clientId);
   }
   
-  if (connected && _config.useHomeAssistant && !_discoveryPublished) {
-    publishHomeAssistantDiscovery();
-    _discoveryPublished = true;
-  }
+  // PubSubClient returns after CONNACK; the Linux client only starts the
+  // connection and loop() notices when the broker accepted it
+  if (_mqttClient->connected()) _startSession();
   
   return connected;
 }
@@ -56,13 +169,57 @@ bool VBUSMqttClient::isConnected() {
 
 void VBUSMqttClient::loop() {
   if (!_mqttClient->connected()) {
+    _sessionUp = false;
     _reconnect();
   }
   
   _mqttClient->loop();
+  if (!_sessionUp && _mqttClient->connected()) _startSession();
+  
+  if (_decoder != nullptr) {
+    // Discovery needs the channel counts, so it may have to wait for a frame
+    if (_config.useHomeAssistant && !_discoveryPublished && _decoder->isReady() &&
+        _mqttClient->connected()) {
+      _publishDiscovery();
+    }
+    
+    uint32_t now = VBUSClock::now();
+    _publishDue(now);
+    
+    // Offline: keep timestamped samples. Online: replay them behind live values
+    if (!_mqttClient->connected()) {
+      _sampleBacklog(now);
+    } else if (_backlogCount > 0) {
+      _replayBacklog();
+    }
+  }
+  
+  _drainQueue();
+}
+
+// Publish whatever the current mode has due; messages go to the queue
+void VBUSMqttClient::_publishDue(uint32_t now) {
+  // Frame-driven modes only look at the data when a new frame was decoded
+  if (_mode != MQTT_PUBLISH_PER_VALUE) {
+    uint32_t frameCount = _decoder->getFrameCount();
+    if (frameCount == _lastFrameCount) return;
+    _lastFrameCount = frameCount;
+    if (!_decoder->isReady()) return;
+    
+    if (_mode == MQTT_PUBLISH_AGGREGATED) {
+      if (_stateDue(_decoder->getCurrentSourceAddress(), now)) {
+        publishState();
+      }
+    } else if (!_sentValid || now - _lastFullRefresh >= _fullRefreshInterval * 1000) {
+      publishAll();
+      _lastFullRefresh = now;
+    } else {
+      publishChanges();
+    }
+    return;
+  }
   
   // Check if it's time to publish
-  uint32_t now = millis();
   if (now - _lastPublish >= (_config.publishInterval * 1000)) {
     publishAll();
     _lastPublish = now;
@@ -80,143 +237,259 @@ void VBUSMqttClient::publishAll() {
   if (_decoder->getProtocol() == PROTOCOL_KM) {
     publishKMBusData();
   }
+  
+  _sentValid = true;
 }
 
 void VBUSMqttClient::publishTemperatures() {
+  _updateTables();
   uint8_t tempCount = _decoder->getTempNum();
+  if (tempCount > _layoutTemps) tempCount = _layoutTemps;
   for (uint8_t i = 0; i < tempCount; i++) {
     float temp = _decoder->getTemp(i);
     if (temp > -99.0 && temp < 999.0) {  // Sanity check
-      char topic[64];
-      snprintf(topic, sizeof(topic), "%s/temperature/%d", _config.baseTopic, i);
-      _publishFloat(topic, temp);
+      _publishFloat(_tempTopic(i), temp);
     }
+    _sentTemp[i] = temp;
   }
 }
 
 void VBUSMqttClient::publishPumps() {
+  _updateTables();
   uint8_t pumpCount = _decoder->getPumpNum();
+  if (pumpCount > _layoutPumps) pumpCount = _layoutPumps;
   for (uint8_t i = 0; i < pumpCount; i++) {
     uint8_t power = _decoder->getPump(i);
-    char topic[64];
-    snprintf(topic, sizeof(topic), "%s/pump/%d", _config.baseTopic, i);
-    _publishInt(topic, power);
+    _publishInt(_pumpTopic(i), power);
+    _sentPump[i] = power;
   }
 }
 
 void VBUSMqttClient::publishRelays() {
+  _updateTables();
   uint8_t relayCount = _decoder->getRelayNum();
+  if (relayCount > _layoutRelays) relayCount = _layoutRelays;
+  _sentRelays = 0;
   for (uint8_t i = 0; i < relayCount; i++) {
     bool state = _decoder->getRelay(i);
-    char topic[64];
-    snprintf(topic, sizeof(topic), "%s/relay/%d", _config.baseTopic, i);
-    _publishBool(topic, state);
+    _publishBool(_relayTopic(i), state);
+    if (state) _sentRelays |= (1UL << i);
   }
 }
 
 void VBUSMqttClient::publishStatus() {
-  char topic[64];
-  
-  // Protocol
-  snprintf(topic, sizeof(topic), "%s/status/protocol", _config.baseTopic);
-  _publishInt(topic, _decoder->getProtocol());
+  _updateTables();
   
-  // Connection status
-  snprintf(topic, sizeof(topic), "%s/status/ready", _config.baseTopic);
-  _publishBool(topic, _decoder->isReady());
+  _publishInt(_topic(MQTT_TOPIC_PROTOCOL), _decoder->getProtocol());
+  _publishBool(_topic(MQTT_TOPIC_READY), _decoder->isReady());
+  _publishInt(_topic(MQTT_TOPIC_ERROR_MASK), _decoder->getErrorMask());
+  _publishInt(_topic(MQTT_TOPIC_SYSTEM_TIME), _decoder->getSystemTime());
+  _publishInt(_topic(MQTT_TOPIC_HEAT), _decoder->getHeatQuantity());
   
-  // Error mask
-  snprintf(topic, sizeof(topic), "%s/status/error_mask", _config.baseTopic);
-  _publishInt(topic, _decoder->getErrorMask());
+  _sentErrorMask = _decoder->getErrorMask();
+  _sentSystemTime = _decoder->getSystemTime();
+  _sentHeat = _decoder->getHeatQuantity();
+}
+
+void VBUSMqttClient::publishKMBusData() {
+  _updateTables();
   
-  // System time
-  snprintf(topic, sizeof(topic), "%s/status/system_time", _config.baseTopic);
-  _publishInt(topic, _decoder->getSystemTime());
+  _publishBool(_topic(MQTT_TOPIC_KM_BURNER), _decoder->getKMBusBurnerStatus());
+  _publishBool(_topic(MQTT_TOPIC_KM_MAIN_PUMP), _decoder->getKMBusMainPumpStatus());
+  _publishBool(_topic(MQTT_TOPIC_KM_LOOP_PUMP), _decoder->getKMBusLoopPumpStatus());
+  _publishInt(_topic(MQTT_TOPIC_KM_MODE), _decoder->getKMBusMode());
+  _publishFloat(_topic(MQTT_TOPIC_KM_BOILER), _decoder->getKMBusBoilerTemp());
+  _publishFloat(_topic(MQTT_TOPIC_KM_HOTWATER), _decoder->getKMBusHotWaterTemp());
+  _publishFloat(_topic(MQTT_TOPIC_KM_OUTDOOR), _decoder->getKMBusOutdoorTemp());
+  _publishFloat(_topic(MQTT_TOPIC_KM_SETPOINT), _decoder->getKMBusSetpointTemp());
+  _publishFloat(_topic(MQTT_TOPIC_KM_DEPARTURE), _decoder->getKMBusDepartureTemp());
   
-  // Heat quantity
-  snprintf(topic, sizeof(topic), "%s/energy/heat_quantity", _config.baseTopic);
-  _publishInt(topic, _decoder->getHeatQuantity());
+  _sentKMStatus = (_decoder->getKMBusBurnerStatus() ? 0x01 : 0) |
+                  (_decoder->getKMBusMainPumpStatus() ? 0x02 : 0) |
+                  (_decoder->getKMBusLoopPumpStatus() ? 0x04 : 0);
+  _sentKMMode = _decoder->getKMBusMode();
+  _sentKMTemp[0] = _decoder->getKMBusBoilerTemp();
+  _sentKMTemp[1] = _decoder->getKMBusHotWaterTemp();
+  _sentKMTemp[2] = _decoder->getKMBusOutdoorTemp();
+  _sentKMTemp[3] = _decoder->getKMBusSetpointTemp();
+  _sentKMTemp[4] = _decoder->getKMBusDepartureTemp();
 }
 
-void VBUSMqttClient::publishKMBusData() {
-  char topic[64];
+// One compact JSON document with all values of the participant whose frame
+// was decoded last, published to <base>/state/<address>
+void VBUSMqttClient::publishState() {
+  if (!_decoder->isReady()) return;
+  if (_stateBuffer == nullptr) return;  // Only allocated in aggregated mode
   
-  // Burner status
-  snprintf(topic, sizeof(topic), "%s/kmbus/burner", _config.baseTopic);
-  _publishBool(topic, _decoder->getKMBusBurnerStatus());
+  char* out = _stateBuffer;
+  size_t size = MQTT_STATE_PAYLOAD_SIZE;
+  size_t len = 0;
+  uint16_t source = _decoder->getCurrentSourceAddress();
+  const BusParticipant* participant = _decoder->getParticipantByAddress(source);
   
-  // Main pump status
-  snprintf(topic, sizeof(topic), "%s/kmbus/main_pump", _config.baseTopic);
-  _publishBool(topic, _decoder->getKMBusMainPumpStatus());
+  len += snprintf(out + len, size - len, "{\"src\":\"0x%04X\"", source);
+  if (participant != nullptr && participant->name[0] != '\0' && len < size) {
+    len += snprintf(out + len, size - len, ",\"name\":\"%s\"", participant->name);
+  }
   
-  // Loop pump status
-  snprintf(topic, sizeof(topic), "%s/kmbus/loop_pump", _config.baseTopic);
-  _publishBool(topic, _decoder->getKMBusLoopPumpStatus());
+  if (len < size) len += snprintf(out + len, size - len, ",\"temp\":[");
+  for (uint8_t i = 0; i < _decoder->getTempNum() && len < size; i++) {
+    if (i > 0) len += snprintf(out + len, size - len, ",");
+    float temp = _decoder->getTemp(i);
+    if (temp > -99.0 && temp < 999.0) {
+      len += _appendFloat(out + len, size - len, temp);
+    } else {
+      len += snprintf(out + len, size - len, "null");
+    }
+  }
   
-  // Operating mode
-  snprintf(topic, sizeof(topic), "%s/kmbus/mode", _config.baseTopic);
-  _publishInt(topic, _decoder->getKMBusMode());
+  if (len < size) len += snprintf(out + len, size - len, "],\"pump\":[");
+  for (uint8_t i = 0; i < _decoder->getPumpNum() && len < size; i++) {
+    len += snprintf(out + len, size - len, i > 0 ? ",%u" : "%u", _decoder->getPump(i));
+  }
   
-  // Temperatures
-  snprintf(topic, sizeof(topic), "%s/kmbus/boiler_temp", _config.baseTopic);
-  _publishFloat(topic, _decoder->getKMBusBoilerTemp());
+  if (len < size) len += snprintf(out + len, size - len, "],\"relay\":[");
+  for (uint8_t i = 0; i < _decoder->getRelayNum() && len < size; i++) {
+    len += snprintf(out + len, size - len, i > 0 ? ",%u" : "%u", _decoder->getRelay(i) ? 1 : 0);
+  }
   
-  snprintf(topic, sizeof(topic), "%s/kmbus/hotwater_temp", _config.baseTopic);
-  _publishFloat(topic, _decoder->getKMBusHotWaterTemp());
+  if (len < size) {
+    len += snprintf(out + len, size - len, "],\"errors\":%u,\"heat\":%u,\"time\":%u",
+                    _decoder->getErrorMask(), _decoder->getHeatQuantity(), _decoder->getSystemTime());
+  }
   
-  snprintf(topic, sizeof(topic), "%s/kmbus/outdoor_temp", _config.baseTopic);
-  _publishFloat(topic, _decoder->getKMBusOutdoorTemp());
+  if (_decoder->getProtocol() == PROTOCOL_KM && len < size) {
+    len += snprintf(out + len, size - len,
+                    ",\"km\":{\"burner\":%u,\"mainPump\":%u,\"loopPump\":%u,\"mode\":%u,\"boiler\":",
+                    _decoder->getKMBusBurnerStatus() ? 1 : 0, _decoder->getKMBusMainPumpStatus() ? 1 : 0,
+                    _decoder->getKMBusLoopPumpStatus() ? 1 : 0, _decoder->getKMBusMode());
+    if (len < size) len += _appendFloat(out + len, size - len, _decoder->getKMBusBoilerTemp());
+    if (len < size) len += snprintf(out + len, size - len, ",\"hotWater\":");
+    if (len < size) len += _appendFloat(out + len, size - len, _decoder->getKMBusHotWaterTemp());
+    if (len < size) len += snprintf(out + len, size - len, ",\"outdoor\":");
+    if (len < size) len += _appendFloat(out + len, size - len, _decoder->getKMBusOutdoorTemp());
+    if (len < size) len += snprintf(out + len, size - len, ",\"setpoint\":");
+    if (len < size) len += _appendFloat(out + len, size - len, _decoder->getKMBusSetpointTemp());
+    if (len < size) len += snprintf(out + len, size - len, ",\"flow\":");
+    if (len < size) len += _appendFloat(out + len, size - len, _decoder->getKMBusDepartureTemp());
+    if (len < size) len += snprintf(out + len, size - len, "}");
+  }
   
-  snprintf(topic, sizeof(topic), "%s/kmbus/setpoint_temp", _config.baseTopic);
-  _publishFloat(topic, _decoder->getKMBusSetpointTemp());
+  if (len < size) len += snprintf(out + len, size - len, "}");
+  if (len >= size) return;  // Truncated document, do not publish
   
-  snprintf(topic, sizeof(topic), "%s/kmbus/departure_temp", _config.baseTopic);
-  _publishFloat(topic, _decoder->getKMBusDepartureTemp());
+  _updateTables();
+  const char* topic = _stateTopic(source);
+  char fallback[64];
+  if (topic == nullptr) {
+    // Not a known participant, so there is no precomputed topic
+    _formatStateTopic(fallback, sizeof(fallback), source);
+    topic = fallback;
+  }
+  _enqueue(topic, (const uint8_t*)out, len, false);
 }
 
-void VBUSMqttClient::publishHomeAssistantDiscovery() {
-  if (!_config.useHomeAssistant) return;
+// Publish only the values that moved beyond their deadband since they were
+// last sent; everything else stays quiet until the next full refresh
+void VBUSMqttClient::publishChanges() {
+  if (!_decoder->isReady()) return;
+  if (!_sentValid) {
+    publishAll();
+    return;
+  }
+  
+  _updateTables();
   
-  // Publish temperature sensors
   uint8_t tempCount = _decoder->getTempNum();
+  if (tempCount > _layoutTemps) tempCount = _layoutTemps;
   for (uint8_t i = 0; i < tempCount; i++) {
-    char objectId[32];
-    snprintf(objectId, sizeof(objectId), "viessmann_temp_%d", i);
-    char name[32];
-    snprintf(name, sizeof(name), "Temperature %d", i);
-    char valueTopic[64];
-    snprintf(valueTopic, sizeof(valueTopic), "%s/temperature/%d", _config.baseTopic, i);
-    _publishSensor(name, "temperature", "°C", valueTopic);
+    float temp = _decoder->getTemp(i);
+    if (!(temp > -99.0 && temp < 999.0)) continue;
+    float delta = temp - _sentTemp[i];
+    if (delta < 0) delta = -delta;
+    // Values coming back from an invalid reading always count
+    if (delta >= _tempDeadband || !(_sentTemp[i] > -99.0 && _sentTemp[i] < 999.0)) {
+      _publishFloat(_tempTopic(i), temp);
+      _sentTemp[i] = temp;
+    }
   }
   
-  // Publish pump sensors
   uint8_t pumpCount = _decoder->getPumpNum();
+  if (pumpCount > _layoutPumps) pumpCount = _layoutPumps;
   for (uint8_t i = 0; i < pumpCount; i++) {
-    char objectId[32];
-    snprintf(objectId, sizeof(objectId), "viessmann_pump_%d", i);
-    char name[32];
-    snprintf(name, sizeof(name), "Pump %d Power", i);
-    char valueTopic[64];
-    snprintf(valueTopic, sizeof(valueTopic), "%s/pump/%d", _config.baseTopic, i);
-    _publishSensor(name, "power_factor", "%", valueTopic);
+    uint8_t power = _decoder->getPump(i);
+    int16_t delta = (int16_t)power - (int16_t)_sentPump[i];
+    if (delta < 0) delta = -delta;
+    // Any on/off transition counts, even below the deadband
+    if ((delta > 0 && delta >= _pumpDeadband) || ((power == 0) != (_sentPump[i] == 0))) {
+      _publishInt(_pumpTopic(i), power);
+      _sentPump[i] = power;
+    }
   }
   
-  // Publish relay binary sensors
   uint8_t relayCount = _decoder->getRelayNum();
+  if (relayCount > _layoutRelays) relayCount = _layoutRelays;
   for (uint8_t i = 0; i < relayCount; i++) {
-    char objectId[32];
-    snprintf(objectId, sizeof(objectId), "viessmann_relay_%d", i);
-    char name[32];
-    snprintf(name, sizeof(name), "Relay %d", i);
-    char valueTopic[64];
-    snprintf(valueTopic, sizeof(valueTopic), "%s/relay/%d", _config.baseTopic, i);
-    _publishBinarySensor(name, "power", valueTopic);
+    bool state = _decoder->getRelay(i);
+    if (state != ((_sentRelays >> i) & 1)) {
+      _publishBool(_relayTopic(i), state);
+      _sentRelays ^= (1UL << i);
+    }
   }
   
-  // Publish heat quantity sensor
-  char valueTopic[64];
-  snprintf(valueTopic, sizeof(valueTopic), "%s/energy/heat_quantity", _config.baseTopic);
-  _publishSensor("Heat Quantity", "energy", "Wh", valueTopic);
+  if (_decoder->getErrorMask() != _sentErrorMask) {
+    _sentErrorMask = _decoder->getErrorMask();
+    _publishInt(_topic(MQTT_TOPIC_ERROR_MASK), _sentErrorMask);
+  }
+  if (_decoder->getSystemTime() != _sentSystemTime) {
+    _sentSystemTime = _decoder->getSystemTime();
+    _publishInt(_topic(MQTT_TOPIC_SYSTEM_TIME), _sentSystemTime);
+  }
+  if (_decoder->getHeatQuantity() != _sentHeat) {
+    _sentHeat = _decoder->getHeatQuantity();
+    _publishInt(_topic(MQTT_TOPIC_HEAT), _sentHeat);
+  }
+  
+  if (_decoder->getProtocol() != PROTOCOL_KM) return;
+  
+  uint8_t kmStatus = (_decoder->getKMBusBurnerStatus() ? 0x01 : 0) |
+                     (_decoder->getKMBusMainPumpStatus() ? 0x02 : 0) |
+                     (_decoder->getKMBusLoopPumpStatus() ? 0x04 : 0);
+  for (uint8_t i = 0; i < 3; i++) {
+    if ((kmStatus ^ _sentKMStatus) & (1 << i)) {
+      _publishBool(_topic((MqttTopicId)(MQTT_TOPIC_KM_BURNER + i)), kmStatus & (1 << i));
+    }
+  }
+  _sentKMStatus = kmStatus;
+  
+  if (_decoder->getKMBusMode() != _sentKMMode) {
+    _sentKMMode = _decoder->getKMBusMode();
+    _publishInt(_topic(MQTT_TOPIC_KM_MODE), _sentKMMode);
+  }
+  
+  float kmTemps[5] = {
+    _decoder->getKMBusBoilerTemp(), _decoder->getKMBusHotWaterTemp(), _decoder->getKMBusOutdoorTemp(),
+    _decoder->getKMBusSetpointTemp(), _decoder->getKMBusDepartureTemp()
+  };
+  for (uint8_t i = 0; i < 5; i++) {
+    float delta = kmTemps[i] - _sentKMTemp[i];
+    if (delta < 0) delta = -delta;
+    if (delta >= _tempDeadband) {
+      _publishFloat(_topic((MqttTopicId)(MQTT_TOPIC_KM_BOILER + i)), kmTemps[i]);
+      _sentKMTemp[i] = kmTemps[i];
+    }
+  }
+}
+
+// Discovery configs are built together with the topics, so (re)publishing
+// them after every reconnect costs no formatting and no allocation
+// Announces all entities again; what the client does not take now is sent
+// by the following loop() calls
+void VBUSMqttClient::publishHomeAssistantDiscovery() {
+  if (!_config.useHomeAssistant) return;
+  _discoveryPublished = false;
+  _discoveryNext = 0;
+  _publishDiscovery();
 }
 
 void VBUSMqttClient::publishHomeAssistantSensors() {
@@ -224,96 +497,544 @@ void VBUSMqttClient::publishHomeAssistantSensors() {
 }
 
 bool VBUSMqttClient::publish(const char* topic, const char* payload, bool retained) {
-  return _mqttClient->publish(topic, payload, retained);
+  return _enqueue(topic, (const uint8_t*)payload, strlen(payload), retained);
 }
 
 void VBUSMqttClient::setCallback(void (*callback)(char*, uint8_t*, unsigned int)) {
   _mqttClient->setCallback(callback);
 }
 
+#if !defined(ESP32) && !defined(ESP8266)
+int VBUSMqttClient::getSocket() {
+  return _mqttClient->getSocket();
+}
+
+bool VBUSMqttClient::wantsWrite() {
+  return _mqttClient->wantsWrite();
+}
+#endif
+
 // Private helper methods
 
+// Broker connections run on wall time, also while a replay uses virtual time
 void VBUSMqttClient::_reconnect() {
-  static uint32_t lastAttempt = 0;
   uint32_t now = millis();
+  if (now - _lastReconnectAttempt < _reconnectDelay) return;
+  _lastReconnectAttempt = now;
+  
+  // Back off while the broker stays away: 5 s, 10 s, ... up to 60 s
+  if (!connect()) {
+    _reconnectDelay *= 2;
+    if (_reconnectDelay > MQTT_RECONNECT_MAX) _reconnectDelay = MQTT_RECONNECT_MAX;
+  }
+}
+
+// Runs once per broker session, when CONNACK arrived
+void VBUSMqttClient::_startSession() {
+  _sessionUp = true;
+  _reconnectDelay = MQTT_RECONNECT_MIN;
+  
+  // The broker may have missed changes while we were away
+  _sentValid = false;
+  
+  // Entries accepted in an earlier session may not have reached the broker;
+  // loop() sends the announcement
+  if (!_discoveryPublished) _discoveryNext = 0;
+}
+
+// A full announcement is around 100 retained configs, too much to write in
+// one go on an ESP or to fit the Linux client's output buffer. They go out
+// MQTT_DISCOVERY_PER_LOOP at a time, an entry the client refused is retried
+// on the next call, and _discoveryPublished is set once all were accepted
+void VBUSMqttClient::_publishDiscovery() {
+  if (_decoder == nullptr || !_mqttClient->connected()) return;
+  
+  // Aggregated entities point at the state topic of the current participant
+  if (_discoveryNext == 0 && _mode == MQTT_PUBLISH_AGGREGATED &&
+      _decoder->getCurrentSourceAddress() != _discoverySource) {
+    _invalidateTables();
+  }
+  _updateTables();  // A rebuild starts over
+  
+  const char* entry = _arena + _discoveryOffset;
+  uint8_t sent = 0;
+  for (uint8_t i = 0; i < _discoveryCount && sent < MQTT_DISCOVERY_PER_LOOP; i++) {
+    const char* payload = entry + strlen(entry) + 1;
+    if (i == _discoveryNext) {
+      if (!_mqttClient->publish(entry, payload, true)) return;
+      _discoveryNext++;
+      sent++;
+    }
+    entry = payload + strlen(payload) + 1;
+  }
+  if (_discoveryNext >= _discoveryCount) _discoveryPublished = true;
+}
+
+// Queue entry layout:
+//   [0-1] entry size, [2] flags, [3] topic length, [4-5] payload length,
+//   then the NUL terminated topic and the payload
+#define MQTT_QUEUE_HEADER 6
+#define MQTT_QUEUE_LIVE 0x01
+#define MQTT_QUEUE_RETAINED 0x02
+
+// Append a message. Unless coalesce is false, an older message for the same
+// topic still waiting in the queue is replaced, so only the latest is sent
+bool VBUSMqttClient::_enqueue(const char* topic, const uint8_t* payload, uint16_t length,
+                              bool retained, bool coalesce) {
+  size_t topicLength = strlen(topic);
+  size_t size = MQTT_QUEUE_HEADER + topicLength + 1 + length;
+  if (topicLength > 255 || size > MQTT_QUEUE_BYTES) return false;
+  
+  if (coalesce) {
+    for (uint16_t pos = _queueHead; pos < _queueTail; pos += _queue[pos] | (_queue[pos + 1] << 8)) {
+      uint8_t* entry = _queue + pos;
+      if ((entry[2] & MQTT_QUEUE_LIVE) && entry[3] == topicLength &&
+          memcmp(entry + MQTT_QUEUE_HEADER, topic, topicLength) == 0) {
+        entry[2] &= ~MQTT_QUEUE_LIVE;
+        _queueCount--;
+        break;
+      }
+    }
+  }
+  
+  if (_queueTail + size > MQTT_QUEUE_BYTES) {
+    _compactQueue();
+    while (_queueTail + size > MQTT_QUEUE_BYTES) {
+      _dropOldest();
+    }
+  }
+  
+  uint8_t* entry = _queue + _queueTail;
+  entry[0] = size & 0xFF;
+  entry[1] = size >> 8;
+  entry[2] = MQTT_QUEUE_LIVE | (retained ? MQTT_QUEUE_RETAINED : 0);
+  entry[3] = topicLength;
+  entry[4] = length & 0xFF;
+  entry[5] = length >> 8;
+  memcpy(entry + MQTT_QUEUE_HEADER, topic, topicLength + 1);
+  memcpy(entry + MQTT_QUEUE_HEADER + topicLength + 1, payload, length);
+  _queueTail += size;
+  _queueCount++;
+  return true;
+}
+
+// Move live entries to the start of the queue, dropping replaced ones
+void VBUSMqttClient::_compactQueue() {
+  uint16_t out = 0;
+  uint16_t pos = _queueHead;
+  while (pos < _queueTail) {
+    uint16_t size = _queue[pos] | (_queue[pos + 1] << 8);
+    if (_queue[pos + 2] & MQTT_QUEUE_LIVE) {
+      if (out != pos) memmove(_queue + out, _queue + pos, size);
+      out += size;
+    }
+    pos += size;
+  }
+  _queueHead = 0;
+  _queueTail = out;
+}
+
+// Queue full: the oldest message gives way to the newest
+void VBUSMqttClient::_dropOldest() {
+  uint16_t size = _queue[_queueHead] | (_queue[_queueHead + 1] << 8);
+  if (_queue[_queueHead + 2] & MQTT_QUEUE_LIVE) {
+    _queueCount--;
+    _queueDropped++;
+  }
+  _queueHead += size;
+  _compactQueue();
+}
+
+// Hand a few messages to the client per loop(), so a burst never holds up
+// decoding; stops when the client does not take more
+void VBUSMqttClient::_drainQueue() {
+  uint8_t sent = 0;
+  while (_queueHead < _queueTail && sent < MQTT_QUEUE_DRAIN_PER_LOOP) {
+    uint8_t* entry = _queue + _queueHead;
+    uint16_t size = entry[0] | (entry[1] << 8);
+    if (entry[2] & MQTT_QUEUE_LIVE) {
+      if (!_mqttClient->connected()) break;
+      const char* topic = (const char*)(entry + MQTT_QUEUE_HEADER);
+      const uint8_t* payload = entry + MQTT_QUEUE_HEADER + entry[3] + 1;
+      uint16_t length = entry[4] | (entry[5] << 8);
+      if (!_mqttClient->publish(topic, payload, length, (entry[2] & MQTT_QUEUE_RETAINED) != 0)) break;
+      _queueCount--;
+      sent++;
+    }
+    _queueHead += size;
+  }
   
-  // Try to reconnect every 5 seconds
-  if (now - lastAttempt > 5000) {
-    connect();
-    lastAttempt = now;
+  if (_queueHead == _queueTail) {
+    _queueHead = 0;
+    _queueTail = 0;
   }
 }
 
-void VBUSMqttClient::_publishSensor(const char* name, const char* deviceClass, 
-                                   const char* unit, const char* valueTopic) {
-  char discoveryTopic[128];
-  snprintf(discoveryTopic, sizeof(discoveryTopic), 
-           "%s/sensor/%s/config", _config.haDiscoveryPrefix, valueTopic);
+// One sample per publish interval while the broker is unreachable; when the
+// ring is full the oldest sample is overwritten
+void VBUSMqttClient::_sampleBacklog(uint32_t now) {
+  if (_backlogSize == 0 || !_decoder->isReady()) return;
+  if (_lastBacklogSample != 0 && now - _lastBacklogSample < _config.publishInterval * 1000UL) return;
+  _lastBacklogSample = now;
+  
+  if (_backlog == nullptr) {
+    _backlog = new MqttBacklogSample[_backlogSize];
+  }
+  
+  uint16_t index;
+  if (_backlogCount < _backlogSize) {
+    index = (_backlogStart + _backlogCount) % _backlogSize;
+    _backlogCount++;
+  } else {
+    index = _backlogStart;
+    _backlogStart = (_backlogStart + 1) % _backlogSize;
+  }
   
-  char payload[512];
-  snprintf(payload, sizeof(payload),
-           "{\"name\":\"%s\",\"device_class\":\"%s\",\"unit_of_measurement\":\"%s\","
-           "\"state_topic\":\"%s\",\"unique_id\":\"%s\","
-           "\"device\":{\"identifiers\":[\"viessmann_%s\"],\"name\":\"Viessmann Heating\","
-           "\"model\":\"Multi-Protocol\",\"manufacturer\":\"Viessmann\"}}",
-           name, deviceClass, unit, valueTopic, valueTopic, _config.clientId);
+  MqttBacklogSample& sample = _backlog[index];
+  sample.timestamp = now / 1000;
+  sample.source = _decoder->getCurrentSourceAddress();
+  sample.errorMask = _decoder->getErrorMask();
+  sample.heatQuantity = _decoder->getHeatQuantity();
+  
+  sample.tempCount = _decoder->getTempNum();
+  if (sample.tempCount > MQTT_BACKLOG_TEMPS) sample.tempCount = MQTT_BACKLOG_TEMPS;
+  for (uint8_t i = 0; i < sample.tempCount; i++) {
+    float temp = _decoder->getTemp(i);
+    sample.temp[i] = (temp > -99.0 && temp < 999.0) ? (int16_t)(temp * 10 + (temp < 0 ? -0.5 : 0.5)) : INT16_MIN;
+  }
+  
+  sample.pumpCount = _decoder->getPumpNum();
+  if (sample.pumpCount > MQTT_BACKLOG_PUMPS) sample.pumpCount = MQTT_BACKLOG_PUMPS;
+  for (uint8_t i = 0; i < sample.pumpCount; i++) {
+    sample.pump[i] = _decoder->getPump(i);
+  }
   
-  _mqttClient->publish(discoveryTopic, payload, true);
+  sample.relayCount = _decoder->getRelayNum();
+  if (sample.relayCount > 32) sample.relayCount = 32;
+  sample.relays = 0;
+  for (uint8_t i = 0; i < sample.relayCount; i++) {
+    if (_decoder->getRelay(i)) sample.relays |= (1UL << i);
+  }
 }
 
-void VBUSMqttClient::_publishBinarySensor(const char* name, const char* deviceClass, 
-                                         const char* valueTopic) {
-  char discoveryTopic[128];
-  snprintf(discoveryTopic, sizeof(discoveryTopic), 
-           "%s/binary_sensor/%s/config", _config.haDiscoveryPrefix, valueTopic);
+// Publish the oldest backlog samples as one message to <base>/backlog:
+// {"samples":[{"age":s,"src":"0x7E11","temp":[..],"pump":[..],"relay":[..],"errors":n,"heat":n},..]}
+// "age" is the number of seconds between taking the sample and sending it.
+// Only one batch is queued per loop() and only while the queue is mostly
+// empty, so live values always go first
+void VBUSMqttClient::_replayBacklog() {
+  if (_queueTail - _queueHead > MQTT_QUEUE_BYTES / 2) return;
+  
+  if (_stateBuffer == nullptr) {
+    _stateBuffer = new char[MQTT_STATE_PAYLOAD_SIZE];
+#if defined(ESP32) || defined(ESP8266)
+    _mqttClient->setBufferSize(MQTT_STATE_PAYLOAD_SIZE + 128);
+#endif
+  }
+  
+  char* out = _stateBuffer;
+  size_t size = MQTT_STATE_PAYLOAD_SIZE - 2;  // Room for the closing "]}"
+  size_t len = snprintf(out, size, "{\"samples\":[");
+  uint32_t now = VBUSClock::now() / 1000;
+  uint8_t batch = 0;
   
-  char payload[512];
-  snprintf(payload, sizeof(payload),
-           "{\"name\":\"%s\",\"device_class\":\"%s\","
-           "\"state_topic\":\"%s\",\"payload_on\":\"true\",\"payload_off\":\"false\","
-           "\"unique_id\":\"%s\","
-           "\"device\":{\"identifiers\":[\"viessmann_%s\"],\"name\":\"Viessmann Heating\","
-           "\"model\":\"Multi-Protocol\",\"manufacturer\":\"Viessmann\"}}",
-           name, deviceClass, valueTopic, valueTopic, _config.clientId);
+  while (batch < MQTT_BACKLOG_BATCH && batch < _backlogCount) {
+    const MqttBacklogSample& sample = _backlog[(_backlogStart + batch) % _backlogSize];
+    size_t start = len;
+    
+    len += snprintf(out + len, size - len, "%s{\"age\":%lu,\"src\":\"0x%04X\",\"temp\":[",
+                    batch > 0 ? "," : "", (unsigned long)(now - sample.timestamp), sample.source);
+    for (uint8_t i = 0; i < sample.tempCount && len < size; i++) {
+      if (sample.temp[i] == INT16_MIN) {
+        len += snprintf(out + len, size - len, i > 0 ? ",null" : "null");
+      } else {
+        len += snprintf(out + len, size - len, i > 0 ? ",%.1f" : "%.1f", sample.temp[i] / 10.0);
+      }
+    }
+    if (len < size) len += snprintf(out + len, size - len, "],\"pump\":[");
+    for (uint8_t i = 0; i < sample.pumpCount && len < size; i++) {
+      len += snprintf(out + len, size - len, i > 0 ? ",%u" : "%u", sample.pump[i]);
+    }
+    if (len < size) len += snprintf(out + len, size - len, "],\"relay\":[");
+    for (uint8_t i = 0; i < sample.relayCount && len < size; i++) {
+      len += snprintf(out + len, size - len, i > 0 ? ",%u" : "%u", (unsigned)((sample.relays >> i) & 1));
+    }
+    if (len < size) {
+      len += snprintf(out + len, size - len, "],\"errors\":%u,\"heat\":%u}",
+                      sample.errorMask, sample.heatQuantity);
+    }
+    
+    if (len >= size) {
+      // Sample does not fit any more, it goes into the next batch
+      len = start;
+      break;
+    }
+    batch++;
+  }
+  if (batch == 0) {
+    // A single sample larger than the buffer cannot be sent at all
+    _backlogStart = (_backlogStart + 1) % _backlogSize;
+    _backlogCount--;
+    return;
+  }
+  len += snprintf(out + len, MQTT_STATE_PAYLOAD_SIZE - len, "]}");
   
-  _mqttClient->publish(discoveryTopic, payload, true);
+  _updateTables();
+  if (_enqueue(_topic(MQTT_TOPIC_BACKLOG), (const uint8_t*)out, len, false, false)) {
+    _backlogStart = (_backlogStart + batch) % _backlogSize;
+    _backlogCount -= batch;
+  }
 }
 
-String VBUSMqttClient::_buildTopic(const char* suffix) {
-  String topic = _config.baseTopic;
-  topic += "/";
-  topic += suffix;
-  return topic;
+void VBUSMqttClient::_invalidateTables() {
+  _tablesValid = false;
+}
+
+// The layout only grows: it covers the widest of the current frame and all
+// known participants, so a controller with more channels appearing later
+// triggers one rebuild and switching back and forth costs nothing
+void VBUSMqttClient::_updateTables() {
+  if (_decoder == nullptr) return;
+  
+  uint8_t temps = _decoder->getTempNum();
+  uint8_t pumps = _decoder->getPumpNum();
+  uint8_t relays = _decoder->getRelayNum();
+  uint8_t participants = _decoder->getParticipantCount();
+  
+  if (_tablesValid && temps <= _layoutTemps && pumps <= _layoutPumps &&
+      relays <= _layoutRelays && participants == _layoutParticipants) {
+    return;
+  }
+  
+  if (!_tablesValid) {
+    _layoutTemps = 0;
+    _layoutPumps = 0;
+    _layoutRelays = 0;
+  } else if (temps > _layoutTemps || pumps > _layoutPumps || relays > _layoutRelays) {
+    _discoveryPublished = false;  // Announce the new channels as well
+  }
+  if (temps > _layoutTemps) _layoutTemps = temps;
+  if (pumps > _layoutPumps) _layoutPumps = pumps;
+  if (relays > _layoutRelays) _layoutRelays = relays;
+  for (uint8_t i = 0; i < participants; i++) {
+    const BusParticipant* participant = _decoder->getParticipant(i);
+    if (participant->tempChannels > _layoutTemps) _layoutTemps = participant->tempChannels;
+    if (participant->pumpChannels > _layoutPumps) _layoutPumps = participant->pumpChannels;
+    if (participant->relayChannels > _layoutRelays) _layoutRelays = participant->relayChannels;
+  }
+  // Change detection keeps 32 values per kind
+  if (_layoutTemps > 32) _layoutTemps = 32;
+  if (_layoutPumps > 32) _layoutPumps = 32;
+  if (_layoutRelays > 32) _layoutRelays = 32;
+  _layoutParticipants = participants;
+  _discoverySource = _decoder->getCurrentSourceAddress();
+  
+  delete[] _channelOffset;
+  _channelOffset = new uint16_t[_layoutTemps + _layoutPumps + _layoutRelays + 1];
+  
+  // First pass only measures, the second one fills an arena of exact size
+  delete[] _arena;
+  _arena = nullptr;
+  _arenaSize = 0;
+  _arenaUsed = 0;
+  _fillTables();
+  _arenaSize = _arenaUsed;
+  _arena = new char[_arenaSize];
+  _arenaUsed = 0;
+  _fillTables();
+  
+  _tablesValid = true;
+  _discoveryNext = 0;
+}
+
+void VBUSMqttClient::_fillTables() {
+  static const char* const fixedTopics[MQTT_TOPIC_FIXED_COUNT] = {
+    "status/protocol", "status/ready", "status/error_mask", "status/system_time",
+    "energy/heat_quantity", "kmbus/burner", "kmbus/main_pump", "kmbus/loop_pump",
+    "kmbus/mode", "kmbus/boiler_temp", "kmbus/hotwater_temp", "kmbus/outdoor_temp",
+    "kmbus/setpoint_temp", "kmbus/departure_temp", "backlog"
+  };
+  for (uint8_t i = 0; i < MQTT_TOPIC_FIXED_COUNT; i++) {
+    _topicOffset[i] = _arenaPrintf("%s/%s", _config.baseTopic, fixedTopics[i]);
+  }
+  
+  uint8_t channel = 0;
+  for (uint8_t i = 0; i < _layoutTemps; i++) {
+    _channelOffset[channel++] = _arenaPrintf("%s/temperature/%d", _config.baseTopic, i);
+  }
+  for (uint8_t i = 0; i < _layoutPumps; i++) {
+    _channelOffset[channel++] = _arenaPrintf("%s/pump/%d", _config.baseTopic, i);
+  }
+  for (uint8_t i = 0; i < _layoutRelays; i++) {
+    _channelOffset[channel++] = _arenaPrintf("%s/relay/%d", _config.baseTopic, i);
+  }
+  
+  _stateTopicCount = 0;
+  for (uint8_t i = 0; i < _layoutParticipants && i < MQTT_MAX_STATE_SOURCES; i++) {
+    uint16_t address = _decoder->getParticipant(i)->address;
+    _stateTopicAddress[_stateTopicCount] = address;
+    _stateTopicOffset[_stateTopicCount++] = _arenaPrintf("%s/state/%04x", _config.baseTopic, address);
+  }
+  
+  // Discovery configs last, so that topic offsets stay small
+  _discoveryOffset = _arenaUsed;
+  _discoveryCount = 0;
+  if (!_config.useHomeAssistant) return;
+  
+  // In aggregated mode all entities read from the state document
+  char stateTopic[64];
+  _formatStateTopic(stateTopic, sizeof(stateTopic), _discoverySource);
+  const char* aggregated = _mode == MQTT_PUBLISH_AGGREGATED ? stateTopic : nullptr;
+  char objectId[32];
+  char name[32];
+  char valueTopic[64];
+  char valueTemplate[64];
+  for (uint8_t i = 0; i < _layoutTemps; i++) {
+    snprintf(objectId, sizeof(objectId), "temp_%d", i);
+    snprintf(name, sizeof(name), "Temperature %d", i);
+    snprintf(valueTopic, sizeof(valueTopic), "%s/temperature/%d", _config.baseTopic, i);
+    snprintf(valueTemplate, sizeof(valueTemplate), "{{ value_json.temp[%d] }}", i);
+    _addSensorConfig(objectId, name, "temperature", "°C", aggregated ? aggregated : valueTopic,
+                     aggregated ? valueTemplate : nullptr);
+  }
+  for (uint8_t i = 0; i < _layoutPumps; i++) {
+    snprintf(objectId, sizeof(objectId), "pump_%d", i);
+    snprintf(name, sizeof(name), "Pump %d Power", i);
+    snprintf(valueTopic, sizeof(valueTopic), "%s/pump/%d", _config.baseTopic, i);
+    snprintf(valueTemplate, sizeof(valueTemplate), "{{ value_json.pump[%d] }}", i);
+    _addSensorConfig(objectId, name, "power_factor", "%", aggregated ? aggregated : valueTopic,
+                     aggregated ? valueTemplate : nullptr);
+  }
+  for (uint8_t i = 0; i < _layoutRelays; i++) {
+    snprintf(objectId, sizeof(objectId), "relay_%d", i);
+    snprintf(name, sizeof(name), "Relay %d", i);
+    snprintf(valueTopic, sizeof(valueTopic), "%s/relay/%d", _config.baseTopic, i);
+    snprintf(valueTemplate, sizeof(valueTemplate),
+             "{{ 'true' if value_json.relay[%d] else 'false' }}", i);
+    _addBinarySensorConfig(objectId, name, "power", aggregated ? aggregated : valueTopic,
+                           aggregated ? valueTemplate : nullptr);
+  }
+  snprintf(valueTopic, sizeof(valueTopic), "%s/energy/heat_quantity", _config.baseTopic);
+  _addSensorConfig("heat_quantity", "Heat Quantity", "energy", "Wh", aggregated ? aggregated : valueTopic,
+                   aggregated ? "{{ value_json.heat }}" : nullptr);
+}
+
+// Appends a formatted string including its terminator and returns its offset.
+// Without an arena (measuring pass) only the size is accounted for
+size_t VBUSMqttClient::_arenaPrintf(const char* format, ...) {
+  size_t offset = _arenaUsed;
+  va_list args;
+  va_start(args, format);
+  int len = _arena ? vsnprintf(_arena + offset, _arenaSize - offset, format, args)
+                   : vsnprintf(nullptr, 0, format, args);
+  va_end(args);
+  if (len > 0) _arenaUsed += len;
+  _arenaUsed++;
+  return offset;
+}
+
+// Config payloads use the abbreviated Home Assistant keys. The topic is
+// <prefix>/<component>/<clientId>/<objectId>/config, the unique ID
+// <clientId>_<objectId>. valueTemplate is set when the value is read from
+// the aggregated state document
+void VBUSMqttClient::_addSensorConfig(const char* objectId, const char* name, const char* deviceClass,
+                                      const char* unit, const char* stateTopic, const char* valueTemplate) {
+  _arenaPrintf("%s/sensor/%s/%s/config", _config.haDiscoveryPrefix, _config.clientId, objectId);
+  _arenaPrintf("{\"name\":\"%s\",\"dev_cla\":\"%s\",\"unit_of_meas\":\"%s\","
+               "\"stat_t\":\"%s\",%s%s%s\"uniq_id\":\"%s_%s\","
+               "\"dev\":{\"ids\":[\"viessmann_%s\"],\"name\":\"Viessmann Heating\","
+               "\"mdl\":\"Multi-Protocol\",\"mf\":\"Viessmann\"}}",
+               name, deviceClass, unit, stateTopic,
+               valueTemplate ? "\"val_tpl\":\"" : "", valueTemplate ? valueTemplate : "",
+               valueTemplate ? "\"," : "", _config.clientId, objectId, _config.clientId);
+  _discoveryCount++;
+}
+
+void VBUSMqttClient::_addBinarySensorConfig(const char* objectId, const char* name, const char* deviceClass,
+                                            const char* stateTopic, const char* valueTemplate) {
+  _arenaPrintf("%s/binary_sensor/%s/%s/config", _config.haDiscoveryPrefix, _config.clientId, objectId);
+  _arenaPrintf("{\"name\":\"%s\",\"dev_cla\":\"%s\","
+               "\"stat_t\":\"%s\",%s%s%s\"pl_on\":\"true\",\"pl_off\":\"false\","
+               "\"uniq_id\":\"%s_%s\","
+               "\"dev\":{\"ids\":[\"viessmann_%s\"],\"name\":\"Viessmann Heating\","
+               "\"mdl\":\"Multi-Protocol\",\"mf\":\"Viessmann\"}}",
+               name, deviceClass, stateTopic,
+               valueTemplate ? "\"val_tpl\":\"" : "", valueTemplate ? valueTemplate : "",
+               valueTemplate ? "\"," : "", _config.clientId, objectId, _config.clientId);
+  _discoveryCount++;
+}
+
+const char* VBUSMqttClient::_topic(MqttTopicId id) {
+  return _arena + _topicOffset[id];
+}
+
+const char* VBUSMqttClient::_tempTopic(uint8_t idx) {
+  return _arena + _channelOffset[idx];
+}
+
+const char* VBUSMqttClient::_pumpTopic(uint8_t idx) {
+  return _arena + _channelOffset[_layoutTemps + idx];
+}
+
+const char* VBUSMqttClient::_relayTopic(uint8_t idx) {
+  return _arena + _channelOffset[_layoutTemps + _layoutPumps + idx];
+}
+
+// Precomputed state topic of a known participant, nullptr otherwise
+const char* VBUSMqttClient::_stateTopic(uint16_t source) {
+  for (uint8_t i = 0; i < _stateTopicCount; i++) {
+    if (_stateTopicAddress[i] == source) return _arena + _stateTopicOffset[i];
+  }
+  return nullptr;
+}
+
+// Per-participant publish interval for the aggregated mode
+bool VBUSMqttClient::_stateDue(uint16_t source, uint32_t now) {
+  uint8_t slot = 0;
+  while (slot < _stateSourceCount && _stateSource[slot] != source) slot++;
+  
+  if (slot == _stateSourceCount) {
+    if (_stateSourceCount < MQTT_MAX_STATE_SOURCES) {
+      _stateSourceCount++;
+    } else {
+      // Table full, reuse the slot published longest ago
+      slot = 0;
+      for (uint8_t i = 1; i < MQTT_MAX_STATE_SOURCES; i++) {
+        if (now - _statePublished[i] > now - _statePublished[slot]) slot = i;
+      }
+    }
+    _stateSource[slot] = source;
+  } else if (now - _statePublished[slot] < _config.publishInterval * 1000UL) {
+    return false;
+  }
+  
+  _statePublished[slot] = now;
+  return true;
 }
 
-String VBUSMqttClient::_buildStateTopic(const char* suffix) {
-  return _buildTopic(suffix);
+void VBUSMqttClient::_formatStateTopic(char* topic, size_t size, uint16_t source) {
+  snprintf(topic, size, "%s/state/%04x", _config.baseTopic, source);
 }
 
-String VBUSMqttClient::_buildDiscoveryTopic(const char* component, const char* objectId) {
-  String topic = _config.haDiscoveryPrefix;
-  topic += "/";
-  topic += component;
-  topic += "/";
-  topic += objectId;
-  topic += "/config";
-  return topic;
+// Shortest reasonable representation: decoder values have one decimal
+size_t VBUSMqttClient::_appendFloat(char* out, size_t size, float value) {
+  return snprintf(out, size, "%.1f", value);
 }
 
 void VBUSMqttClient::_publishFloat(const char* topic, float value) {
   char buffer[16];
-  snprintf(buffer, sizeof(buffer), "%.2f", value);
-  _mqttClient->publish(topic, buffer);
+  int len = snprintf(buffer, sizeof(buffer), "%.2f", value);
+  _enqueue(topic, (const uint8_t*)buffer, len, false);
 }
 
 void VBUSMqttClient::_publishInt(const char* topic, int value) {
   char buffer[16];
-  snprintf(buffer, sizeof(buffer), "%d", value);
-  _mqttClient->publish(topic, buffer);
+  int len = snprintf(buffer, sizeof(buffer), "%d", value);
+  _enqueue(topic, (const uint8_t*)buffer, len, false);
 }
 
 void VBUSMqttClient::_publishBool(const char* topic, bool value) {
-  _mqttClient->publish(topic, value ? "true" : "false");
+  _enqueue(topic, (const uint8_t*)(value ? "true" : "false"), value ? 4 : 5, false);
 }
 
-#endif // ESP32 || ESP8266
+#endif // ESP32 || ESP8266 || __linux__
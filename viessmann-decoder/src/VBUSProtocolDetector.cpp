@@ -0,0 +1,204 @@
+/*
+ * Viessmann Multi-Protocol Library - Protocol Detector Implementation
+ */
+
+#include "VBUSProtocolDetector.h"
+
+VBUSProtocolDetector::VBUSProtocolDetector() {
+  reset();
+}
+
+void VBUSProtocolDetector::reset() {
+  _length = 0;
+  for (uint8_t i = 0; i < VBUSDETECT_PROTOCOLS; i++) {
+    _covered[i] = 0;
+    _frames[i] = 0;
+  }
+}
+
+void VBUSProtocolDetector::feed(uint8_t data) {
+  if (_length < VBUSDETECT_WINDOW_SIZE) {
+    _window[_length++] = data;
+  }
+}
+
+void VBUSProtocolDetector::feed(const uint8_t* data, uint16_t length) {
+  for (uint16_t i = 0; i < length && _length < VBUSDETECT_WINDOW_SIZE; i++) {
+    _window[_length++] = data[i];
+  }
+}
+
+uint16_t VBUSProtocolDetector::getLength() {
+  return _length;
+}
+
+bool VBUSProtocolDetector::isFull() {
+  return _length == VBUSDETECT_WINDOW_SIZE;
+}
+
+ProtocolMatch VBUSProtocolDetector::classify() {
+  ProtocolMatch match = { PROTOCOL_VBUS, 0, 0 };
+  if (_length == 0) return match;
+
+  // Each protocol walks the whole window on its own: a valid frame is
+  // skipped as a whole, anything else byte by byte
+  for (uint8_t p = 0; p < VBUSDETECT_PROTOCOLS; p++) {
+    _covered[p] = 0;
+    _frames[p] = 0;
+    uint16_t pos = 0;
+    while (pos < _length) {
+      uint16_t length = _match((ProtocolType)p, pos);
+      if (length == 0) {
+        pos++;
+        continue;
+      }
+      _covered[p] += length;
+      _frames[p]++;
+      pos += length;
+    }
+  }
+
+  uint8_t best = 0;
+  uint8_t second = 1;
+  if (_covered[second] > _covered[best]) {
+    best = 1;
+    second = 0;
+  }
+  for (uint8_t p = 2; p < VBUSDETECT_PROTOCOLS; p++) {
+    if (_covered[p] > _covered[best]) {
+      second = best;
+      best = p;
+    } else if (_covered[p] > _covered[second]) {
+      second = p;
+    }
+  }
+
+  uint8_t confidence = getScore((ProtocolType)best) - getScore((ProtocolType)second);
+  if (_frames[best] < 2) confidence /= 2;
+  match.protocol = (ProtocolType)best;
+  match.confidence = confidence;
+  match.frames = _frames[best];
+  return match;
+}
+
+uint8_t VBUSProtocolDetector::getScore(ProtocolType protocol) {
+  if (protocol >= VBUSDETECT_PROTOCOLS || _length == 0) return 0;
+  return (uint32_t)_covered[protocol] * 100 / _length;
+}
+
+uint16_t VBUSProtocolDetector::getFrames(ProtocolType protocol) {
+  if (protocol >= VBUSDETECT_PROTOCOLS) return 0;
+  return _frames[protocol];
+}
+
+// Private helper methods
+
+uint16_t VBUSProtocolDetector::_match(ProtocolType protocol, uint16_t pos) {
+  switch (protocol) {
+    case PROTOCOL_VBUS: return _matchVBUS(pos);
+    case PROTOCOL_KW: return _matchKW(pos);
+    case PROTOCOL_P300: return _matchP300(pos);
+    case PROTOCOL_KM: return _matchKM(pos);
+    default: return 0;
+  }
+}
+
+// 0xAA, 9 header bytes (protocol version 0x10, CRC last), then frame count
+// blocks of 4 data bytes, septet byte and CRC. All bytes after the sync
+// have the MSB clear
+uint16_t VBUSProtocolDetector::_matchVBUS(uint16_t pos) {
+  if (_window[pos] != 0xAA || pos + 10 > _length) return 0;
+  const uint8_t* header = _window + pos + 1;
+  for (uint8_t i = 0; i < 9; i++) {
+    if (header[i] & 0x80) return 0;
+  }
+  if (header[4] != 0x10 || _vbusCRC(header, 8) != header[8]) return 0;
+
+  uint16_t length = 10 + header[7] * 6;
+  if (pos + length > _length) return 0;
+  for (uint8_t block = 0; block < header[7]; block++) {
+    const uint8_t* data = header + 9 + block * 6;
+    for (uint8_t i = 0; i < 6; i++) {
+      if (data[i] & 0x80) return 0;
+    }
+    if (_vbusCRC(data, 5) != data[5]) return 0;
+  }
+  return length;
+}
+
+// An idle VS1 bus only carries the 0x05 sync the controller sends about
+// every two seconds; frames are 0x01 <len> <data...> <XOR of all before>
+uint16_t VBUSProtocolDetector::_matchKW(uint16_t pos) {
+  if (_window[pos] == 0x05) return 1;
+  if (_window[pos] != 0x01 || pos + 2 > _length) return 0;
+
+  uint16_t length = _window[pos + 1] + 3;
+  if (_window[pos + 1] == 0 || length > VBUSDETECT_MAX_FRAME || pos + length > _length) return 0;
+  uint8_t checksum = 0;
+  for (uint16_t i = 0; i < length - 1; i++) {
+    checksum ^= _window[pos + i];
+  }
+  return checksum == _window[pos + length - 1] ? length : 0;
+}
+
+// Optolink P300 telegrams: 0x41 <len> <type 0/1/3> ... <sum from len on>.
+// The decoder's own framing starts with 0x05 or 0x01 and sums from the start
+uint16_t VBUSProtocolDetector::_matchP300(uint16_t pos) {
+  uint8_t start = _window[pos];
+  if ((start != 0x41 && start != 0x05 && start != 0x01) || pos + 3 > _length) return 0;
+
+  uint16_t length = _window[pos + 1] + 3;
+  if (_window[pos + 1] == 0 || length > VBUSDETECT_MAX_FRAME || pos + length > _length) return 0;
+  if (start == 0x41 && _window[pos + 2] != 0x00 && _window[pos + 2] != 0x01 && _window[pos + 2] != 0x03) return 0;
+
+  uint8_t checksum = 0;
+  for (uint16_t i = start == 0x41 ? 1 : 0; i < length - 1; i++) {
+    checksum += _window[pos + i];
+  }
+  return checksum == _window[pos + length - 1] ? length : 0;
+}
+
+// Long frames 0x68 L L 0x68 <L bytes> <check> 0x16, checked with the
+// decoder's CRC-16 or the plain M-Bus sum
+uint16_t VBUSProtocolDetector::_matchKM(uint16_t pos) {
+  if (_window[pos] != 0x68 || pos + 4 > _length) return 0;
+  uint8_t frameLen = _window[pos + 1];
+  if (frameLen == 0 || _window[pos + 2] != frameLen || _window[pos + 3] != 0x68) return 0;
+  const uint8_t* body = _window + pos + 4;
+
+  // M-Bus: one checksum byte
+  uint16_t length = frameLen + 6;
+  if (pos + length <= _length && body[frameLen + 1] == 0x16) {
+    uint8_t sum = 0;
+    for (uint8_t i = 0; i < frameLen; i++) sum += body[i];
+    if (sum == body[frameLen]) return length;
+  }
+
+  // KM-Bus as decoded by the library: CRC-16, low byte first
+  length = frameLen + 7;
+  if (pos + length <= _length && body[frameLen + 2] == 0x16) {
+    uint16_t crc = body[frameLen] | (body[frameLen + 1] << 8);
+    if (_kmCRC16(body, frameLen) == crc) return length;
+  }
+  return 0;
+}
+
+uint8_t VBUSProtocolDetector::_vbusCRC(const uint8_t* data, uint8_t length) {
+  uint8_t crc = 0x7F;
+  for (uint8_t i = 0; i < length; i++) {
+    crc = (crc - data[i]) & 0x7F;
+  }
+  return crc;
+}
+
+// Polynomial 0x1021 with reflected input and output, same as the decoder
+uint16_t VBUSProtocolDetector::_kmCRC16(const uint8_t* data, uint16_t length) {
+  uint16_t crc = 0x0000;
+  for (uint16_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x0001) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,64 @@
+/*
+ * Viessmann Multi-Protocol Library - Protocol Detector
+ * Guesses the bus protocol from a window of sniffed bytes
+ */
+
+#pragma once
+#ifndef VBUSProtocolDetector_h
+#define VBUSProtocolDetector_h
+
+#include <Arduino.h>
+#include "vbusdecoder.h"
+
+#define VBUSDETECT_WINDOW_SIZE 512     // Bytes kept for classification
+#define VBUSDETECT_PROTOCOLS 4
+#define VBUSDETECT_MAX_FRAME 64        // Longer KW/P300 frames are taken for noise
+
+// Result of classify(). confidence is 0-100: the share of the window
+// explained by frames of the best protocol, minus that of the runner-up.
+// Windows with a single frame are capped at half confidence.
+struct ProtocolMatch {
+  ProtocolType protocol;
+  uint8_t confidence;
+  uint16_t frames;         // Checksum-valid frames of the best protocol
+};
+
+class VBUSProtocolDetector {
+  public:
+    VBUSProtocolDetector();
+
+    // Bytes received at one baud rate and parity; reset() before sniffing
+    // with other line settings
+    void reset();
+    void feed(uint8_t data);
+    void feed(const uint8_t* data, uint16_t length);
+    uint16_t getLength();
+    bool isFull();
+
+    // Scores the window against the framing rules of every protocol:
+    //   VBUS    0xAA, 7-bit bytes, septet CRC on header and data blocks
+    //   KW-Bus  0x05 sync bytes; 0x01 <len> ... XOR checksum
+    //   P300    0x41 <len> ... sum checksum; 0x05/0x01 <len> ... sum checksum
+    //   KM-Bus  0x68 L L 0x68 ... CRC-16 or sum checksum, 0x16
+    ProtocolMatch classify();
+    uint8_t getScore(ProtocolType protocol);    // Percent of the window, after classify()
+    uint16_t getFrames(ProtocolType protocol);
+
+  private:
+    uint8_t _window[VBUSDETECT_WINDOW_SIZE];
+    uint16_t _length;
+    uint16_t _covered[VBUSDETECT_PROTOCOLS];
+    uint16_t _frames[VBUSDETECT_PROTOCOLS];
+
+    // Length of a valid frame starting at pos, 0 if there is none
+    uint16_t _matchVBUS(uint16_t pos);
+    uint16_t _matchKW(uint16_t pos);
+    uint16_t _matchP300(uint16_t pos);
+    uint16_t _matchKM(uint16_t pos);
+    uint16_t _match(ProtocolType protocol, uint16_t pos);
+
+    static uint8_t _vbusCRC(const uint8_t* data, uint8_t length);
+    static uint16_t _kmCRC16(const uint8_t* data, uint16_t length);
+};
+
+#endif
@@ -4,7 +4,7 @@
 
 #include "VBUSScheduler.h"
 
-VBUSScheduler::VBUSScheduler(VBUSDecoder* decoder, uint8_t maxRules) :
+VBUSScheduler::VBUSScheduler(VBUSDecoder* decoder, uint16_t maxRules) :
   _decoder(decoder),
   _maxRules(maxRules),
   _ruleCount(0),
@@ -13,18 +13,34 @@ VBUSScheduler::VBUSScheduler(VBUSDecoder* decoder, uint8_t maxRules) :
   _currentMinute(0),
   _currentDayOfWeek(0),
   _lastCheck(0),
-  _lastExecution(0)
+  _lastExecution(0),
+  _timeCount(0),
+  _tempCount(0),
+  _conditionCount(0),
+  _lastMinuteOfWeek(0xFFFF),
+  _lastFrameCount(0),
+  _indexDirty(true)
 {
   _rules = new ScheduleRule[_maxRules];
   memset(_rules, 0, sizeof(ScheduleRule) * _maxRules);
+  _timeIndex = new uint16_t[_maxRules];
+  _tempIndex = new uint16_t[_maxRules];
+  _conditionIndex = new uint16_t[_maxRules];
+  memset(_sensorStart, 0, sizeof(_sensorStart));
 }
 
 VBUSScheduler::~VBUSScheduler() {
+  for (uint16_t i = 0; i < _ruleCount; i++) {
+    delete _rules[i].condition;
+  }
   delete[] _rules;
+  delete[] _conditionIndex;
+  delete[] _timeIndex;
+  delete[] _tempIndex;
 }
 
 void VBUSScheduler::begin() {
-  _lastCheck = millis();
+  _lastCheck = VBUSClock::now();
 }
 
 void VBUSScheduler::setCurrentTime(uint8_t hour, uint8_t minute, uint8_t dayOfWeek) {
@@ -33,9 +49,10 @@ void VBUSScheduler::setCurrentTime(uint8_t hour, uint8_t minute, uint8_t dayOfWe
   _currentDayOfWeek = dayOfWeek;
 }
 
-uint8_t VBUSScheduler::addTimeRule(uint8_t hour, uint8_t minute, uint8_t daysOfWeek, 
-                                   ActionType action, uint8_t actionValue1, float actionValue2) {
+uint16_t VBUSScheduler::addTimeRule(uint8_t hour, uint8_t minute, uint8_t daysOfWeek, 
+                                    ActionType action, uint8_t actionValue1, float actionValue2) {
   if (_ruleCount >= _maxRules) return 0;
+  _indexDirty = true;
   
   ScheduleRule& rule = _rules[_ruleCount++];
   rule.id = _nextRuleId++;
@@ -52,15 +69,18 @@ uint8_t VBUSScheduler::addTimeRule(uint8_t hour, uint8_t minute, uint8_t daysOfW
   rule.actionValue1 = actionValue1;
   rule.actionValue2 = actionValue2;
   rule.callback = nullptr;
+  rule.condition = nullptr;
   rule.lastTriggered = 0;
   rule.wasActive = false;
   
   return rule.id;
 }
 
-uint8_t VBUSScheduler::addTemperatureRule(uint8_t sensorIndex, float threshold, bool aboveThreshold,
-                                          ActionType action, uint8_t actionValue1, float actionValue2) {
+uint16_t VBUSScheduler::addTemperatureRule(uint8_t sensorIndex, float threshold, bool aboveThreshold,
+                                           ActionType action, uint8_t actionValue1, float actionValue2) {
   if (_ruleCount >= _maxRules) return 0;
+  if (sensorIndex >= VBUSSCHED_MAX_SENSORS) return 0;
+  _indexDirty = true;
   
   ScheduleRule& rule = _rules[_ruleCount++];
   rule.id = _nextRuleId++;
@@ -76,15 +96,17 @@ uint8_t VBUSScheduler::addTemperatureRule(uint8_t sensorIndex, float threshold,
   rule.actionValue1 = actionValue1;
   rule.actionValue2 = actionValue2;
   rule.callback = nullptr;
+  rule.condition = nullptr;
   rule.lastTriggered = 0;
   rule.wasActive = false;
   
   return rule.id;
 }
 
-uint8_t VBUSScheduler::addCallbackRule(RuleType type, void (*callback)(VBUSDecoder*)) {
+uint16_t VBUSScheduler::addCallbackRule(RuleType type, void (*callback)(VBUSDecoder*)) {
   if (_ruleCount >= _maxRules) return 0;
   if (callback == nullptr) return 0;
+  _indexDirty = true;
   
   ScheduleRule& rule = _rules[_ruleCount++];
   rule.id = _nextRuleId++;
@@ -93,54 +115,107 @@ uint8_t VBUSScheduler::addCallbackRule(RuleType type, void (*callback)(VBUSDecod
   rule.enabled = true;
   rule.priority = 50;
   rule.callback = callback;
+  rule.condition = nullptr;
+  rule.lastTriggered = 0;
+  rule.wasActive = false;
+  
+  return rule.id;
+}
+
+// Compile the expression once; returns 0 if it does not parse
+uint16_t VBUSScheduler::addConditionRule(const char* expression, ActionType action,
+                                         uint8_t actionValue1, float actionValue2) {
+  if (_ruleCount >= _maxRules) return 0;
+  
+  VBUSExpression* condition = new VBUSExpression();
+  if (!condition->compile(expression)) {
+    delete condition;
+    return 0;
+  }
+  _indexDirty = true;
+  
+  ScheduleRule& rule = _rules[_ruleCount++];
+  rule.id = _nextRuleId++;
+  rule.type = RULE_CONDITION_BASED;
+  rule.action = action;
+  rule.enabled = true;
+  rule.priority = 50;  // Default priority
+  rule.condition = condition;
+  
+  rule.actionValue1 = actionValue1;
+  rule.actionValue2 = actionValue2;
+  rule.callback = nullptr;
   rule.lastTriggered = 0;
   rule.wasActive = false;
   
   return rule.id;
 }
 
-bool VBUSScheduler::removeRule(uint8_t ruleId) {
-  int8_t index = _findRuleIndex(ruleId);
+uint16_t VBUSScheduler::addConditionRule(const char* expression, void (*callback)(VBUSDecoder*)) {
+  if (callback == nullptr) return 0;
+  
+  uint16_t id = addConditionRule(expression, ACTION_CALLBACK);
+  if (id != 0) {
+    _rules[_ruleCount - 1].callback = callback;
+  }
+  return id;
+}
+
+bool VBUSScheduler::removeRule(uint16_t ruleId) {
+  int16_t index = _findRuleIndex(ruleId);
   if (index < 0) return false;
   
+  delete _rules[index].condition;
+  
   // Shift remaining rules
-  for (uint8_t i = index; i < _ruleCount - 1; i++) {
+  for (uint16_t i = index; i < _ruleCount - 1; i++) {
     _rules[i] = _rules[i + 1];
   }
   _ruleCount--;
+  _rules[_ruleCount].condition = nullptr;
+  _indexDirty = true;
   
   return true;
 }
 
-bool VBUSScheduler::enableRule(uint8_t ruleId, bool enable) {
-  int8_t index = _findRuleIndex(ruleId);
+bool VBUSScheduler::enableRule(uint16_t ruleId, bool enable) {
+  int16_t index = _findRuleIndex(ruleId);
   if (index < 0) return false;
   
   _rules[index].enabled = enable;
+  _indexDirty = true;
   return true;
 }
 
-bool VBUSScheduler::disableRule(uint8_t ruleId) {
+bool VBUSScheduler::disableRule(uint16_t ruleId) {
   return enableRule(ruleId, false);
 }
 
 void VBUSScheduler::clearAllRules() {
+  for (uint16_t i = 0; i < _ruleCount; i++) {
+    delete _rules[i].condition;
+  }
   _ruleCount = 0;
   memset(_rules, 0, sizeof(ScheduleRule) * _maxRules);
+  _indexDirty = true;
 }
 
-uint8_t VBUSScheduler::getRuleCount() {
+void VBUSScheduler::invalidateIndex() {
+  _indexDirty = true;
+}
+
+uint16_t VBUSScheduler::getRuleCount() {
   return _ruleCount;
 }
 
-ScheduleRule* VBUSScheduler::getRule(uint8_t ruleId) {
-  int8_t index = _findRuleIndex(ruleId);
+ScheduleRule* VBUSScheduler::getRule(uint16_t ruleId) {
+  int16_t index = _findRuleIndex(ruleId);
   if (index < 0) return nullptr;
   return &_rules[index];
 }
 
 void VBUSScheduler::loop() {
-  uint32_t now = millis();
+  uint32_t now = VBUSClock::now();
   
   // Check rules every second
   if (now - _lastCheck >= 1000) {
@@ -149,50 +224,64 @@ void VBUSScheduler::loop() {
   }
 }
 
+// Only rules affected by a time or value change are evaluated. After rules
+// changed, the index is rebuilt and every rule is evaluated once.
 void VBUSScheduler::checkRules() {
   if (!_decoder->isReady()) return;
   
-  for (uint8_t i = 0; i < _ruleCount; i++) {
-    ScheduleRule& rule = _rules[i];
-    if (!rule.enabled) continue;
-    
-    bool shouldTrigger = false;
-    
-    switch (rule.type) {
-      case RULE_TIME_BASED:
-        shouldTrigger = _checkTimeRule(rule);
-        break;
-      
-      case RULE_TEMPERATURE_BASED:
-        shouldTrigger = _checkTemperatureRule(rule);
-        break;
-      
-      case RULE_CONDITION_BASED:
-        // Complex conditions - future implementation
-        break;
+  if (_indexDirty) {
+    _rebuildIndex();
+    _checkAllRules();
+    return;
+  }
+  
+  // Time rules: the bucket of the minute just left and the current one
+  uint16_t minuteOfWeek = _currentDayOfWeek * 1440 + _currentHour * 60 + _currentMinute;
+  uint16_t minuteOfDay = minuteOfWeek % 1440;
+  bool minuteChanged = minuteOfWeek != _lastMinuteOfWeek;
+  if (minuteChanged) {
+    if (_lastMinuteOfWeek != 0xFFFF && _lastMinuteOfWeek % 1440 != minuteOfDay) {
+      _checkTimeBucket(_lastMinuteOfWeek % 1440);
     }
-    
-    // Execute if condition is met and wasn't active before (edge trigger)
-    if (shouldTrigger && !rule.wasActive) {
-      executeRule(rule.id);
-      rule.lastTriggered = millis();
+    _checkTimeBucket(minuteOfDay);
+    _lastMinuteOfWeek = minuteOfWeek;
+  }
+  
+  // Temperature rules: only when a new frame arrived, only crossed thresholds
+  uint32_t frameCount = _decoder->getFrameCount();
+  bool frameChanged = frameCount != _lastFrameCount;
+  if (frameChanged) {
+    _lastFrameCount = frameCount;
+    for (uint8_t sensor = 0; sensor < VBUSSCHED_MAX_SENSORS && !_indexDirty; sensor++) {
+      if (_sensorStart[sensor] != _sensorStart[sensor + 1]) {
+        _checkSensor(sensor);
+      }
+    }
+  }
+  
+  // Condition rules: only when one of their inputs may have changed
+  if (minuteChanged || frameChanged) {
+    for (uint16_t i = 0; i < _conditionCount && !_indexDirty; i++) {
+      ScheduleRule& rule = _rules[_conditionIndex[i]];
+      if ((minuteChanged && rule.condition->usesTime()) ||
+          (frameChanged && rule.condition->usesBusData())) {
+        _updateRule(rule, _checkConditionRule(rule));
+      }
     }
-    
-    rule.wasActive = shouldTrigger;
   }
 }
 
-void VBUSScheduler::executeRule(uint8_t ruleId) {
-  int8_t index = _findRuleIndex(ruleId);
+void VBUSScheduler::executeRule(uint16_t ruleId) {
+  int16_t index = _findRuleIndex(ruleId);
   if (index < 0) return;
   
   _executeAction(_rules[index]);
-  _lastExecution = millis();
+  _lastExecution = VBUSClock::now();
 }
 
-uint8_t VBUSScheduler::getActiveRuleCount() {
-  uint8_t count = 0;
-  for (uint8_t i = 0; i < _ruleCount; i++) {
+uint16_t VBUSScheduler::getActiveRuleCount() {
+  uint16_t count = 0;
+  for (uint16_t i = 0; i < _ruleCount; i++) {
     if (_rules[i].enabled) count++;
   }
   return count;
@@ -231,6 +320,11 @@ bool VBUSScheduler::_checkTemperatureRule(const ScheduleRule& rule) {
   }
 }
 
+bool VBUSScheduler::_checkConditionRule(const ScheduleRule& rule) {
+  if (rule.condition == nullptr) return false;
+  return rule.condition->test(_decoder, _currentHour, _currentMinute, _currentDayOfWeek);
+}
+
 void VBUSScheduler::_executeAction(const ScheduleRule& rule) {
   bool success = false;
   
@@ -284,11 +378,171 @@ void VBUSScheduler::_executeAction(const ScheduleRule& rule) {
   (void)success;  // Suppress unused variable warning
 }
 
-int8_t VBUSScheduler::_findRuleIndex(uint8_t ruleId) {
-  for (uint8_t i = 0; i < _ruleCount; i++) {
+int16_t VBUSScheduler::_findRuleIndex(uint16_t ruleId) {
+  for (uint16_t i = 0; i < _ruleCount; i++) {
     if (_rules[i].id == ruleId) {
       return i;
     }
   }
   return -1;
 }
+
+// Edge trigger: execute when the condition becomes active
+void VBUSScheduler::_updateRule(ScheduleRule& rule, bool shouldTrigger) {
+  if (!rule.enabled) return;
+  
+  if (shouldTrigger && !rule.wasActive) {
+    _executeAction(rule);
+    _lastExecution = VBUSClock::now();
+    rule.lastTriggered = _lastExecution;
+  }
+  
+  rule.wasActive = shouldTrigger;
+}
+
+void VBUSScheduler::_rebuildIndex() {
+  _timeCount = 0;
+  _tempCount = 0;
+  _conditionCount = 0;
+  uint16_t sensorCount[VBUSSCHED_MAX_SENSORS] = {0};
+  
+  // Insertion sort, rules only change rarely
+  for (uint16_t i = 0; i < _ruleCount; i++) {
+    const ScheduleRule& rule = _rules[i];
+    if (!rule.enabled) continue;
+    
+    if (rule.type == RULE_TIME_BASED) {
+      uint16_t pos = _timeCount++;
+      while (pos > 0 && _timeKey(_timeIndex[pos - 1]) > _timeKey(i)) {
+        _timeIndex[pos] = _timeIndex[pos - 1];
+        pos--;
+      }
+      _timeIndex[pos] = i;
+    } else if (rule.type == RULE_TEMPERATURE_BASED &&
+               rule.tempCondition.sensorIndex < VBUSSCHED_MAX_SENSORS) {
+      uint16_t pos = _tempCount++;
+      while (pos > 0) {
+        const TemperatureCondition& prev = _rules[_tempIndex[pos - 1]].tempCondition;
+        if (prev.sensorIndex < rule.tempCondition.sensorIndex) break;
+        if (prev.sensorIndex == rule.tempCondition.sensorIndex &&
+            prev.threshold <= rule.tempCondition.threshold) break;
+        _tempIndex[pos] = _tempIndex[pos - 1];
+        pos--;
+      }
+      _tempIndex[pos] = i;
+      sensorCount[rule.tempCondition.sensorIndex]++;
+    } else if (rule.type == RULE_CONDITION_BASED && rule.condition != nullptr) {
+      _conditionIndex[_conditionCount++] = i;
+    }
+  }
+  
+  _sensorStart[0] = 0;
+  for (uint8_t s = 0; s < VBUSSCHED_MAX_SENSORS; s++) {
+    _sensorStart[s + 1] = _sensorStart[s] + sensorCount[s];
+  }
+  
+  _indexDirty = false;
+}
+
+// Full pass over all rules; also records the state the incremental checks start from
+void VBUSScheduler::_checkAllRules() {
+  for (uint16_t i = 0; i < _ruleCount && !_indexDirty; i++) {
+    ScheduleRule& rule = _rules[i];
+    
+    bool shouldTrigger = false;
+    
+    switch (rule.type) {
+      case RULE_TIME_BASED:
+        shouldTrigger = _checkTimeRule(rule);
+        break;
+      
+      case RULE_TEMPERATURE_BASED:
+        shouldTrigger = _checkTemperatureRule(rule);
+        break;
+      
+      case RULE_CONDITION_BASED:
+        shouldTrigger = _checkConditionRule(rule);
+        break;
+    }
+    
+    _updateRule(rule, shouldTrigger);
+  }
+  
+  _lastMinuteOfWeek = _currentDayOfWeek * 1440 + _currentHour * 60 + _currentMinute;
+  _lastFrameCount = _decoder->getFrameCount();
+  for (uint8_t s = 0; s < VBUSSCHED_MAX_SENSORS; s++) {
+    float temp = _decoder->getTemp(s);
+    _lastTemp[s] = (temp < -99.0 || temp > 999.0) ? NAN : temp;
+  }
+}
+
+// Evaluate the time rules scheduled at one minute of the day
+void VBUSScheduler::_checkTimeBucket(uint16_t minuteOfDay) {
+  // Binary search for the first rule at this minute
+  uint16_t lo = 0;
+  uint16_t hi = _timeCount;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (_timeKey(_timeIndex[mid]) < minuteOfDay) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  
+  for (uint16_t i = lo; i < _timeCount && !_indexDirty; i++) {
+    ScheduleRule& rule = _rules[_timeIndex[i]];
+    if (_timeKey(_timeIndex[i]) != minuteOfDay) break;
+    _updateRule(rule, _checkTimeRule(rule));
+  }
+}
+
+// Evaluate the temperature rules of one sensor whose threshold lies
+// between the previous and the current value
+void VBUSScheduler::_checkSensor(uint8_t sensor) {
+  float temp = _decoder->getTemp(sensor);
+  bool valid = !(temp < -99.0 || temp > 999.0);
+  float last = _lastTemp[sensor];
+  if (valid && temp == last) return;
+  if (!valid && isnan(last)) return;
+  
+  uint16_t from = _sensorStart[sensor];
+  uint16_t to = _sensorStart[sensor + 1];
+  
+  // A sensor becoming valid or invalid affects all of its rules
+  if (valid && !isnan(last)) {
+    float low = temp < last ? temp : last;
+    float high = temp < last ? last : temp;
+    
+    uint16_t lo = from;
+    uint16_t hi = to;
+    while (lo < hi) {
+      uint16_t mid = (lo + hi) / 2;
+      if (_threshold(mid) < low) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    from = lo;
+    while (to > from && _threshold(to - 1) > high) {
+      to--;
+    }
+  }
+  
+  for (uint16_t i = from; i < to && !_indexDirty; i++) {
+    ScheduleRule& rule = _rules[_tempIndex[i]];
+    _updateRule(rule, _checkTemperatureRule(rule));
+  }
+  
+  _lastTemp[sensor] = valid ? temp : NAN;
+}
+
+uint16_t VBUSScheduler::_timeKey(uint16_t ruleIndex) {
+  const TimeSchedule& schedule = _rules[ruleIndex].timeSchedule;
+  return schedule.hour * 60 + schedule.minute;
+}
+
+float VBUSScheduler::_threshold(uint16_t tempIndexPos) {
+  return _rules[_tempIndex[tempIndexPos]].tempCondition.threshold;
+}
@@ -9,12 +9,16 @@
 
 #include <Arduino.h>
 #include "vbusdecoder.h"
+#include "VBUSExpression.h"
+
+// Temperature sensors that can be indexed (matches the decoder channel array)
+#define VBUSSCHED_MAX_SENSORS 32
 
 // Rule types
 enum RuleType {
   RULE_TIME_BASED,           // Time-based trigger (e.g., daily at 6:00)
   RULE_TEMPERATURE_BASED,    // Temperature threshold trigger
-  RULE_CONDITION_BASED       // Complex condition with multiple factors
+  RULE_CONDITION_BASED       // Expression over sensors, outputs and time (see VBUSExpression.h)
 };
 
 // Action types
@@ -45,7 +49,7 @@ struct TemperatureCondition {
 
 // Schedule rule
 struct ScheduleRule {
-  uint8_t id;                // Unique rule ID
+  uint16_t id;               // Unique rule ID
   RuleType type;             // Type of rule
   ActionType action;         // Action to perform
   bool enabled;              // Is this rule enabled?
@@ -54,6 +58,7 @@ struct ScheduleRule {
   // Type-specific data
   TimeSchedule timeSchedule;
   TemperatureCondition tempCondition;
+  VBUSExpression* condition; // Compiled condition, owned by the scheduler
   
   // Action parameters
   uint8_t actionValue1;      // First parameter (e.g., mode, circuit)
@@ -69,7 +74,7 @@ struct ScheduleRule {
 
 class VBUSScheduler {
   public:
-    VBUSScheduler(VBUSDecoder* decoder, uint8_t maxRules = 16);
+    VBUSScheduler(VBUSDecoder* decoder, uint16_t maxRules = 16);
     ~VBUSScheduler();
     
     // Configuration
@@ -77,35 +82,39 @@ class VBUSScheduler {
     void setCurrentTime(uint8_t hour, uint8_t minute, uint8_t dayOfWeek);
     
     // Rule management
-    uint8_t addTimeRule(uint8_t hour, uint8_t minute, uint8_t daysOfWeek, 
-                        ActionType action, uint8_t actionValue1 = 0, float actionValue2 = 0);
-    uint8_t addTemperatureRule(uint8_t sensorIndex, float threshold, bool aboveThreshold,
-                               ActionType action, uint8_t actionValue1 = 0, float actionValue2 = 0);
-    uint8_t addCallbackRule(RuleType type, void (*callback)(VBUSDecoder*));
-    bool removeRule(uint8_t ruleId);
-    bool enableRule(uint8_t ruleId, bool enable = true);
-    bool disableRule(uint8_t ruleId);
+    uint16_t addTimeRule(uint8_t hour, uint8_t minute, uint8_t daysOfWeek, 
+                         ActionType action, uint8_t actionValue1 = 0, float actionValue2 = 0);
+    uint16_t addTemperatureRule(uint8_t sensorIndex, float threshold, bool aboveThreshold,
+                                ActionType action, uint8_t actionValue1 = 0, float actionValue2 = 0);
+    uint16_t addCallbackRule(RuleType type, void (*callback)(VBUSDecoder*));
+    uint16_t addConditionRule(const char* expression, ActionType action,
+                              uint8_t actionValue1 = 0, float actionValue2 = 0);
+    uint16_t addConditionRule(const char* expression, void (*callback)(VBUSDecoder*));
+    bool removeRule(uint16_t ruleId);
+    bool enableRule(uint16_t ruleId, bool enable = true);
+    bool disableRule(uint16_t ruleId);
     void clearAllRules();
+    void invalidateIndex();    // Call after editing a rule returned by getRule()
     
     // Rule queries
-    uint8_t getRuleCount();
-    ScheduleRule* getRule(uint8_t ruleId);
+    uint16_t getRuleCount();
+    ScheduleRule* getRule(uint16_t ruleId);
     
     // Execution
     void loop();
     void checkRules();
-    void executeRule(uint8_t ruleId);
+    void executeRule(uint16_t ruleId);
     
     // Status
-    uint8_t getActiveRuleCount();
+    uint16_t getActiveRuleCount();
     uint32_t getLastExecutionTime();
     
   private:
     VBUSDecoder* _decoder;
     ScheduleRule* _rules;
-    uint8_t _maxRules;
-    uint8_t _ruleCount;
-    uint8_t _nextRuleId;
+    uint16_t _maxRules;
+    uint16_t _ruleCount;
+    uint16_t _nextRuleId;
     
     // Current time (must be updated externally)
     uint8_t _currentHour;
@@ -114,11 +123,32 @@ class VBUSScheduler {
     uint32_t _lastCheck;
     uint32_t _lastExecution;
     
+    // Rule index, rebuilt only when rules are added, removed or toggled
+    uint16_t* _timeIndex;      // Time rules sorted by minute of day
+    uint16_t _timeCount;
+    uint16_t* _tempIndex;      // Temperature rules sorted by sensor, then threshold
+    uint16_t _tempCount;
+    uint16_t _sensorStart[VBUSSCHED_MAX_SENSORS + 1];  // First _tempIndex entry per sensor
+    float _lastTemp[VBUSSCHED_MAX_SENSORS];            // NAN if unknown or invalid
+    uint16_t* _conditionIndex; // Condition rules with a compiled expression
+    uint16_t _conditionCount;
+    uint16_t _lastMinuteOfWeek;
+    uint32_t _lastFrameCount;
+    bool _indexDirty;
+    
     // Helper methods
     bool _checkTimeRule(const ScheduleRule& rule);
     bool _checkTemperatureRule(const ScheduleRule& rule);
+    bool _checkConditionRule(const ScheduleRule& rule);
     void _executeAction(const ScheduleRule& rule);
-    int8_t _findRuleIndex(uint8_t ruleId);
+    int16_t _findRuleIndex(uint16_t ruleId);
+    void _updateRule(ScheduleRule& rule, bool shouldTrigger);
+    void _rebuildIndex();
+    void _checkAllRules();
+    void _checkTimeBucket(uint16_t minuteOfDay);
+    void _checkSensor(uint8_t sensor);
+    uint16_t _timeKey(uint16_t ruleIndex);
+    float _threshold(uint16_t tempIndexPos);
 };
 
 #endif
@@ -0,0 +1,191 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Data Encoding implementation
+ */
+
+#include "DataEncoding.h"
+#include "HttpAccept.h"
+#include <string.h>
+
+// Appends CBOR or MessagePack items. Only the item types the data schema
+// needs: unsigned integers, text, bool, float32, arrays and maps
+class DataWriter {
+public:
+    DataWriter(DataFormat format, std::string& out) : format(format), out(out) {}
+
+    void map(size_t count) {
+        if (format == DATA_FORMAT_CBOR) cborHead(5, count);
+        else if (count < 16) byte(0x80 | count);
+        else { byte(0xde); be(count, 2); }
+    }
+
+    void array(size_t count) {
+        if (format == DATA_FORMAT_CBOR) cborHead(4, count);
+        else if (count < 16) byte(0x90 | count);
+        else { byte(0xdc); be(count, 2); }
+    }
+
+    void uint(uint32_t value) {
+        if (format == DATA_FORMAT_CBOR) cborHead(0, value);
+        else if (value < 0x80) byte(value);
+        else if (value <= 0xff) { byte(0xcc); be(value, 1); }
+        else if (value <= 0xffff) { byte(0xcd); be(value, 2); }
+        else { byte(0xce); be(value, 4); }
+    }
+
+    void text(const char* value) {
+        size_t length = strnlen(value, 255);
+        if (format == DATA_FORMAT_CBOR) cborHead(3, length);
+        else if (length < 32) byte(0xa0 | length);
+        else { byte(0xd9); be(length, 1); }
+        out.append(value, length);
+    }
+
+    void boolean(bool value) {
+        if (format == DATA_FORMAT_CBOR) byte(value ? 0xf5 : 0xf4);
+        else byte(value ? 0xc3 : 0xc2);
+    }
+
+    // NAN (sensor unavailable) is kept, both formats carry it as a float
+    void float32(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        byte(format == DATA_FORMAT_CBOR ? 0xfa : 0xca);
+        be(bits, 4);
+    }
+
+private:
+    DataFormat format;
+    std::string& out;
+
+    void byte(uint32_t value) {
+        out.push_back((char)(value & 0xff));
+    }
+
+    void be(uint32_t value, int bytes) {
+        for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) byte(value >> shift);
+    }
+
+    // Major type and argument in the shortest form
+    void cborHead(uint8_t major, uint32_t value) {
+        major <<= 5;
+        if (value < 24) byte(major | value);
+        else if (value <= 0xff) { byte(major | 24); be(value, 1); }
+        else if (value <= 0xffff) { byte(major | 25); be(value, 2); }
+        else { byte(major | 26); be(value, 4); }
+    }
+};
+
+void encodeDataState(const DataState& state, DataFormat format, std::string& out) {
+    DataWriter w(format, out);
+    out.clear();
+
+    w.map(state.decoding ? (state.kmBus ? 16 : 15) : 8);
+    w.uint(DATA_KEY_SCHEMA);
+    w.uint(DATA_SCHEMA_ID);
+    w.uint(DATA_KEY_SEQUENCE);
+    w.uint(state.sequence);
+    w.uint(DATA_KEY_SERIAL_CONNECTED);
+    w.boolean(state.serialConnected);
+    w.uint(DATA_KEY_COMPATIBLE);
+    w.boolean(state.compatible);
+    w.uint(DATA_KEY_READY);
+    w.boolean(state.ready);
+    w.uint(DATA_KEY_STATUS);
+    w.uint(state.status);
+    w.uint(DATA_KEY_PROTOCOL);
+    w.uint(state.protocol);
+    w.uint(DATA_KEY_SERIAL_PORT);
+    w.text(state.serialPort);
+    if (!state.decoding) return;
+
+    w.uint(DATA_KEY_TEMPERATURES);
+    w.array(state.tempCount);
+    for (uint8_t i = 0; i < state.tempCount; i++) w.float32(state.temperatures[i]);
+    w.uint(DATA_KEY_PUMPS);
+    w.array(state.pumpCount);
+    for (uint8_t i = 0; i < state.pumpCount; i++) w.uint(state.pumps[i]);
+    w.uint(DATA_KEY_RELAYS);
+    w.array(state.relayCount);
+    for (uint8_t i = 0; i < state.relayCount; i++) w.boolean(state.relays[i]);
+    w.uint(DATA_KEY_ERROR_MASK);
+    w.uint(state.errorMask);
+    w.uint(DATA_KEY_HEAT_QUANTITY);
+    w.uint(state.heatQuantity);
+    w.uint(DATA_KEY_SYSTEM_TIME);
+    w.uint(state.systemTime);
+
+    w.uint(DATA_KEY_PARTICIPANTS);
+    w.array(state.participantCount);
+    for (uint8_t i = 0; i < state.participantCount; i++) {
+        const DataParticipant& p = state.participants[i];
+        w.map(7);
+        w.uint(DATA_PARTICIPANT_ADDRESS);
+        w.uint(p.address);
+        w.uint(DATA_PARTICIPANT_NAME);
+        w.text(p.name);
+        w.uint(DATA_PARTICIPANT_TEMPS);
+        w.uint(p.tempChannels);
+        w.uint(DATA_PARTICIPANT_PUMPS);
+        w.uint(p.pumpChannels);
+        w.uint(DATA_PARTICIPANT_RELAYS);
+        w.uint(p.relayChannels);
+        w.uint(DATA_PARTICIPANT_ACTIVE);
+        w.boolean(p.active);
+        w.uint(DATA_PARTICIPANT_AGE);
+        w.uint(p.age);
+    }
+
+    if (!state.kmBus) return;
+    w.uint(DATA_KEY_KM);
+    w.map(9);
+    w.uint(DATA_KM_BURNER);
+    w.boolean(state.kmBurner);
+    w.uint(DATA_KM_MAIN_PUMP);
+    w.boolean(state.kmMainPump);
+    w.uint(DATA_KM_LOOP_PUMP);
+    w.boolean(state.kmLoopPump);
+    w.uint(DATA_KM_MODE);
+    w.uint(state.kmMode);
+    w.uint(DATA_KM_BOILER_TEMP);
+    w.float32(state.kmBoilerTemp);
+    w.uint(DATA_KM_HOT_WATER_TEMP);
+    w.float32(state.kmHotWaterTemp);
+    w.uint(DATA_KM_OUTDOOR_TEMP);
+    w.float32(state.kmOutdoorTemp);
+    w.uint(DATA_KM_SETPOINT_TEMP);
+    w.float32(state.kmSetpointTemp);
+    w.uint(DATA_KM_DEPARTURE_TEMP);
+    w.float32(state.kmDepartureTemp);
+}
+
+const char* getDataContentType(DataFormat format) {
+    switch (format) {
+        case DATA_FORMAT_CBOR: return "application/cbor";
+        case DATA_FORMAT_MSGPACK: return "application/msgpack";
+        default: return "application/json";
+    }
+}
+
+DataFormat parseDataAccept(const char* accept) {
+    static const struct {
+        const char* type;
+        DataFormat format;
+    } types[] = {
+        { "application/json", DATA_FORMAT_JSON },
+        { "application/cbor", DATA_FORMAT_CBOR },
+        { "application/msgpack", DATA_FORMAT_MSGPACK },
+        { "application/vnd.msgpack", DATA_FORMAT_MSGPACK },
+        { "application/x-msgpack", DATA_FORMAT_MSGPACK }
+    };
+    if (!accept) return DATA_FORMAT_JSON;
+
+    const char* p = accept;
+    AcceptItem item;
+    while (nextAcceptItem(p, item)) {
+        if (!item.accepted) continue;
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (acceptItemIs(item, types[i].type)) return types[i].format;
+        }
+    }
+    return DATA_FORMAT_JSON;
+}
@@ -0,0 +1,123 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Data Encoding
+ * CBOR and MessagePack renderings of the decoded state served at
+ * /data.cbor and /data.msgpack
+ */
+
+#pragma once
+#ifndef DATA_ENCODING_H
+#define DATA_ENCODING_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Bumped whenever a key changes meaning or type. New keys may be added to
+// a schema; clients must skip keys they do not know
+#define DATA_SCHEMA_ID 1
+
+#define DATA_MAX_CHANNELS 32
+#define DATA_MAX_PARTICIPANTS 16
+
+// Top level map keys of schema 1
+enum DataKey: uint8_t {
+    DATA_KEY_SCHEMA = 0,
+    DATA_KEY_SEQUENCE = 1,
+    DATA_KEY_SERIAL_CONNECTED = 2,
+    DATA_KEY_COMPATIBLE = 3,
+    DATA_KEY_READY = 4,
+    DATA_KEY_STATUS = 5,           // 0 = disconnected, 1 = OK, 2 = error
+    DATA_KEY_PROTOCOL = 6,
+    DATA_KEY_SERIAL_PORT = 7,
+    DATA_KEY_TEMPERATURES = 8,     // Array of float32, degrees Celsius
+    DATA_KEY_PUMPS = 9,            // Array of percent
+    DATA_KEY_RELAYS = 10,          // Array of bool
+    DATA_KEY_ERROR_MASK = 11,
+    DATA_KEY_HEAT_QUANTITY = 12,   // Wh
+    DATA_KEY_SYSTEM_TIME = 13,     // Minutes since midnight
+    DATA_KEY_PARTICIPANTS = 14,    // Array of maps, see DataParticipantKey
+    DATA_KEY_KM = 15               // KM-Bus only, see DataKmKey
+};
+
+enum DataParticipantKey: uint8_t {
+    DATA_PARTICIPANT_ADDRESS = 0,
+    DATA_PARTICIPANT_NAME = 1,
+    DATA_PARTICIPANT_TEMPS = 2,
+    DATA_PARTICIPANT_PUMPS = 3,
+    DATA_PARTICIPANT_RELAYS = 4,
+    DATA_PARTICIPANT_ACTIVE = 5,
+    DATA_PARTICIPANT_AGE = 6       // Milliseconds since the last packet
+};
+
+enum DataKmKey: uint8_t {
+    DATA_KM_BURNER = 0,
+    DATA_KM_MAIN_PUMP = 1,
+    DATA_KM_LOOP_PUMP = 2,
+    DATA_KM_MODE = 3,
+    DATA_KM_BOILER_TEMP = 4,
+    DATA_KM_HOT_WATER_TEMP = 5,
+    DATA_KM_OUTDOOR_TEMP = 6,
+    DATA_KM_SETPOINT_TEMP = 7,
+    DATA_KM_DEPARTURE_TEMP = 8
+};
+
+enum DataFormat: uint8_t {
+    DATA_FORMAT_JSON = 0,
+    DATA_FORMAT_CBOR = 1,
+    DATA_FORMAT_MSGPACK = 2
+};
+
+struct DataParticipant {
+    uint16_t address;
+    char name[32];
+    uint8_t tempChannels;
+    uint8_t pumpChannels;
+    uint8_t relayChannels;
+    bool active;
+    uint32_t age;
+};
+
+// Decoded values copied out of the decoder under data_mutex, so both
+// encodings are rendered from the same frame without holding the lock
+struct DataState {
+    uint32_t sequence;
+    bool serialConnected;
+    bool compatible;
+    bool ready;
+    uint8_t status;
+    uint8_t protocol;
+    char serialPort[64];
+    bool decoding;                 // Values below are only encoded when set
+    uint8_t tempCount;
+    float temperatures[DATA_MAX_CHANNELS];
+    uint8_t pumpCount;
+    uint8_t pumps[DATA_MAX_CHANNELS];
+    uint8_t relayCount;
+    bool relays[DATA_MAX_CHANNELS];
+    uint16_t errorMask;
+    uint16_t heatQuantity;
+    uint16_t systemTime;
+    uint8_t participantCount;
+    DataParticipant participants[DATA_MAX_PARTICIPANTS];
+    bool kmBus;
+    bool kmBurner;
+    bool kmMainPump;
+    bool kmLoopPump;
+    uint8_t kmMode;
+    float kmBoilerTemp;
+    float kmHotWaterTemp;
+    float kmOutdoorTemp;
+    float kmSetpointTemp;
+    float kmDepartureTemp;
+};
+
+// Renders state as CBOR (RFC 8949) or MessagePack into out. Both use the
+// integer keys above and the smallest encoding for every integer
+void encodeDataState(const DataState& state, DataFormat format, std::string& out);
+
+// Content type of a format, and the first format an Accept header lists
+// (ignoring q=0 entries); DATA_FORMAT_JSON when it names none
+const char* getDataContentType(DataFormat format);
+DataFormat parseDataAccept(const char* accept);
+
+#endif // DATA_ENCODING_H
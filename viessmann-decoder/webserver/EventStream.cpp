@@ -0,0 +1,471 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Event Stream implementation
+ */
+
+#include "EventStream.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "Arduino.h"
+
+// WebSocket opcodes (RFC 6455)
+#define WS_OP_TEXT  0x1
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING  0x9
+#define WS_OP_PONG  0xA
+
+static const char* WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// SHA-1 of a short string, only used for the WebSocket handshake
+static void sha1(const uint8_t* data, size_t length, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    uint64_t bits = (uint64_t)length * 8;
+    size_t total = ((length + 8) / 64 + 1) * 64;
+
+    for (size_t chunk = 0; chunk < total; chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = 0;
+            for (int j = 0; j < 4; j++) {
+                size_t pos = chunk + i * 4 + j;
+                uint8_t byte;
+                if (pos < length) byte = data[pos];
+                else if (pos == length) byte = 0x80;
+                else if (pos >= total - 8) byte = (uint8_t)(bits >> ((total - 1 - pos) * 8));
+                else byte = 0;
+                w[i] = (w[i] << 8) | byte;
+            }
+        }
+        for (int i = 16; i < 80; i++) {
+            uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (x << 1) | (x >> 31);
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            uint32_t temp = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = temp;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    for (int i = 0; i < 20; i++) {
+        digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+    }
+}
+
+static void base64(const uint8_t* data, size_t length, char* out) {
+    static const char* table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < length) v |= data[i + 1] << 8;
+        if (i + 2 < length) v |= data[i + 2];
+        out[o++] = table[(v >> 18) & 0x3F];
+        out[o++] = table[(v >> 12) & 0x3F];
+        out[o++] = i + 1 < length ? table[(v >> 6) & 0x3F] : '=';
+        out[o++] = i + 2 < length ? table[v & 0x3F] : '=';
+    }
+    out[o] = '\0';
+}
+
+static MHD_Result queueStatus(struct MHD_Connection* connection, unsigned int status, const char* text) {
+    struct MHD_Response* response = MHD_create_response_from_buffer(strlen(text), (void*)text,
+                                                                    MHD_RESPMEM_PERSISTENT);
+    if (status == MHD_HTTP_BAD_REQUEST) {
+        MHD_add_response_header(response, "Sec-WebSocket-Version", "13");
+    }
+    MHD_Result ret = MHD_queue_response(connection, status, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+EventStream::EventStream() :
+    closing(false),
+    frameSeq(0),
+    heartbeatSeq(0),
+    lastEvent(millis()) {
+    pthread_mutex_init(&mutex, NULL);
+    sseHeartbeat = Message(new std::string(": ping\n\n"));
+}
+
+EventStream::~EventStream() {
+    for (size_t i = 0; i < wsClients.size(); i++) closeWebSocket(wsClients[i]);
+    pthread_mutex_destroy(&mutex);
+}
+
+MHD_Result EventStream::handleRequest(struct MHD_Connection* connection, const char* method) {
+    if (strcmp(method, "GET") != 0) {
+        return queueStatus(connection, MHD_HTTP_METHOD_NOT_ALLOWED, "Method not allowed");
+    }
+
+    const char* upgrade = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_UPGRADE);
+    if (upgrade != NULL && strcasecmp(upgrade, "websocket") == 0) {
+        return handleWebSocket(connection);
+    }
+    return handleSse(connection);
+}
+
+MHD_Result EventStream::handleSse(struct MHD_Connection* connection) {
+    pthread_mutex_lock(&mutex);
+    if (closing || sseClients.size() + wsClients.size() >= EVENTS_MAX_CLIENTS) {
+        pthread_mutex_unlock(&mutex);
+        return queueStatus(connection, MHD_HTTP_SERVICE_UNAVAILABLE, "Too many event clients");
+    }
+    SseClient* client = new SseClient();
+    client->owner = this;
+    client->connection = connection;
+    client->frameSeq = 0;                 // The current frame goes out right away
+    client->heartbeatSeq = heartbeatSeq;
+    client->offset = 0;
+    client->suspended = false;
+    sseClients.push_back(client);
+    pthread_mutex_unlock(&mutex);
+
+    // freeSse() runs when the connection is gone and drops the client
+    struct MHD_Response* response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4096,
+                                                                      &EventStream::readSse, client,
+                                                                      &EventStream::freeSse);
+    if (response == NULL) {
+        freeSse(client);
+        return MHD_NO;
+    }
+    MHD_add_response_header(response, "Content-Type", "text/event-stream");
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    MHD_add_response_header(response, "X-Accel-Buffering", "no");   // Reverse proxies must not buffer
+    MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+MHD_Result EventStream::handleWebSocket(struct MHD_Connection* connection) {
+    const char* key = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Sec-WebSocket-Key");
+    const char* version = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Sec-WebSocket-Version");
+    if (key == NULL || version == NULL || strcmp(version, "13") != 0 || strlen(key) > 64) {
+        return queueStatus(connection, MHD_HTTP_BAD_REQUEST, "Bad WebSocket handshake");
+    }
+
+    pthread_mutex_lock(&mutex);
+    bool full = closing || sseClients.size() + wsClients.size() >= EVENTS_MAX_CLIENTS;
+    pthread_mutex_unlock(&mutex);
+    if (full) {
+        return queueStatus(connection, MHD_HTTP_SERVICE_UNAVAILABLE, "Too many event clients");
+    }
+
+    char input[128];
+    int length = snprintf(input, sizeof(input), "%s%s", key, WS_GUID);
+    uint8_t digest[20];
+    sha1((const uint8_t*)input, length, digest);
+    char accept[32];
+    base64(digest, sizeof(digest), accept);
+
+    struct MHD_Response* response = MHD_create_response_for_upgrade(&EventStream::upgraded, this);
+    if (response == NULL) return MHD_NO;
+    MHD_add_response_header(response, MHD_HTTP_HEADER_UPGRADE, "websocket");
+    MHD_add_response_header(response, "Sec-WebSocket-Accept", accept);
+    MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_SWITCHING_PROTOCOLS, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+void EventStream::publish(const char* json, size_t length) {
+    // Serialize once per transport, outside the lock
+    char header[32];
+    int headerLength = snprintf(header, sizeof(header), "id: %u\ndata: ", (unsigned)(frameSeq + 1));
+    std::string* sse = new std::string();
+    sse->reserve(headerLength + length + 2);
+    sse->append(header, headerLength);
+    sse->append(json, length);
+    sse->append("\n\n");
+
+    uint8_t wsHeader[10];
+    size_t wsHeaderLength;
+    wsHeader[0] = 0x80 | WS_OP_TEXT;
+    if (length < 126) {
+        wsHeader[1] = (uint8_t)length;
+        wsHeaderLength = 2;
+    } else if (length < 65536) {
+        wsHeader[1] = 126;
+        wsHeader[2] = (uint8_t)(length >> 8);
+        wsHeader[3] = (uint8_t)length;
+        wsHeaderLength = 4;
+    } else {
+        wsHeader[1] = 127;
+        for (int i = 0; i < 8; i++) wsHeader[2 + i] = (uint8_t)((uint64_t)length >> ((7 - i) * 8));
+        wsHeaderLength = 10;
+    }
+    std::string* ws = new std::string();
+    ws->reserve(wsHeaderLength + length);
+    ws->append((const char*)wsHeader, wsHeaderLength);
+    ws->append(json, length);
+
+    pthread_mutex_lock(&mutex);
+    if (++frameSeq == 0) frameSeq = 1;   // 0 means "nothing sent yet"
+    sseFrame = Message(sse);
+    wsFrame = Message(ws);
+    lastEvent = millis();
+    resumeSuspended();
+    pthread_mutex_unlock(&mutex);
+}
+
+void EventStream::loop() {
+    unsigned long now = millis();
+
+    pthread_mutex_lock(&mutex);
+    bool heartbeat = !closing && now - lastEvent >= EVENTS_HEARTBEAT_MS;
+    if (heartbeat) {
+        lastEvent = now;
+        heartbeatSeq++;
+        resumeSuspended();
+    }
+
+    for (size_t i = 0; i < wsClients.size(); ) {
+        WsClient* client = wsClients[i];
+        bool alive = !heartbeat || sendControlFrame(client, WS_OP_PING, NULL, 0);
+        if (!alive || !readWebSocket(client) || !flushWebSocket(client, now)) {
+            closeWebSocket(client);
+            wsClients.erase(wsClients.begin() + i);
+            continue;
+        }
+        i++;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void EventStream::closeAll() {
+    pthread_mutex_lock(&mutex);
+    closing = true;
+    // Suspended connections would block MHD_stop_daemon; readSse() ends them
+    resumeSuspended();
+    for (size_t i = 0; i < wsClients.size(); i++) {
+        static const uint8_t goingAway[2] = { 0x03, 0xE9 };   // 1001
+        sendControlFrame(wsClients[i], WS_OP_CLOSE, goingAway, sizeof(goingAway));
+        closeWebSocket(wsClients[i]);
+    }
+    wsClients.clear();
+    pthread_mutex_unlock(&mutex);
+}
+
+size_t EventStream::getClientCount() {
+    pthread_mutex_lock(&mutex);
+    size_t count = sseClients.size() + wsClients.size();
+    pthread_mutex_unlock(&mutex);
+    return count;
+}
+
+// Called with the mutex held
+void EventStream::resumeSuspended() {
+    for (size_t i = 0; i < sseClients.size(); i++) {
+        if (sseClients[i]->suspended) {
+            sseClients[i]->suspended = false;
+            MHD_resume_connection(sseClients[i]->connection);
+        }
+    }
+}
+
+// libmicrohttpd asks for more data whenever the socket is writable. With
+// nothing new to send the connection is suspended until publish() resumes it
+ssize_t EventStream::readSse(void* cls, uint64_t pos, char* buf, size_t max) {
+    (void)pos;
+    SseClient* client = (SseClient*)cls;
+    EventStream* self = client->owner;
+
+    pthread_mutex_lock(&self->mutex);
+    if (self->closing) {
+        pthread_mutex_unlock(&self->mutex);
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+
+    if (!client->message) {
+        if (self->frameSeq != client->frameSeq && self->sseFrame) {
+            // Always the newest frame; frames published meanwhile are skipped
+            client->message = self->sseFrame;
+            client->frameSeq = self->frameSeq;
+            client->heartbeatSeq = self->heartbeatSeq;
+        } else if (self->heartbeatSeq != client->heartbeatSeq) {
+            client->message = self->sseHeartbeat;
+            client->heartbeatSeq = self->heartbeatSeq;
+        } else {
+            client->suspended = true;
+            MHD_suspend_connection(client->connection);
+            pthread_mutex_unlock(&self->mutex);
+            return 0;
+        }
+        client->offset = 0;
+    }
+
+    size_t length = client->message->size() - client->offset;
+    if (length > max) length = max;
+    memcpy(buf, client->message->data() + client->offset, length);
+    client->offset += length;
+    if (client->offset == client->message->size()) client->message.reset();
+    pthread_mutex_unlock(&self->mutex);
+    return (ssize_t)length;
+}
+
+void EventStream::freeSse(void* cls) {
+    SseClient* client = (SseClient*)cls;
+    EventStream* self = client->owner;
+
+    pthread_mutex_lock(&self->mutex);
+    for (size_t i = 0; i < self->sseClients.size(); i++) {
+        if (self->sseClients[i] == client) {
+            self->sseClients.erase(self->sseClients.begin() + i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+    delete client;
+}
+
+void EventStream::upgraded(void* cls, struct MHD_Connection* connection, void* con_cls,
+                           const char* extra_in, size_t extra_in_size, MHD_socket sock,
+                           struct MHD_UpgradeResponseHandle* urh) {
+    (void)connection;
+    (void)con_cls;
+    EventStream* self = (EventStream*)cls;
+
+    // All writes happen from loop() and must never block the main loop
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    WsClient* client = new WsClient();
+    client->fd = sock;
+    client->urh = urh;
+    client->frameSeq = 0;
+    client->offset = 0;
+    client->lastProgress = millis();
+    client->inputLength = 0;
+
+    // Bytes sent along with the handshake. More than the input buffer holds
+    // is more than a client of this stream sends, as in readWebSocket()
+    if (extra_in_size > sizeof(client->input)) {
+        self->closeWebSocket(client);
+        return;
+    }
+    memcpy(client->input, extra_in, extra_in_size);
+    client->inputLength = extra_in_size;
+
+    pthread_mutex_lock(&self->mutex);
+    if (self->closing) {
+        pthread_mutex_unlock(&self->mutex);
+        self->closeWebSocket(client);
+        return;
+    }
+    self->wsClients.push_back(client);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+// Returns false when the client has to be dropped
+bool EventStream::flushWebSocket(WsClient* client, unsigned long now) {
+    if (!client->message) {
+        if (client->frameSeq == frameSeq || !wsFrame) {
+            client->lastProgress = now;
+            return true;
+        }
+        client->message = wsFrame;
+        client->frameSeq = frameSeq;
+        client->offset = 0;
+    }
+
+    while (client->offset < client->message->size()) {
+        ssize_t sent = send(client->fd, client->message->data() + client->offset,
+                            client->message->size() - client->offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0) {
+            client->offset += sent;
+            client->lastProgress = now;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            break;
+        } else {
+            return false;
+        }
+    }
+
+    if (client->offset == client->message->size()) {
+        client->message.reset();
+        return true;
+    }
+    // Still busy with one frame after this long: the client is not reading
+    return now - client->lastProgress < EVENTS_STALL_MS;
+}
+
+bool EventStream::readWebSocket(WsClient* client) {
+    for (;;) {
+        if (client->inputLength == sizeof(client->input)) return false;   // No frame fits
+        ssize_t received = recv(client->fd, client->input + client->inputLength,
+                                sizeof(client->input) - client->inputLength, MSG_DONTWAIT);
+        if (received == 0) return false;
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+            return false;
+        }
+        client->inputLength += received;
+    }
+
+    // Complete client frames; they must be masked and small
+    while (client->inputLength >= 2) {
+        uint8_t* input = client->input;
+        uint8_t opcode = input[0] & 0x0F;
+        size_t length = input[1] & 0x7F;
+        size_t header = 2;
+        if (!(input[1] & 0x80)) return false;
+        if (length == 127) return false;
+        if (length == 126) {
+            if (client->inputLength < 4) break;
+            length = (input[2] << 8) | input[3];
+            header = 4;
+        }
+        header += 4;
+        if (header + length > sizeof(client->input)) return false;
+        if (client->inputLength < header + length) break;
+
+        uint8_t* payload = input + header;
+        const uint8_t* mask = payload - 4;
+        for (size_t i = 0; i < length; i++) payload[i] ^= mask[i % 4];
+
+        if (opcode == WS_OP_CLOSE) {
+            sendControlFrame(client, WS_OP_CLOSE, payload, length > 125 ? 0 : length);
+            return false;
+        }
+        if (opcode == WS_OP_PING && length <= 125 &&
+            !sendControlFrame(client, WS_OP_PONG, payload, length)) {
+            return false;
+        }
+        // Text, binary and pong frames are ignored
+
+        size_t used = header + length;
+        memmove(input, input + used, client->inputLength - used);
+        client->inputLength -= used;
+    }
+    return true;
+}
+
+// Best effort: skipped while a data frame is half written, since it would
+// end up in the middle of it. Returns false if the frame went out partially,
+// which leaves the stream unusable
+bool EventStream::sendControlFrame(WsClient* client, uint8_t opcode, const uint8_t* payload, size_t length) {
+    if (client->message && client->offset > 0) return true;
+    uint8_t frame[2 + 125];
+    frame[0] = 0x80 | opcode;
+    frame[1] = (uint8_t)length;
+    if (length > 0) memcpy(frame + 2, payload, length);
+    ssize_t sent = send(client->fd, frame, 2 + length, MSG_NOSIGNAL | MSG_DONTWAIT);
+    return sent <= 0 || (size_t)sent == 2 + length;
+}
+
+void EventStream::closeWebSocket(WsClient* client) {
+    MHD_upgrade_action(client->urh, MHD_UPGRADE_ACTION_CLOSE);
+    delete client;
+}
@@ -0,0 +1,97 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Event Stream
+ * Pushes every decoded frame to dashboard clients over Server-Sent Events
+ * or WebSocket at /events
+ */
+
+#pragma once
+#ifndef EVENT_STREAM_H
+#define EVENT_STREAM_H
+
+#include <microhttpd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define EVENTS_MAX_CLIENTS 32          // Further subscribers get 503
+#define EVENTS_HEARTBEAT_MS 15000      // Keeps proxies from closing idle streams
+#define EVENTS_STALL_MS 10000          // WebSocket clients that accept nothing are dropped
+#define EVENTS_WS_INPUT_SIZE 256       // Client frames are only control frames
+
+// Daemon flags required by EventStream, combine with the threading mode
+#define EVENTS_DAEMON_FLAGS (MHD_ALLOW_SUSPEND_RESUME | MHD_ALLOW_UPGRADE)
+
+class EventStream {
+public:
+    EventStream();
+    ~EventStream();
+
+    // Request handler for /events: Server-Sent Events, or WebSocket when the
+    // client asks for an upgrade. Runs on the libmicrohttpd thread
+    MHD_Result handleRequest(struct MHD_Connection* connection, const char* method);
+
+    // Main loop side. publish() serializes a frame once for each transport;
+    // every subscriber then only gets a reference to the shared message.
+    // A subscriber that is still busy with an older frame skips straight to
+    // the newest one, so nothing queues up per client
+    void publish(const char* json, size_t length);
+    void loop();
+
+    // Ends all streams; must be called before MHD_stop_daemon
+    void closeAll();
+    size_t getClientCount();
+
+private:
+    typedef std::shared_ptr<const std::string> Message;
+
+    struct SseClient {
+        EventStream* owner;
+        struct MHD_Connection* connection;
+        uint32_t frameSeq;             // Last frame handed to this client
+        uint32_t heartbeatSeq;
+        Message message;               // Message being written, may be partial
+        size_t offset;
+        bool suspended;                // Waiting for the next frame
+    };
+
+    struct WsClient {
+        int fd;
+        struct MHD_UpgradeResponseHandle* urh;
+        uint32_t frameSeq;
+        Message message;
+        size_t offset;
+        unsigned long lastProgress;
+        uint8_t input[EVENTS_WS_INPUT_SIZE];
+        size_t inputLength;
+    };
+
+    pthread_mutex_t mutex;
+    bool closing;
+    uint32_t frameSeq;
+    uint32_t heartbeatSeq;
+    Message sseFrame;                  // "id: <seq>\ndata: <json>\n\n"
+    Message wsFrame;                   // Text frame with the same JSON
+    Message sseHeartbeat;              // Comment line, ignored by EventSource
+    unsigned long lastEvent;
+    std::vector<SseClient*> sseClients;
+    std::vector<WsClient*> wsClients;
+
+    MHD_Result handleSse(struct MHD_Connection* connection);
+    MHD_Result handleWebSocket(struct MHD_Connection* connection);
+    void resumeSuspended();
+    bool flushWebSocket(WsClient* client, unsigned long now);
+    bool readWebSocket(WsClient* client);
+    bool sendControlFrame(WsClient* client, uint8_t opcode, const uint8_t* payload, size_t length);
+    void closeWebSocket(WsClient* client);
+
+    // libmicrohttpd callbacks
+    static ssize_t readSse(void* cls, uint64_t pos, char* buf, size_t max);
+    static void freeSse(void* cls);
+    static void upgraded(void* cls, struct MHD_Connection* connection, void* con_cls,
+                         const char* extra_in, size_t extra_in_size, MHD_socket sock,
+                         struct MHD_UpgradeResponseHandle* urh);
+};
+
+#endif // EVENT_STREAM_H
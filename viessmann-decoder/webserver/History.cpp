@@ -0,0 +1,304 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server History implementation
+ */
+
+#include "History.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Tiers from finest to coarsest: every change for about a day, one point
+// per minute for a week, one per 15 minutes for a year
+static const struct {
+    LogMode mode;
+    uint32_t interval;
+    uint16_t points;
+} TIER_CONFIG[HISTORY_TIER_COUNT] = {
+    { LOG_MODE_CHANGE, 0, 20000 },
+    { LOG_MODE_INTERVAL, 60, 10080 },
+    { LOG_MODE_INTERVAL, 900, 35136 }
+};
+
+// Records carry Unix time so from= and to= are absolute
+static uint32_t unixClock() {
+    return (uint32_t)time(NULL);
+}
+
+static MHD_Result queueError(struct MHD_Connection* connection, unsigned int status, const char* text) {
+    char json[128];
+    int length = snprintf(json, sizeof(json), "{\"error\":\"%s\"}", text);
+    struct MHD_Response* response = MHD_create_response_from_buffer(length, json, MHD_RESPMEM_MUST_COPY);
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    MHD_Result ret = MHD_queue_response(connection, status, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Unsigned query parameter; false if present but not a number
+static bool parseArgument(struct MHD_Connection* connection, const char* name, uint32_t& value) {
+    const char* text = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, name);
+    if (text == NULL || *text == '\0') return true;
+    char* end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (*end != '\0' || parsed > UINT32_MAX) return false;
+    value = (uint32_t)parsed;
+    return true;
+}
+
+History::History() : started(false) {
+    pthread_mutex_init(&mutex, NULL);
+    for (int i = 0; i < HISTORY_TIER_COUNT; i++) {
+        tiers[i].logger = new VBUSDataLogger(nullptr, TIER_CONFIG[i].points);
+        tiers[i].resolution = TIER_CONFIG[i].interval;
+        tiers[i].logger->setClock(unixClock);
+        tiers[i].logger->setLogMode(TIER_CONFIG[i].mode);
+        if (TIER_CONFIG[i].mode == LOG_MODE_CHANGE) {
+            tiers[i].logger->setTemperatureDeadband(0.2);
+            tiers[i].logger->setMaxGap(300);
+        } else {
+            tiers[i].logger->setLogInterval(TIER_CONFIG[i].interval);
+        }
+    }
+}
+
+History::~History() {
+    for (int i = 0; i < HISTORY_TIER_COUNT; i++) delete tiers[i].logger;
+    pthread_mutex_destroy(&mutex);
+}
+
+void History::setDecoder(VBUSDecoder* decoder) {
+    pthread_mutex_lock(&mutex);
+    for (int i = 0; i < HISTORY_TIER_COUNT; i++) {
+        tiers[i].logger->setDecoder(decoder);
+        // The schema comes from the first decoder; later ones keep it
+        if (decoder && !started) tiers[i].logger->begin();
+    }
+    if (decoder) started = true;
+    pthread_mutex_unlock(&mutex);
+}
+
+void History::loop() {
+    if (!started) return;
+    pthread_mutex_lock(&mutex);
+    for (int i = 0; i < HISTORY_TIER_COUNT; i++) tiers[i].logger->loop();
+    pthread_mutex_unlock(&mutex);
+}
+
+const History::Tier* History::selectTier(uint32_t from, uint32_t step) {
+    int chosen = 0;
+    for (int i = 1; i < HISTORY_TIER_COUNT; i++) {
+        if (tiers[i].resolution <= step) chosen = i;
+    }
+
+    // When the chosen tier does not reach back to from (its retention is
+    // shorter, or it has not logged yet after a start), use the tier that
+    // covers most of the range: coarser ones first, finer ones last
+    int best = chosen;
+    uint32_t bestReach = UINT32_MAX;
+    for (int n = 0; n < HISTORY_TIER_COUNT; n++) {
+        int i = chosen + n < HISTORY_TIER_COUNT ? chosen + n : HISTORY_TIER_COUNT - 1 - n;
+        DataPoint* oldest = tiers[i].logger->getOldestDataPoint();
+        if (oldest == nullptr) continue;
+        if (oldest->timestamp <= from) return &tiers[i];
+        if (oldest->timestamp < bestReach) {
+            best = i;
+            bestReach = oldest->timestamp;
+        }
+    }
+    return &tiers[best];
+}
+
+// "temp1,pump2,relay1,heat,errors,kmmode"; channel numbers start at 1 like
+// in the dashboard. Without a list all temperatures are returned
+bool History::parseFields(const char* list, const LogSchema& schema, std::vector<Field>& fields) {
+    if (list == NULL || *list == '\0') {
+        for (uint8_t i = 0; i < schema.tempCount && fields.size() < HISTORY_MAX_FIELDS; i++) {
+            Field field;
+            snprintf(field.name, sizeof(field.name), "temp%u", i + 1);
+            field.kind = LOG_CHANNEL_TEMPERATURE;
+            field.channel = i;
+            fields.push_back(field);
+        }
+        return true;
+    }
+
+    static const struct {
+        const char* prefix;
+        LogChannelKind kind;
+        bool indexed;
+    } names[] = {
+        { "temp", LOG_CHANNEL_TEMPERATURE, true },
+        { "pump", LOG_CHANNEL_PUMP, true },
+        { "relay", LOG_CHANNEL_RELAY, true },
+        { "heat", LOG_CHANNEL_HEAT_QUANTITY, false },
+        { "errors", LOG_CHANNEL_ERROR_MASK, false },
+        { "kmmode", LOG_CHANNEL_KM_MODE, false }
+    };
+
+    const char* p = list;
+    while (*p) {
+        const char* end = strchr(p, ',');
+        size_t length = end ? (size_t)(end - p) : strlen(p);
+        if (length == 0 || length >= sizeof(((Field*)0)->name) || fields.size() == HISTORY_MAX_FIELDS) {
+            return false;
+        }
+
+        Field field;
+        memcpy(field.name, p, length);
+        field.name[length] = '\0';
+        bool known = false;
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]) && !known; i++) {
+            size_t prefixLength = strlen(names[i].prefix);
+            if (strncasecmp(field.name, names[i].prefix, prefixLength) != 0) continue;
+            const char* rest = field.name + prefixLength;
+            if (!names[i].indexed) {
+                if (*rest != '\0') continue;
+                field.channel = 0;
+            } else {
+                char* numberEnd;
+                long number = strtol(rest, &numberEnd, 10);
+                if (*rest == '\0' || *numberEnd != '\0' || number < 1 || number > 32) continue;
+                field.channel = (uint8_t)(number - 1);
+            }
+            field.kind = names[i].kind;
+            known = true;
+        }
+        if (!known) return false;
+        fields.push_back(field);
+
+        p += length;
+        if (*p == ',') p++;
+    }
+    (void)schema;   // Channels outside the schema are valid but always null
+    return true;
+}
+
+MHD_Result History::handleRequest(struct MHD_Connection* connection, const char* method) {
+    if (strcmp(method, "GET") != 0 && strcmp(method, "HEAD") != 0) {
+        return queueError(connection, MHD_HTTP_METHOD_NOT_ALLOWED, "method not allowed");
+    }
+
+    uint32_t to = unixClock();
+    uint32_t from = 0;
+    uint32_t step = 0;
+    if (!parseArgument(connection, "to", to) || !parseArgument(connection, "step", step)) {
+        return queueError(connection, MHD_HTTP_BAD_REQUEST, "from, to and step are Unix seconds");
+    }
+    from = to > HISTORY_DEFAULT_RANGE ? to - HISTORY_DEFAULT_RANGE : 0;
+    if (!parseArgument(connection, "from", from)) {
+        return queueError(connection, MHD_HTTP_BAD_REQUEST, "from, to and step are Unix seconds");
+    }
+    if (from > to) {
+        return queueError(connection, MHD_HTTP_BAD_REQUEST, "from is after to");
+    }
+
+    // The number of points is bounded whatever step was asked for
+    uint32_t minStep = (to - from) / HISTORY_MAX_POINTS + 1;
+    if (step < minStep) step = minStep;
+
+    Query* query = new Query();
+    query->rows = 0;
+    query->row = 0;
+    query->offset = 0;
+    query->done = false;
+
+    pthread_mutex_lock(&mutex);
+    const Tier* tier = selectTier(from, step);
+    if (step < tier->resolution) step = tier->resolution;
+    const char* list = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "fields");
+    if (!parseFields(list, tier->logger->getSchema(), query->fields)) {
+        pthread_mutex_unlock(&mutex);
+        delete query;
+        return queueError(connection, MHD_HTTP_BAD_REQUEST, "unknown field");
+    }
+
+    // Every field walks the same records, so the bucket rows line up
+    std::vector<LogBucket> buckets(HISTORY_MAX_POINTS + 1);
+    for (size_t f = 0; f < query->fields.size(); f++) {
+        uint16_t count = tier->logger->getSeries(query->fields[f].kind, query->fields[f].channel,
+                                                 from, to, step, buckets.data(), buckets.size());
+        query->series.push_back(std::vector<LogBucket>(buckets.begin(), buckets.begin() + count));
+        query->rows = count;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    char head[160];
+    snprintf(head, sizeof(head), "{\"from\":%u,\"to\":%u,\"step\":%u,\"resolution\":%u,\"fields\":[",
+             from, to, step, tier->resolution);
+    query->header = head;
+    for (size_t f = 0; f < query->fields.size(); f++) {
+        if (f > 0) query->header += ",";
+        query->header += "\"";
+        query->header += query->fields[f].name;
+        query->header += "\"";
+    }
+    query->header += "],\"points\":[";
+    query->pending = query->header;
+
+    // freeQuery() runs once the response is sent or the client went away
+    struct MHD_Response* response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 8192,
+                                                                      &History::readQuery, query,
+                                                                      &History::freeQuery);
+    if (response == NULL) {
+        freeQuery(query);
+        return MHD_NO;
+    }
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// One point: [timestamp, min, avg, max, ...] with the three values per
+// field, null where the field had no valid sample in the bucket
+void History::renderRow(Query* query, size_t row) {
+    char number[32];
+    snprintf(number, sizeof(number), "%s[%u", row > 0 ? ",\n" : "\n",
+             query->series.empty() ? 0 : query->series[0][row].timestamp);
+    query->pending += number;
+
+    for (size_t f = 0; f < query->fields.size(); f++) {
+        const LogBucket& bucket = query->series[f][row];
+        if (bucket.samples == 0) {
+            query->pending += ",null,null,null";
+            continue;
+        }
+        const char* format = query->fields[f].kind == LOG_CHANNEL_RELAY ? ",%.0f,%.3f,%.0f" : ",%.1f,%.1f,%.1f";
+        snprintf(number, sizeof(number), format, bucket.min, bucket.avg, bucket.max);
+        query->pending += number;
+    }
+    query->pending += "]";
+}
+
+ssize_t History::readQuery(void* cls, uint64_t pos, char* buf, size_t max) {
+    Query* query = (Query*)cls;
+    (void)pos;
+
+    // Render rows until the block is full
+    while (query->pending.size() - query->offset < max && !query->done) {
+        if (query->offset > 0) {
+            query->pending.erase(0, query->offset);
+            query->offset = 0;
+        }
+        if (query->row < query->rows) {
+            renderRow(query, query->row++);
+        } else {
+            query->pending += "\n]}";
+            query->done = true;
+        }
+    }
+
+    size_t length = query->pending.size() - query->offset;
+    if (length == 0) return MHD_CONTENT_READER_END_OF_STREAM;
+    if (length > max) length = max;
+    memcpy(buf, query->pending.data() + query->offset, length);
+    query->offset += length;
+    return length;
+}
+
+void History::freeQuery(void* cls) {
+    delete (Query*)cls;
+}
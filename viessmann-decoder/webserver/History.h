@@ -0,0 +1,76 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server History
+ * Records decoded values with VBUSDataLogger and serves downsampled series
+ * at /history?from=&to=&fields=&step=
+ */
+
+#pragma once
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <microhttpd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "VBUSDataLogger.h"
+
+#define HISTORY_MAX_POINTS 1000        // Points per series, the step grows to stay below
+#define HISTORY_MAX_FIELDS 16
+#define HISTORY_DEFAULT_RANGE 86400    // Without from=: the last 24 hours
+#define HISTORY_TIER_COUNT 3
+
+class History {
+public:
+    History();
+    ~History();
+
+    // Main loop side. The decoder may change on reconnect (nullptr while
+    // disconnected); recorded points are kept
+    void setDecoder(VBUSDecoder* decoder);
+    void loop();
+
+    // Request handler for /history. Runs on the libmicrohttpd thread; the
+    // series are computed under the lock, the JSON is streamed afterwards
+    MHD_Result handleRequest(struct MHD_Connection* connection, const char* method);
+
+private:
+    // Each tier is a logger with its own resolution and retention; queries
+    // use the coarsest one that still resolves the requested step
+    struct Tier {
+        VBUSDataLogger* logger;
+        uint32_t resolution;           // Seconds between points, 0 = every change
+    };
+
+    struct Field {
+        char name[12];
+        LogChannelKind kind;
+        uint8_t channel;
+    };
+
+    // One response in flight; rendered row by row into the MHD buffer
+    struct Query {
+        std::string header;
+        std::vector<Field> fields;
+        std::vector<std::vector<LogBucket> > series;
+        size_t rows;
+        size_t row;
+        std::string pending;
+        size_t offset;
+        bool done;
+    };
+
+    pthread_mutex_t mutex;
+    Tier tiers[HISTORY_TIER_COUNT];
+    bool started;
+
+    const Tier* selectTier(uint32_t from, uint32_t step);
+    bool parseFields(const char* list, const LogSchema& schema, std::vector<Field>& fields);
+    static void renderRow(Query* query, size_t row);
+
+    // libmicrohttpd callbacks
+    static ssize_t readQuery(void* cls, uint64_t pos, char* buf, size_t max);
+    static void freeQuery(void* cls);
+};
+
+#endif // HISTORY_H
@@ -0,0 +1,31 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Accept Headers implementation
+ */
+
+#include "HttpAccept.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+bool nextAcceptItem(const char*& p, AcceptItem& item) {
+    while (*p == ' ' || *p == ',') p++;
+    if (!*p) return false;
+
+    item.name = p;
+    while (*p && *p != ',' && *p != ';' && *p != ' ') p++;
+    item.nameLength = p - item.name;
+
+    // Parameters, only q is of interest
+    item.accepted = true;
+    while (*p && *p != ',') {
+        if (*p == 'q' && p[1] == '=') {
+            item.accepted = strtod(p + 2, nullptr) > 0.0;
+        }
+        p++;
+    }
+    return true;
+}
+
+bool acceptItemIs(const AcceptItem& item, const char* name) {
+    return item.nameLength == strlen(name) && strncasecmp(item.name, name, item.nameLength) == 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Accept Headers
+ * Reads the entries of Accept and Accept-Encoding request headers
+ */
+
+#pragma once
+#ifndef HTTP_ACCEPT_H
+#define HTTP_ACCEPT_H
+
+#include <stddef.h>
+
+// One entry of a comma separated Accept or Accept-Encoding list. Of the
+// parameters only q is read; q=0 means the client refuses the entry
+struct AcceptItem {
+    const char* name;      // Not terminated, nameLength characters
+    size_t nameLength;
+    bool accepted;
+};
+
+// Reads the entry at p and moves p past it; false at the end of the header
+bool nextAcceptItem(const char*& p, AcceptItem& item);
+
+// Case-insensitive comparison of the entry's name
+bool acceptItemIs(const AcceptItem& item, const char* name);
+
+#endif // HTTP_ACCEPT_H
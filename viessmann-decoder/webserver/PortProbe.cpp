@@ -0,0 +1,148 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Port Probe implementation
+ */
+
+#include "PortProbe.h"
+#include <poll.h>
+#include <stdio.h>
+
+PortProbe::PortProbe(const std::vector<ProbeSetting>& settings, volatile bool* running)
+    : settings(settings), running(running), found(false), serial(nullptr), decoder(nullptr) {
+    pthread_mutex_init(&mutex, NULL);
+    setting = settings.empty() ? ProbeSetting{PROTOCOL_VBUS, 9600, SERIAL_8N1} : settings[0];
+}
+
+PortProbe::~PortProbe() {
+    delete decoder;
+    delete serial;
+    pthread_mutex_destroy(&mutex);
+}
+
+bool PortProbe::run(const std::vector<std::string>& ports) {
+    std::vector<Worker> workers(ports.size());
+    for (size_t i = 0; i < ports.size(); i++) {
+        workers[i].owner = this;
+        workers[i].port = ports[i];
+        if (pthread_create(&workers[i].thread, NULL, &PortProbe::probeThread, &workers[i]) != 0) {
+            // Out of threads: probe this one here instead
+            workers[i].owner = nullptr;
+            probePort(ports[i]);
+        }
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (workers[i].owner) pthread_join(workers[i].thread, NULL);
+    }
+    return found;
+}
+
+LinuxSerial* PortProbe::takeSerial() {
+    LinuxSerial* result = serial;
+    serial = nullptr;
+    return result;
+}
+
+VBUSDecoder* PortProbe::takeDecoder() {
+    VBUSDecoder* result = decoder;
+    decoder = nullptr;
+    return result;
+}
+
+void* PortProbe::probeThread(void* arg) {
+    Worker* worker = (Worker*)arg;
+    worker->owner->probePort(worker->port);
+    return NULL;
+}
+
+static bool sameLine(const ProbeSetting& a, const ProbeSetting& b) {
+    return a.baudRate == b.baudRate && a.serialConfig == b.serialConfig;
+}
+
+bool PortProbe::probePort(const std::string& path) {
+    LinuxSerial* portSerial = new LinuxSerial();
+    bool detect = settings.size() > 1;
+
+    for (size_t i = 0; i < settings.size() && !found && *running; i++) {
+        const ProbeSetting& line = settings[i];
+
+        // Each baud rate and parity is opened once for all protocols sharing it
+        bool seen = false;
+        for (size_t j = 0; j < i; j++) seen |= sameLine(settings[j], line);
+        if (seen) continue;
+
+        portSerial->end();
+        if (!portSerial->begin(path.c_str(), line.baudRate, line.serialConfig)) break;
+
+        // The detector's pick is decoded first, if it is one of them
+        ProtocolType detected = line.protocol;
+        bool sniffed = detect && sniff(portSerial, detected);
+        if (sniffed) {
+            sniffed = false;
+            for (size_t j = i; j < settings.size() && !sniffed; j++) {
+                sniffed = sameLine(settings[j], line) && settings[j].protocol == detected;
+            }
+            ProbeSetting attempt = { detected, line.baudRate, line.serialConfig };
+            if (sniffed && tryDecoder(path, portSerial, attempt)) return true;
+        }
+
+        for (size_t j = i; j < settings.size() && !found && *running; j++) {
+            if (!sameLine(settings[j], line)) continue;
+            if (sniffed && settings[j].protocol == detected) continue;
+            if (tryDecoder(path, portSerial, settings[j])) return true;
+        }
+    }
+
+    delete portSerial;
+    return false;
+}
+
+// Collects bytes until the detector is confident, the window is full or
+// the timeout passed
+bool PortProbe::sniff(LinuxSerial* portSerial, ProtocolType& protocol) {
+    VBUSProtocolDetector detector;
+    unsigned long start = millis();
+    while (!found && *running && millis() - start < PROBE_TIMEOUT_MS && !detector.isFull()) {
+        struct pollfd pfd = { portSerial->getFd(), POLLIN, 0 };
+        if (poll(&pfd, 1, PROBE_POLL_MS) <= 0) continue;
+
+        uint16_t before = detector.getLength();
+        while (portSerial->available() > 0 && !detector.isFull()) {
+            detector.feed((uint8_t)portSerial->read());
+        }
+        if (detector.getLength() == before) continue;
+
+        ProtocolMatch match = detector.classify();
+        if (match.frames >= PROBE_MIN_FRAMES && match.confidence >= PROBE_MIN_CONFIDENCE) {
+            protocol = match.protocol;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs a decoder on the open port until it reports compatible frames
+bool PortProbe::tryDecoder(const std::string& path, LinuxSerial* portSerial, const ProbeSetting& candidate) {
+    VBUSDecoder* portDecoder = new VBUSDecoder(portSerial);
+    portDecoder->begin(candidate.protocol);
+    unsigned long start = millis();
+    while (!found && *running && millis() - start < PROBE_TIMEOUT_MS) {
+        struct pollfd pfd = { portSerial->getFd(), POLLIN, 0 };
+        poll(&pfd, 1, PROBE_POLL_MS);
+        portDecoder->loop();
+        if (!portDecoder->isReady() || !portDecoder->getVbusStat()) continue;
+
+        pthread_mutex_lock(&mutex);
+        bool first = !found;
+        if (first) {
+            found = true;
+            port = path;
+            setting = candidate;
+            serial = portSerial;
+            decoder = portDecoder;
+        }
+        pthread_mutex_unlock(&mutex);
+        if (first) return true;
+        break;
+    }
+    delete portDecoder;
+    return false;
+}
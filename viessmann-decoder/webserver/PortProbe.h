@@ -0,0 +1,75 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Port Probe
+ * Looks for a compatible device on all candidate serial ports at once
+ */
+
+#pragma once
+#ifndef PORT_PROBE_H
+#define PORT_PROBE_H
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "LinuxSerial.h"
+#include "vbusdecoder.h"
+#include "VBUSProtocolDetector.h"
+
+#define PROBE_TIMEOUT_MS 2000          // Per port and setting, VBUS sends about once a second
+#define PROBE_POLL_MS 10
+#define PROBE_MIN_CONFIDENCE 30        // Detector result good enough to be decoded first
+#define PROBE_MIN_FRAMES 2             // A single frame (one KW sync byte) proves nothing
+
+// Line settings and protocol tried on a port
+struct ProbeSetting {
+    ProtocolType protocol;
+    unsigned long baudRate;
+    uint8_t serialConfig;
+};
+
+class PortProbe {
+public:
+    // Stops early when *running turns false (shutdown)
+    PortProbe(const std::vector<ProbeSetting>& settings, volatile bool* running);
+    ~PortProbe();
+
+    // Probes every port on a thread of its own. A single setting is tried
+    // with a decoder right away. With several, each distinct baud rate and
+    // parity is sniffed once and the protocol VBUSProtocolDetector picks is
+    // decoded first; when it is unsure or its pick does not decode, every
+    // protocol sharing the line settings is tried in turn.
+    // The first port whose decoder becomes ready wins; the other threads give
+    // up within PROBE_POLL_MS. Blocks until all threads have finished
+    bool run(const std::vector<std::string>& ports);
+
+    // The winning port, valid after run() returned true. Serial port and
+    // decoder are handed over to the caller, who deletes them
+    LinuxSerial* takeSerial();
+    VBUSDecoder* takeDecoder();
+    const std::string& getPort() const { return port; }
+    const ProbeSetting& getSetting() const { return setting; }
+
+private:
+    struct Worker {
+        PortProbe* owner;
+        std::string port;
+        pthread_t thread;
+    };
+
+    std::vector<ProbeSetting> settings;
+    volatile bool* running;
+    std::atomic<bool> found;
+    pthread_mutex_t mutex;
+
+    std::string port;
+    ProbeSetting setting;
+    LinuxSerial* serial;
+    VBUSDecoder* decoder;
+
+    bool probePort(const std::string& path);
+    bool sniff(LinuxSerial* portSerial, ProtocolType& protocol);
+    bool tryDecoder(const std::string& path, LinuxSerial* portSerial, const ProbeSetting& candidate);
+    static void* probeThread(void* arg);
+};
+
+#endif // PORT_PROBE_H
@@ -0,0 +1,76 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Port Watch implementation
+ */
+
+#include "PortWatch.h"
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+PortWatch::PortWatch() : fd(-1) {}
+
+PortWatch::~PortWatch() {
+    end();
+}
+
+bool PortWatch::begin(const std::vector<std::string>& patterns) {
+    end();
+    this->patterns = patterns;
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Warning: inotify not available: %s\n", strerror(errno));
+        return false;
+    }
+    // Device nodes are created and unlinked by devtmpfs/udev; renames cover
+    // tools that stage symlinks under a temporary name
+    if (inotify_add_watch(fd, PORT_WATCH_DIR, IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0) {
+        fprintf(stderr, "Warning: cannot watch %s: %s\n", PORT_WATCH_DIR, strerror(errno));
+        end();
+        return false;
+    }
+    return true;
+}
+
+void PortWatch::end() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+void PortWatch::read(std::vector<std::string>& added, std::vector<std::string>& removed) {
+    if (fd < 0) return;
+
+    alignas(struct inotify_event) char buffer[PORT_WATCH_BUFFER_SIZE];
+    for (;;) {
+        ssize_t length = ::read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            if (length < 0 && errno == EINTR) continue;
+            return;
+        }
+
+        for (char* p = buffer; p < buffer + length; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "Warning: %s events lost\n", PORT_WATCH_DIR);
+                continue;
+            }
+            if (event->len == 0 || (event->mask & IN_ISDIR)) continue;
+
+            std::string path = std::string(PORT_WATCH_DIR "/") + event->name;
+            if (!matches(path)) continue;
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) added.push_back(path);
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) removed.push_back(path);
+        }
+    }
+}
+
+bool PortWatch::matches(const std::string& path) const {
+    for (const auto& pattern : patterns) {
+        if (fnmatch(pattern.c_str(), path.c_str(), FNM_PATHNAME) == 0) return true;
+    }
+    return false;
+}
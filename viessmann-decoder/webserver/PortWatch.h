@@ -0,0 +1,42 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Port Watch
+ * Reports serial ports appearing in and disappearing from /dev
+ */
+
+#pragma once
+#ifndef PORT_WATCH_H
+#define PORT_WATCH_H
+
+#include <string>
+#include <vector>
+
+#define PORT_WATCH_DIR "/dev"
+#define PORT_WATCH_BUFFER_SIZE 4096    // Events read per call, more stay queued
+
+class PortWatch {
+public:
+    PortWatch();
+    ~PortWatch();
+
+    // Watches PORT_WATCH_DIR for entries matching one of the glob patterns
+    // (full paths such as "/dev/ttyUSB*"). Returns false where inotify is
+    // not available; the caller then has to scan on its own
+    bool begin(const std::vector<std::string>& patterns);
+    void end();
+
+    // For poll() based event loops, -1 when not watching
+    int getFd() const { return fd; }
+
+    // Drains the pending events without blocking. Paths are reported in
+    // the order the kernel queued them; a port removed and re-added within
+    // one call shows up in both lists
+    void read(std::vector<std::string>& added, std::vector<std::string>& removed);
+
+private:
+    int fd;
+    std::vector<std::string> patterns;
+
+    bool matches(const std::string& path) const;
+};
+
+#endif // PORT_WATCH_H
@@ -0,0 +1,82 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Static Assets implementation
+ */
+
+#include "StaticAssets.h"
+#include "HttpAccept.h"
+#include <stdio.h>
+#include <string.h>
+
+const StaticAsset* findStaticAsset(const char* url) {
+    for (size_t i = 0; i < STATIC_ASSET_COUNT; i++) {
+        if (strcmp(STATIC_ASSETS[i].path, url) == 0) return &STATIC_ASSETS[i];
+    }
+    return nullptr;
+}
+
+// Whether an Accept-Encoding header allows the coding: listed by name or
+// through "*", and not with q=0
+static bool acceptsEncoding(const char* header, const char* coding) {
+    if (!header) return false;
+    int wildcard = -1;   // q of "*", -1 when absent
+
+    const char* p = header;
+    AcceptItem item;
+    while (nextAcceptItem(p, item)) {
+        if (acceptItemIs(item, coding)) return item.accepted;
+        if (acceptItemIs(item, "*")) wildcard = item.accepted;
+    }
+    return wildcard == 1;
+}
+
+MHD_Result serveStaticAsset(struct MHD_Connection* connection, const StaticAsset* asset) {
+    struct MHD_Response* response;
+    MHD_Result ret;
+
+    // Only a request for the current version may be cached for good; a
+    // stale or missing ?v= gets the same content but is revalidated
+    const char* version = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "v");
+    const char* cacheControl = "no-cache";
+    char immutable[64];
+    if (asset->version && version && strcmp(version, asset->version) == 0) {
+        snprintf(immutable, sizeof(immutable), "public, max-age=%d, immutable", STATIC_ASSET_MAX_AGE);
+        cacheControl = immutable;
+    }
+
+    const char* ifNoneMatch = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-None-Match");
+    if (ifNoneMatch && (strstr(ifNoneMatch, asset->etag) || strcmp(ifNoneMatch, "*") == 0)) {
+        response = MHD_create_response_from_buffer(0, (void*)"", MHD_RESPMEM_PERSISTENT);
+        MHD_add_response_header(response, "ETag", asset->etag);
+        MHD_add_response_header(response, "Cache-Control", cacheControl);
+        MHD_add_response_header(response, "Vary", "Accept-Encoding");
+        ret = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+        MHD_destroy_response(response);
+        return ret;
+    }
+
+    // Brotli is smallest, gzip is understood by every browser
+    const char* acceptEncoding = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Accept-Encoding");
+    const uint8_t* data = asset->data;
+    size_t size = asset->size;
+    const char* encoding = nullptr;
+    if (asset->brotli && acceptsEncoding(acceptEncoding, "br")) {
+        data = asset->brotli;
+        size = asset->brotliSize;
+        encoding = "br";
+    } else if (asset->gzip && acceptsEncoding(acceptEncoding, "gzip")) {
+        data = asset->gzip;
+        size = asset->gzipSize;
+        encoding = "gzip";
+    }
+
+    // The table lives in the binary, nothing to copy or free
+    response = MHD_create_response_from_buffer(size, (void*)data, MHD_RESPMEM_PERSISTENT);
+    MHD_add_response_header(response, "Content-Type", asset->contentType);
+    if (encoding) MHD_add_response_header(response, "Content-Encoding", encoding);
+    MHD_add_response_header(response, "Vary", "Accept-Encoding");
+    MHD_add_response_header(response, "ETag", asset->etag);
+    MHD_add_response_header(response, "Cache-Control", cacheControl);
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
@@ -0,0 +1,42 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Static Assets
+ * Serves the web interface pages embedded at build time by embed_assets.sh
+ */
+
+#pragma once
+#ifndef STATIC_ASSETS_H
+#define STATIC_ASSETS_H
+
+#include <microhttpd.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATIC_ASSET_MAX_AGE 31536000  // Versioned assets never change (one year)
+
+// One file from www/, generated into StaticAssetsData.cpp. Compressed
+// variants are nullptr when the tool was missing or they were not smaller
+struct StaticAsset {
+    const char* path;          // URL, "/" for index.html
+    const char* contentType;
+    const char* etag;          // Weak, the same for every encoding
+    const char* version;       // Value of ?v= in page references, nullptr for pages
+    const uint8_t* data;
+    size_t size;
+    const uint8_t* gzip;
+    size_t gzipSize;
+    const uint8_t* brotli;
+    size_t brotliSize;
+};
+
+extern const StaticAsset STATIC_ASSETS[];
+extern const size_t STATIC_ASSET_COUNT;
+
+// Asset for a request URL, nullptr when there is none
+const StaticAsset* findStaticAsset(const char* url);
+
+// Queues the asset in the best encoding the client accepts. Pages are
+// revalidated through their ETag, versioned assets are cached for
+// STATIC_ASSET_MAX_AGE when requested with the current version
+MHD_Result serveStaticAsset(struct MHD_Connection* connection, const StaticAsset* asset);
+
+#endif // STATIC_ASSETS_H
@@ -0,0 +1,339 @@
+/*
+ * Viessmann Multi-Protocol Library - Web Server Load Generator
+ *
+ * Simulates many dashboards polling the web server and reports the latency
+ * distribution. Each client is one thread with one keep-alive connection
+ * sending requests back to back.
+ *
+ * The X-Frame-Sequence header of /data counts decoded frames; the first and
+ * last value seen show whether bus decoding kept up during the run.
+ *
+ * Build: g++ -O2 -std=c++11 -o http_bench http_bench.cpp -lpthread
+ * Usage: http_bench [-c clients] [-d seconds] [-H header] [-x] http://host:port/path
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+constexpr size_t MAX_RESPONSE_HEADER = 16384;
+
+struct BenchConfig {
+    std::string host;
+    std::string port;
+    std::string path;
+    std::vector<std::string> headers;
+    unsigned int clients;
+    unsigned int seconds;
+    bool keepAlive;
+};
+
+struct ClientResult {
+    std::vector<uint32_t> latencies;   // Microseconds, successful requests only
+    unsigned long ok;                  // 2xx
+    unsigned long notModified;         // 304
+    unsigned long otherStatus;
+    unsigned long errors;              // Connect, send or receive failures
+    unsigned long reconnects;
+    long firstSequence;                // X-Frame-Sequence, -1 when absent
+    long lastSequence;
+};
+
+static BenchConfig bench;
+static std::string request;
+static struct addrinfo* address = nullptr;
+static pthread_barrier_t startBarrier;
+static struct timespec deadline;
+
+static uint64_t nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static bool pastDeadline() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec > deadline.tv_sec ||
+           (ts.tv_sec == deadline.tv_sec && ts.tv_nsec >= deadline.tv_nsec);
+}
+
+static int connectToServer() {
+    int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval timeout = { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Case-insensitive header lookup in a raw header block, nullptr when absent
+static const char* findHeader(const std::string& head, const char* name) {
+    size_t nameLength = strlen(name);
+    size_t pos = head.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < head.size()) {
+        const char* line = head.c_str() + pos + 2;
+        if (strncasecmp(line, name, nameLength) == 0 && line[nameLength] == ':') {
+            line += nameLength + 1;
+            while (*line == ' ') line++;
+            return line;
+        }
+        pos = head.find("\r\n", pos + 2);
+    }
+    return nullptr;
+}
+
+// Reads one response. Returns the status code, 0 on failure; closeAfter is
+// set when the server ends the connection after this response
+static int readResponse(int fd, std::string& buffer, long& sequence, bool& closeAfter) {
+    char chunk[8192];
+    size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (buffer.size() > MAX_RESPONSE_HEADER) return 0;
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return 0;
+        buffer.append(chunk, n);
+    }
+
+    std::string head = buffer.substr(0, headerEnd);
+    int status = 0;
+    if (sscanf(head.c_str(), "HTTP/%*d.%*d %d", &status) != 1) return 0;
+
+    const char* value = findHeader(head, "Content-Length");
+    size_t contentLength = value ? strtoul(value, nullptr, 10) : 0;
+    value = findHeader(head, "X-Frame-Sequence");
+    if (value) sequence = strtol(value, nullptr, 10);
+    value = findHeader(head, "Connection");
+    closeAfter = value && strncasecmp(value, "close", 5) == 0;
+    if (!findHeader(head, "Content-Length") && status != 304 && status >= 200) {
+        closeAfter = true;   // Body runs until the connection closes
+    }
+
+    size_t total = headerEnd + 4 + contentLength;
+    while (buffer.size() < total) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return 0;
+        buffer.append(chunk, n);
+    }
+    buffer.erase(0, total);
+    return status;
+}
+
+static void* clientThread(void* arg) {
+    ClientResult* result = (ClientResult*)arg;
+    std::string buffer;
+    int fd = -1;
+
+    pthread_barrier_wait(&startBarrier);
+    while (!pastDeadline()) {
+        if (fd < 0) {
+            fd = connectToServer();
+            if (fd < 0) {
+                result->errors++;
+                usleep(10000);
+                continue;
+            }
+            result->reconnects++;
+            buffer.clear();
+        }
+
+        uint64_t start = nowMicros();
+        long sequence = -1;
+        bool closeAfter = false;
+        int status = 0;
+        if (sendAll(fd, request.data(), request.size())) {
+            status = readResponse(fd, buffer, sequence, closeAfter);
+        }
+        uint64_t elapsed = nowMicros() - start;
+
+        if (status == 0) {
+            result->errors++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        result->latencies.push_back((uint32_t)std::min<uint64_t>(elapsed, UINT32_MAX));
+        if (status >= 200 && status < 300) result->ok++;
+        else if (status == 304) result->notModified++;
+        else result->otherStatus++;
+        if (sequence >= 0) {
+            if (result->firstSequence < 0) result->firstSequence = sequence;
+            result->lastSequence = sequence;
+        }
+        if (closeAfter || !bench.keepAlive) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0) close(fd);
+    return nullptr;
+}
+
+static double percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t index = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[index] / 1000.0;
+}
+
+static bool parseUrl(const char* url) {
+    if (strncmp(url, "http://", 7) != 0) return false;
+    std::string rest = url + 7;
+    size_t slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    bench.path = slash == std::string::npos ? "/" : rest.substr(slash);
+    size_t colon = authority.rfind(':');
+    if (colon != std::string::npos) {
+        bench.host = authority.substr(0, colon);
+        bench.port = authority.substr(colon + 1);
+    } else {
+        bench.host = authority;
+        bench.port = "80";
+    }
+    return !bench.host.empty();
+}
+
+static void printHelp(const char* progname) {
+    printf("Viessmann Decoder - Web Server Load Generator\n");
+    printf("\nUsage: %s [options] http://host:port/path\n", progname);
+    printf("  -c <clients>   Concurrent clients, one connection each (default: 200)\n");
+    printf("  -d <seconds>   Test duration (default: 10)\n");
+    printf("  -H <header>    Extra request header, may be repeated\n");
+    printf("  -x             New connection for every request (no keep-alive)\n");
+    printf("  -h             Show this help\n");
+}
+
+int main(int argc, char* argv[]) {
+    bench.clients = 200;
+    bench.seconds = 10;
+    bench.keepAlive = true;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:H:xh")) != -1) {
+        switch (opt) {
+            case 'c':
+                bench.clients = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'd':
+                bench.seconds = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'H':
+                bench.headers.push_back(optarg);
+                break;
+            case 'x':
+                bench.keepAlive = false;
+                break;
+            case 'h':
+                printHelp(argv[0]);
+                return 0;
+            default:
+                printHelp(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc || !parseUrl(argv[optind])) {
+        printHelp(argv[0]);
+        return 1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(bench.host.c_str(), bench.port.c_str(), &hints, &address);
+    if (rc != 0) {
+        fprintf(stderr, "Error: cannot resolve %s: %s\n", bench.host.c_str(), gai_strerror(rc));
+        return 1;
+    }
+
+    request = "GET " + bench.path + " HTTP/1.1\r\nHost: " + bench.host + ":" + bench.port + "\r\n";
+    for (const auto& header : bench.headers) request += header + "\r\n";
+    request += bench.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+    printf("%u clients, %u s, %s, %s\n", bench.clients, bench.seconds,
+           bench.keepAlive ? "keep-alive" : "one connection per request", argv[optind]);
+
+    std::vector<ClientResult> results(bench.clients);
+    std::vector<pthread_t> threads(bench.clients);
+    pthread_barrier_init(&startBarrier, nullptr, bench.clients + 1);
+    for (unsigned int i = 0; i < bench.clients; i++) {
+        results[i].ok = results[i].notModified = results[i].otherStatus = 0;
+        results[i].errors = results[i].reconnects = 0;
+        results[i].firstSequence = results[i].lastSequence = -1;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, 256 * 1024);
+        if (pthread_create(&threads[i], &attr, clientThread, &results[i]) != 0) {
+            fprintf(stderr, "Error: cannot start client %u: %s\n", i, strerror(errno));
+            return 1;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += bench.seconds;
+    pthread_barrier_wait(&startBarrier);
+    for (unsigned int i = 0; i < bench.clients; i++) pthread_join(threads[i], nullptr);
+    freeaddrinfo(address);
+
+    // Merge all clients
+    std::vector<uint32_t> latencies;
+    unsigned long ok = 0, notModified = 0, otherStatus = 0, errors = 0, connections = 0;
+    long firstSequence = -1, lastSequence = -1;
+    for (const auto& result : results) {
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        ok += result.ok;
+        notModified += result.notModified;
+        otherStatus += result.otherStatus;
+        errors += result.errors;
+        connections += result.reconnects;
+        if (result.firstSequence >= 0 && (firstSequence < 0 || result.firstSequence < firstSequence)) {
+            firstSequence = result.firstSequence;
+        }
+        lastSequence = std::max(lastSequence, result.lastSequence);
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("\nRequests:    %lu (%.0f/s)\n", (unsigned long)latencies.size(),
+           (double)latencies.size() / bench.seconds);
+    printf("Status:      %lu 2xx, %lu 304, %lu other\n", ok, notModified, otherStatus);
+    printf("Errors:      %lu\n", errors);
+    printf("Connections: %lu\n", connections);
+    if (!latencies.empty()) {
+        printf("Latency ms:  min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+               latencies.front() / 1000.0, percentile(latencies, 50), percentile(latencies, 90),
+               percentile(latencies, 99), latencies.back() / 1000.0);
+    }
+    if (firstSequence >= 0) {
+        printf("Frames:      %ld decoded during the run (sequence %ld to %ld)\n",
+               lastSequence - firstSequence, firstSequence, lastSequence);
+    }
+    return errors > 0 && latencies.empty() ? 1 : 0;
+}
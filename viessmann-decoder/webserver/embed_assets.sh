@@ -0,0 +1,132 @@
+#!/bin/sh
+#
+# Viessmann Decoder - Embed web interface assets
+#
+# Compiles the files in www/ into StaticAssetsData.cpp, a table in the
+# layout of StaticAssets.h, so the webserver binary carries its own pages.
+# Every file is stored as is and precompressed with gzip and, when the
+# brotli tool is installed, brotli; the server then only picks the variant
+# matching Accept-Encoding.
+#
+# Pages reference shared assets as assets/<name>. Those references are
+# rewritten to assets/<name>?v=<checksum> so browsers can cache the assets
+# for a year and still fetch a new version after an update.
+#
+# Usage: embed_assets.sh [www dir] [output file]
+
+set -e
+
+WWW=${1:-www}
+OUT=${2:-StaticAssetsData.cpp}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+if command -v brotli >/dev/null 2>&1; then
+    HAVE_BROTLI=1
+else
+    HAVE_BROTLI=0
+    echo "embed_assets: brotli not found, embedding gzip variants only" >&2
+fi
+
+checksum() {
+    cksum < "$1" | awk '{ printf "%08x", $1 }'
+}
+
+size() {
+    wc -c < "$1" | tr -d ' '
+}
+
+content_type() {
+    case "$1" in
+        *.html) echo "text/html; charset=utf-8" ;;
+        *.css)  echo "text/css; charset=utf-8" ;;
+        *.js)   echo "application/javascript; charset=utf-8" ;;
+        *.json) echo "application/json" ;;
+        *.svg)  echo "image/svg+xml" ;;
+        *.png)  echo "image/png" ;;
+        *.ico)  echo "image/x-icon" ;;
+        *)      echo "application/octet-stream" ;;
+    esac
+}
+
+# Emits "static const uint8_t <name>[] = {...};"
+emit_array() {
+    echo "static const uint8_t $1[] = {"
+    od -An -v -tx1 "$2" | sed -e 's/ *\([0-9a-f][0-9a-f]\)/0x\1,/g' -e 's/^/    /'
+    echo "};"
+}
+
+# Shared assets first: their checksums become part of the page URLs
+VERSIONS=""
+for file in "$WWW"/*; do
+    name=$(basename "$file")
+    case "$name" in *.html) continue ;; esac
+    cp "$file" "$TMP/$name"
+    VERSIONS="$VERSIONS -e s|assets/$name'|assets/$name?v=$(checksum "$file")'|g"
+done
+for file in "$WWW"/*.html; do
+    name=$(basename "$file")
+    if [ -n "$VERSIONS" ]; then
+        sed $VERSIONS "$file" > "$TMP/$name"
+    else
+        cp "$file" "$TMP/$name"
+    fi
+done
+
+{
+    echo "// Generated by embed_assets.sh from $(basename "$WWW")/, do not edit"
+    echo
+    echo "#include \"StaticAssets.h\""
+    echo
+} > "$OUT.tmp"
+
+TABLE=""
+for file in "$TMP"/*; do
+    name=$(basename "$file")
+    case "$name" in *.gz|*.br) continue ;; esac
+    id="asset_$(echo "$name" | tr -c 'A-Za-z0-9\n' '_')"
+    length=$(size "$file")
+
+    case "$name" in
+        index.html) path="/" ;;
+        *.html)     path="/${name%.html}" ;;
+        *)          path="/assets/$name" ;;
+    esac
+    case "$name" in
+        *.html) version="nullptr" ;;
+        *)      version="\"$(checksum "$file")\"" ;;
+    esac
+
+    emit_array "$id" "$file" >> "$OUT.tmp"
+
+    # A compressed variant is only kept when it is actually smaller
+    gzip -9 -c < "$file" > "$file.gz"
+    if [ "$(size "$file.gz")" -lt "$length" ]; then
+        emit_array "${id}_gz" "$file.gz" >> "$OUT.tmp"
+        gz="${id}_gz, $(size "$file.gz")"
+    else
+        gz="nullptr, 0"
+    fi
+    br="nullptr, 0"
+    if [ "$HAVE_BROTLI" = 1 ]; then
+        brotli -q 11 -c < "$file" > "$file.br"
+        if [ "$(size "$file.br")" -lt "$length" ]; then
+            emit_array "${id}_br" "$file.br" >> "$OUT.tmp"
+            br="${id}_br, $(size "$file.br")"
+        fi
+    fi
+    echo >> "$OUT.tmp"
+
+    TABLE="$TABLE
+    {\"$path\", \"$(content_type "$name")\", \"W/\\\"$(checksum "$file")-$length\\\"\", $version,
+     $id, $length, $gz, $br},"
+done
+
+{
+    echo "const StaticAsset STATIC_ASSETS[] = {$TABLE"
+    echo "};"
+    echo
+    echo "const size_t STATIC_ASSET_COUNT = sizeof(STATIC_ASSETS) / sizeof(STATIC_ASSETS[0]);"
+} >> "$OUT.tmp"
+
+mv "$OUT.tmp" "$OUT"
@@ -14,41 +14,105 @@
 #include <string.h>
 #include <strings.h>
 #include <signal.h>
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <microhttpd.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <glob.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <unordered_set>
 #include "LinuxSerial.h"
+#include "LinuxSerialReader.h"
+#include "LinuxTcpSerial.h"
+#include "LinuxCapture.h"
 #include "vbusdecoder.h"
+#include "VBUSMqttClient.h"
+#include "EventStream.h"
+#include "StaticAssets.h"
+#include "History.h"
+#include "DataEncoding.h"
+#include "PortProbe.h"
+#include "PortWatch.h"
 
-constexpr int COMPATIBILITY_ATTEMPTS = 200; // ~2 seconds with 10ms delay
-constexpr useconds_t COMPATIBILITY_DELAY_US = 10000;
-constexpr int RECONNECT_INTERVAL_TICKS = 500; // 5 seconds with 10ms loop delay
-constexpr useconds_t LOOP_DELAY_US = 10000;
+constexpr unsigned long RECONNECT_INTERVAL_MS = 5000;    // Rescan without hotplug events
+constexpr unsigned long RESCAN_INTERVAL_MS = 60000;      // With hotplug events, for devices powered on later
+constexpr int LOOP_TIMEOUT_MS = 10; // Upper bound; serial and MQTT activity wake the loop earlier
+constexpr int HTTP_THREAD_NICE = 5;  // HTTP threads yield to the decoding loop under load
 
 // Configuration structure
 struct Config {
     uint8_t protocol;      // 0=VBUS, 1=KW, 2=P300, 3=KM
+    bool autoProtocol;     // Also probe the other protocols' usual settings
     unsigned long baudRate;
     uint8_t serialConfig;  // SERIAL_8N1 or SERIAL_8E2
+    bool serialThread;     // Read the port on a thread of its own, see LinuxSerialReader
+    bool lowLatency;       // ASYNC_LOW_LATENCY and 1 ms USB latency timer
+    const char* capturePath; // Record the raw bus bytes, nullptr = off
+    uint64_t captureSize;  // Bytes at which the capture file is rotated
     const char* serialPort;
     uint16_t webPort;
+    const char* mqttHost;  // nullptr disables MQTT
+    uint16_t mqttPort;
+    const char* mqttUser;
+    const char* mqttPassword;
+    const char* mqttTopic;
+    bool mqttDiscovery;
+    MqttPublishMode mqttMode;
+    unsigned int httpThreads;         // 1 = one internal thread, more = thread pool
+    unsigned int httpPolling;         // MHD_USE_AUTO, MHD_USE_EPOLL, MHD_USE_POLL or 0 (select)
+    unsigned int httpMaxConnections;  // All clients together
+    unsigned int httpConnectionsPerIp; // 0 = unlimited
+    unsigned int httpTimeout;         // Seconds an idle (keep-alive) connection stays open
 };
 
 // Global variables
 volatile bool running = true;
 volatile bool serialConnected = false;
 volatile bool deviceCompatible = false;
-LinuxSerial vbusSerial;
+LinuxSerial* vbusSerial = nullptr;   // Port of vbus, owned by the main loop
+LinuxSerialReader* serialReader = nullptr; // Stream of vbus with config.serialThread
+LinuxTcpSerial* netSerial = nullptr; // Stream of vbus for a tcp:// or rfc2217:// port
+LinuxCapture capture;
+LinuxCaptureStream* captureTee = nullptr; // Stream of vbus while recording, reads one of the above
 VBUSDecoder* vbus = nullptr;
+VBUSMqttClient* mqtt = nullptr;
+EventStream events;
+History history;
 Config config;
 pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;
 std::string activeSerialPort;
+std::string activeDevicePath;      // activeSerialPort with symlinks resolved, as /dev reports it
+PortWatch portWatch;
+
+// Ports probed for a device, also watched for hotplug events
+const char* const SERIAL_PORT_GLOBS[] = { "/dev/ttyUSB*", "/dev/ttyACM*", "/dev/ttyAMA*" };
+
+// /data as rendered for the last frame, in every format. Immutable once
+// published; requests hold a reference while libmicrohttpd sends it
+// straight from the snapshot
+struct DataSnapshot {
+    std::atomic<int> refs;
+    uint32_t sequence;     // Frame sequence, also part of the ETags
+    char etag[32];
+    char cborEtag[40];
+    char msgpackEtag[40];
+    std::string json;
+    std::string cbor;      // /data.cbor, see DataEncoding.h
+    std::string msgpack;   // /data.msgpack
+};
+DataSnapshot* dataSnapshot = nullptr;
+pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned long snapshotEpoch = 0;   // Start time, keeps ETags unique across restarts
+std::string infoJSON;              // /info, fixed once the options are parsed
 
 // Signal handler
 void signalHandler(int signum) {
@@ -81,6 +145,46 @@ uint8_t parseSerialConfig(const char* str) {
     return SERIAL_8N1;
 }
 
+MqttPublishMode parseMqttMode(const char* str) {
+    if (strcasecmp(str, "state") == 0) return MQTT_PUBLISH_AGGREGATED;
+    if (strcasecmp(str, "interval") == 0) return MQTT_PUBLISH_PER_VALUE;
+    return MQTT_PUBLISH_CHANGES;
+}
+
+const char* getMqttModeName(MqttPublishMode mode) {
+    switch (mode) {
+        case MQTT_PUBLISH_AGGREGATED: return "state";
+        case MQTT_PUBLISH_PER_VALUE: return "interval";
+        default: return "changes";
+    }
+}
+
+unsigned int parseHttpPolling(const char* str) {
+    if (strcasecmp(str, "epoll") == 0) return MHD_USE_EPOLL;
+    if (strcasecmp(str, "poll") == 0) return MHD_USE_POLL;
+    if (strcasecmp(str, "select") == 0) return 0;
+    return MHD_USE_AUTO;
+}
+
+const char* getHttpPollingName(unsigned int polling) {
+    switch (polling) {
+        case MHD_USE_EPOLL: return "epoll";
+        case MHD_USE_POLL: return "poll";
+        case 0: return "select";
+        default: return "auto";
+    }
+}
+
+// Split "host:port" in place; a bare host keeps the default port
+void parseMqttHost(char* str) {
+    char* colon = strrchr(str, ':');
+    if (colon != nullptr && strchr(str, ':') == colon) {
+        *colon = '\0';
+        config.mqttPort = atoi(colon + 1);
+    }
+    config.mqttHost = str;
+}
+
 bool portExists(const std::string& port) {
     struct stat st;
     return stat(port.c_str(), &st) == 0;
@@ -107,79 +211,171 @@ std::vector<std::string> discoverSerialPorts() {
     if (hasConfiguredPort && portExists(config.serialPort) && seen.insert(config.serialPort).second) {
         ports.push_back(config.serialPort);
     }
-    addPortsFromGlob("/dev/ttyUSB*", ports, seen);
-    addPortsFromGlob("/dev/ttyACM*", ports, seen);
-    addPortsFromGlob("/dev/ttyAMA*", ports, seen);
+    for (const char* pattern : SERIAL_PORT_GLOBS) {
+        addPortsFromGlob(pattern, ports, seen);
+    }
     if (ports.empty() && hasConfiguredPort) {
         ports.push_back(config.serialPort);
     }
     return ports;
 }
 
-bool waitForCompatibility(VBUSDecoder* decoder) {
-    if (!decoder) {
-        return false;
-    }
-    for (int i = 0; i < COMPATIBILITY_ATTEMPTS && running; ++i) {
-        decoder->loop();
-        if (decoder->isReady() && decoder->getVbusStat()) {
-            return true;
+// Settings tried on every port: the configured ones first, and with
+// protocol auto the usual line settings of the other protocols
+std::vector<ProbeSetting> getProbeSettings() {
+    static const ProbeSetting defaults[] = {
+        { PROTOCOL_VBUS, 9600, SERIAL_8N1 },
+        { PROTOCOL_KW, 4800, SERIAL_8E2 },
+        { PROTOCOL_P300, 4800, SERIAL_8E2 },
+        { PROTOCOL_KM, 4800, SERIAL_8N1 }
+    };
+    std::vector<ProbeSetting> settings;
+    settings.push_back({ (ProtocolType)config.protocol, config.baudRate, config.serialConfig });
+    if (config.autoProtocol) {
+        for (const ProbeSetting& setting : defaults) {
+            if (setting.protocol == config.protocol && setting.baudRate == config.baudRate &&
+                setting.serialConfig == config.serialConfig) continue;
+            settings.push_back(setting);
         }
-        usleep(COMPATIBILITY_DELAY_US);
     }
-    return false;
+    return settings;
 }
 
-bool attemptConnection(const std::string& port) {
-    if (vbusSerial.isOpen()) {
-        vbusSerial.end();
+// Watches /dev for the probed port names and the configured port
+bool startPortWatch() {
+    std::vector<std::string> patterns(std::begin(SERIAL_PORT_GLOBS), std::end(SERIAL_PORT_GLOBS));
+    if (config.serialPort && strncmp(config.serialPort, "/dev/", 5) == 0 && !strchr(config.serialPort + 5, '/')) {
+        patterns.push_back(config.serialPort);
     }
-    if (!vbusSerial.begin(port.c_str(), config.baudRate, config.serialConfig)) {
-        fprintf(stderr, "Failed to open serial port %s\n", port.c_str());
-        return false;
+    return portWatch.begin(patterns);
+}
+
+// While recording, the decoder reads the port through captureTee. The
+// decoder passed in is replaced, its successor becomes ready with the next
+// frame
+VBUSDecoder* startCapture(Stream* stream, VBUSDecoder* decoder, const std::string& port,
+                          ProtocolType protocol, unsigned long baud, uint8_t serialConfig) {
+    if (!capture.isOpen()) return decoder;
+    int id = capture.addPort(port.c_str(), protocol, baud, serialConfig);
+    if (id < 0) {
+        fprintf(stderr, "Warning: too many ports for one capture, %s is not recorded\n", port.c_str());
+        return decoder;
     }
+    delete decoder;
+    captureTee = new LinuxCaptureStream(stream, &capture, id);
+    decoder = new VBUSDecoder(captureTee);
+    decoder->begin(protocol);
+    captureTee->setDecoder(decoder);
+    return decoder;
+}
 
+// Closes the current port and drops its decoder
+void disconnectSerial() {
     pthread_mutex_lock(&data_mutex);
     VBUSDecoder* oldDecoder = vbus;
     vbus = nullptr;
+    serialConnected = false;
+    deviceCompatible = false;
+    activeSerialPort = "";
     pthread_mutex_unlock(&data_mutex);
-
-    if (oldDecoder) {
-        delete oldDecoder;
+    activeDevicePath.clear();
+    if (mqtt) mqtt->setDecoder(nullptr);
+    history.setDecoder(nullptr);
+    delete oldDecoder;
+    delete captureTee;
+    captureTee = nullptr;
+    if (serialReader && serialReader->getOverflowCount() > 0) {
+        printf("Serial reader dropped %lu bytes in total\n", serialReader->getOverflowCount());
     }
+    delete serialReader;
+    serialReader = nullptr;
+    delete vbusSerial;
+    vbusSerial = nullptr;
+}
 
-    VBUSDecoder* decoder = new VBUSDecoder(&vbusSerial);
+// Network ports are not probed: the decoder runs with the configured
+// settings from the start and the connection is kept up by netSerial
+void connectNetwork() {
+    netSerial = new LinuxTcpSerial();
+    if (!netSerial->begin(config.serialPort, config.baudRate, config.serialConfig)) {
+        delete netSerial;
+        netSerial = nullptr;
+        return;
+    }
+    VBUSDecoder* decoder = new VBUSDecoder(netSerial);
     decoder->begin((ProtocolType)config.protocol);
-
-    bool compatible = waitForCompatibility(decoder);
+    decoder = startCapture(netSerial, decoder, config.serialPort, (ProtocolType)config.protocol,
+                           config.baudRate, config.serialConfig);
     pthread_mutex_lock(&data_mutex);
-    if (compatible) {
-        vbus = decoder;
-        serialConnected = true;
-        deviceCompatible = true;
-        activeSerialPort = port;
-    } else {
-        delete decoder;
-        vbus = nullptr;
-        serialConnected = false;
-        deviceCompatible = false;
-        activeSerialPort = "";
-    }
+    vbus = decoder;
+    serialConnected = netSerial->isConnected();
+    deviceCompatible = true;
+    activeSerialPort = config.serialPort;
     pthread_mutex_unlock(&data_mutex);
+    if (mqtt) mqtt->setDecoder(decoder);
+    history.setDecoder(decoder);
+}
+
+// Probes all ports at once and binds to the first one that delivers
+// compatible frames. The current port is closed first, it is one of the
+// candidates again
+bool connectSerial(const std::vector<std::string>& ports) {
+    disconnectSerial();
+
+    for (const auto& port : ports) {
+        printf("Probing %s...\n", port.c_str());
+    }
+    PortProbe probe(getProbeSettings(), &running);
+    unsigned long start = millis();
+    if (!probe.run(ports)) {
+        fprintf(stderr, "No compatible frames detected on %zu port(s)\n", ports.size());
+        return false;
+    }
 
-    if (compatible) {
-        printf("Connected to %s and detected compatible frames\n", port.c_str());
-        return true;
+    const ProbeSetting& setting = probe.getSetting();
+    vbusSerial = probe.takeSerial();
+    if (config.lowLatency && !vbusSerial->setLowLatency(true)) {
+        printf("Low-latency mode is not supported by %s\n", probe.getPort().c_str());
     }
+    VBUSDecoder* decoder = probe.takeDecoder();
+    if (config.serialThread) {
+        // The probe decoder reads the port directly; its successor reads the
+        // ring and becomes ready with the next frame
+        serialReader = new LinuxSerialReader(vbusSerial);
+        if (serialReader->start()) {
+            delete decoder;
+            decoder = new VBUSDecoder(serialReader);
+            decoder->begin(setting.protocol);
+        } else {
+            delete serialReader;
+            serialReader = nullptr;
+        }
+    }
+    decoder = startCapture(serialReader ? (Stream*)serialReader : vbusSerial, decoder, probe.getPort(),
+                           setting.protocol, setting.baudRate, setting.serialConfig);
+    pthread_mutex_lock(&data_mutex);
+    vbus = decoder;
+    serialConnected = true;
+    deviceCompatible = true;
+    activeSerialPort = probe.getPort();
+    config.protocol = setting.protocol;
+    config.baudRate = setting.baudRate;
+    config.serialConfig = setting.serialConfig;
+    pthread_mutex_unlock(&data_mutex);
+    char resolved[PATH_MAX];
+    activeDevicePath = realpath(probe.getPort().c_str(), resolved) ? resolved : probe.getPort();
 
-    fprintf(stderr, "No compatible frames detected on %s\n", port.c_str());
-    vbusSerial.end();
-    return false;
+    printf("Connected to %s (%s, %lu %s) after %lu ms\n", probe.getPort().c_str(),
+           getProtocolName(setting.protocol), setting.baudRate,
+           setting.serialConfig == SERIAL_8N1 ? "8N1" : "8E2", millis() - start);
+    if (mqtt) mqtt->setDecoder(decoder);
+    history.setDecoder(decoder);
+    return true;
 }
 
 // Generate JSON data response
 char* generateDataJSON() {
-    static char json[4096];
+    static char json[4096]; // Only rendered by the main loop, see publishDataSnapshot()
     int offset = 0;
     int remaining = sizeof(json) - 1; // Reserve space for null terminator
     
@@ -215,6 +411,14 @@ char* generateDataJSON() {
     JSON_APPEND("\"ready\":%s,", (decoder && serialConnected && deviceCompatible && decoder->isReady()) ? "true" : "false");
     JSON_APPEND("\"status\":\"%s\",", status);
     JSON_APPEND("\"protocol\":%d,", config.protocol);
+    if (vbusSerial) {
+        // Byte arrival as seen by the decoder or the reader thread
+        SerialTiming timing = vbusSerial->getTiming();
+        JSON_APPEND("\"serialTiming\":{\"lowLatency\":%s,\"bytesPerRead\":%.1f,\"charTimeUs\":%lu,\"jitterUs\":%lu,\"maxGapUs\":%lu},",
+                    vbusSerial->isLowLatency() ? "true" : "false",
+                    timing.reads ? (double)timing.bytes / timing.reads : 0.0,
+                    timing.charTime, timing.jitter, timing.maxGap);
+    }
     
     if (!serialConnected || !decoder || !deviceCompatible) {
         JSON_APPEND("\"temperatures\":[],\"pumps\":[],\"relays\":[]");
@@ -265,508 +469,139 @@ char* generateDataJSON() {
     return json;
 }
 
-// Generate HTML pages
-const char* getDashboardHTML() {
-    static const char* html = 
-    "<!DOCTYPE html><html><head><meta charset='UTF-8'>"
-    "<title>Viessmann Decoder</title>"
-    "<meta name='viewport' content='width=device-width, initial-scale=1'>"
-    "<style>"
-    ":root{"
-    "--primary-color:#03a9f4;"
-    "--primary-dark:#0288d1;"
-    "--accent-color:#ff9800;"
-    "--card-background:#fff;"
-    "--primary-background:#fafafa;"
-    "--secondary-background:#e5e5e5;"
-    "--primary-text:#212121;"
-    "--secondary-text:#727272;"
-    "--divider-color:#e0e0e0;"
-    "--error-color:#f44336;"
-    "--success-color:#4caf50;"
-    "--warning-color:#ff9800;"
-    "--disabled-text:#9e9e9e;"
-    "--card-shadow:0 2px 2px 0 rgba(0,0,0,.14),0 1px 5px 0 rgba(0,0,0,.12),0 3px 1px -2px rgba(0,0,0,.2);"
-    "}"
-    "*{margin:0;padding:0;box-sizing:border-box;}"
-    "body{font-family:'Roboto','Noto',sans-serif;background:var(--primary-background);color:var(--primary-text);-webkit-font-smoothing:antialiased;}"
-    ".app-header{background:var(--primary-color);color:white;padding:0;box-shadow:0 2px 4px rgba(0,0,0,0.2);position:sticky;top:0;z-index:100;}"
-    ".header-toolbar{display:flex;align-items:center;justify-content:space-between;padding:16px 24px;max-width:1200px;margin:0 auto;}"
-    ".header-title{font-size:20px;font-weight:400;letter-spacing:0.02em;}"
-    ".header-icon{display:inline-block;width:24px;height:24px;margin-right:12px;vertical-align:middle;}"
-    ".view-container{max-width:1200px;margin:24px auto;padding:0 24px;}"
-    ".status-bar{display:flex;gap:16px;margin-bottom:24px;flex-wrap:wrap;}"
-    ".status-chip{background:var(--card-background);padding:12px 20px;border-radius:16px;box-shadow:var(--card-shadow);display:flex;align-items:center;gap:8px;font-size:14px;}"
-    ".status-chip .label{color:var(--secondary-text);font-weight:500;}"
-    ".status-chip .value{color:var(--primary-text);font-weight:500;}"
-    ".status-indicator{width:8px;height:8px;border-radius:50%%;background:var(--disabled-text);}"
-    ".status-indicator.ok{background:var(--success-color);}"
-    ".status-indicator.error{background:var(--error-color);}"
-    ".card{background:var(--card-background);border-radius:8px;box-shadow:var(--card-shadow);margin-bottom:24px;overflow:hidden;}"
-    ".card-header{padding:16px 20px;border-bottom:1px solid var(--divider-color);}"
-    ".card-title{font-size:16px;font-weight:500;color:var(--primary-text);}"
-    ".card-content{padding:0;}"
-    ".sensor-grid{display:grid;grid-template-columns:repeat(auto-fill,minmax(280px,1fr));gap:1px;background:var(--divider-color);}"
-    ".sensor-item{background:var(--card-background);padding:20px;display:flex;flex-direction:column;gap:8px;}"
-    ".sensor-label{font-size:14px;color:var(--secondary-text);font-weight:400;}"
-    ".sensor-value{font-size:28px;font-weight:300;color:var(--primary-text);display:flex;align-items:baseline;gap:4px;}"
-    ".sensor-unit{font-size:16px;color:var(--secondary-text);font-weight:400;}"
-    ".sensor-icon{width:40px;height:40px;margin-bottom:8px;opacity:0.7;}"
-    ".empty-state{padding:48px 20px;text-align:center;color:var(--secondary-text);}"
-    ".empty-state-icon{font-size:64px;margin-bottom:16px;opacity:0.3;}"
-    ".nav-buttons{display:flex;gap:16px;margin-bottom:24px;flex-wrap:wrap;}"
-    ".nav-button{background:var(--card-background);padding:16px 24px;border-radius:8px;box-shadow:var(--card-shadow);display:flex;align-items:center;gap:12px;text-decoration:none;color:var(--primary-text);transition:all 0.2s;font-weight:500;}"
-    ".nav-button:hover{transform:translateY(-2px);box-shadow:0 4px 8px rgba(0,0,0,0.2);background:var(--primary-color);color:white;}"
-    ".button-icon{width:24px;height:24px;}"
-    "@media(max-width:768px){"
-    ".view-container{padding:0 16px;margin:16px auto;}"
-    ".header-toolbar{padding:12px 16px;}"
-    ".sensor-grid{grid-template-columns:1fr;}"
-    "}"
-    "</style>"
-    "<script>"
-    "function updateData(){"
-    "fetch('/data').then(r=>r.json()).then(d=>{"
-    "const statusDot=document.getElementById('statusDot');"
-    "const statusText=document.getElementById('statusText');"
-    "const protocolText=document.getElementById('protocol');"
-    "const container=document.getElementById('sensorData');"
-    "if(d.serialConnected===false){"
-    "statusDot.className='status-indicator error';"
-    "statusText.textContent='Serial port not connected';"
-    "const protocols=['VBUS','KW-Bus','P300','KM-Bus'];"
-    "protocolText.textContent=protocols[d.protocol]||'Unknown';"
-    "container.innerHTML='<div class=\"empty-state\"><div class=\"empty-state-icon\">🔌</div><div style=\"font-size:18px;margin-bottom:8px;\">Serial port not connected</div><div style=\"color:var(--secondary-text);\">Please connect your Viessmann device and check the serial port configuration.</div></div>';"
-    "return;"
-    "}"
-    "statusDot.className='status-indicator '+(d.status==='OK'?'ok':'error');"
-    "statusText.textContent=d.status;"
-    "const protocols=['VBUS','KW-Bus','P300','KM-Bus'];"
-    "protocolText.textContent=protocols[d.protocol]||'Unknown';"
-    "if(!d.ready||(!d.temperatures.length&&!d.pumps.length&&!d.relays.length)){"
-    "container.innerHTML='<div class=\"empty-state\"><div class=\"empty-state-icon\">⏳</div><div>Waiting for data...</div></div>';"
-    "return;"
-    "}"
-    "let html='';"
-    "if(d.temperatures&&d.temperatures.length>0){"
-    "d.temperatures.forEach((t,i)=>{"
-    "html+='<div class=\"sensor-item\">';"
-    "html+='<div class=\"sensor-label\">Temperature '+(i+1)+'</div>';"
-    "html+='<div class=\"sensor-value\">'+t.toFixed(1)+'<span class=\"sensor-unit\">°C</span></div>';"
-    "html+='</div>';"
-    "});"
-    "}"
-    "if(d.pumps&&d.pumps.length>0){"
-    "d.pumps.forEach((p,i)=>{"
-    "html+='<div class=\"sensor-item\">';"
-    "html+='<div class=\"sensor-label\">Pump '+(i+1)+' Power</div>';"
-    "html+='<div class=\"sensor-value\">'+p+'<span class=\"sensor-unit\">%%</span></div>';"
-    "html+='</div>';"
-    "});"
-    "}"
-    "if(d.relays&&d.relays.length>0){"
-    "d.relays.forEach((r,i)=>{"
-    "html+='<div class=\"sensor-item\">';"
-    "html+='<div class=\"sensor-label\">Relay '+(i+1)+'</div>';"
-    "html+='<div class=\"sensor-value\" style=\"color:'+(r?'var(--success-color)':'var(--disabled-text)')+'\">'+(r?'ON':'OFF')+'</div>';"
-    "html+='</div>';"
-    "});"
-    "}"
-    "container.innerHTML=html;"
-    "}).catch(err=>{"
-    "console.error('Error fetching data:',err);"
-    "document.getElementById('sensorData').innerHTML='<div class=\"empty-state\"><div class=\"empty-state-icon\">⚠️</div><div>Error loading data</div></div>';"
-    "});"
-    "}"
-    "setInterval(updateData,2000);"
-    "window.onload=updateData;"
-    "</script>"
-    "</head><body>"
-    "<div class='app-header'>"
-    "<div class='header-toolbar'>"
-    "<div class='header-title'>"
-    "<svg class='header-icon' viewBox='0 0 24 24' fill='currentColor'>"
-    "<path d='M12,2A10,10 0 0,0 2,12A10,10 0 0,0 12,22A10,10 0 0,0 22,12A10,10 0 0,0 12,2M12,4A8,8 0 0,1 20,12C20,14.4 19,16.5 17.3,18C15.9,16.7 14,16 12,16C10,16 8.2,16.7 6.7,18C5,16.5 4,14.4 4,12A8,8 0 0,1 12,4M14,5.89C13.62,5.9 13.26,6.15 13.1,6.54L11.81,9.77L11.71,10C11,10.13 10.41,10.6 10.14,11.26C9.73,12.29 10.23,13.45 11.26,13.86C12.29,14.27 13.45,13.77 13.86,12.74C14.12,12.08 14,11.32 13.57,10.76L13.67,10.5L14.96,7.29L14.97,7.26C15.17,6.75 14.92,6.17 14.41,5.96C14.28,5.91 14.15,5.89 14,5.89M10,6A1,1 0 0,0 9,7A1,1 0 0,0 10,8A1,1 0 0,0 11,7A1,1 0 0,0 10,6M7,9A1,1 0 0,0 6,10A1,1 0 0,0 7,11A1,1 0 0,0 8,10A1,1 0 0,0 7,9M17,9A1,1 0 0,0 16,10A1,1 0 0,0 17,11A1,1 0 0,0 18,10A1,1 0 0,0 17,9Z'/>"
-    "</svg>"
-    "Viessmann Decoder"
-    "</div>"
-    "</div>"
-    "</div>"
-    "<div class='view-container'>"
-    "<div class='status-bar'>"
-    "<div class='status-chip'>"
-    "<div id='statusDot' class='status-indicator'></div>"
-    "<span class='label'>Status:</span>"
-    "<span id='statusText' class='value'>Checking...</span>"
-    "</div>"
-    "<div class='status-chip'>"
-    "<span class='label'>Protocol:</span>"
-    "<span id='protocol' class='value'>-</span>"
-    "</div>"
-    "</div>"
-    "<div class='nav-buttons'>"
-    "<a href='/settings' class='nav-button'>"
-    "<svg class='button-icon' viewBox='0 0 24 24' fill='currentColor'><path d='M12,15.5A3.5,3.5 0 0,1 8.5,12A3.5,3.5 0 0,1 12,8.5A3.5,3.5 0 0,1 15.5,12A3.5,3.5 0 0,1 12,15.5M19.43,12.97C19.47,12.65 19.5,12.33 19.5,12C19.5,11.67 19.47,11.34 19.43,11L21.54,9.37C21.73,9.22 21.78,8.95 21.66,8.73L19.66,5.27C19.54,5.05 19.27,4.96 19.05,5.05L16.56,6.05C16.04,5.66 15.5,5.32 14.87,5.07L14.5,2.42C14.46,2.18 14.25,2 14,2H10C9.75,2 9.54,2.18 9.5,2.42L9.13,5.07C8.5,5.32 7.96,5.66 7.44,6.05L4.95,5.05C4.73,4.96 4.46,5.05 4.34,5.27L2.34,8.73C2.21,8.95 2.27,9.22 2.46,9.37L4.57,11C4.53,11.34 4.5,11.67 4.5,12C4.5,12.33 4.53,12.65 4.57,12.97L2.46,14.63C2.27,14.78 2.21,15.05 2.34,15.27L4.34,18.73C4.46,18.95 4.73,19.03 4.95,18.95L7.44,17.94C7.96,18.34 8.5,18.68 9.13,18.93L9.5,21.58C9.54,21.82 9.75,22 10,22H14C14.25,22 14.46,21.82 14.5,21.58L14.87,18.93C15.5,18.67 16.04,18.34 16.56,17.94L19.05,18.95C19.27,19.03 19.54,18.95 19.66,18.73L21.66,15.27C21.78,15.05 21.73,14.78 21.54,14.63L19.43,12.97Z'/></svg>"
-    "<span>Settings</span>"
-    "</a>"
-    "<a href='/devices' class='nav-button'>"
-    "<svg class='button-icon' viewBox='0 0 24 24' fill='currentColor'><path d='M17,13H13V17H11V13H7V11H11V7H13V11H17M12,2A10,10 0 0,0 2,12A10,10 0 0,0 12,22A10,10 0 0,0 22,12A10,10 0 0,0 12,2Z'/></svg>"
-    "<span>Add Device</span>"
-    "</a>"
-    "</div>"
-    "<div class='card'>"
-    "<div class='card-header'>"
-    "<div class='card-title'>Sensor Data</div>"
-    "</div>"
-    "<div class='card-content'>"
-    "<div id='sensorData' class='sensor-grid'>"
-    "<div class='empty-state'><div class='empty-state-icon'>⏳</div><div>Loading...</div></div>"
-    "</div>"
-    "</div>"
-    "</div>"
-    "</div>"
-    "</body></html>";
-    
-    return html;
-}
+// Copy of the values /data.cbor and /data.msgpack encode, taken in one go
+// under data_mutex
+void captureDataState(DataState& state, uint32_t sequence) {
+    memset(&state, 0, sizeof(state));
+    state.sequence = sequence;
+    state.protocol = config.protocol;
 
-const char* getStatusHTML() {
-    static thread_local char html[16384]; // Thread-local buffer for thread-safe access
-    
-    // Check if vbus is valid
-    if (!vbus) {
-        snprintf(html, sizeof(html), 
-                "<!DOCTYPE html><html><body><h1>Error: System not initialized</h1></body></html>");
-        return html;
+    pthread_mutex_lock(&data_mutex);
+    VBUSDecoder* decoder = vbus;
+    state.serialConnected = serialConnected;
+    state.compatible = deviceCompatible;
+    snprintf(state.serialPort, sizeof(state.serialPort), "%s", activeSerialPort.c_str());
+    state.decoding = serialConnected && deviceCompatible && decoder;
+    if (!state.decoding) {
+        pthread_mutex_unlock(&data_mutex);
+        return;
     }
-    
-    int written = snprintf(html, sizeof(html) - 1, // Reserve space for null terminator
-    "<!DOCTYPE html><html><head><meta charset='UTF-8'>"
-    "<title>Viessmann Decoder - Status</title>"
-    "<meta name='viewport' content='width=device-width, initial-scale=1'>"
-    "<style>"
-    ":root{"
-    "--primary-color:#03a9f4;"
-    "--card-background:#fff;"
-    "--primary-background:#fafafa;"
-    "--primary-text:#212121;"
-    "--secondary-text:#727272;"
-    "--divider-color:#e0e0e0;"
-    "--card-shadow:0 2px 2px 0 rgba(0,0,0,.14),0 1px 5px 0 rgba(0,0,0,.12),0 3px 1px -2px rgba(0,0,0,.2);"
-    "}"
-    "*{margin:0;padding:0;box-sizing:border-box;}"
-    "body{font-family:'Roboto','Noto',sans-serif;background:var(--primary-background);color:var(--primary-text);}"
-    ".app-header{background:var(--primary-color);color:white;padding:0;box-shadow:0 2px 4px rgba(0,0,0,0.2);}"
-    ".header-toolbar{display:flex;align-items:center;padding:16px 24px;max-width:1200px;margin:0 auto;}"
-    ".header-title{font-size:20px;font-weight:400;}"
-    ".header-icon{width:24px;height:24px;margin-right:12px;vertical-align:middle;}"
-    ".view-container{max-width:1200px;margin:24px auto;padding:0 24px;}"
-    ".card{background:var(--card-background);border-radius:8px;box-shadow:var(--card-shadow);margin-bottom:24px;overflow:hidden;}"
-    ".card-header{padding:16px 20px;border-bottom:1px solid var(--divider-color);}"
-    ".card-title{font-size:16px;font-weight:500;}"
-    ".info-table{width:100%%;}"
-    ".info-row{display:flex;padding:16px 20px;border-bottom:1px solid var(--divider-color);}"
-    ".info-row:last-child{border-bottom:none;}"
-    ".info-label{flex:1;color:var(--secondary-text);font-size:14px;}"
-    ".info-value{flex:1;color:var(--primary-text);font-size:14px;font-weight:500;text-align:right;}"
-    "@media(max-width:768px){.view-container{padding:0 16px;margin:16px auto;}}"
-    "</style>"
-    "</head><body>"
-    "<div class='app-header'>"
-    "<div class='header-toolbar'>"
-    "<div class='header-title'>"
-    "<svg class='header-icon' viewBox='0 0 24 24' fill='currentColor'>"
-    "<path d='M12,2A10,10 0 0,0 2,12A10,10 0 0,0 12,22A10,10 0 0,0 22,12A10,10 0 0,0 12,2M12,4A8,8 0 0,1 20,12C20,14.4 19,16.5 17.3,18C15.9,16.7 14,16 12,16C10,16 8.2,16.7 6.7,18C5,16.5 4,14.4 4,12A8,8 0 0,1 12,4M14,5.89C13.62,5.9 13.26,6.15 13.1,6.54L11.81,9.77L11.71,10C11,10.13 10.41,10.6 10.14,11.26C9.73,12.29 10.23,13.45 11.26,13.86C12.29,14.27 13.45,13.77 13.86,12.74C14.12,12.08 14,11.32 13.57,10.76L13.67,10.5L14.96,7.29L14.97,7.26C15.17,6.75 14.92,6.17 14.41,5.96C14.28,5.91 14.15,5.89 14,5.89M10,6A1,1 0 0,0 9,7A1,1 0 0,0 10,8A1,1 0 0,0 11,7A1,1 0 0,0 10,6M7,9A1,1 0 0,0 6,10A1,1 0 0,0 7,11A1,1 0 0,0 8,10A1,1 0 0,0 7,9M17,9A1,1 0 0,0 16,10A1,1 0 0,0 17,11A1,1 0 0,0 18,10A1,1 0 0,0 17,9Z'/>"
-    "</svg>"
-    "System Status"
-    "</div>"
-    "</div>"
-    "</div>"
-    "<div class='view-container'>"
-    "<div class='card'>"
-    "<div class='card-header'><div class='card-title'>Current Configuration</div></div>"
-    "<div class='info-table'>"
-    "<div class='info-row'><div class='info-label'>Protocol</div><div class='info-value'>%s</div></div>"
-    "<div class='info-row'><div class='info-label'>Baud Rate</div><div class='info-value'>%lu</div></div>"
-    "<div class='info-row'><div class='info-label'>Serial Config</div><div class='info-value'>%s</div></div>"
-    "<div class='info-row'><div class='info-label'>Serial Port</div><div class='info-value'>%s</div></div>"
-    "<div class='info-row'><div class='info-label'>Web Port</div><div class='info-value'>%d</div></div>"
-    "</div>"
-    "</div>"
-    "<div class='card'>"
-    "<div class='card-header'><div class='card-title'>System Information</div></div>"
-    "<div class='info-table'>"
-    "<div class='info-row'><div class='info-label'>Platform</div><div class='info-value'>Linux</div></div>"
-    "<div class='info-row'><div class='info-label'>Communication Status</div><div class='info-value'>%s</div></div>"
-    "<div class='info-row'><div class='info-label'>Data Ready</div><div class='info-value'>%s</div></div>"
-    "</div>"
-    "</div>"
-    "</div></body></html>",
-    getProtocolName(config.protocol),
-    config.baudRate,
-    config.serialConfig == SERIAL_8N1 ? "8N1" : "8E2",
-    config.serialPort,
-    config.webPort,
-    vbus->getVbusStat() ? "OK" : "Error",
-    vbus->isReady() ? "Yes" : "No");
-    
-    // Ensure null termination and check for overflow
-    html[sizeof(html) - 1] = '\0';
-    if (written < 0 || written >= (int)(sizeof(html) - 1)) {
-        fprintf(stderr, "Warning: HTML buffer overflow detected and handled\n");
-        // Buffer is already null-terminated and truncated
+
+    state.ready = decoder->isReady();
+    state.status = decoder->getVbusStat() ? 1 : 2;
+    if (state.ready) {
+        state.tempCount = min(decoder->getTempNum(), (uint8_t)DATA_MAX_CHANNELS);
+        for (uint8_t i = 0; i < state.tempCount; i++) state.temperatures[i] = decoder->getTemp(i);
+        state.pumpCount = min(decoder->getPumpNum(), (uint8_t)DATA_MAX_CHANNELS);
+        for (uint8_t i = 0; i < state.pumpCount; i++) state.pumps[i] = decoder->getPump(i);
+        state.relayCount = min(decoder->getRelayNum(), (uint8_t)DATA_MAX_CHANNELS);
+        for (uint8_t i = 0; i < state.relayCount; i++) state.relays[i] = decoder->getRelay(i);
     }
-    
-    return html;
-}
+    state.errorMask = decoder->getErrorMask();
+    state.heatQuantity = decoder->getHeatQuantity();
+    state.systemTime = decoder->getSystemTime();
 
-// Generate Settings Page HTML
-const char* getSettingsHTML() {
-    static thread_local char html[16384];
-    
-    if (!vbus) {
-        snprintf(html, sizeof(html), 
-                "<!DOCTYPE html><html><body><h1>Error: System not initialized</h1></body></html>");
-        return html;
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < decoder->getParticipantCount() && state.participantCount < DATA_MAX_PARTICIPANTS; i++) {
+        const BusParticipant* participant = decoder->getParticipant(i);
+        if (participant == nullptr) continue;
+        DataParticipant& p = state.participants[state.participantCount++];
+        p.address = participant->address;
+        snprintf(p.name, sizeof(p.name), "%s", participant->name);
+        p.tempChannels = participant->tempChannels;
+        p.pumpChannels = participant->pumpChannels;
+        p.relayChannels = participant->relayChannels;
+        p.active = participant->active;
+        p.age = now - participant->lastSeen;
     }
-    
-    int written = snprintf(html, sizeof(html) - 1,
-    "<!DOCTYPE html><html><head><meta charset='UTF-8'>"
-    "<title>Settings - Viessmann Decoder</title>"
-    "<meta name='viewport' content='width=device-width, initial-scale=1'>"
-    "<style>"
-    ":root{"
-    "--primary-color:#03a9f4;"
-    "--card-background:#fff;"
-    "--primary-background:#fafafa;"
-    "--primary-text:#212121;"
-    "--secondary-text:#727272;"
-    "--divider-color:#e0e0e0;"
-    "--success-color:#4caf50;"
-    "--card-shadow:0 2px 2px 0 rgba(0,0,0,.14),0 1px 5px 0 rgba(0,0,0,.12),0 3px 1px -2px rgba(0,0,0,.2);"
-    "}"
-    "*{margin:0;padding:0;box-sizing:border-box;}"
-    "body{font-family:'Roboto','Noto',sans-serif;background:var(--primary-background);color:var(--primary-text);}"
-    ".app-header{background:var(--primary-color);color:white;box-shadow:0 2px 4px rgba(0,0,0,0.2);}"
-    ".header-toolbar{display:flex;align-items:center;padding:16px 24px;max-width:1200px;margin:0 auto;}"
-    ".header-title{font-size:20px;font-weight:400;}"
-    ".back-button{background:none;border:none;color:white;cursor:pointer;padding:8px;margin-right:16px;}"
-    ".back-icon{width:24px;height:24px;}"
-    ".view-container{max-width:1200px;margin:24px auto;padding:0 24px;}"
-    ".card{background:var(--card-background);border-radius:8px;box-shadow:var(--card-shadow);margin-bottom:24px;overflow:hidden;}"
-    ".card-header{padding:16px 20px;border-bottom:1px solid var(--divider-color);}"
-    ".card-title{font-size:16px;font-weight:500;}"
-    ".form-group{padding:20px;border-bottom:1px solid var(--divider-color);}"
-    ".form-group:last-child{border-bottom:none;}"
-    ".form-label{font-size:14px;color:var(--secondary-text);margin-bottom:8px;display:block;}"
-    ".form-control{width:100%%;padding:12px;border:1px solid var(--divider-color);border-radius:4px;font-size:14px;}"
-    ".form-control:focus{outline:none;border-color:var(--primary-color);}"
-    ".form-select{width:100%%;padding:12px;border:1px solid var(--divider-color);border-radius:4px;font-size:14px;background:white;}"
-    ".button-group{padding:20px;display:flex;gap:12px;justify-content:flex-end;}"
-    ".btn{padding:12px 24px;border:none;border-radius:4px;font-size:14px;font-weight:500;cursor:pointer;transition:all 0.2s;}"
-    ".btn-primary{background:var(--primary-color);color:white;}"
-    ".btn-primary:hover{background:#0288d1;}"
-    ".btn-secondary{background:var(--divider-color);color:var(--primary-text);}"
-    ".btn-secondary:hover{background:#ccc;}"
-    "@media(max-width:768px){.view-container{padding:0 16px;margin:16px auto;}}"
-    "</style>"
-    "</head><body>"
-    "<div class='app-header'>"
-    "<div class='header-toolbar'>"
-    "<a href='/' class='back-button'>"
-    "<svg class='back-icon' viewBox='0 0 24 24' fill='currentColor'><path d='M20,11V13H8L13.5,18.5L12.08,19.92L4.16,12L12.08,4.08L13.5,5.5L8,11H20Z'/></svg>"
-    "</a>"
-    "<div class='header-title'>Settings</div>"
-    "</div>"
-    "</div>"
-    "<div class='view-container'>"
-    "<div class='card'>"
-    "<div class='card-header'><div class='card-title'>Connection Settings</div></div>"
-    "<form onsubmit='return false;'>"
-    "<div class='form-group'>"
-    "<label class='form-label'>Serial Port</label>"
-    "<input type='text' class='form-control' value='%s' readonly>"
-    "</div>"
-    "<div class='form-group'>"
-    "<label class='form-label'>Baud Rate</label>"
-    "<select class='form-select'>"
-    "<option value='2400'%s>2400</option>"
-    "<option value='4800'%s>4800</option>"
-    "<option value='9600'%s>9600</option>"
-    "<option value='19200'%s>19200</option>"
-    "<option value='38400'%s>38400</option>"
-    "<option value='115200'%s>115200</option>"
-    "</select>"
-    "</div>"
-    "<div class='form-group'>"
-    "<label class='form-label'>Protocol</label>"
-    "<select class='form-select'>"
-    "<option value='vbus'%s>VBUS (RESOL)</option>"
-    "<option value='kw'%s>KW-Bus (VS1)</option>"
-    "<option value='p300'%s>P300 (VS2/Optolink)</option>"
-    "<option value='km'%s>KM-Bus</option>"
-    "</select>"
-    "</div>"
-    "<div class='form-group'>"
-    "<label class='form-label'>Serial Configuration</label>"
-    "<select class='form-select'>"
-    "<option value='8N1'%s>8N1</option>"
-    "<option value='8E2'%s>8E2</option>"
-    "</select>"
-    "</div>"
-    "<div class='button-group'>"
-    "<button class='btn btn-secondary' onclick='window.location.href=\"/\"'>Cancel</button>"
-    "<button class='btn btn-primary' onclick='alert(\"Settings are read-only in this version. Configure through Home Assistant addon settings.\")'>Save</button>"
-    "</div>"
-    "</form>"
-    "</div>"
-    "</div>"
-    "</body></html>",
-    config.serialPort,
-    config.baudRate == 2400 ? " selected" : "",
-    config.baudRate == 4800 ? " selected" : "",
-    config.baudRate == 9600 ? " selected" : "",
-    config.baudRate == 19200 ? " selected" : "",
-    config.baudRate == 38400 ? " selected" : "",
-    config.baudRate == 115200 ? " selected" : "",
-    config.protocol == PROTOCOL_VBUS ? " selected" : "",
-    config.protocol == PROTOCOL_KW ? " selected" : "",
-    config.protocol == PROTOCOL_P300 ? " selected" : "",
-    config.protocol == PROTOCOL_KM ? " selected" : "",
-    config.serialConfig == SERIAL_8N1 ? " selected" : "",
-    config.serialConfig == SERIAL_8E2 ? " selected" : "");
-    
-    html[sizeof(html) - 1] = '\0';
-    if (written < 0 || written >= (int)(sizeof(html) - 1)) {
-        fprintf(stderr, "Warning: HTML buffer overflow detected\n");
+
+    state.kmBus = decoder->getProtocol() == PROTOCOL_KM;
+    if (state.kmBus) {
+        state.kmBurner = decoder->getKMBusBurnerStatus();
+        state.kmMainPump = decoder->getKMBusMainPumpStatus();
+        state.kmLoopPump = decoder->getKMBusLoopPumpStatus();
+        state.kmMode = decoder->getKMBusMode();
+        state.kmBoilerTemp = decoder->getKMBusBoilerTemp();
+        state.kmHotWaterTemp = decoder->getKMBusHotWaterTemp();
+        state.kmOutdoorTemp = decoder->getKMBusOutdoorTemp();
+        state.kmSetpointTemp = decoder->getKMBusSetpointTemp();
+        state.kmDepartureTemp = decoder->getKMBusDepartureTemp();
     }
-    
-    return html;
+    pthread_mutex_unlock(&data_mutex);
 }
 
-// Generate Device Configuration Page HTML
-const char* getDevicesHTML() {
-    static thread_local char html[16384];
-    
-    if (!vbus) {
-        snprintf(html, sizeof(html), 
-                "<!DOCTYPE html><html><body><h1>Error: System not initialized</h1></body></html>");
-        return html;
-    }
-    
-    int written = snprintf(html, sizeof(html) - 1,
-    "<!DOCTYPE html><html><head><meta charset='UTF-8'>"
-    "<title>Device Configuration - Viessmann Decoder</title>"
-    "<meta name='viewport' content='width=device-width, initial-scale=1'>"
-    "<style>"
-    ":root{"
-    "--primary-color:#03a9f4;"
-    "--card-background:#fff;"
-    "--primary-background:#fafafa;"
-    "--primary-text:#212121;"
-    "--secondary-text:#727272;"
-    "--divider-color:#e0e0e0;"
-    "--success-color:#4caf50;"
-    "--card-shadow:0 2px 2px 0 rgba(0,0,0,.14),0 1px 5px 0 rgba(0,0,0,.12),0 3px 1px -2px rgba(0,0,0,.2);"
-    "}"
-    "*{margin:0;padding:0;box-sizing:border-box;}"
-    "body{font-family:'Roboto','Noto',sans-serif;background:var(--primary-background);color:var(--primary-text);}"
-    ".app-header{background:var(--primary-color);color:white;box-shadow:0 2px 4px rgba(0,0,0,0.2);}"
-    ".header-toolbar{display:flex;align-items:center;padding:16px 24px;max-width:1200px;margin:0 auto;}"
-    ".header-title{font-size:20px;font-weight:400;}"
-    ".back-button{background:none;border:none;color:white;cursor:pointer;padding:8px;margin-right:16px;text-decoration:none;display:flex;align-items:center;}"
-    ".back-icon{width:24px;height:24px;}"
-    ".view-container{max-width:1200px;margin:24px auto;padding:0 24px;}"
-    ".card{background:var(--card-background);border-radius:8px;box-shadow:var(--card-shadow);margin-bottom:24px;overflow:hidden;}"
-    ".card-header{padding:16px 20px;border-bottom:1px solid var(--divider-color);}"
-    ".card-title{font-size:16px;font-weight:500;}"
-    ".form-group{padding:20px;border-bottom:1px solid var(--divider-color);}"
-    ".form-group:last-child{border-bottom:none;}"
-    ".form-label{font-size:14px;color:var(--secondary-text);margin-bottom:8px;display:block;}"
-    ".form-control{width:100%%;padding:12px;border:1px solid var(--divider-color);border-radius:4px;font-size:14px;}"
-    ".form-control:focus{outline:none;border-color:var(--primary-color);}"
-    ".form-select{width:100%%;padding:12px;border:1px solid var(--divider-color);border-radius:4px;font-size:14px;background:white;}"
-    ".form-hint{font-size:12px;color:var(--secondary-text);margin-top:4px;}"
-    ".button-group{padding:20px;display:flex;gap:12px;justify-content:flex-end;}"
-    ".btn{padding:12px 24px;border:none;border-radius:4px;font-size:14px;font-weight:500;cursor:pointer;transition:all 0.2s;}"
-    ".btn-primary{background:var(--primary-color);color:white;}"
-    ".btn-primary:hover{background:#0288d1;}"
-    ".btn-secondary{background:var(--divider-color);color:var(--primary-text);}"
-    ".btn-secondary:hover{background:#ccc;}"
-    ".info-box{background:#e3f2fd;border-left:4px solid var(--primary-color);padding:16px;margin:20px;border-radius:4px;}"
-    ".info-box-title{font-weight:500;margin-bottom:8px;}"
-    ".info-box-text{font-size:14px;color:var(--secondary-text);}"
-    "@media(max-width:768px){.view-container{padding:0 16px;margin:16px auto;}}"
-    "</style>"
-    "</head><body>"
-    "<div class='app-header'>"
-    "<div class='header-toolbar'>"
-    "<a href='/' class='back-button'>"
-    "<svg class='back-icon' viewBox='0 0 24 24' fill='currentColor'><path d='M20,11V13H8L13.5,18.5L12.08,19.92L4.16,12L12.08,4.08L13.5,5.5L8,11H20Z'/></svg>"
-    "</a>"
-    "<div class='header-title'>Add Device</div>"
-    "</div>"
-    "</div>"
-    "<div class='view-container'>"
-    "<div class='info-box'>"
-    "<div class='info-box-title'>Auto-Discovery Active</div>"
-    "<div class='info-box-text'>Devices are automatically discovered on the bus. Manual configuration is available for advanced users.</div>"
-    "</div>"
-    "<div class='card'>"
-    "<div class='card-header'><div class='card-title'>Manual Device Configuration</div></div>"
-    "<form onsubmit='return false;'>"
-    "<div class='form-group'>"
-    "<label class='form-label'>Device Address</label>"
-    "<input type='text' class='form-control' placeholder='e.g., 0x10 or 0x7E11'>"
-    "<div class='form-hint'>Hexadecimal address of the device on the bus</div>"
-    "</div>"
-    "<div class='form-group'>"
-    "<label class='form-label'>Device Type</label>"
-    "<select class='form-select'>"
-    "<option value=''>Select device type...</option>"
-    "<option value='vitosolic200'>Viessmann Vitosolic 200 (0x1060)</option>"
-    "<option value='deltasol_bx_plus'>DeltaSol BX Plus (0x7E11)</option>"
-    "<option value='deltasol_bx'>DeltaSol BX (0x7E21)</option>"
-    "<option value='deltasol_mx'>DeltaSol MX (0x7E31)</option>"
-    "<option value='vitotronic100'>Vitotronic 100 Series</option>"
-    "<option value='vitotronic200'>Vitotronic 200 Series</option>"
-    "<option value='generic'>Generic Device</option>"
-    "</select>"
-    "</div>"
-    "<div class='form-group'>"
-    "<label class='form-label'>Device Name</label>"
-    "<input type='text' class='form-control' placeholder='e.g., Solar Controller'>"
-    "<div class='form-hint'>Friendly name for this device</div>"
-    "</div>"
-    "<div class='form-group'>"
-    "<label class='form-label'>Enable Discovery</label>"
-    "<select class='form-select'>"
-    "<option value='auto' selected>Automatic Discovery</option>"
-    "<option value='manual'>Manual Configuration Only</option>"
-    "</select>"
-    "</div>"
-    "<div class='button-group'>"
-    "<button class='btn btn-secondary' onclick='window.location.href=\"/\"'>Cancel</button>"
-    "<button class='btn btn-primary' onclick='alert(\"Device management is handled automatically. For manual configuration, devices can be added through the library API.\")'>Add Device</button>"
-    "</div>"
-    "</form>"
-    "</div>"
-    "<div class='card'>"
-    "<div class='card-header'><div class='card-title'>Discovered Devices</div></div>"
-    "<div class='info-box'>"
-    "<div class='info-box-text'>Currently detected: %d device(s) on the bus. Check the main dashboard for real-time sensor data.</div>"
-    "</div>"
-    "</div>"
-    "</div>"
-    "</body></html>",
-    vbus->isReady() ? 1 : 0);
-    
-    html[sizeof(html) - 1] = '\0';
-    if (written < 0 || written >= (int)(sizeof(html) - 1)) {
-        fprintf(stderr, "Warning: HTML buffer overflow detected\n");
-    }
-    
-    return html;
+DataSnapshot* acquireDataSnapshot() {
+    pthread_mutex_lock(&snapshot_mutex);
+    DataSnapshot* snapshot = dataSnapshot;
+    if (snapshot) snapshot->refs++;
+    pthread_mutex_unlock(&snapshot_mutex);
+    return snapshot;
+}
+
+void releaseDataSnapshot(void* cls) {
+    DataSnapshot* snapshot = (DataSnapshot*)cls;
+    if (--snapshot->refs == 0) delete snapshot;
+}
+
+// Render /data once for a new frame (or connection change) and swap it in;
+// responses still sending the previous snapshot keep it alive
+DataSnapshot* publishDataSnapshot(uint32_t sequence) {
+    DataSnapshot* snapshot = new DataSnapshot();
+    snapshot->refs = 1;    // Reference held by dataSnapshot
+    snapshot->sequence = sequence;
+    snprintf(snapshot->etag, sizeof(snapshot->etag), "\"%lx-%u\"", snapshotEpoch, sequence);
+    snapshot->json = generateDataJSON();
+
+    // Both binary formats come from one copy of the decoder state
+    static DataState state;
+    captureDataState(state, sequence);
+    encodeDataState(state, DATA_FORMAT_CBOR, snapshot->cbor);
+    encodeDataState(state, DATA_FORMAT_MSGPACK, snapshot->msgpack);
+    snprintf(snapshot->cborEtag, sizeof(snapshot->cborEtag), "\"%lx-%u-c%d\"", snapshotEpoch, sequence, DATA_SCHEMA_ID);
+    snprintf(snapshot->msgpackEtag, sizeof(snapshot->msgpackEtag), "\"%lx-%u-m%d\"", snapshotEpoch, sequence, DATA_SCHEMA_ID);
+
+    pthread_mutex_lock(&snapshot_mutex);
+    DataSnapshot* previous = dataSnapshot;
+    dataSnapshot = snapshot;
+    pthread_mutex_unlock(&snapshot_mutex);
+    if (previous) releaseDataSnapshot(previous);
+    return snapshot;
+}
+
+// Configuration for the status and settings pages. The pages themselves are
+// static assets; this is the only part of them that depends on the options
+std::string generateInfoJSON() {
+    static const char* protocolIds[] = {"vbus", "kw", "p300", "km"};
+    char json[512];
+    snprintf(json, sizeof(json),
+             "{\"protocol\":%d,\"protocolId\":\"%s\",\"protocolName\":\"%s\","
+             "\"baudRate\":%lu,\"serialConfig\":\"%s\",\"serialPort\":\"%s\","
+             "\"webPort\":%d,\"platform\":\"Linux\"}",
+             config.protocol,
+             config.protocol < 4 ? protocolIds[config.protocol] : "",
+             getProtocolName(config.protocol),
+             config.baudRate,
+             config.serialConfig == SERIAL_8N1 ? "8N1" : "8E2",
+             config.serialPort,
+             config.webPort);
+    return json;
+}
+
+// Called by libmicrohttpd on the thread that takes over a new connection.
+// Each HTTP thread lowers its own priority once, so a busy dashboard never
+// delays the main loop reading the bus
+static void onConnection(void* cls, struct MHD_Connection* connection,
+                         void** socket_context, enum MHD_ConnectionNotificationCode code) {
+    (void)cls;
+    (void)connection;
+    (void)socket_context;
+    static thread_local bool niced = false;
+    if (code != MHD_CONNECTION_NOTIFY_STARTED || niced) return;
+    niced = true;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, tid);
+    if (errno == 0) setpriority(PRIO_PROCESS, tid, nice + HTTP_THREAD_NICE);
 }
 
 // HTTP request handler
@@ -783,52 +618,89 @@ static MHD_Result handle_request(void *cls,
     MHD_Result ret;
     
     // Handle routes
-    if (strcmp(url, "/") == 0) {
-        const char* html = getDashboardHTML();
-        response = MHD_create_response_from_buffer(strlen(html),
-                                                   (void*)html,
-                                                   MHD_RESPMEM_PERSISTENT);
-        MHD_add_response_header(response, "Content-Type", "text/html");
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        return ret;
+    // Pages, scripts and styles, embedded and precompressed at build time
+    const StaticAsset* asset = findStaticAsset(url);
+    if (asset) {
+        return serveStaticAsset(connection, asset);
     }
-    else if (strcmp(url, "/data") == 0) {
-        char* json = generateDataJSON();
-        response = MHD_create_response_from_buffer(strlen(json),
-                                                   (void*)json,
-                                                   MHD_RESPMEM_MUST_COPY);
-        MHD_add_response_header(response, "Content-Type", "application/json");
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        return ret;
+    
+    // /data in the format the Accept header asks for, or a fixed format by
+    // extension for clients that cannot set headers
+    DataFormat dataFormat = DATA_FORMAT_JSON;
+    bool dataRoute = true;
+    if (strcmp(url, "/data") == 0) {
+        dataFormat = parseDataAccept(MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Accept"));
+    } else if (strcmp(url, "/data.json") == 0) {
+        dataFormat = DATA_FORMAT_JSON;
+    } else if (strcmp(url, "/data.cbor") == 0) {
+        dataFormat = DATA_FORMAT_CBOR;
+    } else if (strcmp(url, "/data.msgpack") == 0) {
+        dataFormat = DATA_FORMAT_MSGPACK;
+    } else {
+        dataRoute = false;
     }
-    else if (strcmp(url, "/status") == 0) {
-        const char* html = getStatusHTML();
-        response = MHD_create_response_from_buffer(strlen(html),
-                                                   (void*)html,
-                                                   MHD_RESPMEM_MUST_COPY);
-        MHD_add_response_header(response, "Content-Type", "text/html");
+
+    if (dataRoute) {
+        DataSnapshot* snapshot = acquireDataSnapshot();
+        char sequence[16];
+        snprintf(sequence, sizeof(sequence), "%u", snapshot->sequence);
+        const std::string* body = &snapshot->json;
+        const char* etag = snapshot->etag;
+        if (dataFormat == DATA_FORMAT_CBOR) {
+            body = &snapshot->cbor;
+            etag = snapshot->cborEtag;
+        } else if (dataFormat == DATA_FORMAT_MSGPACK) {
+            body = &snapshot->msgpack;
+            etag = snapshot->msgpackEtag;
+        }
+        
+        // Nothing decoded since the client's copy: headers only
+        const char* ifNoneMatch = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-None-Match");
+        if (ifNoneMatch && (strstr(ifNoneMatch, etag) || strcmp(ifNoneMatch, "*") == 0)) {
+            response = MHD_create_response_from_buffer(0, (void*)"", MHD_RESPMEM_PERSISTENT);
+            MHD_add_response_header(response, "ETag", etag);
+            MHD_add_response_header(response, "X-Frame-Sequence", sequence);
+            MHD_add_response_header(response, "Cache-Control", "no-cache");
+            if (strcmp(url, "/data") == 0) MHD_add_response_header(response, "Vary", "Accept");
+            releaseDataSnapshot(snapshot);
+            ret = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+            MHD_destroy_response(response);
+            return ret;
+        }
+        
+        // Zero copy: the response references the snapshot until it is sent
+        response = MHD_create_response_from_buffer_with_free_callback_cls(body->size(),
+                                                                          body->data(),
+                                                                          &releaseDataSnapshot,
+                                                                          snapshot);
+        MHD_add_response_header(response, "Content-Type", getDataContentType(dataFormat));
+        MHD_add_response_header(response, "ETag", etag);
+        MHD_add_response_header(response, "X-Frame-Sequence", sequence);
+        MHD_add_response_header(response, "Cache-Control", "no-cache");
+        if (dataFormat != DATA_FORMAT_JSON) {
+            char schema[8];
+            snprintf(schema, sizeof(schema), "%d", DATA_SCHEMA_ID);
+            MHD_add_response_header(response, "X-Data-Schema", schema);
+        }
+        if (strcmp(url, "/data") == 0) MHD_add_response_header(response, "Vary", "Accept");
         ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
         MHD_destroy_response(response);
         return ret;
     }
-    else if (strcmp(url, "/settings") == 0) {
-        const char* html = getSettingsHTML();
-        response = MHD_create_response_from_buffer(strlen(html),
-                                                   (void*)html,
-                                                   MHD_RESPMEM_MUST_COPY);
-        MHD_add_response_header(response, "Content-Type", "text/html");
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        return ret;
+    if (strcmp(url, "/events") == 0) {
+        // Server-Sent Events, or WebSocket on upgrade; one message per frame
+        return events.handleRequest(connection, method);
     }
-    else if (strcmp(url, "/devices") == 0) {
-        const char* html = getDevicesHTML();
-        response = MHD_create_response_from_buffer(strlen(html),
-                                                   (void*)html,
-                                                   MHD_RESPMEM_MUST_COPY);
-        MHD_add_response_header(response, "Content-Type", "text/html");
+    else if (strcmp(url, "/history") == 0) {
+        // Downsampled series from the recorded history, streamed as JSON
+        return history.handleRequest(connection, method);
+    }
+    else if (strcmp(url, "/info") == 0) {
+        response = MHD_create_response_from_buffer(infoJSON.size(),
+                                                   (void*)infoJSON.data(),
+                                                   MHD_RESPMEM_PERSISTENT);
+        MHD_add_response_header(response, "Content-Type", "application/json");
+        MHD_add_response_header(response, "Cache-Control", "no-cache");
         ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
         MHD_destroy_response(response);
         return ret;
@@ -859,11 +731,30 @@ static MHD_Result handle_request(void *cls,
 void printHelp(const char* progname) {
     printf("Viessmann Multi-Protocol Library - Web Server\n");
     printf("\nUsage: %s [options]\n", progname);
-    printf("  -p <port>      Serial port (default: /dev/ttyUSB0)\n");
+    printf("  -p <port>      Serial port, or tcp://host:port or rfc2217://host:port of a\n");
+    printf("                 serial server (default: /dev/ttyUSB0)\n");
     printf("  -b <baud>      Baud rate (default: 9600)\n");
-    printf("  -t <protocol>  Protocol type: vbus, kw, p300, km (default: vbus)\n");
+    printf("  -t <protocol>  Protocol type: vbus, kw, p300, km, or auto to also try the other\n");
+    printf("                 protocols' usual line settings (default: vbus)\n");
     printf("  -c <config>    Serial config: 8N1, 8E2 (default: 8N1)\n");
     printf("  -w <port>      Web server port (default: 8099)\n");
+    printf("  -m <host[:port]> MQTT broker, enables MQTT publishing (default port: 1883)\n");
+    printf("  -u <user>      MQTT username\n");
+    printf("  -k <password>  MQTT password\n");
+    printf("  -o <topic>     MQTT base topic (default: viessmann)\n");
+    printf("  -M <mode>      MQTT publish mode: changes, state, interval (default: changes)\n");
+    printf("  -D             Disable Home Assistant MQTT discovery\n");
+    printf("  -T <threads>   HTTP threads, more than 1 starts a thread pool (default: 1)\n");
+    printf("  -P <mode>      HTTP polling: auto, epoll, poll, select (default: auto)\n");
+    printf("  -C <count>     Maximum HTTP connections (default: 128)\n");
+    printf("  -I <count>     Maximum HTTP connections per client IP, 0 = unlimited (default: 0)\n");
+    printf("  -K <seconds>   Idle/keep-alive timeout of HTTP connections (default: 30)\n");
+    printf("  -R             Read the serial port on a separate thread into a ring buffer\n");
+    printf("  -L             Low-latency serial mode (ASYNC_LOW_LATENCY, 1 ms latency timer\n");
+    printf("                 of USB adapters)\n");
+    printf("  -r <file>      Record the raw bus bytes for vbusreplay_linux\n");
+    printf("  -s <MiB>       Size at which the capture file is rotated (default: %d)\n",
+           CAPTURE_FILE_SIZE >> 20);
     printf("  -h             Show this help\n");
 }
 
@@ -872,12 +763,29 @@ int main(int argc, char* argv[]) {
     config.serialPort = "/dev/ttyUSB0";
     config.baudRate = 9600;
     config.protocol = PROTOCOL_VBUS;
+    config.autoProtocol = false;
     config.serialConfig = SERIAL_8N1;
+    config.serialThread = false;
+    config.lowLatency = false;
+    config.capturePath = nullptr;
+    config.captureSize = CAPTURE_FILE_SIZE;
     config.webPort = 8099;
+    config.mqttHost = nullptr;
+    config.mqttPort = 1883;
+    config.mqttUser = nullptr;
+    config.mqttPassword = nullptr;
+    config.mqttTopic = "viessmann";
+    config.mqttDiscovery = true;
+    config.mqttMode = MQTT_PUBLISH_CHANGES;
+    config.httpThreads = 1;
+    config.httpPolling = MHD_USE_AUTO;
+    config.httpMaxConnections = 128;
+    config.httpConnectionsPerIp = 0;
+    config.httpTimeout = 30;
     
     // Parse command line arguments
     int opt;
-    while ((opt = getopt(argc, argv, "p:b:t:c:w:h")) != -1) {
+    while ((opt = getopt(argc, argv, "p:b:t:c:w:m:u:k:o:M:DT:P:C:I:K:RLr:s:h")) != -1) {
         switch (opt) {
             case 'p':
                 config.serialPort = optarg;
@@ -886,7 +794,8 @@ int main(int argc, char* argv[]) {
                 config.baudRate = atol(optarg);
                 break;
             case 't':
-                config.protocol = parseProtocol(optarg);
+                config.autoProtocol = strcasecmp(optarg, "auto") == 0;
+                if (!config.autoProtocol) config.protocol = parseProtocol(optarg);
                 break;
             case 'c':
                 config.serialConfig = parseSerialConfig(optarg);
@@ -894,6 +803,51 @@ int main(int argc, char* argv[]) {
             case 'w':
                 config.webPort = atoi(optarg);
                 break;
+            case 'm':
+                parseMqttHost(optarg);
+                break;
+            case 'u':
+                config.mqttUser = optarg;
+                break;
+            case 'k':
+                config.mqttPassword = optarg;
+                break;
+            case 'o':
+                config.mqttTopic = optarg;
+                break;
+            case 'M':
+                config.mqttMode = parseMqttMode(optarg);
+                break;
+            case 'D':
+                config.mqttDiscovery = false;
+                break;
+            case 'T':
+                config.httpThreads = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'P':
+                config.httpPolling = parseHttpPolling(optarg);
+                break;
+            case 'C':
+                config.httpMaxConnections = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'I':
+                config.httpConnectionsPerIp = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+            case 'K':
+                config.httpTimeout = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+            case 'R':
+                config.serialThread = true;
+                break;
+            case 'L':
+                config.lowLatency = true;
+                break;
+            case 'r':
+                config.capturePath = optarg;
+                break;
+            case 's':
+                config.captureSize = (uint64_t)strtoul(optarg, nullptr, 10) << 20;
+                break;
             case 'h':
                 printHelp(argv[0]);
                 return 0;
@@ -911,76 +865,239 @@ int main(int argc, char* argv[]) {
     printf("=============================\n");
     printf("Serial Port: %s\n", config.serialPort);
     printf("Baud Rate: %lu\n", config.baudRate);
-    printf("Protocol: %s\n", getProtocolName(config.protocol));
-    printf("Serial Config: %s\n", config.serialConfig == SERIAL_8N1 ? "8N1" : "8E2");
+    printf("Protocol: %s%s\n", getProtocolName(config.protocol), config.autoProtocol ? ", auto" : "");
+    printf("Serial Config: %s%s%s\n", config.serialConfig == SERIAL_8N1 ? "8N1" : "8E2",
+           config.serialThread ? ", reader thread" : "", config.lowLatency ? ", low latency" : "");
     printf("Web Port: %d\n", config.webPort);
+    if (config.httpPolling == MHD_USE_EPOLL && MHD_is_feature_supported(MHD_FEATURE_EPOLL) != MHD_YES) {
+        fprintf(stderr, "Warning: epoll is not supported by libmicrohttpd, using auto\n");
+        config.httpPolling = MHD_USE_AUTO;
+    }
+    if (config.httpPolling == MHD_USE_POLL && MHD_is_feature_supported(MHD_FEATURE_POLL) != MHD_YES) {
+        fprintf(stderr, "Warning: poll is not supported by libmicrohttpd, using auto\n");
+        config.httpPolling = MHD_USE_AUTO;
+    }
+    printf("HTTP: %u thread(s), %s, %u connections (%u per IP), %us idle timeout\n",
+           config.httpThreads, getHttpPollingName(config.httpPolling), config.httpMaxConnections,
+           config.httpConnectionsPerIp, config.httpTimeout);
+    if (config.mqttHost) {
+        printf("MQTT Broker: %s:%u (topic: %s, mode: %s)\n", config.mqttHost, config.mqttPort,
+               config.mqttTopic, getMqttModeName(config.mqttMode));
+    }
+    if (config.capturePath) {
+        // Started before the port is connected, which adds its port record
+        if (capture.begin(config.capturePath, config.captureSize)) {
+            printf("Capture: %s, rotated at %lu MiB\n", config.capturePath, (unsigned long)(config.captureSize >> 20));
+        } else {
+            fprintf(stderr, "Warning: capture %s could not be started\n", config.capturePath);
+        }
+    }
     printf("\n");
     
+    // MQTT is connected without blocking; publishes queue until the broker answers
+    static MqttConfig mqttConfig;
+    if (config.mqttHost) {
+        mqttConfig.broker = config.mqttHost;
+        mqttConfig.port = config.mqttPort;
+        mqttConfig.username = config.mqttUser;
+        mqttConfig.password = config.mqttPassword;
+        mqttConfig.clientId = "viessmann_decoder";
+        mqttConfig.baseTopic = config.mqttTopic;
+        mqttConfig.publishInterval = 30;
+        mqttConfig.useHomeAssistant = config.mqttDiscovery;
+        mqttConfig.haDiscoveryPrefix = "homeassistant";
+        
+        mqtt = new VBUSMqttClient(nullptr);
+        mqtt->begin(mqttConfig);
+        mqtt->setPublishMode(config.mqttMode);
+        mqtt->connect();
+    }
+    
+    // Hotplug events first, so no port added during the probe below is missed
+    bool network = LinuxTcpSerial::isUrl(config.serialPort);
+    bool hotplug = !network && startPortWatch();
+
     // Try to initialize serial port (don't exit on failure)
-    bool connected = false;
-    for (const auto& port : discoverSerialPorts()) {
-        printf("Attempting to connect on %s...\n", port.c_str());
-        if (attemptConnection(port)) {
-            connected = true;
-            break;
+    if (network) {
+        if (config.autoProtocol || config.serialThread) {
+            printf("Note: protocol detection and the reader thread are not used with network ports\n");
         }
-    }
-    if (!connected) {
+        connectNetwork();
+    } else if (!connectSerial(discoverSerialPorts())) {
         fprintf(stderr, "Warning: No compatible serial device found - starting in disconnected mode\n");
         fprintf(stderr, "The web interface will show 'Serial port not connected'\n");
     }
     
-    // Start HTTP server (always start, even without serial connection)
+    // /data is served from snapshots, the first one exists before the server starts
+    snapshotEpoch = (unsigned long)time(NULL);
+    uint32_t dataSequence = 0;
+    publishDataSnapshot(++dataSequence);
+    infoJSON = generateInfoJSON();
+    
+    // Start HTTP server (always start, even without serial connection).
+    // All threading modes are internal: the main loop belongs to the bus
     struct MHD_Daemon *daemon;
-    daemon = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY,
+    daemon = MHD_start_daemon(MHD_USE_INTERNAL_POLLING_THREAD | config.httpPolling | EVENTS_DAEMON_FLAGS,
                              config.webPort,
                              NULL, NULL,
                              &handle_request, NULL,
+                             MHD_OPTION_THREAD_POOL_SIZE, config.httpThreads > 1 ? config.httpThreads : 0,
+                             MHD_OPTION_CONNECTION_LIMIT, config.httpMaxConnections,
+                             MHD_OPTION_PER_IP_CONNECTION_LIMIT, config.httpConnectionsPerIp,
+                             MHD_OPTION_CONNECTION_TIMEOUT, config.httpTimeout,
+                             MHD_OPTION_NOTIFY_CONNECTION, &onConnection, NULL,
                              MHD_OPTION_END);
     
     if (daemon == NULL) {
         fprintf(stderr, "Error: Failed to start HTTP server on port %d\n", config.webPort);
+        if (mqtt) delete mqtt;
         if (vbus) delete vbus;
         return 1;
     }
     
     printf("Web server started on port %d\n", config.webPort);
     printf("Access the dashboard at: http://localhost:%d\n", config.webPort);
-    if (!serialConnected) {
-        printf("Note: Serial port not connected - will retry periodically\n");
+    if (network) {
+        printf("Note: Connecting to %s in the background\n", config.serialPort);
+    } else if (!serialConnected) {
+        printf("Note: Serial port not connected - will retry when a port is plugged in%s\n",
+               hotplug ? "" : " and periodically");
     }
     printf("\nPress Ctrl+C to stop\n\n");
     
     // Main loop with serial port reconnection logic
-    int reconnectCounter = 0;
+    unsigned long lastReconnect = millis();
+    const unsigned long rescanInterval = hotplug ? RESCAN_INTERVAL_MS : RECONNECT_INTERVAL_MS;
+    std::vector<std::string> portsAdded, portsRemoved;
+    uint32_t lastFrameCount = 0;
+    bool lastOnline = false;
+    unsigned long lastOverflow = 0;
+    unsigned long lastCaptureLost = 0;
     
     while (running) {
-        if (serialConnected && vbus && deviceCompatible) {
+        bool decoding = serialConnected && vbus && deviceCompatible;
+        if (netSerial) {
+            // The decoder also drives the reconnects of the network port
+            decoding = vbus != nullptr;
+            if (decoding) vbus->loop();
+            if (netSerial->isConnected() != serialConnected) {
+                pthread_mutex_lock(&data_mutex);
+                serialConnected = netSerial->isConnected();
+                pthread_mutex_unlock(&data_mutex);
+            }
+        } else if (decoding) {
             vbus->loop();
-        } else {
-            // Try to reconnect periodically
-            reconnectCounter++;
-            if (reconnectCounter >= RECONNECT_INTERVAL_TICKS) {
-                reconnectCounter = 0;
-                auto ports = discoverSerialPorts();
-                if (ports.empty() && config.serialPort && strlen(config.serialPort) > 0) {
-                    ports.push_back(config.serialPort);
-                }
-                for (const auto& port : ports) {
-                    printf("Attempting to connect on %s...\n", port.c_str());
-                    if (attemptConnection(port)) {
-                        break;
-                    }
-                }
+        } else if (!portsAdded.empty()) {
+            // Ports plugged in are probed right away, the others already failed
+            lastReconnect = millis();
+            connectSerial(portsAdded);
+            decoding = serialConnected && vbus && deviceCompatible;
+        } else if (millis() - lastReconnect >= rescanInterval) {
+            lastReconnect = millis();
+            auto ports = discoverSerialPorts();
+            if (ports.empty() && config.serialPort && strlen(config.serialPort) > 0) {
+                ports.push_back(config.serialPort);
+            }
+            connectSerial(ports);
+            decoding = serialConnected && vbus && deviceCompatible;
+        }
+        portsAdded.clear();
+        
+        // Frame-driven: a frame decoded above is published in the same pass
+        if (mqtt) mqtt->loop();
+        
+        // Same for /data and /events: rendered once per frame, connection
+        // changes count as well
+        uint32_t frameCount = decoding ? vbus->getFrameCount() : 0;
+        bool online = serialConnected && deviceCompatible;
+        if (frameCount != lastFrameCount || online != lastOnline) {
+            lastFrameCount = frameCount;
+            lastOnline = online;
+            DataSnapshot* snapshot = publishDataSnapshot(++dataSequence);
+            events.publish(snapshot->json.data(), snapshot->json.size());
+        }
+        events.loop();
+        
+        // Records the frames decoded above into the history tiers
+        history.loop();
+        
+        // Sleep until serial data arrives, a port is plugged in or removed,
+        // or the MQTT socket needs attention
+        struct pollfd fds[3];
+        nfds_t count = 0;
+        int serialIndex = -1;
+        int watchIndex = -1;
+        if (netSerial && netSerial->getFd() >= 0) {
+            fds[count].fd = netSerial->getFd();
+            fds[count].events = POLLIN | (netSerial->wantsWrite() ? POLLOUT : 0);
+            count++;
+        } else if (decoding && serialReader) {
+            serialIndex = count;
+            fds[count].fd = serialReader->getEventFd();
+            fds[count].events = POLLIN;
+            count++;
+        } else if (decoding && vbusSerial && vbusSerial->isOpen()) {
+            serialIndex = count;
+            fds[count].fd = vbusSerial->getFd();
+            fds[count].events = POLLIN;
+            count++;
+        }
+        if (portWatch.getFd() >= 0) {
+            watchIndex = count;
+            fds[count].fd = portWatch.getFd();
+            fds[count].events = POLLIN;
+            count++;
+        }
+        if (mqtt && mqtt->getSocket() >= 0) {
+            fds[count].fd = mqtt->getSocket();
+            fds[count].events = POLLIN | (mqtt->wantsWrite() ? POLLOUT : 0);
+            count++;
+        }
+        unsigned long dropped = serialReader ? serialReader->getOverflowCount() : 0;
+        if (dropped != lastOverflow) {
+            lastOverflow = dropped;
+            if (dropped) fprintf(stderr, "Warning: serial ring buffer full, %lu bytes dropped so far\n", dropped);
+        }
+        if (capture.getLostCount() != lastCaptureLost) {
+            lastCaptureLost = capture.getLostCount();
+            fprintf(stderr, "Warning: capture buffers full, %lu bytes not recorded so far\n", lastCaptureLost);
+        }
+        if (poll(fds, count, LOOP_TIMEOUT_MS) <= 0) continue;
+
+        bool removed = serialIndex >= 0 && (fds[serialIndex].revents & (POLLHUP | POLLERR | POLLNVAL));
+        if (serialIndex >= 0 && serialReader && (fds[serialIndex].revents & POLLIN)) {
+            // Before the decoder drains the ring in the next pass
+            serialReader->acknowledge();
+            removed |= serialReader->hasFailed();
+        }
+        if (watchIndex >= 0 && (fds[watchIndex].revents & POLLIN)) {
+            portsRemoved.clear();
+            portWatch.read(portsAdded, portsRemoved);
+            for (const auto& port : portsRemoved) {
+                removed |= decoding && (port == activeSerialPort || port == activeDevicePath);
             }
         }
-        usleep(LOOP_DELAY_US);  // 10ms delay
+        // Dropped at once instead of after the decoder's 20 s frame timeout
+        if (removed) {
+            printf("Serial port %s removed\n", activeSerialPort.c_str());
+            disconnectSerial();
+        }
     }
     
     // Cleanup
     printf("Stopping web server...\n");
+    events.closeAll();
     MHD_stop_daemon(daemon);
-    if (vbus) delete vbus;
+    releaseDataSnapshot(dataSnapshot);
+    // Stops the serial reader thread before its port is closed
+    disconnectSerial();
+    if (mqtt) {
+        mqtt->disconnect();
+        delete mqtt;
+    }
+    delete netSerial;
+    capture.end();
+    portWatch.end();
     
     printf("Shutdown complete\n");
     return 0;
@@ -0,0 +1,115 @@
+// Viessmann Decoder web interface. The pages are static; everything that
+// changes at runtime comes from the JSON endpoints (data, events, info).
+// URLs stay relative so the pages also work behind the Home Assistant
+// ingress proxy.
+
+const PROTOCOLS = ['VBUS', 'KW-Bus', 'P300', 'KM-Bus'];
+
+function emptyState(icon, text) {
+  return '<div class="empty-state"><div class="empty-state-icon">' + icon + '</div>' + text + '</div>';
+}
+
+function render(d) {
+  const statusDot = document.getElementById('statusDot');
+  const statusText = document.getElementById('statusText');
+  const container = document.getElementById('sensorData');
+  document.getElementById('protocol').textContent = PROTOCOLS[d.protocol] || 'Unknown';
+
+  if (d.serialConnected === false) {
+    statusDot.className = 'status-indicator error';
+    statusText.textContent = 'Serial port not connected';
+    container.innerHTML = emptyState('🔌',
+      '<div style="font-size:18px;margin-bottom:8px;">Serial port not connected</div>' +
+      '<div style="color:var(--secondary-text);">Please connect your Viessmann device and check the serial port configuration.</div>');
+    return;
+  }
+
+  statusDot.className = 'status-indicator ' + (d.status === 'OK' ? 'ok' : 'error');
+  statusText.textContent = d.status;
+  if (!d.ready || (!d.temperatures.length && !d.pumps.length && !d.relays.length)) {
+    container.innerHTML = emptyState('⏳', '<div>Waiting for data...</div>');
+    return;
+  }
+
+  let html = '';
+  const item = (label, value) =>
+    '<div class="sensor-item"><div class="sensor-label">' + label + '</div>' + value + '</div>';
+  d.temperatures.forEach((t, i) => {
+    html += item('Temperature ' + (i + 1),
+      '<div class="sensor-value">' + t.toFixed(1) + '<span class="sensor-unit">°C</span></div>');
+  });
+  d.pumps.forEach((p, i) => {
+    html += item('Pump ' + (i + 1) + ' Power',
+      '<div class="sensor-value">' + p + '<span class="sensor-unit">%</span></div>');
+  });
+  d.relays.forEach((r, i) => {
+    html += item('Relay ' + (i + 1),
+      '<div class="sensor-value" style="color:' + (r ? 'var(--success-color)' : 'var(--disabled-text)') + '">' +
+      (r ? 'ON' : 'OFF') + '</div>');
+  });
+  container.innerHTML = html;
+}
+
+function updateData() {
+  fetch('data').then(r => r.json()).then(render).catch(err => {
+    console.error('Error fetching data:', err);
+    document.getElementById('sensorData').innerHTML = emptyState('⚠️', '<div>Error loading data</div>');
+  });
+}
+
+function startDashboard() {
+  let pollTimer = null;
+  const startPolling = () => {
+    if (!pollTimer) pollTimer = setInterval(updateData, 2000);
+  };
+  updateData();
+  if (!window.EventSource) {
+    startPolling();
+    return;
+  }
+  const es = new EventSource('events');
+  es.onmessage = e => render(JSON.parse(e.data));
+  es.onopen = () => {
+    if (pollTimer) {
+      clearInterval(pollTimer);
+      pollTimer = null;
+    }
+  };
+  es.onerror = startPolling;
+}
+
+// Fills every element tagged data-info='<key>' from /info: inputs and
+// selects get their value, everything else its text
+function loadInfo() {
+  return fetch('info').then(r => r.json()).then(info => {
+    document.querySelectorAll('[data-info]').forEach(el => {
+      const value = info[el.dataset.info];
+      if (value === undefined) return;
+      if (el.tagName === 'INPUT' || el.tagName === 'SELECT') el.value = value;
+      else el.textContent = value;
+    });
+  });
+}
+
+function startStatus() {
+  loadInfo();
+  fetch('data').then(r => r.json()).then(d => {
+    document.getElementById('commStatus').textContent = d.status;
+    document.getElementById('dataReady').textContent = d.ready ? 'Yes' : 'No';
+  });
+}
+
+function startDevices() {
+  fetch('data').then(r => r.json()).then(d => {
+    document.getElementById('deviceCount').textContent = d.ready ? 1 : 0;
+  });
+}
+
+document.addEventListener('DOMContentLoaded', () => {
+  switch (document.body.dataset.page) {
+    case 'dashboard': startDashboard(); break;
+    case 'status': startStatus(); break;
+    case 'settings': loadInfo(); break;
+    case 'devices': startDevices(); break;
+  }
+});